@@ -0,0 +1,169 @@
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <exception>
+#include "frame_stack.h"
+#include "pattern_spec.h"
+#include "fiducial_patterns.h"
+#include "dmd_calibration.h"
+#include "remap_tables.h"
+
+// Fit the mirror -> camera geometry from pictures of the @fiducial
+// patterns and write the remap tables the loader and the reducers use.
+
+// Grey value per camera pixel (sum of the channels) of the stack frame
+// whose pattern id is `id`.
+std::vector<float> grey_frame(FrameStackReader& stack, int32_t id)
+{
+    const FrameStackHeader& info = stack.info();
+    for(uint64_t i = 0; i < stack.capacity(); ++i)
+    {
+        if( ! stack.has_frame(i) || stack.metadata(i).pattern_id != id)
+        {
+            continue;
+        }
+        const int channels = info.bits_per_pixel / 8;
+        const unsigned char* pixels = stack.frame(i);
+        std::vector<float> grey(static_cast<size_t>(info.width)*info.height);
+        for(uint32_t y = 0; y < info.height; ++y)
+        {
+            const unsigned char* row = pixels + static_cast<size_t>(y)*info.line_pitch;
+            for(uint32_t x = 0; x < info.width; ++x)
+            {
+                unsigned int sum = 0;
+                for(int c = 0; c < channels; ++c)
+                {
+                    sum += row[x*channels + c];
+                }
+                grey[static_cast<size_t>(y)*info.width + x] = static_cast<float>(sum);
+            }
+        }
+        return grey;
+    }
+    char number[32];
+    sprintf(number, "%d", id);
+    throw std::runtime_error(std::string("No picture of fiducial frame ") + number + " in the stack");
+}
+
+double seconds_since(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char* argv[])
+{
+    std::string stack_file;
+    std::string model_file;
+    std::string fiducial_line = "@fiducial";
+    std::string mirror_text;
+    std::string output_prefix;
+    bool distortion = true;
+    int min_pixels = 4;
+    for(int i = 1; i < argc; i += 2)
+    {
+        std::string option = argv[i];
+        if(option == "--no-distortion") { distortion = false; --i; continue; }
+        if(i + 1 >= argc)
+        {
+            std::cerr << option << " needs a value" << std::endl;
+            return 1;
+        }
+        if(option == "--stack")           { stack_file = argv[i+1]; }
+        else if(option == "--model")      { model_file = argv[i+1]; }
+        else if(option == "--fiducials")  { fiducial_line = argv[i+1]; }
+        else if(option == "--mirror")     { mirror_text = argv[i+1]; }
+        else if(option == "--output")     { output_prefix = argv[i+1]; }
+        else if(option == "--min-pixels") { min_pixels = atoi(argv[i+1]); }
+        else
+        {
+            std::cerr << "Unknown option " << option << std::endl;
+            return 1;
+        }
+    }
+
+    bool errors = false;
+    unsigned mirror_w = 0;
+    unsigned mirror_h = 0;
+    if(stack_file.empty() == model_file.empty())
+    {
+        std::cerr << "Give the fiducial pictures with --stack <file>, or a saved calibration with --model <file.txt>" << std::endl;
+        errors = true;
+    }
+    if( ! stack_file.empty() && (sscanf(mirror_text.c_str(), "%ux%u", &mirror_w, &mirror_h) != 2 || mirror_w == 0 || mirror_h == 0))
+    {
+        std::cerr << "Mirror size must be given as --mirror <width>x<height>" << std::endl;
+        errors = true;
+    }
+    if(output_prefix.empty())
+    {
+        std::cerr << "Output files must be named with --output <prefix>" << std::endl;
+        errors = true;
+    }
+    if(errors)
+    {
+        return 1;
+    }
+
+    try
+    {
+        DmdCameraModel model;
+        if( ! model_file.empty())
+        {
+            model = DmdCameraModel::load(model_file);
+        }
+        else
+        {
+            PatternSpec spec = PatternSpec::parse(fiducial_line);
+            if(spec.type != "fiducial")
+            {
+                throw std::invalid_argument("--fiducials needs a @fiducial line");
+            }
+            FiducialLayout layout = fiducial_layout_from(spec);
+
+            FrameStackReader stack(stack_file);
+            std::vector<std::vector<float> > frames;
+            for(uint32_t f = 0; f < layout.frame_count(); ++f)
+            {
+                frames.push_back(grey_frame(stack, f));
+            }
+            model.mirror_w = mirror_w;
+            model.mirror_h = mirror_h;
+            model.camera_w = stack.info().width;
+            model.camera_h = stack.info().height;
+
+            std::vector<FiducialDetection> found = detect_fiducials(layout, frames, model.camera_w, model.camera_h, min_pixels);
+            std::cout << found.size() << " of " << layout.dot_count() << " fiducials found" << std::endl;
+            std::vector<CalibrationPoint> points;
+            for(size_t i = 0; i < found.size(); ++i)
+            {
+                CalibrationPoint p;
+                layout.dot_centre(found[i].dot, mirror_w, mirror_h, p.mirror_x, p.mirror_y);
+                p.camera_x = found[i].x;
+                p.camera_y = found[i].y;
+                points.push_back(p);
+            }
+
+            fit_homography(points, model);
+            std::cout << "Homography: " << calibration_rms(points, model) << " camera pixels RMS" << std::endl;
+            double rms = fit_dmd_camera_model(points, model, distortion);
+            std::cout << (distortion ? "Homography and distortion: " : "Refined homography: ")
+                      << rms << " camera pixels RMS (k1 = " << model.k1 << ", k2 = " << model.k2 << ")" << std::endl;
+            model.save(output_prefix + ".txt");
+        }
+
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        write_forward_remap(output_prefix + ".forward", build_forward_remap(model));
+        write_inverse_remap(output_prefix + ".inverse", build_inverse_remap(model));
+        std::cout << "Remap tables for " << model.mirror_w << " x " << model.mirror_h << " mirror and "
+                  << model.camera_w << " x " << model.camera_h << " camera written in " << seconds_since(start) << " s" << std::endl;
+    }
+    catch(const std::exception& e)
+    {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,137 @@
+#ifndef ALLOCATION_COUNTER_H
+#define ALLOCATION_COUNTER_H
+
+#include <cstdlib>
+#include <new>
+#include <atomic>
+#include <ostream>
+
+// Counts the program's heap allocations (every operator new and new[],
+// from any thread) when built with TEM_COUNT_ALLOCATIONS, as the Debug
+// and Benchmark targets are; otherwise allocation_count() is always 0
+// and nothing is replaced.  Memory the C library takes for itself (such
+// as a FILE from fopen) is not counted.
+//
+// The global operator new and delete are replaced here, so include this
+// from the program's main.cpp only.
+
+#ifdef TEM_COUNT_ALLOCATIONS
+
+inline std::atomic<unsigned long long>& allocation_counter()
+{
+    static std::atomic<unsigned long long> count(0);
+    return count;
+}
+
+inline unsigned long long allocation_count()
+{
+    return allocation_counter().load(std::memory_order_relaxed);
+}
+
+// Not inlined, so that the compiler matches new[] with delete[] and not
+// with what they are made of.
+__attribute__((noinline)) void* operator new(std::size_t size)
+{
+    allocation_counter().fetch_add(1, std::memory_order_relaxed);
+    for(;;)
+    {
+        void* p = std::malloc(size ? size : 1);
+        if(p)
+        {
+            return p;
+        }
+        std::new_handler handler = std::get_new_handler();
+        if( ! handler)
+        {
+            throw std::bad_alloc();
+        }
+        handler();
+    }
+}
+
+__attribute__((noinline)) void* operator new[](std::size_t size)
+{
+    return operator new(size);
+}
+
+__attribute__((noinline)) void* operator new(std::size_t size, const std::nothrow_t&) noexcept
+{
+    try
+    {
+        return operator new(size);
+    }
+    catch(const std::bad_alloc&)
+    {
+        return NULL;
+    }
+}
+
+__attribute__((noinline)) void* operator new[](std::size_t size, const std::nothrow_t&) noexcept
+{
+    return operator new(size, std::nothrow);
+}
+
+__attribute__((noinline)) void operator delete(void* p) noexcept { std::free(p); }
+__attribute__((noinline)) void operator delete[](void* p) noexcept { std::free(p); }
+__attribute__((noinline)) void operator delete(void* p, const std::nothrow_t&) noexcept { std::free(p); }
+__attribute__((noinline)) void operator delete[](void* p, const std::nothrow_t&) noexcept { std::free(p); }
+
+#else
+
+inline unsigned long long allocation_count() { return 0; }
+
+#endif
+
+// Allocations per pattern after the first ones.  The loader's buffers
+// grow to the size of the pictures and patterns with the first few it
+// shows; after that a pattern should not allocate at all.
+class AllocationTally
+{
+public:
+    explicit AllocationTally(unsigned long warm_up)
+        : warm_up(warm_up), patterns(0), at_warm_up(0), last(0), allocating(0)
+    {
+    }
+
+    // Call after each pattern (line or command).
+    void pattern_done()
+    {
+        const unsigned long long now = allocation_count();
+        ++patterns;
+        if(patterns == warm_up)
+        {
+            at_warm_up = now;
+        }
+        else if(patterns > warm_up && now != last)
+        {
+            ++allocating;
+        }
+        last = now;
+    }
+
+    // Nothing unless allocations are counted.
+    void report(std::ostream& out) const
+    {
+#ifdef TEM_COUNT_ALLOCATIONS
+        if(patterns <= warm_up)
+        {
+            out << "Allocations: " << last << " in " << patterns << " patterns (" << warm_up << " to warm up)\n";
+            return;
+        }
+        out << "Allocations: " << at_warm_up << " in the first " << warm_up << " patterns, "
+            << last - at_warm_up << " in the " << patterns - warm_up << " after them ("
+            << allocating << " patterns allocated)\n";
+#else
+        (void)out;
+#endif
+    }
+
+private:
+    unsigned long warm_up;
+    unsigned long patterns;
+    unsigned long long at_warm_up;
+    unsigned long long last;
+    unsigned long allocating;
+};
+
+#endif // ALLOCATION_COUNTER_H
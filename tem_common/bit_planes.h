@@ -0,0 +1,208 @@
+#ifndef BIT_PLANES_H
+#define BIT_PLANES_H
+
+#include <cstring>
+#include <vector>
+#include <stdexcept>
+#include <stdint.h>
+
+// Packed binary pictures, one bit per pixel: rows of (width + 7) / 8
+// bytes, pixel x of a row in bit (x % 8) of byte x / 8 (least
+// significant bit first).  expand() turns one into one byte per pixel,
+// a byte of eight pixels at a time through a 256-entry table.
+class BitExpander
+{
+public:
+    BitExpander() : table_off(0), table_on(0) { }
+
+    void expand(const unsigned char* bits, int width, int height,
+                unsigned char* out, unsigned char off_value, unsigned char on_value)
+    {
+        if(table.empty() || off_value != table_off || on_value != table_on)
+        {
+            table.resize(256);
+            for(int v = 0; v < 256; ++v)
+            {
+                unsigned char bytes[8];
+                for(int i = 0; i < 8; ++i)
+                {
+                    bytes[i] = ((v >> i) & 1) ? on_value : off_value;
+                }
+                memcpy(&table[v], bytes, 8);
+            }
+            table_off = off_value;
+            table_on = on_value;
+        }
+        const int row_bytes = (width + 7) / 8;
+        const int whole = width / 8;
+        for(int y = 0; y < height; ++y)
+        {
+            const unsigned char* in = bits + static_cast<size_t>(y)*row_bytes;
+            unsigned char* o = out + static_cast<size_t>(y)*width;
+            for(int k = 0; k < whole; ++k)
+            {
+                memcpy(o + 8*k, &table[in[k]], 8);
+            }
+            if(whole < row_bytes)
+            {
+                memcpy(o + 8*whole, &table[in[whole]], width - 8*whole);
+            }
+        }
+    }
+
+private:
+    std::vector<uint64_t> table;
+    unsigned char table_off;
+    unsigned char table_on;
+};
+
+
+// The other way round: bits (packed as for BitExpander) of a picture of
+// one byte per pixel, set where the byte's top bit is (the mirror's on
+// value, 128).  Eight bytes become a byte with one multiplication.
+inline void pack_bits(const unsigned char* bytes, int width, int height, unsigned char* bits)
+{
+    const int row_bytes = (width + 7) / 8;
+    for(int y = 0; y < height; ++y)
+    {
+        const unsigned char* in = bytes + static_cast<size_t>(y)*width;
+        unsigned char* out = bits + static_cast<size_t>(y)*row_bytes;
+        for(int k = 0; k < row_bytes; ++k)
+        {
+            uint64_t x = 0;
+            if(8*(k + 1) <= width)
+            {
+                memcpy(&x, in + 8*k, 8);
+            }
+            else
+            {
+                memcpy(&x, in + 8*k, width - 8*k);
+            }
+            x = (x >> 7) & 0x0101010101010101ull;
+            out[k] = static_cast<unsigned char>((x * 0x0102040810204080ull) >> 56);
+        }
+    }
+}
+
+
+// The eight bit planes of an 8-bit grey picture, one bit per pixel.
+//
+// Plane b holds bit b of every pixel, packed as for BitExpander; bits
+// past the end of a row are 0.
+//
+// Extraction is a bit-slice transpose: eight pixels are one 64-bit word,
+// an 8 x 8 bit matrix, and transposing it gives byte b = bit b of each
+// of the eight pixels.  Two words go through the transpose together as
+// one vector.
+class BitPlanes
+{
+public:
+    static const int PLANES = 8;
+
+    BitPlanes() : width(0), height(0), row_bytes(0) { }
+
+    int get_width() const { return width; }
+    int get_height() const { return height; }
+    int get_row_bytes() const { return row_bytes; }
+    size_t plane_bytes() const { return static_cast<size_t>(row_bytes)*height; }
+
+    const unsigned char* plane(int b) const { return &bits[b*plane_bytes()]; }
+
+    void extract(const unsigned char* grey, int w, int h)
+    {
+        if(w <= 0 || h <= 0)
+        {
+            throw std::invalid_argument("Bit planes need a picture of at least one pixel");
+        }
+        width = w;
+        height = h;
+        row_bytes = (w + 7) / 8;
+        bits.resize(PLANES*plane_bytes());
+        const size_t stride = plane_bytes();
+        for(int y = 0; y < h; ++y)
+        {
+            const unsigned char* in = grey + static_cast<size_t>(y)*w;
+            unsigned char* out = &bits[static_cast<size_t>(y)*row_bytes];
+            int k = 0;
+            for( ; 8*(k + 2) <= w; k += 2)
+            {
+                WordVector v;
+                memcpy(&v, in + 8*k, sizeof(v));
+                v = transpose(v);
+                unsigned char t[sizeof(v)];
+                memcpy(t, &v, sizeof(v));
+                for(int b = 0; b < PLANES; ++b)
+                {
+                    unsigned char* p = out + b*stride + k;
+                    p[0] = t[b];
+                    p[1] = t[8 + b];
+                }
+            }
+            for( ; k < row_bytes; ++k)
+            {
+                // Last words of the row, padded with 0.
+                unsigned char word[8] = { 0 };
+                memcpy(word, in + 8*k, (8*(k + 1) <= w) ? 8 : w - 8*k);
+                uint64_t x;
+                memcpy(&x, word, 8);
+                x = transpose(x);
+                memcpy(word, &x, 8);
+                for(int b = 0; b < PLANES; ++b)
+                {
+                    out[b*stride + k] = word[b];
+                }
+            }
+        }
+    }
+
+    // Plane b as one byte per pixel, off_value or on_value, rows of
+    // width bytes: what AlpbDevLoadRows takes.
+    void expand(int b, unsigned char* out, unsigned char off_value, unsigned char on_value)
+    {
+        expander.expand(plane(b), width, height, out, off_value, on_value);
+    }
+
+private:
+    typedef uint64_t WordVector __attribute__((vector_size(16)));
+
+    int width;
+    int height;
+    int row_bytes;
+    std::vector<unsigned char> bits;
+    BitExpander expander;
+
+    // Transpose of the 8 x 8 bit matrix whose row i is byte i (Hacker's
+    // Delight, 7-3): swap 1 x 1, then 2 x 2, then 4 x 4 blocks.
+    template<typename T>
+    static T transpose(T x)
+    {
+        T t;
+        t = (x ^ (x >> 7)) & 0x00AA00AA00AA00AAull;
+        x = x ^ t ^ (t << 7);
+        t = (x ^ (x >> 14)) & 0x0000CCCC0000CCCCull;
+        x = x ^ t ^ (t << 14);
+        t = (x ^ (x >> 28)) & 0x00000000F0F0F0F0ull;
+        x = x ^ t ^ (t << 28);
+        return x;
+    }
+};
+
+
+
+// Binary-weighted display of the top `bits` planes of a picture: the
+// lowest of them is shown for unit_us, each plane above it twice as
+// long as the one below.  Over one cycle a pixel is then on for a time
+// proportional to its grey value (its top `bits` bits).
+struct BitPlaneSchedule
+{
+    BitPlaneSchedule() : bits(8), unit_us(100) { }
+
+    int bits;
+    double unit_us;
+
+    int first_plane() const { return BitPlanes::PLANES - bits; }
+    double dwell_us(int plane) const { return unit_us * (1 << (plane - first_plane())); }
+    double cycle_us() const { return unit_us * ((1 << bits) - 1); }
+};
+
+#endif // BIT_PLANES_H
@@ -0,0 +1,153 @@
+#ifndef BUCKET_FILE_H
+#define BUCKET_FILE_H
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <stdexcept>
+
+// Bucket values of a single-pixel scan: one number per pattern, in the
+// order the patterns were shown.
+//
+// Bucket files are text.  Each line holds either a value (for the next
+// pattern) or a pattern number followed by its value, so scans that
+// skipped patterns or were measured out of order can be written as they
+// come.  Empty lines and lines starting with # or % are ignored, which
+// makes Octave's  save -ascii  and  dlmwrite  output readable as is.
+// The two numbers are separated by white space or a comma; lines with
+// more than two are rejected.
+//
+// Pattern numbers are below MAX_BUCKET_PATTERNS, far more than a mirror
+// has pixels, so that a stray number cannot make the series huge.
+static const size_t MAX_BUCKET_PATTERNS = 1u << 24;
+
+struct BucketSeries
+{
+    std::vector<double> values;
+    std::vector<unsigned char> present;  // 1 where values[i] was measured
+
+    void set(size_t index, double value)
+    {
+        if(index >= values.size())
+        {
+            values.resize(index + 1, 0.0);
+            present.resize(index + 1, 0);
+        }
+        values[index] = value;
+        present[index] = 1;
+    }
+
+    bool has(size_t index) const
+    {
+        return index < present.size() && present[index];
+    }
+
+    size_t measured() const
+    {
+        size_t n = 0;
+        for(size_t i = 0; i < present.size(); ++i)
+        {
+            n += present[i];
+        }
+        return n;
+    }
+};
+
+// One line of a bucket file.  Returns false for lines without a value;
+// otherwise sets index and value and advances next.  Throws
+// std::invalid_argument for a malformed line.
+inline bool parse_bucket_line(const char* line, size_t& next, size_t& index, double& value)
+{
+    const char* p = line;
+    while(*p == ' ' || *p == '\t')
+    {
+        ++p;
+    }
+    if(*p == '\0' || *p == '\n' || *p == '\r' || *p == '#' || *p == '%')
+    {
+        return false;
+    }
+
+    char* end;
+    double first = strtod(p, &end);
+    if(end == p)
+    {
+        throw std::invalid_argument("not a number");
+    }
+    // Octave's dlmwrite separates the columns with a comma.
+    char* rest = end;
+    while(*rest == ' ' || *rest == '\t')
+    {
+        ++rest;
+    }
+    if(*rest == ',')
+    {
+        ++rest;
+    }
+    double second = strtod(rest, &end);
+    if(end != rest)
+    {
+        if( ! (first >= 0 && first < MAX_BUCKET_PATTERNS) || first != static_cast<double>(static_cast<size_t>(first)))
+        {
+            throw std::invalid_argument("pattern number must be a whole number from 0 to " + std::to_string(MAX_BUCKET_PATTERNS - 1));
+        }
+        next = static_cast<size_t>(first);
+        value = second;
+    }
+    else
+    {
+        value = first;
+    }
+    while(*end == ' ' || *end == '\t' || *end == '\r' || *end == '\n')
+    {
+        ++end;
+    }
+    if(*end != '\0')
+    {
+        throw std::invalid_argument("more than a pattern number and a value");
+    }
+    if(next >= MAX_BUCKET_PATTERNS)
+    {
+        throw std::invalid_argument("more than " + std::to_string(MAX_BUCKET_PATTERNS) + " patterns");
+    }
+    index = next++;
+    return true;
+}
+
+inline BucketSeries read_bucket_file(const std::string& path)
+{
+    FILE* f = fopen(path.c_str(), "r");
+    if(f == NULL)
+    {
+        throw std::runtime_error("Could not open bucket file " + path);
+    }
+
+    BucketSeries buckets;
+    size_t next = 0;
+    int line_number = 0;
+    char line[256];
+    while(fgets(line, sizeof(line), f) != NULL)
+    {
+        ++line_number;
+        size_t index;
+        double value;
+        try
+        {
+            if( ! parse_bucket_line(line, next, index, value))
+            {
+                continue;
+            }
+        }
+        catch(const std::invalid_argument& e)
+        {
+            fclose(f);
+            throw std::runtime_error(path + ": line " + std::to_string(line_number) + ": " + e.what());
+        }
+        buckets.set(index, value);
+    }
+    fclose(f);
+    return buckets;
+}
+
+#endif // BUCKET_FILE_H
@@ -0,0 +1,168 @@
+#ifndef CAMERA_CONFIGURATION_H
+#define CAMERA_CONFIGURATION_H
+
+#include <iostream>
+#include <string>
+#include <chrono>
+#include "ueye_camera.h"
+#include "camera_preset.h"
+#include "frame_codec.h"
+
+// The camera configuration used by the acquisition programs.  After
+// a preset has been loaded, the cache in UEyeCamera turns most of
+// these calls into no-ops.
+inline void configure_camera(UEyeCamera& camera, int gain_setting, int blacklvl_setting, double exposure_time, bool quiet)
+{
+    if( ! quiet) { std::cout << "Getting current frame rate ..." << std::endl; }
+    double new_frame_rate = camera.get_frame_rate();
+    if( ! quiet) { std::cout << "Current frame rate " << new_frame_rate << std::endl << std::endl; }
+
+
+    if( ! quiet) { std::cout << "Getting current exposure ..." << std::endl; }
+    double exposure_ms = camera.get_exposure();
+    if( ! quiet) { std::cout << "Current exposure: " << exposure_ms << " ms" << std::endl; }
+
+    // SET current pixel clock
+    camera.set_pixel_clock(10);
+    if( ! quiet) { std::cout << "Just attempted setting pixel clock ..." << std::endl; }
+
+    // Set long exposure enable
+    camera.set_long_exposure(true);
+
+    // SET LOG MODE OFF
+    camera.set_log_mode(IS_LOG_MODE_OFF);
+
+    // Set rolling shutter
+    camera.set_shutter_mode(IS_DEVICE_FEATURE_CAP_SHUTTER_MODE_ROLLING);
+
+
+
+    if( ! quiet) { std::cout << "Getting current gain ..." << std::endl; }
+    int current_gain = camera.get_gain();
+    if( ! quiet) { std::cout << "Current gain setting is: " << current_gain << std::endl; }
+    if( ! quiet) { std::cout << "Setting gain to " << gain_setting << " ..." << std::endl; }
+    camera.set_gain(gain_setting);
+    if( ! quiet) { std::cout << "Getting current gain ..." << std::endl; }
+    current_gain = camera.get_gain();
+    if( ! quiet) { std::cout << "Current gain setting is: " << current_gain << std::endl << std::endl; }
+
+    if( ! quiet) { std::cout << "Getting current blacklevel ..." << std::endl; }
+    int current_blacklevel = camera.get_blacklevel();
+    if( ! quiet) { std::cout << "Current blacklevel: " << current_blacklevel << std::endl; }
+
+    if( ! quiet) { std::cout << "Setting blacklevel to " << blacklvl_setting << "..." << std::endl; }
+    camera.set_blacklevel(blacklvl_setting);
+
+    if( ! quiet) { std::cout << "Getting current blacklevel ..." << std::endl; }
+    current_blacklevel = camera.get_blacklevel();
+    if( ! quiet) { std::cout << "Current blacklevel: " << current_blacklevel << std::endl; }
+
+
+    if( ! quiet) { std::cout << "Getting valid exposure range ..." << std::endl; }
+    double exposure_range[3];
+    camera.get_exposure_range(exposure_range);
+    if( ! quiet) { std::cout << "Min: " << exposure_range[0] << " ms\nMax: " << exposure_range[1] << " ms\nInc: " << exposure_range[2] << " ms" << std::endl; }
+
+
+
+    if( ! quiet) { std::cout << "Setting new exposure to: " << exposure_time << " ms ..." << std::endl; }
+    camera.set_exposure(exposure_time);
+    if( ! quiet) { std::cout << "Current exposure now " << exposure_time << " ms" << std::endl << std::endl; }
+}
+
+inline double milliseconds_since(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Time the step-by-step configuration against loading the preset,
+// each starting from a camera whose state is unknown.
+inline void compare_preset_startup(UEyeCamera& camera, const std::string& preset_name, int gain_setting, int blacklvl_setting, double exposure_time)
+{
+    camera.forget_state();
+    unsigned calls_before = camera.issued_calls();
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    configure_camera(camera, gain_setting, blacklvl_setting, exposure_time, true);
+    double sequential_ms = milliseconds_since(start);
+    unsigned sequential_calls = camera.issued_calls() - calls_before;
+
+    camera.forget_state();
+    calls_before = camera.issued_calls();
+    start = std::chrono::steady_clock::now();
+    if( ! load_camera_preset(camera, preset_name))
+    {
+        std::cout << "Preset " << preset_name << " not found" << std::endl;
+        return;
+    }
+    configure_camera(camera, gain_setting, blacklvl_setting, exposure_time, true);
+    double preset_ms = milliseconds_since(start);
+    unsigned preset_calls = camera.issued_calls() - calls_before;
+
+    std::cout << "Sequential configuration: " << sequential_ms << " ms (" << sequential_calls << " calls)" << std::endl;
+    std::cout << "Preset " << preset_name << ": " << preset_ms << " ms (" << preset_calls << " calls)" << std::endl;
+    std::cout << "Difference: " << (sequential_ms - preset_ms) << " ms" << std::endl;
+}
+
+// File formats for saved pictures.
+enum PictureFormat
+{
+    PICTURE_PNG, // written by the uEye SDK (is_ImageFile)
+    PICTURE_TLC  // our lossless codec, encoded on all cores (frame_codec.h)
+};
+
+inline bool parse_picture_format(const std::string& name, PictureFormat& format)
+{
+    if(name == "png") { format = PICTURE_PNG; return true; }
+    if(name == "tlc") { format = PICTURE_TLC; return true; }
+    return false;
+}
+
+// Take one picture and save it in the requested format.
+inline void save_picture(UEyeCamera& camera, const std::string& file_name, PictureFormat format, bool quiet)
+{
+    if(format == PICTURE_PNG)
+    {
+        camera.capture_to_file(file_name, IS_IMG_PNG, 100);
+        return;
+    }
+
+    // freeze_video() repeats itself after a reconnect, so once it
+    // returns the frame in the camera's buffer is complete.
+    if( ! quiet) { std::cout << "\nFreezing video ..." << std::endl; }
+    camera.freeze_video();
+    if( ! quiet) { std::cout << "\nSaving image to " << file_name << " ..." << std::endl; }
+    tlc_write_file(file_name, reinterpret_cast<const unsigned char*>(camera.image_data()),
+                   camera.width(), camera.height(), camera.bit_depth()/8, camera.pitch());
+}
+
+// Save a frame held in other memory than the camera's own buffer (a
+// pool or ring buffer registered with the camera as `id`, rows `pitch`
+// bytes apart).  `wide_name` is the caller's scratch for the file name,
+// kept from picture to picture so that its storage is reused.
+inline void save_frame_memory(UEyeCamera& camera, char* memory, INT id, int pitch, const std::string& file_name,
+                              PictureFormat format, std::wstring& wide_name)
+{
+    if(format == PICTURE_PNG)
+    {
+        // Copied by hand: assign() from narrow characters makes a
+        // temporary wide string first.
+        wide_name.resize(file_name.size());
+        for(size_t i = 0; i < file_name.size(); ++i)
+        {
+            wide_name[i] = static_cast<unsigned char>(file_name[i]);
+        }
+        UINT image_id = id;
+        IMAGE_FILE_PARAMS params;
+        params.pwchFileName = &wide_name[0];
+        params.nFileType = IS_IMG_PNG;
+        params.pnImageID = &image_id;
+        params.ppcImageMem = &memory;
+        params.nQuality = 100;
+        camera.call("is_ImageFile", [&]() { return is_ImageFile(camera.handle(), IS_IMAGE_FILE_CMD_SAVE, &params, sizeof(params)); });
+        return;
+    }
+    tlc_write_file(file_name, reinterpret_cast<const unsigned char*>(memory),
+                   camera.width(), camera.height(), camera.bit_depth()/8, pitch);
+}
+
+#endif // CAMERA_CONFIGURATION_H
@@ -0,0 +1,542 @@
+#ifndef CAMERA_GROUP_H
+#define CAMERA_GROUP_H
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <chrono>
+#include <algorithm>
+#include <functional>
+#include <condition_variable>
+#include <stdexcept>
+#include <stdint.h>
+#include <Windows.h>
+#include "uEye.h"
+#include "ueye_camera.h"
+#include "camera_configuration.h"
+
+// Several uEye cameras taking frames on the same trigger (--cameras), for
+// example the main camera and a reference beam monitor.
+//
+// Each camera captures continuously into its own ring of image memories
+// (a uEye image sequence).  A thread per camera waits for the camera's
+// frame event and hands every new frame to a FrameGrouper, locked so the
+// camera does not write over it.  The grouper matches frames by the
+// time the cameras took them: each camera's device clock, brought onto
+// the first camera's by the offset between them.  Frames of the cameras
+// within `match_us` of each other are one trigger.  A complete group is
+// one CameraRecord, stamped with the first camera's timestamp for all of
+// its frames.
+//
+// The first frame of every camera is taken to be from the same trigger,
+// which sets the clock offsets; every complete group sets them again, so
+// that clocks running at slightly different rates stay matched.
+//
+// Dropped frames are frames a camera did not deliver: triggers it missed
+// (the frame is simply not there, since the camera's frame numbers only
+// count frames it took), found when a later trigger's group completes
+// without it or when its group times out; and frames written over
+// because the ring was full (gaps in its frame numbers).  Unmatched
+// frames are the ones in such incomplete groups; they are released and
+// counted.  A group that is still incomplete after `timeout_ms` is given
+// up on as well, so that a camera that stops delivering does not keep
+// the others' ring buffers locked.
+//
+// A camera started late, or triggered by something the others do not
+// see, before its first frame stays out of step.
+
+// A frame in a camera's ring.
+struct CameraFrame
+{
+    CameraFrame() : memory(NULL), id(0), timestamp_us(0) { }
+
+    char* memory;
+    INT id;
+    uint64_t timestamp_us;    // the camera's own clock
+};
+
+struct CameraRecord
+{
+    uint64_t sequence;                // triggers seen before this one
+    uint64_t timestamp_us;            // the first camera's, shared by all
+    std::vector<CameraFrame> frames;  // one per camera, until released
+};
+
+// Matching frames of several cameras into records by their timestamps.
+// Thread safe; `release` is called for frames that are given up on.
+class FrameGrouper
+{
+public:
+    FrameGrouper(size_t cameras, const std::function<void(size_t, const CameraFrame&)>& release,
+                 uint64_t match_us, int timeout_ms)
+        : cameras(cameras), release(release), match_us(static_cast<int64_t>(match_us)), timeout(std::chrono::milliseconds(timeout_ms)),
+          offsets(cameras, 0), started(cameras, false), missed_frames(cameras, 0),
+          matched_any(false), last_matched(0), triggers(0), unmatched_frames(0) { }
+
+    // The next frame of camera `camera`, in the order it took them.
+    void add(size_t camera, const CameraFrame& frame)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if( ! started[camera])
+        {
+            started[camera] = true;
+            offsets[camera] = static_cast<int64_t>(frame.timestamp_us);
+        }
+        const int64_t time = static_cast<int64_t>(frame.timestamp_us) - offsets[camera];
+        if(matched_any && time <= last_matched + match_us)
+        {
+            // Its group was completed or given up on already.
+            ++unmatched_frames;
+            release(camera, frame);
+            return;
+        }
+
+        // The group of the same trigger, if another camera got there
+        // first.
+        std::map<int64_t, Pending>::iterator group = pending.lower_bound(time - match_us);
+        while(group != pending.end() && group->first <= time + match_us && group->second.present[camera])
+        {
+            ++group;
+        }
+        if(group == pending.end() || group->first > time + match_us)
+        {
+            group = pending.insert(std::make_pair(time, Pending(cameras))).first;
+            group->second.since = std::chrono::steady_clock::now();
+        }
+        Pending& g = group->second;
+        g.frames[camera] = frame;
+        g.present[camera] = true;
+        if(++g.count < cameras)
+        {
+            return;
+        }
+
+        // Complete: the groups before it will not be.
+        while(pending.begin() != group)
+        {
+            give_up(pending.begin()->second);
+            pending.erase(pending.begin());
+        }
+        CameraRecord record;
+        record.sequence = triggers++;
+        record.timestamp_us = g.frames[0].timestamp_us;
+        record.frames.swap(g.frames);
+        for(size_t c = 1; c < cameras; ++c)
+        {
+            offsets[c] = static_cast<int64_t>(record.frames[c].timestamp_us) - (static_cast<int64_t>(record.frames[0].timestamp_us) - offsets[0]);
+        }
+        matched_any = true;
+        last_matched = static_cast<int64_t>(record.frames[0].timestamp_us) - offsets[0];
+        pending.erase(group);
+        ready.push_back(record);
+        arrived.notify_one();
+    }
+
+    // Give up on the groups that have waited longer than the timeout.
+    void expire()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        for(std::map<int64_t, Pending>::iterator i = pending.begin(); i != pending.end(); )
+        {
+            if(now - i->second.since < timeout)
+            {
+                ++i;
+                continue;
+            }
+            give_up(i->second);
+            if( ! matched_any || i->first > last_matched)
+            {
+                // Later frames of its trigger are too late as well.
+                matched_any = true;
+                last_matched = i->first;
+            }
+            pending.erase(i++);
+        }
+    }
+
+    // The next complete record, waiting up to timeout_ms for it.
+    bool next(CameraRecord& record, int timeout_ms)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        if( ! arrived.wait_for(lock, std::chrono::milliseconds(timeout_ms), [this]() { return ! ready.empty(); }))
+        {
+            return false;
+        }
+        record = ready.front();
+        ready.pop_front();
+        return true;
+    }
+
+    unsigned long unmatched() const
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return unmatched_frames;
+    }
+
+    // Triggers camera `camera` gave no frame for, as far as the others
+    // show.
+    unsigned long missed(size_t camera) const
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return missed_frames[camera];
+    }
+
+    // Release everything not taken.
+    void clear()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for(std::map<int64_t, Pending>::iterator i = pending.begin(); i != pending.end(); ++i)
+        {
+            for(size_t c = 0; c < cameras; ++c)
+            {
+                if(i->second.present[c])
+                {
+                    release(c, i->second.frames[c]);
+                }
+            }
+        }
+        pending.clear();
+        for(size_t r = 0; r < ready.size(); ++r)
+        {
+            for(size_t c = 0; c < cameras; ++c)
+            {
+                release(c, ready[r].frames[c]);
+            }
+        }
+        ready.clear();
+    }
+
+private:
+    struct Pending
+    {
+        explicit Pending(size_t cameras) : frames(cameras), present(cameras, false), count(0) { }
+
+        std::vector<CameraFrame> frames;
+        std::vector<bool> present;
+        size_t count;
+        std::chrono::steady_clock::time_point since;   // when its first frame came
+    };
+
+    size_t cameras;
+    std::function<void(size_t, const CameraFrame&)> release;
+    int64_t match_us;
+    std::chrono::steady_clock::duration timeout;
+    mutable std::mutex mutex;
+    std::condition_variable arrived;
+    std::map<int64_t, Pending> pending;    // by time on the first camera's clock
+    std::deque<CameraRecord> ready;
+    std::vector<int64_t> offsets;           // camera clock minus the first camera's
+    std::vector<bool> started;
+    std::vector<unsigned long> missed_frames;
+    bool matched_any;
+    int64_t last_matched;                   // time of the last group completed or given up
+    uint64_t triggers;
+    unsigned long unmatched_frames;
+
+    void give_up(const Pending& group)
+    {
+        ++triggers;
+        for(size_t c = 0; c < cameras; ++c)
+        {
+            if(group.present[c])
+            {
+                ++unmatched_frames;
+                release(c, group.frames[c]);
+            }
+            else
+            {
+                ++missed_frames[c];
+            }
+        }
+    }
+};
+
+class CameraGroup
+{
+public:
+    // The cameras must be configured, with the trigger set, and have
+    // their image memory allocated (for the size and bit depth).  Frames
+    // taken within match_us of each other are one trigger's (see
+    // FrameGrouper); a trigger not every camera has answered within
+    // timeout_ms is given up on.
+    CameraGroup(const std::vector<UEyeCamera*>& group_cameras, int ring_frames, uint64_t match_us, int timeout_ms)
+        : grouper(group_cameras.size(), [this](size_t c, const CameraFrame& f) { unlock(c, f); }, match_us, timeout_ms),
+          stopping(false)
+    {
+        if(ring_frames < 2)
+        {
+            throw std::invalid_argument("A camera ring needs at least two frames");
+        }
+        try
+        {
+            for(size_t c = 0; c < group_cameras.size(); ++c)
+            {
+                rings.push_back(std::unique_ptr<Ring>(new Ring(*group_cameras[c])));
+                allocate(*rings.back(), ring_frames);
+            }
+            for(size_t c = 0; c < rings.size(); ++c)
+            {
+                Ring& ring = *rings[c];
+                ring.camera.call("is_CaptureVideo", [&ring]() { return is_CaptureVideo(ring.camera.handle(), IS_DONT_WAIT); });
+                ring.capturing = true;
+                ring.thread = std::thread(&CameraGroup::collect, this, c);
+            }
+        }
+        catch(...)
+        {
+            stop();
+            throw;
+        }
+    }
+
+    ~CameraGroup()
+    {
+        stop();
+    }
+
+    size_t size() const { return rings.size(); }
+
+    // Software trigger for every camera, one after the other.
+    void trigger()
+    {
+        for(size_t c = 0; c < rings.size(); ++c)
+        {
+            Ring& ring = *rings[c];
+            ring.camera.call("is_ForceTrigger", [&ring]() { return is_ForceTrigger(ring.camera.handle()); });
+        }
+    }
+
+    // The next frame from every camera, waiting up to timeout_ms.  The
+    // frames stay locked until release().
+    bool next_record(CameraRecord& record, int timeout_ms)
+    {
+        return grouper.next(record, timeout_ms);
+    }
+
+    void release(const CameraRecord& record)
+    {
+        for(size_t c = 0; c < record.frames.size(); ++c)
+        {
+            unlock(c, record.frames[c]);
+        }
+    }
+
+    // Triggers the camera missed and frames written over in its ring.
+    unsigned long dropped(size_t camera) const
+    {
+        std::lock_guard<std::mutex> lock(rings[camera]->mutex);
+        return rings[camera]->dropped + grouper.missed(camera);
+    }
+
+    unsigned long unmatched() const { return grouper.unmatched(); }
+
+private:
+    struct Ring
+    {
+        explicit Ring(UEyeCamera& camera) : camera(camera), event(NULL), capturing(false), started(false), last_frame(0), dropped(0) { }
+
+        UEyeCamera& camera;
+        std::vector<char*> memory;
+        std::vector<INT> ids;
+        std::vector<bool> held;    // taken and still locked, under `mutex`
+        HANDLE event;
+        bool capturing;
+        std::thread thread;
+        mutable std::mutex mutex;
+        bool started;              // a frame has come in
+        uint64_t last_frame;       // camera frame number of the last one
+        unsigned long dropped;     // written over before they were taken
+    };
+
+    std::vector<std::unique_ptr<Ring> > rings;
+    FrameGrouper grouper;
+    std::mutex mutex;
+    bool stopping;
+
+    void allocate(Ring& ring, int frames)
+    {
+        UEyeCamera& camera = ring.camera;
+        for(int i = 0; i < frames; ++i)
+        {
+            char* memory = NULL;
+            INT id = 0;
+            camera.call("is_AllocImageMem", [&]() { return is_AllocImageMem(camera.handle(), camera.width(), camera.height(), camera.bit_depth(), &memory, &id); });
+            ring.memory.push_back(memory);
+            ring.ids.push_back(id);
+            ring.held.push_back(false);
+            camera.call("is_AddToSequence", [&]() { return is_AddToSequence(camera.handle(), memory, id); });
+        }
+        ring.event = CreateEvent(NULL, FALSE, FALSE, NULL);
+        camera.call("is_InitEvent", [&]() { return is_InitEvent(camera.handle(), ring.event, IS_SET_EVENT_FRAME); });
+        camera.call("is_EnableEvent", [&]() { return is_EnableEvent(camera.handle(), IS_SET_EVENT_FRAME); });
+    }
+
+    bool stopped()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return stopping;
+    }
+
+    void stop()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        for(size_t c = 0; c < rings.size(); ++c)
+        {
+            if(rings[c]->thread.joinable())
+            {
+                rings[c]->thread.join();
+            }
+        }
+        grouper.clear();
+        for(size_t c = 0; c < rings.size(); ++c)
+        {
+            // Not retried: the cameras are being given up anyway.
+            Ring& ring = *rings[c];
+            HIDS h = ring.camera.handle();
+            if(ring.capturing)
+            {
+                is_StopLiveVideo(h, IS_FORCE_VIDEO_STOP);
+            }
+            if(ring.event)
+            {
+                is_DisableEvent(h, IS_SET_EVENT_FRAME);
+                is_ExitEvent(h, IS_SET_EVENT_FRAME);
+                CloseHandle(ring.event);
+            }
+            is_ClearSequence(h);
+            for(size_t i = 0; i < ring.memory.size(); ++i)
+            {
+                is_FreeImageMem(h, ring.memory[i], ring.ids[i]);
+            }
+            ring.camera.restore_image_memory();
+        }
+    }
+
+    void unlock(size_t camera, const CameraFrame& frame)
+    {
+        Ring& ring = *rings[camera];
+        {
+            std::lock_guard<std::mutex> lock(ring.mutex);
+            for(size_t i = 0; i < ring.memory.size(); ++i)
+            {
+                if(ring.memory[i] == frame.memory)
+                {
+                    ring.held[i] = false;
+                }
+            }
+        }
+        is_UnlockSeqBuf(ring.camera.handle(), IS_IGNORE_PARAMETER, frame.memory);
+    }
+
+    // Camera c's thread: on every frame event, take the frames in the
+    // ring that are newer than the last one taken, oldest first.  The
+    // buffer the camera is writing and those still held are left alone.
+    // Groups that waited too long are given up on here as well.  The
+    // calls here are not retried; a camera that is lost stops giving
+    // frames, which shows as dropped frames and missing records.
+    void collect(size_t c)
+    {
+        Ring& ring = *rings[c];
+        const HIDS h = ring.camera.handle();
+        std::vector<std::pair<uint64_t, size_t> > fresh;
+        std::vector<uint64_t> timestamps(ring.memory.size());
+        while( ! stopped())
+        {
+            const bool signalled = WaitForSingleObject(ring.event, 100) == WAIT_OBJECT_0;
+            grouper.expire();
+            if( ! signalled)
+            {
+                continue;
+            }
+            INT number = 0;
+            char* writing = NULL;
+            char* last = NULL;
+            if(is_GetActSeqBuf(h, &number, &writing, &last) != IS_SUCCESS)
+            {
+                writing = NULL;
+            }
+            fresh.clear();
+            for(size_t i = 0; i < ring.memory.size(); ++i)
+            {
+                {
+                    std::lock_guard<std::mutex> lock(ring.mutex);
+                    if(ring.held[i] || ring.memory[i] == writing)
+                    {
+                        continue;
+                    }
+                }
+                // Locked first, so that the frame cannot change between
+                // reading its number and handing it on.
+                if(is_LockSeqBuf(h, IS_IGNORE_PARAMETER, ring.memory[i]) != IS_SUCCESS)
+                {
+                    continue;
+                }
+                UEYEIMAGEINFO info;
+                if(is_GetImageInfo(h, ring.ids[i], &info, sizeof(info)) == IS_SUCCESS &&
+                   info.u64TimestampDevice != 0 &&     // written at all
+                   ( ! ring.started || info.u64FrameNumber > ring.last_frame))
+                {
+                    timestamps[i] = info.u64TimestampDevice / 10; // device clock counts 0.1 us
+                    fresh.push_back(std::make_pair(info.u64FrameNumber, i));
+                    continue;
+                }
+                is_UnlockSeqBuf(h, IS_IGNORE_PARAMETER, ring.memory[i]);
+            }
+            std::sort(fresh.begin(), fresh.end());
+            for(size_t k = 0; k < fresh.size(); ++k)
+            {
+                const size_t i = fresh[k].second;
+                CameraFrame frame;
+                frame.memory = ring.memory[i];
+                frame.id = ring.ids[i];
+                frame.timestamp_us = timestamps[i];
+                {
+                    std::lock_guard<std::mutex> lock(ring.mutex);
+                    ring.held[i] = true;
+                    if(ring.started)
+                    {
+                        ring.dropped += static_cast<unsigned long>(fresh[k].first - ring.last_frame - 1);
+                    }
+                    ring.started = true;
+                    ring.last_frame = fresh[k].first;
+                }
+                grouper.add(c, frame);
+            }
+        }
+    }
+};
+
+// Camera `id`'s version of an output file name: the first camera's
+// keeps the name, the others get -cam<id> before the extension.
+inline std::string camera_file_name(const std::string& file_name, HIDS id, bool first)
+{
+    if(first)
+    {
+        return file_name;
+    }
+    const std::string suffix = "-cam" + std::to_string(id);
+    const std::string::size_type dot = file_name.find_last_of('.');
+    const std::string::size_type slash = file_name.find_last_of("/\\");
+    if(dot == std::string::npos || (slash != std::string::npos && dot < slash))
+    {
+        return file_name + suffix;
+    }
+    return file_name.substr(0, dot) + suffix + file_name.substr(dot);
+}
+
+// Save a frame from a camera's ring as a picture file.
+inline void save_frame_picture(UEyeCamera& camera, const CameraFrame& frame, const std::string& file_name,
+                               PictureFormat format, std::wstring& wide_name)
+{
+    save_frame_memory(camera, frame.memory, frame.id, camera.pitch(), file_name, format, wide_name);
+}
+
+#endif // CAMERA_GROUP_H
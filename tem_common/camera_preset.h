@@ -0,0 +1,88 @@
+#ifndef CAMERA_PRESET_H
+#define CAMERA_PRESET_H
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <stdexcept>
+#include <stdint.h>
+#include "ueye_camera.h"
+
+// Named camera presets.
+//
+// A preset called <name> is two files:
+//   <name>.ini    - the uEye parameter set, holding the full camera state
+//                   and loaded with a single is_ParameterSet call
+//   <name>.preset - a small binary snapshot of the settings made through
+//                   UEyeCamera, so that its cache and reconnect logic know
+//                   what the parameter set contains without querying
+//
+// Loading a preset replaces the sequential pixel clock, exposure mode,
+// log mode, shutter, gain, black level and exposure calls at startup.
+
+struct CameraPresetHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t settings_size;
+};
+
+inline const char* camera_preset_magic() { return "TSPRESET"; }
+
+inline std::string camera_preset_ini(const std::string& name) { return name + ".ini"; }
+inline std::string camera_preset_snapshot(const std::string& name) { return name + ".preset"; }
+
+// Snapshot the camera's current state under the given name.
+inline void save_camera_preset(UEyeCamera& camera, const std::string& name)
+{
+    camera.save_parameter_set(camera_preset_ini(name));
+
+    CameraPresetHeader header;
+    memcpy(header.magic, camera_preset_magic(), sizeof(header.magic));
+    header.version = 1;
+    header.settings_size = sizeof(CameraSettings);
+
+    FILE* f = fopen(camera_preset_snapshot(name).c_str(), "wb");
+    if(f == NULL)
+    {
+        throw std::runtime_error("Could not write camera preset " + camera_preset_snapshot(name));
+    }
+    bool ok = fwrite(&header, sizeof(header), 1, f) == 1
+           && fwrite(&camera.settings(), sizeof(CameraSettings), 1, f) == 1;
+    fclose(f);
+    if( ! ok)
+    {
+        throw std::runtime_error("Could not write camera preset " + camera_preset_snapshot(name));
+    }
+}
+
+// Restore a preset made by save_camera_preset.  Returns false if the
+// preset is missing or was written by a different build, in which
+// case the caller should fall back to configuring the camera
+// step by step.
+inline bool load_camera_preset(UEyeCamera& camera, const std::string& name)
+{
+    FILE* f = fopen(camera_preset_snapshot(name).c_str(), "rb");
+    if(f == NULL)
+    {
+        return false;
+    }
+
+    CameraPresetHeader header;
+    CameraSettings settings;
+    bool ok = fread(&header, sizeof(header), 1, f) == 1
+           && memcmp(header.magic, camera_preset_magic(), sizeof(header.magic)) == 0
+           && header.version == 1
+           && header.settings_size == sizeof(CameraSettings)
+           && fread(&settings, sizeof(settings), 1, f) == 1;
+    fclose(f);
+    if( ! ok)
+    {
+        return false;
+    }
+
+    camera.load_parameter_set(camera_preset_ini(name), settings);
+    return true;
+}
+
+#endif // CAMERA_PRESET_H
@@ -0,0 +1,78 @@
+#ifndef CODEC_BENCHMARK_H
+#define CODEC_BENCHMARK_H
+
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <sys/stat.h>
+#include "ueye_camera.h"
+#include "frame_codec.h"
+#include "synthetic_frame.h"
+
+// Compare the uEye PNG writer with the TLC codec on synthetic detector
+// frames of the camera's size.  For the PNG path each synthetic frame is
+// copied into the camera's image buffer and saved with is_ImageFile,
+// exactly as a captured frame would be.
+inline void run_codec_benchmark(UEyeCamera& camera, int frames)
+{
+    const int width = camera.width();
+    const int height = camera.height();
+    const int channels = camera.bit_depth()/8;
+    const double raw_mb = static_cast<double>(width)*height*channels/1e6;
+    const std::string png_file = "codec_benchmark.png";
+
+    double png_seconds = 0;
+    double tlc_encode_seconds = 0;
+    double tlc_decode_seconds = 0;
+    double png_bytes = 0;
+    double tlc_bytes = 0;
+    bool round_trip_ok = true;
+
+    std::vector<unsigned char> frame;
+    std::vector<unsigned char> encoded;
+    std::vector<unsigned char> decoded;
+    for(int i = 0; i < frames; ++i)
+    {
+        make_synthetic_frame(frame, width, height, channels, i);
+
+        for(int y = 0; y < height; ++y)
+        {
+            memcpy(camera.image_data() + static_cast<size_t>(y)*camera.pitch(), &frame[static_cast<size_t>(y)*width*channels], width*channels);
+        }
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        camera.save_image(png_file, IS_IMG_PNG, 100);
+        png_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        struct stat info;
+        if(stat(png_file.c_str(), &info) == 0)
+        {
+            png_bytes += info.st_size;
+        }
+
+        start = std::chrono::steady_clock::now();
+        tlc_encode(&frame[0], width, height, channels, width*channels, encoded);
+        tlc_encode_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        tlc_bytes += encoded.size();
+
+        int w, h, c;
+        start = std::chrono::steady_clock::now();
+        tlc_decode(&encoded[0], encoded.size(), decoded, w, h, c);
+        tlc_decode_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        round_trip_ok = round_trip_ok && decoded == frame;
+    }
+    remove(png_file.c_str());
+
+    const double total_mb = raw_mb*frames;
+    std::cout << "Codec benchmark, " << frames << " synthetic " << width << " x " << height << " frames ("
+              << std::thread::hardware_concurrency() << " cores)" << std::endl;
+    std::cout << "PNG (uEye): ratio " << (png_bytes > 0 ? total_mb*1e6/png_bytes : 0)
+              << ", encode " << total_mb/png_seconds << " MB/s" << std::endl;
+    std::cout << "TLC:        ratio " << total_mb*1e6/tlc_bytes
+              << ", encode " << total_mb/tlc_encode_seconds << " MB/s"
+              << ", decode " << total_mb/tlc_decode_seconds << " MB/s"
+              << (round_trip_ok ? "" : "  ROUND TRIP FAILED") << std::endl;
+}
+
+#endif // CODEC_BENCHMARK_H
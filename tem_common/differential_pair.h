@@ -0,0 +1,97 @@
+#ifndef DIFFERENTIAL_PAIR_H
+#define DIFFERENTIAL_PAIR_H
+
+#include <vector>
+#include <stdexcept>
+#include <stdint.h>
+#include "frame_stack.h"
+#include "stack_buckets.h"
+
+// One differential measurement from a complementary pattern pair.
+//
+// The pattern and then its complement are captured into two scratch
+// frames that are reused for every pair.  As soon as the second frame
+// is in, the pair is reduced to a single measurement: either the whole
+// difference frame (FRAME_PIXEL_DIFF16) or the difference of the two
+// region sums.  Background light common to both frames cancels, only
+// one measurement per pair is stored, and nothing is left to subtract
+// after the scan.
+class DifferentialPair
+{
+public:
+    // Camera frame geometry, as for FrameStackWriter.
+    DifferentialPair(uint32_t width, uint32_t height, uint32_t bits_per_pixel)
+        : width(width), height(height), bytes_per_pixel(static_cast<int>(bits_per_pixel / 8)),
+          pitch(FrameStackWriter::line_pitch_for(width, bits_per_pixel)),
+          first(static_cast<size_t>(pitch)*height), second(static_cast<size_t>(pitch)*height),
+          first_frame(&first[0]), second_frame(&second[0])
+    {
+    }
+
+    // The same, capturing into the caller's buffers (of
+    // FrameStackWriter::line_pitch_for rows, as from a FramePool).
+    DifferentialPair(uint32_t width, uint32_t height, uint32_t bits_per_pixel, char* pattern, char* complement)
+        : width(width), height(height), bytes_per_pixel(static_cast<int>(bits_per_pixel / 8)),
+          pitch(FrameStackWriter::line_pitch_for(width, bits_per_pixel)),
+          first_frame(pattern), second_frame(complement)
+    {
+    }
+
+    // Capture buffers for the pattern and for its complement.
+    char* pattern_frame() { return first_frame; }
+    char* complement_frame() { return second_frame; }
+
+    // Pattern minus complement, one int16 per camera byte, written to a
+    // frame with rows `out_pitch` bytes apart (a FRAME_PIXEL_DIFF16 stack
+    // slot of twice the camera bits per pixel).
+    void difference_frame(unsigned char* out, uint32_t out_pitch) const
+    {
+        const size_t values = static_cast<size_t>(width)*bytes_per_pixel;
+        for(uint32_t y = 0; y < height; ++y)
+        {
+            const unsigned char* a = reinterpret_cast<const unsigned char*>(first_frame + static_cast<size_t>(y)*pitch);
+            const unsigned char* b = reinterpret_cast<const unsigned char*>(second_frame + static_cast<size_t>(y)*pitch);
+            int16_t* d = reinterpret_cast<int16_t*>(out + static_cast<size_t>(y)*out_pitch);
+            for(size_t i = 0; i < values; ++i)
+            {
+                d[i] = static_cast<int16_t>(a[i] - b[i]);
+            }
+        }
+    }
+
+    // Sum of all pixel values (all channels) inside the region, pattern
+    // minus complement.  Both frames are read in the same pass.
+    int64_t region_difference(const BucketRegion& region) const
+    {
+        int x0, y0, x1, y1;
+        if( ! bucket_region_bounds(region, width, height, x0, y0, x1, y1))
+        {
+            throw std::runtime_error("Bucket region lies outside the camera frame");
+        }
+        int64_t sum = 0;
+        for(int y = y0; y < y1; ++y)
+        {
+            const unsigned char* a = reinterpret_cast<const unsigned char*>(first_frame + static_cast<size_t>(y)*pitch);
+            const unsigned char* b = reinterpret_cast<const unsigned char*>(second_frame + static_cast<size_t>(y)*pitch);
+            int32_t row = 0;  // fits rows of up to 2^31/255, about 8.4 million bytes
+            for(int i = x0*bytes_per_pixel; i < x1*bytes_per_pixel; ++i)
+            {
+                row += a[i] - b[i];
+            }
+            sum += row;
+        }
+        return sum;
+    }
+
+private:
+    uint32_t width;
+    uint32_t height;
+    int bytes_per_pixel;
+    uint32_t pitch;
+    std::vector<char> first;
+    std::vector<char> second;
+    char* first_frame;
+    char* second_frame;
+};
+
+#endif // DIFFERENTIAL_PAIR_H
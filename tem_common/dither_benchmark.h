@@ -0,0 +1,41 @@
+#ifndef DITHER_BENCHMARK_H
+#define DITHER_BENCHMARK_H
+
+#include <iostream>
+#include <vector>
+#include <chrono>
+#include <thread>
+#include "dithering.h"
+#include "synthetic_frame.h"
+
+// Time every dither mode on synthetic grey pictures of width x height,
+// to see which ones keep up with the rate pictures are loaded at.
+inline void run_dither_benchmark(int width, int height, int frames, unsigned char off_value, unsigned char on_value)
+{
+    std::vector<std::vector<unsigned char> > pictures(4);
+    for(size_t i = 0; i < pictures.size(); ++i)
+    {
+        make_synthetic_frame(pictures[i], width, height, 1, static_cast<uint32_t>(i));
+    }
+    std::vector<unsigned char> out(static_cast<size_t>(width)*height);
+
+    std::cout << "Dither benchmark, " << frames << " synthetic " << width << " x " << height << " pictures ("
+              << std::thread::hardware_concurrency() << " cores)" << std::endl;
+    const DitherMode modes[] = { DITHER_THRESHOLD, DITHER_BAYER, DITHER_FLOYD_STEINBERG, DITHER_SIERRA };
+    Ditherer ditherer;
+    for(int m = 0; m < 4; ++m)
+    {
+        // The first picture builds the tables and buffers; not timed.
+        ditherer.dither(modes[m], &pictures[0][0], width, height, &out[0], off_value, on_value);
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        for(int i = 0; i < frames; ++i)
+        {
+            ditherer.dither(modes[m], &pictures[i % pictures.size()][0], width, height, &out[0], off_value, on_value);
+        }
+        const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::cout << dither_mode_name(modes[m]) << ": " << 1000*seconds/frames << " ms per picture, "
+                  << frames/seconds << " pictures/s" << std::endl;
+    }
+}
+
+#endif // DITHER_BENCHMARK_H
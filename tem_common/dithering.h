@@ -0,0 +1,295 @@
+#ifndef DITHERING_H
+#define DITHERING_H
+
+#include <cstring>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <stdexcept>
+#include <stdint.h>
+#include "parallel_for.h"
+
+// Binary mirror patterns from 8-bit grey pictures.
+//
+//   threshold        on where grey >= 128 (what the loader always did)
+//   bayer            ordered dithering with the 8x8 Bayer matrix
+//   floyd-steinberg  error diffusion, weights 7 / 3 5 1 (sixteenths)
+//   sierra           error diffusion, weights 5 3 / 2 4 5 4 2 / 2 3 2
+//                    (thirty-seconds), smoother than Floyd-Steinberg
+//
+// Threshold and Bayer compare each pixel with a threshold row built
+// once per picture width, sixteen pixels at a time.  Error diffusion is
+// sequential along a row, but a row only needs the row above to be a
+// few pixels ahead of it, so rows run on different threads at once,
+// each following the one above (row pipelining).  The threads are
+// started with the first picture big enough to share out and kept for
+// the next ones.
+enum DitherMode
+{
+    DITHER_THRESHOLD,
+    DITHER_BAYER,
+    DITHER_FLOYD_STEINBERG,
+    DITHER_SIERRA
+};
+
+inline bool parse_dither_mode(const std::string& name, DitherMode& mode)
+{
+    if(name == "threshold")                       { mode = DITHER_THRESHOLD;       return true; }
+    if(name == "bayer")                           { mode = DITHER_BAYER;           return true; }
+    if(name == "floyd-steinberg" || name == "fs") { mode = DITHER_FLOYD_STEINBERG; return true; }
+    if(name == "sierra")                          { mode = DITHER_SIERRA;          return true; }
+    return false;
+}
+
+inline const char* dither_mode_name(DitherMode mode)
+{
+    switch(mode)
+    {
+    case DITHER_BAYER:           return "bayer";
+    case DITHER_FLOYD_STEINBERG: return "floyd-steinberg";
+    case DITHER_SIERRA:          return "sierra";
+    default:                     return "threshold";
+    }
+}
+
+class Ditherer
+{
+public:
+    Ditherer() : threads(0), threshold_width(-1), threshold_mode(DITHER_THRESHOLD), progress_rows(0) { }
+
+    void set_threads(int n)
+    {
+        threads = n;
+        pool.reset();
+    }
+
+    // out[i] = on_value or off_value for every grey[i] of a width x
+    // height picture (row by row).
+    void dither(DitherMode mode, const unsigned char* grey, int width, int height,
+                unsigned char* out, unsigned char off_value, unsigned char on_value)
+    {
+        if(width <= 0 || height <= 0)
+        {
+            return;
+        }
+        switch(mode)
+        {
+        case DITHER_THRESHOLD:
+        case DITHER_BAYER:
+            ordered(mode, grey, width, height, out, off_value, on_value);
+            break;
+        case DITHER_FLOYD_STEINBERG:
+            diffuse<FloydSteinberg>(grey, width, height, out, off_value, on_value);
+            break;
+        case DITHER_SIERRA:
+            diffuse<Sierra>(grey, width, height, out, off_value, on_value);
+            break;
+        }
+    }
+
+private:
+    typedef unsigned char ByteVector __attribute__((vector_size(16)));
+
+    int threads;
+    std::unique_ptr<WorkerPool> pool;
+
+    // Ordered dithering: 8 threshold rows of the picture width.
+    int threshold_width;
+    DitherMode threshold_mode;
+    std::vector<unsigned char> threshold_rows;
+
+    // Error diffusion: errors for the next two rows of each row, in a
+    // ring of rows, and how far each row has got.
+    std::vector<int32_t> below1;
+    std::vector<int32_t> below2;
+    std::unique_ptr<std::atomic<int>[]> progress;
+    int progress_rows;
+
+    static const int RING = 4;
+    static const int PAD = 2;
+    static const int BLOCK = 64;
+
+    // f(i) for i in [0, count), on the pool if `parallel`.
+    template<typename F>
+    void run_parallel(int count, bool parallel, F f)
+    {
+        if( ! parallel)
+        {
+            parallel_for(count, 1, f);
+            return;
+        }
+        if( ! pool)
+        {
+            pool.reset(new WorkerPool(threads));
+        }
+        pool->run(count, f);
+    }
+
+    static int bayer8(int x, int y)
+    {
+        // Bit interleave of x ^ y and y, reversed: the classic recursive
+        // Bayer matrix with values 0..63.
+        int v = 0;
+        int a = x ^ y;
+        int b = y;
+        for(int bit = 0; bit < 3; ++bit)
+        {
+            v = (v << 2) | (((a >> bit) & 1) << 1) | ((b >> bit) & 1);
+        }
+        return v;
+    }
+
+    void ordered(DitherMode mode, const unsigned char* grey, int width, int height,
+                 unsigned char* out, unsigned char off_value, unsigned char on_value)
+    {
+        if(width != threshold_width || mode != threshold_mode)
+        {
+            // on where grey > threshold: 127 for a plain threshold, and
+            // thresholds spread over 2..254 for Bayer, so that 0 stays
+            // all off and 255 all on.
+            threshold_rows.resize(8*static_cast<size_t>(width));
+            for(int ty = 0; ty < 8; ++ty)
+            {
+                for(int x = 0; x < width; ++x)
+                {
+                    threshold_rows[static_cast<size_t>(ty)*width + x] = (mode == DITHER_BAYER)
+                        ? static_cast<unsigned char>((bayer8(x & 7, ty)*256 + 128) / 64)
+                        : 127;
+                }
+            }
+            threshold_width = width;
+            threshold_mode = mode;
+        }
+
+        ByteVector on_v, off_v;
+        memset(&on_v, on_value, sizeof(on_v));
+        memset(&off_v, off_value, sizeof(off_v));
+        const int rows_per_task = std::max(1, 65536 / width);
+        const int tasks = (height + rows_per_task - 1) / rows_per_task;
+        run_parallel(tasks, tasks > 1, [&](int task)
+        {
+            const int y1 = std::min(height, (task + 1)*rows_per_task);
+            for(int y = task*rows_per_task; y < y1; ++y)
+            {
+                const unsigned char* g = grey + static_cast<size_t>(y)*width;
+                const unsigned char* t = &threshold_rows[static_cast<size_t>(y & 7)*width];
+                unsigned char* o = out + static_cast<size_t>(y)*width;
+                int x = 0;
+                for( ; x + 16 <= width; x += 16)
+                {
+                    ByteVector gv, tv;
+                    memcpy(&gv, g + x, 16);
+                    memcpy(&tv, t + x, 16);
+                    ByteVector mask = (ByteVector)(gv > tv);
+                    ByteVector ov = (mask & on_v) | (~mask & off_v);
+                    memcpy(o + x, &ov, 16);
+                }
+                for( ; x < width; ++x)
+                {
+                    o[x] = (g[x] > t[x]) ? on_value : off_value;
+                }
+            }
+        });
+    }
+
+    // Error diffusion kernels.  Errors are kept as sums of error*weight
+    // and divided by 2^SHIFT when used.
+    struct FloydSteinberg
+    {
+        static const int SHIFT = 4;
+        static const int REACH = 1;   // columns the next row's weights reach
+        static const int RIGHT1 = 7, RIGHT2 = 0;
+        static void spread(int32_t e, int32_t* b1, int32_t*)
+        {
+            b1[-1] += 3*e;
+            b1[0] += 5*e;
+            b1[1] += e;
+        }
+    };
+
+    struct Sierra
+    {
+        static const int SHIFT = 5;
+        static const int REACH = 2;
+        static const int RIGHT1 = 5, RIGHT2 = 3;
+        static void spread(int32_t e, int32_t* b1, int32_t* b2)
+        {
+            b1[-2] += 2*e;
+            b1[-1] += 4*e;
+            b1[0] += 5*e;
+            b1[1] += 4*e;
+            b1[2] += 2*e;
+            b2[-1] += 2*e;
+            b2[0] += 3*e;
+            b2[1] += 2*e;
+        }
+    };
+
+    // Row y adds the errors for row y+1 to below1 and for row y+2 to
+    // below2, in ring slot (row % RING); the reading row clears them
+    // again.  Before a block of pixels a row waits until the row above
+    // is REACH pixels past the block, so every error it reads is
+    // complete, and since that holds for every row in turn, a ring slot
+    // is never written before its previous row has finished with it.
+    template<typename K>
+    void diffuse(const unsigned char* grey, int width, int height,
+                 unsigned char* out, unsigned char off_value, unsigned char on_value)
+    {
+        const size_t stride = static_cast<size_t>(width) + 2*PAD;
+        below1.assign(RING*stride, 0);
+        below2.assign(RING*stride, 0);
+        if(progress_rows < height)
+        {
+            progress.reset(new std::atomic<int>[height]);
+            progress_rows = height;
+        }
+        for(int y = 0; y < height; ++y)
+        {
+            progress[y].store(0, std::memory_order_relaxed);
+        }
+
+        const int32_t round = 1 << (K::SHIFT - 1);
+        run_parallel(height, static_cast<int64_t>(width)*height >= 65536, [&](int y)
+        {
+            int32_t* own1 = &below1[(y % RING)*stride + PAD];
+            int32_t* own2 = &below2[(y % RING)*stride + PAD];
+            int32_t* next1 = &below1[((y + 1) % RING)*stride + PAD];
+            int32_t* next2 = &below2[((y + 2) % RING)*stride + PAD];
+            const unsigned char* g = grey + static_cast<size_t>(y)*width;
+            unsigned char* o = out + static_cast<size_t>(y)*width;
+            int32_t right1 = 0;
+            int32_t right2 = 0;
+            for(int x0 = 0; x0 < width; x0 += BLOCK)
+            {
+                const int x1 = std::min(width, x0 + BLOCK);
+                if(y > 0)
+                {
+                    const int needed = std::min(width, x1 + K::REACH);
+                    while(progress[y - 1].load(std::memory_order_acquire) < needed)
+                    {
+                        std::this_thread::yield();
+                    }
+                }
+                for(int x = x0; x < x1; ++x)
+                {
+                    const int32_t sum = own1[x] + own2[x] + right1;
+                    own1[x] = 0;
+                    own2[x] = 0;
+                    const int32_t value = g[x] + ((sum + round) >> K::SHIFT);
+                    const bool on = value >= 128;
+                    o[x] = on ? on_value : off_value;
+                    const int32_t e = value - (on ? 255 : 0);
+                    right1 = right2 + K::RIGHT1*e;
+                    right2 = K::RIGHT2*e;
+                    K::spread(e, next1 + x, next2 + x);
+                }
+                progress[y].store(x1, std::memory_order_release);
+            }
+        });
+    }
+};
+
+#endif // DITHERING_H
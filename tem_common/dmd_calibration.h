@@ -0,0 +1,633 @@
+#ifndef DMD_CALIBRATION_H
+#define DMD_CALIBRATION_H
+
+#include <cmath>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+#include <stdint.h>
+#include "fiducial_patterns.h"
+#include "remap_tables.h"
+
+// Geometry between the mirror and the camera.
+//
+// A mirror pixel m lands on the camera at
+//
+//   u = H m                          (homography, in normalized coordinates)
+//   c = u (1 + k1 |u|^2 + k2 |u|^4)  (radial distortion about the camera centre)
+//
+// Both sides are normalized to their centre and half diagonal, so the
+// homography is well conditioned and k1, k2 are in the same units for
+// every camera.  The model is fitted to fiducial dots (see
+// fiducial_patterns.h) and then turned into remap tables once, so that
+// nothing of it has to be evaluated per frame.
+
+struct CalibrationPoint
+{
+    double mirror_x;
+    double mirror_y;
+    double camera_x;
+    double camera_y;
+};
+
+class DmdCameraModel
+{
+public:
+    uint32_t mirror_w;
+    uint32_t mirror_h;
+    uint32_t camera_w;
+    uint32_t camera_h;
+    double h[9];   // normalized mirror -> undistorted normalized camera
+    double k1;
+    double k2;
+
+    DmdCameraModel() : mirror_w(0), mirror_h(0), camera_w(0), camera_h(0), k1(0), k2(0)
+    {
+        for(int i = 0; i < 9; ++i)
+        {
+            h[i] = (i % 4 == 0) ? 1.0 : 0.0;
+        }
+    }
+
+    // False if the mirror pixel maps to infinity (behind the camera).
+    bool mirror_to_camera(double mx, double my, double& cx, double& cy) const
+    {
+        double x, y;
+        normalize(mx, my, mirror_w, mirror_h, x, y);
+        const double w = h[6]*x + h[7]*y + h[8];
+        if(w <= 1e-12)
+        {
+            return false;
+        }
+        const double ux = (h[0]*x + h[1]*y + h[2]) / w;
+        const double uy = (h[3]*x + h[4]*y + h[5]) / w;
+        const double r2 = ux*ux + uy*uy;
+        const double f = 1 + k1*r2 + k2*r2*r2;
+        denormalize(ux*f, uy*f, camera_w, camera_h, cx, cy);
+        return true;
+    }
+
+    // Inverse of mirror_to_camera.  The distortion is undone by fixed
+    // point iteration, which converges for the mild distortion of a
+    // camera lens.
+    bool camera_to_mirror(double cx, double cy, double& mx, double& my) const
+    {
+        double dx, dy;
+        normalize(cx, cy, camera_w, camera_h, dx, dy);
+        double ux = dx;
+        double uy = dy;
+        for(int i = 0; i < 20; ++i)
+        {
+            const double r2 = ux*ux + uy*uy;
+            const double f = 1 + k1*r2 + k2*r2*r2;
+            if(f <= 0)
+            {
+                return false;
+            }
+            ux = dx / f;
+            uy = dy / f;
+        }
+        double inv[9];
+        if( ! invert3(h, inv))
+        {
+            return false;
+        }
+        const double w = inv[6]*ux + inv[7]*uy + inv[8];
+        if(std::fabs(w) <= 1e-12)
+        {
+            return false;
+        }
+        denormalize((inv[0]*ux + inv[1]*uy + inv[2]) / w, (inv[3]*ux + inv[4]*uy + inv[5]) / w,
+                    mirror_w, mirror_h, mx, my);
+        return true;
+    }
+
+    void save(const std::string& path) const
+    {
+        FILE* f = fopen(path.c_str(), "w");
+        if(f == NULL)
+        {
+            throw std::runtime_error("Could not write calibration " + path);
+        }
+        fprintf(f, "# mirror to camera calibration\n");
+        fprintf(f, "mirror %u %u\n", mirror_w, mirror_h);
+        fprintf(f, "camera %u %u\n", camera_w, camera_h);
+        fprintf(f, "homography %.17g %.17g %.17g %.17g %.17g %.17g %.17g %.17g %.17g\n",
+                h[0], h[1], h[2], h[3], h[4], h[5], h[6], h[7], h[8]);
+        fprintf(f, "distortion %.17g %.17g\n", k1, k2);
+        if(fclose(f) != 0)
+        {
+            throw std::runtime_error("Could not write calibration " + path);
+        }
+    }
+
+    static DmdCameraModel load(const std::string& path)
+    {
+        FILE* f = fopen(path.c_str(), "r");
+        if(f == NULL)
+        {
+            throw std::runtime_error("Could not read calibration " + path);
+        }
+        DmdCameraModel m;
+        char line[512];
+        int found = 0;
+        while(fgets(line, sizeof(line), f) != NULL)
+        {
+            if(sscanf(line, "mirror %u %u", &m.mirror_w, &m.mirror_h) == 2
+               || sscanf(line, "camera %u %u", &m.camera_w, &m.camera_h) == 2
+               || sscanf(line, "homography %lf %lf %lf %lf %lf %lf %lf %lf %lf",
+                         &m.h[0], &m.h[1], &m.h[2], &m.h[3], &m.h[4], &m.h[5], &m.h[6], &m.h[7], &m.h[8]) == 9
+               || sscanf(line, "distortion %lf %lf", &m.k1, &m.k2) == 2)
+            {
+                ++found;
+            }
+        }
+        fclose(f);
+        if(found != 4)
+        {
+            throw std::runtime_error("Incomplete calibration " + path);
+        }
+        return m;
+    }
+
+    static bool invert3(const double* a, double* inv)
+    {
+        inv[0] = a[4]*a[8] - a[5]*a[7];
+        inv[1] = a[2]*a[7] - a[1]*a[8];
+        inv[2] = a[1]*a[5] - a[2]*a[4];
+        inv[3] = a[5]*a[6] - a[3]*a[8];
+        inv[4] = a[0]*a[8] - a[2]*a[6];
+        inv[5] = a[2]*a[3] - a[0]*a[5];
+        inv[6] = a[3]*a[7] - a[4]*a[6];
+        inv[7] = a[1]*a[6] - a[0]*a[7];
+        inv[8] = a[0]*a[4] - a[1]*a[3];
+        const double det = a[0]*inv[0] + a[1]*inv[3] + a[2]*inv[6];
+        if(std::fabs(det) < 1e-300)
+        {
+            return false;
+        }
+        for(int i = 0; i < 9; ++i)
+        {
+            inv[i] /= det;
+        }
+        return true;
+    }
+
+    static void normalize(double x, double y, uint32_t w, uint32_t h, double& nx, double& ny)
+    {
+        const double s = 0.5*std::sqrt(static_cast<double>(w)*w + static_cast<double>(h)*h);
+        nx = (x - 0.5*(w - 1.0)) / s;
+        ny = (y - 0.5*(h - 1.0)) / s;
+    }
+
+    static void denormalize(double nx, double ny, uint32_t w, uint32_t h, double& x, double& y)
+    {
+        const double s = 0.5*std::sqrt(static_cast<double>(w)*w + static_cast<double>(h)*h);
+        x = nx*s + 0.5*(w - 1.0);
+        y = ny*s + 0.5*(h - 1.0);
+    }
+};
+
+
+// Solve the n x n system a*x = b in place (b becomes x) by Gaussian
+// elimination with partial pivoting.  False if a is singular.
+inline bool solve_linear_system(std::vector<double>& a, std::vector<double>& b, int n)
+{
+    for(int col = 0; col < n; ++col)
+    {
+        int pivot = col;
+        for(int r = col + 1; r < n; ++r)
+        {
+            if(std::fabs(a[r*n + col]) > std::fabs(a[pivot*n + col]))
+            {
+                pivot = r;
+            }
+        }
+        if(std::fabs(a[pivot*n + col]) < 1e-300)
+        {
+            return false;
+        }
+        if(pivot != col)
+        {
+            for(int c = 0; c < n; ++c)
+            {
+                std::swap(a[pivot*n + c], a[col*n + c]);
+            }
+            std::swap(b[pivot], b[col]);
+        }
+        for(int r = col + 1; r < n; ++r)
+        {
+            const double factor = a[r*n + col] / a[col*n + col];
+            for(int c = col; c < n; ++c)
+            {
+                a[r*n + c] -= factor * a[col*n + c];
+            }
+            b[r] -= factor * b[col];
+        }
+    }
+    for(int r = n - 1; r >= 0; --r)
+    {
+        double sum = b[r];
+        for(int c = r + 1; c < n; ++c)
+        {
+            sum -= a[r*n + c] * b[c];
+        }
+        b[r] = sum / a[r*n + r];
+    }
+    return true;
+}
+
+// Root mean square distance in camera pixels between the detected and
+// the predicted fiducial positions.
+inline double calibration_rms(const std::vector<CalibrationPoint>& points, const DmdCameraModel& model)
+{
+    double sum = 0;
+    for(size_t i = 0; i < points.size(); ++i)
+    {
+        double cx, cy;
+        if( ! model.mirror_to_camera(points[i].mirror_x, points[i].mirror_y, cx, cy))
+        {
+            return HUGE_VAL;
+        }
+        sum += (cx - points[i].camera_x)*(cx - points[i].camera_x) + (cy - points[i].camera_y)*(cy - points[i].camera_y);
+    }
+    return points.empty() ? 0.0 : std::sqrt(sum / points.size());
+}
+
+// Linear homography fit (h[8] = 1) without distortion.  The model's
+// mirror and camera sizes must be set.
+inline void fit_homography(const std::vector<CalibrationPoint>& points, DmdCameraModel& model)
+{
+    if(points.size() < 4)
+    {
+        throw std::runtime_error("A homography needs at least 4 fiducials");
+    }
+    // Normal equations of the 2n x 8 system; two rows per point:
+    //   [x y 1 0 0 0 -u*x -u*y] h = u
+    //   [0 0 0 x y 1 -v*x -v*y] h = v
+    std::vector<double> ata(64, 0.0);
+    std::vector<double> atb(8, 0.0);
+    for(size_t i = 0; i < points.size(); ++i)
+    {
+        double x, y, u, v;
+        DmdCameraModel::normalize(points[i].mirror_x, points[i].mirror_y, model.mirror_w, model.mirror_h, x, y);
+        DmdCameraModel::normalize(points[i].camera_x, points[i].camera_y, model.camera_w, model.camera_h, u, v);
+        const double rows[2][8] = {{x, y, 1, 0, 0, 0, -u*x, -u*y}, {0, 0, 0, x, y, 1, -v*x, -v*y}};
+        const double rhs[2] = {u, v};
+        for(int r = 0; r < 2; ++r)
+        {
+            for(int j = 0; j < 8; ++j)
+            {
+                for(int k = 0; k < 8; ++k)
+                {
+                    ata[j*8 + k] += rows[r][j]*rows[r][k];
+                }
+                atb[j] += rows[r][j]*rhs[r];
+            }
+        }
+    }
+    if( ! solve_linear_system(ata, atb, 8))
+    {
+        throw std::runtime_error("Fiducials do not determine a homography (all on a line?)");
+    }
+    for(int j = 0; j < 8; ++j)
+    {
+        model.h[j] = atb[j];
+    }
+    model.h[8] = 1;
+    model.k1 = 0;
+    model.k2 = 0;
+}
+
+// Refine homography and (optionally) distortion by Levenberg-Marquardt
+// on the camera pixel residuals.  Returns the final RMS error.
+inline double fit_dmd_camera_model(const std::vector<CalibrationPoint>& points, DmdCameraModel& model,
+                                   bool distortion, int iterations = 100)
+{
+    fit_homography(points, model);
+    const int n = distortion ? 10 : 8;
+    if(points.size()*2 < static_cast<size_t>(n))
+    {
+        throw std::runtime_error("Too few fiducials for the distortion model");
+    }
+
+    struct Parameters
+    {
+        static void get(const DmdCameraModel& m, double* p)
+        {
+            for(int j = 0; j < 8; ++j) { p[j] = m.h[j]; }
+            p[8] = m.k1;
+            p[9] = m.k2;
+        }
+        static void set(DmdCameraModel& m, const double* p, int n)
+        {
+            for(int j = 0; j < 8; ++j) { m.h[j] = p[j]; }
+            m.k1 = (n > 8) ? p[8] : 0.0;
+            m.k2 = (n > 9) ? p[9] : 0.0;
+        }
+    };
+    auto residuals = [&](const DmdCameraModel& m, std::vector<double>& r) -> bool
+    {
+        r.resize(points.size()*2);
+        for(size_t i = 0; i < points.size(); ++i)
+        {
+            double cx, cy;
+            if( ! m.mirror_to_camera(points[i].mirror_x, points[i].mirror_y, cx, cy))
+            {
+                return false;
+            }
+            r[2*i] = cx - points[i].camera_x;
+            r[2*i + 1] = cy - points[i].camera_y;
+        }
+        return true;
+    };
+    auto cost_of = [](const std::vector<double>& r)
+    {
+        double c = 0;
+        for(size_t i = 0; i < r.size(); ++i)
+        {
+            c += r[i]*r[i];
+        }
+        return c;
+    };
+
+    double p[10];
+    Parameters::get(model, p);
+    std::vector<double> r;
+    residuals(model, r);
+    double cost = cost_of(r);
+    double lambda = 1e-3;
+    std::vector<double> jacobian(r.size()*n);
+    std::vector<double> r_step;
+    for(int it = 0; it < iterations; ++it)
+    {
+        // Forward difference Jacobian.
+        for(int j = 0; j < n; ++j)
+        {
+            double q[10];
+            std::copy(p, p + 10, q);
+            const double step = 1e-7 * std::max(1.0, std::fabs(p[j]));
+            q[j] += step;
+            DmdCameraModel moved = model;
+            Parameters::set(moved, q, n);
+            if( ! residuals(moved, r_step))
+            {
+                return calibration_rms(points, model);
+            }
+            for(size_t i = 0; i < r.size(); ++i)
+            {
+                jacobian[i*n + j] = (r_step[i] - r[i]) / step;
+            }
+        }
+        std::vector<double> jtj(n*n, 0.0);
+        std::vector<double> jtr(n, 0.0);
+        for(size_t i = 0; i < r.size(); ++i)
+        {
+            const double* row = &jacobian[i*n];
+            for(int j = 0; j < n; ++j)
+            {
+                for(int k = 0; k < n; ++k)
+                {
+                    jtj[j*n + k] += row[j]*row[k];
+                }
+                jtr[j] -= row[j]*r[i];
+            }
+        }
+
+        bool improved = false;
+        while(lambda < 1e12)
+        {
+            std::vector<double> a = jtj;
+            std::vector<double> delta = jtr;
+            for(int j = 0; j < n; ++j)
+            {
+                a[j*n + j] += lambda * std::max(jtj[j*n + j], 1e-12);
+            }
+            if(solve_linear_system(a, delta, n))
+            {
+                double q[10];
+                std::copy(p, p + 10, q);
+                for(int j = 0; j < n; ++j)
+                {
+                    q[j] += delta[j];
+                }
+                DmdCameraModel trial = model;
+                Parameters::set(trial, q, n);
+                if(residuals(trial, r_step) && cost_of(r_step) < cost)
+                {
+                    const double previous = cost;
+                    cost = cost_of(r_step);
+                    r.swap(r_step);
+                    std::copy(q, q + 10, p);
+                    model = trial;
+                    lambda = std::max(lambda / 10, 1e-12);
+                    improved = previous - cost > 1e-12 * previous;
+                    break;
+                }
+            }
+            lambda *= 10;
+        }
+        if( ! improved)
+        {
+            break;
+        }
+    }
+    return calibration_rms(points, model);
+}
+
+
+// A fiducial dot found in the camera frames.
+struct FiducialDetection
+{
+    uint32_t dot;      // number of the dot in the FiducialLayout
+    double x;          // intensity weighted centre, camera pixels
+    double y;
+    uint32_t pixels;
+};
+
+// Find the fiducial dots in the frames of a fiducial set (one grey value
+// per camera pixel, frame f showing fiducial frame f).  Dots are the
+// connected areas lit in frame 1 (brighter than half the brightest dot
+// above the background of frame 0); each is numbered by the bit frames
+// it is lit in.  Areas smaller than `min_pixels`, numbers out of range
+// and numbers found twice are dropped.
+inline std::vector<FiducialDetection> detect_fiducials(const FiducialLayout& layout,
+                                                       const std::vector<std::vector<float> >& frames,
+                                                       int width, int height, uint32_t min_pixels = 4)
+{
+    if(frames.size() < layout.frame_count())
+    {
+        throw std::runtime_error("Fiducial detection needs every frame of the fiducial set");
+    }
+    const size_t count = static_cast<size_t>(width)*height;
+    std::vector<float> lit(count);
+    for(size_t i = 0; i < count; ++i)
+    {
+        lit[i] = frames[1][i] - frames[0][i];
+    }
+    // Brightest dot, ignoring single hot pixels: a pixel counts only as
+    // bright as the darker of its right and lower neighbours.
+    float peak = 0;
+    for(int y = 0; y + 1 < height; ++y)
+    {
+        for(int x = 0; x + 1 < width; ++x)
+        {
+            size_t i = static_cast<size_t>(y)*width + x;
+            peak = std::max(peak, std::min(lit[i], std::min(lit[i + 1], lit[i + width])));
+        }
+    }
+    if(peak <= 0)
+    {
+        return std::vector<FiducialDetection>();
+    }
+    const float threshold = 0.5f*peak;
+
+    std::vector<unsigned char> seen(count, 0);
+    std::vector<size_t> stack;
+    std::vector<size_t> area;
+    std::vector<FiducialDetection> found;
+    for(size_t start = 0; start < count; ++start)
+    {
+        if(seen[start] || lit[start] <= threshold)
+        {
+            continue;
+        }
+        // Flood fill one dot (4-connected).
+        area.clear();
+        stack.assign(1, start);
+        seen[start] = 1;
+        while( ! stack.empty())
+        {
+            size_t i = stack.back();
+            stack.pop_back();
+            area.push_back(i);
+            const int x = static_cast<int>(i % width);
+            const int y = static_cast<int>(i / width);
+            const size_t next[4] = {i - 1, i + 1, i - width, i + width};
+            const bool inside[4] = {x > 0, x + 1 < width, y > 0, y + 1 < height};
+            for(int k = 0; k < 4; ++k)
+            {
+                if(inside[k] && ! seen[next[k]] && lit[next[k]] > threshold)
+                {
+                    seen[next[k]] = 1;
+                    stack.push_back(next[k]);
+                }
+            }
+        }
+        if(area.size() < min_pixels)
+        {
+            continue;
+        }
+
+        double weight = 0, sx = 0, sy = 0;
+        for(size_t a = 0; a < area.size(); ++a)
+        {
+            const double w = lit[area[a]];
+            weight += w;
+            sx += w * static_cast<double>(area[a] % width);
+            sy += w * static_cast<double>(area[a] / width);
+        }
+        uint32_t dot = 0;
+        for(uint32_t b = 0; b < layout.bit_frames(); ++b)
+        {
+            const std::vector<float>& frame = frames[2 + b];
+            double on = 0;
+            for(size_t a = 0; a < area.size(); ++a)
+            {
+                on += frame[area[a]] - frames[0][area[a]];
+            }
+            if(on > 0.5*weight)
+            {
+                dot |= 1u << b;
+            }
+        }
+        FiducialDetection d;
+        d.dot = dot;
+        d.x = sx / weight;
+        d.y = sy / weight;
+        d.pixels = static_cast<uint32_t>(area.size());
+        found.push_back(d);
+    }
+
+    // Drop numbers that are out of range or were found more than once.
+    std::vector<uint32_t> times(layout.dot_count(), 0);
+    for(size_t i = 0; i < found.size(); ++i)
+    {
+        if(found[i].dot < times.size())
+        {
+            ++times[found[i].dot];
+        }
+    }
+    std::vector<FiducialDetection> unique;
+    for(size_t i = 0; i < found.size(); ++i)
+    {
+        if(found[i].dot < times.size() && times[found[i].dot] == 1)
+        {
+            unique.push_back(found[i]);
+        }
+    }
+    return unique;
+}
+
+
+// Remap tables from a fitted model.  Mirror pixel (x, y) is the centre
+// of that mirror, camera pixel (x, y) the centre of that camera pixel.
+inline ForwardRemap build_forward_remap(const DmdCameraModel& model)
+{
+    ForwardRemap remap;
+    remap.mirror_w = model.mirror_w;
+    remap.mirror_h = model.mirror_h;
+    remap.camera_w = model.camera_w;
+    remap.camera_h = model.camera_h;
+    remap.camera_xy.resize(2*static_cast<size_t>(model.mirror_w)*model.mirror_h);
+    for(uint32_t y = 0; y < model.mirror_h; ++y)
+    {
+        for(uint32_t x = 0; x < model.mirror_w; ++x)
+        {
+            double cx, cy;
+            if( ! model.mirror_to_camera(x, y, cx, cy)
+               || cx < -0.5 || cy < -0.5 || cx >= model.camera_w - 0.5 || cy >= model.camera_h - 0.5)
+            {
+                cx = -1;
+                cy = -1;
+            }
+            const size_t i = static_cast<size_t>(y)*model.mirror_w + x;
+            remap.camera_xy[2*i] = static_cast<float>(cx);
+            remap.camera_xy[2*i + 1] = static_cast<float>(cy);
+        }
+    }
+    return remap;
+}
+
+inline InverseRemap build_inverse_remap(const DmdCameraModel& model)
+{
+    InverseRemap remap;
+    remap.camera_w = model.camera_w;
+    remap.camera_h = model.camera_h;
+    remap.mirror_w = model.mirror_w;
+    remap.mirror_h = model.mirror_h;
+    remap.mirror_pixel.resize(static_cast<size_t>(model.camera_w)*model.camera_h);
+    for(uint32_t y = 0; y < model.camera_h; ++y)
+    {
+        for(uint32_t x = 0; x < model.camera_w; ++x)
+        {
+            double mx, my;
+            int32_t pixel = -1;
+            if(model.camera_to_mirror(x, y, mx, my))
+            {
+                const long ix = std::lround(mx);
+                const long iy = std::lround(my);
+                if(ix >= 0 && iy >= 0 && ix < static_cast<long>(model.mirror_w) && iy < static_cast<long>(model.mirror_h))
+                {
+                    pixel = static_cast<int32_t>(iy*model.mirror_w + ix);
+                }
+            }
+            remap.mirror_pixel[static_cast<size_t>(y)*model.camera_w + x] = pixel;
+        }
+    }
+    return remap;
+}
+
+#endif // DMD_CALIBRATION_H
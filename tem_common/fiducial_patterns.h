@@ -0,0 +1,108 @@
+#ifndef FIDUCIAL_PATTERNS_H
+#define FIDUCIAL_PATTERNS_H
+
+#include <cstring>
+#include <algorithm>
+#include <stdexcept>
+#include <stdint.h>
+
+// Fiducial patterns for calibrating where the mirror lands on the camera.
+//
+// A grid of grid_w x grid_h square dots, `dot` mirror pixels wide, is
+// spread over the mirror with `margin` mirror pixels left free at each
+// edge.  Dot k (row by row) is centred on dot_centre(k).  The set is
+//
+//   frame 0       all mirrors off (background)
+//   frame 1       all dots on
+//   frame 2 + b   the dots whose number has bit b set
+//
+// so every dot found in frame 1 is identified by which of the bit
+// frames it is lit in, whatever the rotation, flip or distortion between
+// mirror and camera.
+struct FiducialLayout
+{
+    FiducialLayout() : grid_w(8), grid_h(6), dot(12), margin(-1) { }
+
+    uint32_t grid_w;
+    uint32_t grid_h;
+    uint32_t dot;
+    int margin;      // < 0: a tenth of the smaller mirror side
+
+    uint32_t dot_count() const { return grid_w*grid_h; }
+
+    uint32_t bit_frames() const
+    {
+        uint32_t bits = 0;
+        while((static_cast<uint64_t>(1) << bits) < dot_count())
+        {
+            ++bits;
+        }
+        return bits;
+    }
+
+    uint32_t frame_count() const { return 2 + bit_frames(); }
+
+    // Top left mirror pixel of dot k (the dot may reach past the edge).
+    void dot_origin(uint32_t k, int width, int height, int& x, int& y) const
+    {
+        const int m = (margin >= 0) ? margin : std::min(width, height) / 10;
+        const uint32_t gx = k % grid_w;
+        const uint32_t gy = k / grid_w;
+        const double cx = (grid_w > 1) ? m + gx * static_cast<double>(width - 1 - 2*m) / (grid_w - 1) : 0.5*(width - 1);
+        const double cy = (grid_h > 1) ? m + gy * static_cast<double>(height - 1 - 2*m) / (grid_h - 1) : 0.5*(height - 1);
+        x = static_cast<int>(cx + 0.5) - static_cast<int>(dot/2);
+        y = static_cast<int>(cy + 0.5) - static_cast<int>(dot/2);
+    }
+
+    // Mirror position of the centre of dot k, as drawn.
+    void dot_centre(uint32_t k, int width, int height, double& x, double& y) const
+    {
+        int x0, y0;
+        dot_origin(k, width, height, x0, y0);
+        x = x0 + 0.5*(dot - 1);
+        y = y0 + 0.5*(dot - 1);
+    }
+
+    // Is dot k lit in `frame`?
+    bool lit(uint32_t k, uint32_t frame) const
+    {
+        return frame == 1 || (frame >= 2 && ((k >> (frame - 2)) & 1) != 0);
+    }
+
+    void render(uint32_t frame, unsigned char* mirror, int width, int height,
+                unsigned char off_value, unsigned char on_value) const
+    {
+        if(grid_w == 0 || grid_h == 0 || dot == 0)
+        {
+            throw std::invalid_argument("Fiducial grid and dot size must be positive");
+        }
+        if(frame >= frame_count())
+        {
+            throw std::out_of_range("Fiducial frame beyond the fiducial set");
+        }
+        memset(mirror, off_value, static_cast<size_t>(width)*height);
+        for(uint32_t k = 0; k < dot_count(); ++k)
+        {
+            if( ! lit(k, frame))
+            {
+                continue;
+            }
+            int ox, oy;
+            dot_origin(k, width, height, ox, oy);
+            const int x0 = std::max(ox, 0);
+            const int y0 = std::max(oy, 0);
+            const int x1 = std::min(ox + static_cast<int>(dot), width);
+            const int y1 = std::min(oy + static_cast<int>(dot), height);
+            if(x0 >= x1)
+            {
+                continue;
+            }
+            for(int y = y0; y < y1; ++y)
+            {
+                memset(mirror + static_cast<size_t>(y)*width + x0, on_value, x1 - x0);
+            }
+        }
+    }
+};
+
+#endif // FIDUCIAL_PATTERNS_H
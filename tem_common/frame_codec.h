@@ -0,0 +1,485 @@
+#ifndef FRAME_CODEC_H
+#define FRAME_CODEC_H
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <stdexcept>
+#include <stdint.h>
+#include "parallel_for.h"
+
+// Fast lossless codec for 8-bit camera frames (.tlc files).
+//
+// The frame is cut into strips of TLC_TILE_ROWS rows that are coded
+// independently, so strips are encoded and decoded on all cores.  Each
+// strip picks the best of three row predictors (left, up, median of
+// left/up/left+up-upleft as in LOCO-I) and codes the residuals with
+// adaptive Rice codes in blocks of TLC_BLOCK samples.  Blocks that are
+// all zero cost four bits, which is most of a dark detector background.
+//
+// File layout (little endian):
+//   TlcHeader
+//   tile_count x TlcTile
+//   tile payloads
+
+static const int TLC_TILE_ROWS = 32;
+static const int TLC_BLOCK = 16;
+// Limits on what a file may claim, checked before anything is allocated.
+static const uint32_t TLC_MAX_SIDE = 1u << 15;
+static const uint32_t TLC_MAX_CHANNELS = 4;
+
+enum TlcPredictor
+{
+    TLC_PREDICT_LEFT = 0,
+    TLC_PREDICT_UP = 1,
+    TLC_PREDICT_MEDIAN = 2
+};
+
+struct TlcHeader
+{
+    char magic[4];       // "TLC1"
+    uint32_t width;
+    uint32_t height;
+    uint32_t channels;   // interleaved samples per pixel (3 for BGR, 1 for mono)
+    uint32_t tile_rows;
+    uint32_t tile_count;
+};
+
+struct TlcTile
+{
+    uint32_t offset;     // from the start of the payload area
+    uint32_t size;
+    uint32_t predictor;  // TlcPredictor
+};
+
+
+class TlcBitWriter
+{
+public:
+    explicit TlcBitWriter(std::vector<unsigned char>& output) : out(output), acc(0), nbits(0) { }
+
+    // n <= 32
+    void put(uint32_t value, int n)
+    {
+        acc = (acc << n) | value;
+        nbits += n;
+        while(nbits >= 8)
+        {
+            nbits -= 8;
+            out.push_back(static_cast<unsigned char>(acc >> nbits));
+        }
+    }
+
+    void finish()
+    {
+        if(nbits > 0)
+        {
+            out.push_back(static_cast<unsigned char>(acc << (8 - nbits)));
+            nbits = 0;
+        }
+    }
+
+private:
+    std::vector<unsigned char>& out;
+    uint64_t acc;
+    int nbits;
+};
+
+
+class TlcBitReader
+{
+public:
+    TlcBitReader(const unsigned char* data, size_t size) : p(data), end(data + size), acc(0), nbits(0) { refill(); }
+
+    // n <= 32
+    uint32_t get(int n)
+    {
+        if(n == 0)
+        {
+            return 0;
+        }
+        uint32_t v = static_cast<uint32_t>(acc >> (64 - n));
+        acc <<= n;
+        nbits -= n;
+        refill();
+        return v;
+    }
+
+    // Number of leading one bits, at most limit; the terminating zero
+    // is consumed when it is found.
+    int unary(int limit)
+    {
+        int ones = __builtin_clzll(~acc | 1); // | 1 keeps it defined for all-ones
+        if(ones >= limit)
+        {
+            acc <<= limit;
+            nbits -= limit;
+            refill();
+            return limit;
+        }
+        acc <<= ones + 1;
+        nbits -= ones + 1;
+        refill();
+        return ones;
+    }
+
+private:
+    const unsigned char* p;
+    const unsigned char* end;
+    uint64_t acc;  // next bits, most significant first
+    int nbits;
+
+    void refill()
+    {
+        while(nbits <= 56)
+        {
+            uint64_t byte = (p < end) ? *p++ : 0;
+            acc |= byte << (56 - nbits);
+            nbits += 8;
+        }
+    }
+};
+
+
+inline int tlc_median(int a, int b, int c)
+{
+    // LOCO-I median edge detector
+    int mx = (a > b) ? a : b;
+    int mn = (a > b) ? b : a;
+    if(c >= mx) return mn;
+    if(c <= mn) return mx;
+    return a + b - c;
+}
+
+// Prediction for sample x of `row`, `channels` apart.  The first row of a
+// strip can only look left and the first pixel of a row can only look up,
+// so strips never depend on each other.
+inline int tlc_predict(int predictor, const unsigned char* row, const unsigned char* above, int x, int channels)
+{
+    if(above == NULL)
+    {
+        return (x >= channels) ? row[x - channels] : 0;
+    }
+    if(x < channels)
+    {
+        return above[x];
+    }
+    int a = row[x - channels];
+    int b = above[x];
+    switch(predictor)
+    {
+    case TLC_PREDICT_LEFT: return a;
+    case TLC_PREDICT_UP:   return b;
+    default:               return tlc_median(a, b, above[x - channels]);
+    }
+}
+
+// Residuals are taken mod 256 and folded so small magnitudes get
+// small codes: 0, -1, 1, -2, 2, ... -> 0, 1, 2, 3, 4, ...
+inline unsigned tlc_fold(int residual)
+{
+    int r = static_cast<signed char>(static_cast<unsigned char>(residual));
+    return (r >= 0) ? 2*r : -2*r - 1;
+}
+
+inline int tlc_unfold(unsigned v)
+{
+    return (v & 1) ? -static_cast<int>((v + 1) >> 1) : static_cast<int>(v >> 1);
+}
+
+
+// Pick the predictor with the smallest residuals on a sample of rows.
+inline int tlc_choose_predictor(const unsigned char* pixels, int pitch, int row_bytes, int y0, int y1, int channels)
+{
+    long cost[3] = { 0, 0, 0 };
+    for(int y = y0 + 1; y < y1; y += 4)
+    {
+        const unsigned char* row = pixels + static_cast<size_t>(y)*pitch;
+        const unsigned char* above = row - pitch;
+        for(int x = channels; x < row_bytes; ++x)
+        {
+            int a = row[x - channels];
+            int b = above[x];
+            int v = row[x];
+            cost[0] += abs(v - a);
+            cost[1] += abs(v - b);
+            cost[2] += abs(v - tlc_median(a, b, above[x - channels]));
+        }
+    }
+    int best = TLC_PREDICT_MEDIAN;
+    if(cost[TLC_PREDICT_LEFT] < cost[best]) best = TLC_PREDICT_LEFT;
+    if(cost[TLC_PREDICT_UP] < cost[best]) best = TLC_PREDICT_UP;
+    return best;
+}
+
+// Rice-code one block of folded residuals.
+inline void tlc_put_block(TlcBitWriter& bits, const unsigned* v, int n)
+{
+    unsigned sum = 0;
+    for(int i = 0; i < n; ++i)
+    {
+        sum += v[i];
+    }
+    if(sum == 0)
+    {
+        bits.put(15, 4); // all zero
+        return;
+    }
+
+    int k = 0;
+    while(k < 8 && (static_cast<unsigned>(n) << (k + 1)) <= sum)
+    {
+        ++k;
+    }
+    bits.put(k, 4);
+    for(int i = 0; i < n; ++i)
+    {
+        unsigned q = v[i] >> k;
+        if(q < 24)
+        {
+            bits.put((1u << (q + 1)) - 2, q + 1); // q ones and a zero
+            bits.put(v[i] & ((1u << k) - 1), k);
+        }
+        else
+        {
+            bits.put((1u << 24) - 1, 24);          // escape, then the raw value
+            bits.put(v[i], 8);
+        }
+    }
+}
+
+inline void tlc_get_block(TlcBitReader& bits, unsigned* v, int n)
+{
+    int k = bits.get(4);
+    if(k == 15)
+    {
+        for(int i = 0; i < n; ++i)
+        {
+            v[i] = 0;
+        }
+        return;
+    }
+    for(int i = 0; i < n; ++i)
+    {
+        unsigned q = bits.unary(24);
+        if(q == 24)
+        {
+            v[i] = bits.get(8);
+        }
+        else
+        {
+            v[i] = (q << k) | bits.get(k);
+        }
+    }
+}
+
+inline void tlc_encode_tile(const unsigned char* pixels, int pitch, int row_bytes, int y0, int y1, int channels,
+                            int predictor, std::vector<unsigned char>& out)
+{
+    TlcBitWriter bits(out);
+    unsigned block[TLC_BLOCK];
+    int n = 0;
+    for(int y = y0; y < y1; ++y)
+    {
+        const unsigned char* row = pixels + static_cast<size_t>(y)*pitch;
+        const unsigned char* above = (y > y0) ? row - pitch : NULL;
+        for(int x = 0; x < row_bytes; ++x)
+        {
+            block[n++] = tlc_fold(row[x] - tlc_predict(predictor, row, above, x, channels));
+            if(n == TLC_BLOCK)
+            {
+                tlc_put_block(bits, block, n);
+                n = 0;
+            }
+        }
+    }
+    if(n > 0)
+    {
+        tlc_put_block(bits, block, n);
+    }
+    bits.finish();
+}
+
+inline void tlc_decode_tile(const unsigned char* data, size_t size, unsigned char* pixels, int pitch, int row_bytes,
+                            int y0, int y1, int channels, int predictor)
+{
+    TlcBitReader bits(data, size);
+    unsigned block[TLC_BLOCK];
+    int n = TLC_BLOCK;
+    for(int y = y0; y < y1; ++y)
+    {
+        unsigned char* row = pixels + static_cast<size_t>(y)*pitch;
+        const unsigned char* above = (y > y0) ? row - pitch : NULL;
+        for(int x = 0; x < row_bytes; ++x)
+        {
+            if(n == TLC_BLOCK)
+            {
+                int64_t remaining = static_cast<int64_t>(y1 - y)*row_bytes - x;
+                tlc_get_block(bits, block, (remaining < TLC_BLOCK) ? static_cast<int>(remaining) : TLC_BLOCK);
+                n = 0;
+            }
+            row[x] = static_cast<unsigned char>(tlc_predict(predictor, row, above, x, channels) + tlc_unfold(block[n++]));
+        }
+    }
+}
+
+
+// Encode a frame.  pitch is the distance between rows in bytes.
+inline void tlc_encode(const unsigned char* pixels, int width, int height, int channels, int pitch,
+                       std::vector<unsigned char>& out, int threads = 0)
+{
+    const int row_bytes = width*channels;
+    const int tile_count = (height + TLC_TILE_ROWS - 1) / TLC_TILE_ROWS;
+
+    std::vector<std::vector<unsigned char> > payloads(tile_count);
+    std::vector<TlcTile> tiles(tile_count);
+    parallel_for(tile_count, threads, [&](int t)
+    {
+        int y0 = t*TLC_TILE_ROWS;
+        int y1 = (y0 + TLC_TILE_ROWS < height) ? y0 + TLC_TILE_ROWS : height;
+        int predictor = tlc_choose_predictor(pixels, pitch, row_bytes, y0, y1, channels);
+        payloads[t].reserve(static_cast<size_t>(y1 - y0)*row_bytes / 2);
+        tlc_encode_tile(pixels, pitch, row_bytes, y0, y1, channels, predictor, payloads[t]);
+        tiles[t].predictor = predictor;
+    });
+
+    TlcHeader header;
+    memcpy(header.magic, "TLC1", 4);
+    header.width = width;
+    header.height = height;
+    header.channels = channels;
+    header.tile_rows = TLC_TILE_ROWS;
+    header.tile_count = tile_count;
+
+    size_t payload_bytes = 0;
+    for(int t = 0; t < tile_count; ++t)
+    {
+        tiles[t].offset = static_cast<uint32_t>(payload_bytes);
+        tiles[t].size = static_cast<uint32_t>(payloads[t].size());
+        payload_bytes += payloads[t].size();
+    }
+
+    out.resize(sizeof(header) + tile_count*sizeof(TlcTile) + payload_bytes);
+    unsigned char* p = &out[0];
+    memcpy(p, &header, sizeof(header));
+    p += sizeof(header);
+    if(tile_count > 0)
+    {
+        memcpy(p, &tiles[0], tile_count*sizeof(TlcTile));
+    }
+    p += tile_count*sizeof(TlcTile);
+    for(int t = 0; t < tile_count; ++t)
+    {
+        if( ! payloads[t].empty())
+        {
+            memcpy(p, &payloads[t][0], payloads[t].size());
+            p += payloads[t].size();
+        }
+    }
+}
+
+// Decode a frame into tightly packed rows (width*channels bytes each).
+inline void tlc_decode(const unsigned char* data, size_t size, std::vector<unsigned char>& pixels,
+                       int& width, int& height, int& channels, int threads = 0)
+{
+    TlcHeader header;
+    if(size < sizeof(header))
+    {
+        throw std::runtime_error("Not a TLC frame");
+    }
+    memcpy(&header, data, sizeof(header));
+    // Mono, BGR or BGRA samples of at most TLC_MAX_SIDE pixels a side, so
+    // that the sizes below fit in an int and the frame in a size_t.
+    if(memcmp(header.magic, "TLC1", 4) != 0
+       || header.width > TLC_MAX_SIDE || header.height > TLC_MAX_SIDE
+       || header.channels == 0 || header.channels == 2 || header.channels > TLC_MAX_CHANNELS
+       || header.tile_rows == 0 || header.tile_rows > TLC_MAX_SIDE
+       || header.tile_count != (header.height + header.tile_rows - 1) / header.tile_rows)
+    {
+        throw std::runtime_error("Not a TLC frame");
+    }
+    const size_t table_end = sizeof(header) + static_cast<size_t>(header.tile_count)*sizeof(TlcTile);
+    if(table_end > size)
+    {
+        throw std::runtime_error("Truncated TLC frame");
+    }
+    const size_t frame_bytes = static_cast<size_t>(header.width)*header.channels*header.height;
+    if(header.height > 0 && frame_bytes / header.height != static_cast<size_t>(header.width)*header.channels)
+    {
+        throw std::runtime_error("TLC frame too large");
+    }
+
+    std::vector<TlcTile> tiles(header.tile_count);
+    if( ! tiles.empty())
+    {
+        memcpy(&tiles[0], data + sizeof(header), tiles.size()*sizeof(TlcTile));
+    }
+    const unsigned char* payload = data + table_end;
+    const size_t payload_size = size - table_end;
+    for(size_t t = 0; t < tiles.size(); ++t)
+    {
+        if(tiles[t].offset > payload_size || tiles[t].size > payload_size - tiles[t].offset)
+        {
+            throw std::runtime_error("Truncated TLC frame");
+        }
+    }
+
+    width = header.width;
+    height = header.height;
+    channels = header.channels;
+    const int row_bytes = width*channels;
+    pixels.resize(frame_bytes);
+
+    const int tile_rows = header.tile_rows;
+    unsigned char* out = pixels.empty() ? NULL : &pixels[0];
+    parallel_for(static_cast<int>(tiles.size()), threads, [&](int t)
+    {
+        int y0 = t*tile_rows;
+        int y1 = (y0 + tile_rows < height) ? y0 + tile_rows : height;
+        tlc_decode_tile(payload + tiles[t].offset, tiles[t].size, out, row_bytes, row_bytes, y0, y1, channels, tiles[t].predictor);
+    });
+}
+
+inline void tlc_write_file(const std::string& file_name, const unsigned char* pixels, int width, int height,
+                           int channels, int pitch, int threads = 0)
+{
+    std::vector<unsigned char> encoded;
+    tlc_encode(pixels, width, height, channels, pitch, encoded, threads);
+    FILE* f = fopen(file_name.c_str(), "wb");
+    if(f == NULL)
+    {
+        throw std::runtime_error("Could not write " + file_name);
+    }
+    bool ok = fwrite(&encoded[0], 1, encoded.size(), f) == encoded.size();
+    if(fclose(f) != 0 || ! ok)
+    {
+        throw std::runtime_error("Could not write " + file_name);
+    }
+}
+
+inline void tlc_read_file(const std::string& file_name, std::vector<unsigned char>& pixels,
+                          int& width, int& height, int& channels, int threads = 0)
+{
+    FILE* f = fopen(file_name.c_str(), "rb");
+    if(f == NULL)
+    {
+        throw std::runtime_error("Could not open " + file_name);
+    }
+    std::vector<unsigned char> encoded;
+    unsigned char buffer[65536];
+    size_t n;
+    while((n = fread(buffer, 1, sizeof(buffer), f)) > 0)
+    {
+        encoded.insert(encoded.end(), buffer, buffer + n);
+    }
+    fclose(f);
+    if(encoded.empty())
+    {
+        throw std::runtime_error("Empty file " + file_name);
+    }
+    tlc_decode(&encoded[0], encoded.size(), pixels, width, height, channels, threads);
+}
+
+#endif // FRAME_CODEC_H
@@ -0,0 +1,299 @@
+#ifndef FRAME_POOL_H
+#define FRAME_POOL_H
+
+#include <cstddef>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <stdexcept>
+#include <stdint.h>
+#include "uEye.h"
+#include "ueye_camera.h"
+#include "frame_stack.h"
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+// Frame buffers for a camera, made once and then reused for every
+// capture.
+//
+// Each buffer is allocated straight from the system, page aligned, and
+// registered with the camera once with is_SetAllocatedImageMem (again
+// only if the camera has to be re-initialized).  acquire() hands a free
+// buffer out as a FrameBuffer, which gives it back when it is destroyed,
+// so a capture loop takes and returns buffers without a heap
+// allocation.  The pool must outlive its FrameBuffers.
+//
+// With huge pages the buffers are backed by large pages where the
+// system gives them (on Windows the account needs the "Lock pages in
+// memory" right); otherwise ordinary pages are used.  huge_pages() says
+// which.  Rows are padded to 4 bytes as in a frame stack.
+
+inline size_t system_page_size()
+{
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwPageSize;
+#else
+    return static_cast<size_t>(sysconf(_SC_PAGESIZE));
+#endif
+}
+
+// Page-aligned memory of at least `bytes`, from huge pages if asked and
+// available (`huge` says whether it is).  Throws std::bad_alloc.
+inline char* allocate_pages(size_t& bytes, bool want_huge, bool& huge)
+{
+    huge = false;
+#ifdef _WIN32
+    if(want_huge)
+    {
+        SIZE_T large = GetLargePageMinimum();
+        if(large > 0)
+        {
+            SIZE_T rounded = (bytes + large - 1) / large * large;
+            void* p = VirtualAlloc(NULL, rounded, MEM_COMMIT | MEM_RESERVE | MEM_LARGE_PAGES, PAGE_READWRITE);
+            if(p != NULL)
+            {
+                bytes = rounded;
+                huge = true;
+                return static_cast<char*>(p);
+            }
+        }
+    }
+    void* p = VirtualAlloc(NULL, bytes, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+    if(p == NULL)
+    {
+        throw std::bad_alloc();
+    }
+    return static_cast<char*>(p);
+#else
+    const size_t page = system_page_size();
+    bytes = (bytes + page - 1) / page * page;
+#ifdef MAP_HUGETLB
+    if(want_huge)
+    {
+        const size_t large = 2u << 20;
+        size_t rounded = (bytes + large - 1) / large * large;
+        void* p = mmap(NULL, rounded, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if(p != MAP_FAILED)
+        {
+            bytes = rounded;
+            huge = true;
+            return static_cast<char*>(p);
+        }
+    }
+#endif
+    void* p = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(p == MAP_FAILED)
+    {
+        throw std::bad_alloc();
+    }
+    return static_cast<char*>(p);
+#endif
+}
+
+inline void free_pages(char* p, size_t bytes)
+{
+#ifdef _WIN32
+    (void)bytes;
+    VirtualFree(p, 0, MEM_RELEASE);
+#else
+    munmap(p, bytes);
+#endif
+}
+
+class FramePool;
+
+// A buffer taken from a FramePool, given back when destroyed.  Move only.
+class FrameBuffer
+{
+public:
+    FrameBuffer() : pool(NULL), index(0) { }
+    ~FrameBuffer() { release(); }
+
+    FrameBuffer(FrameBuffer&& other) : pool(other.pool), index(other.index)
+    {
+        other.pool = NULL;
+    }
+
+    FrameBuffer& operator=(FrameBuffer&& other)
+    {
+        if(this != &other)
+        {
+            release();
+            pool = other.pool;
+            index = other.index;
+            other.pool = NULL;
+        }
+        return *this;
+    }
+
+    bool empty() const { return pool == NULL; }
+    inline char* data() const;
+    inline INT memory_id() const;
+    inline void release();
+
+private:
+    friend class FramePool;
+
+    FrameBuffer(FramePool* pool, size_t index) : pool(pool), index(index) { }
+    FrameBuffer(const FrameBuffer&);
+    FrameBuffer& operator=(const FrameBuffer&);
+
+    FramePool* pool;
+    size_t index;
+};
+
+class FramePool
+{
+public:
+    // `count` buffers for frames of the camera's size at its allocated
+    // bit depth.
+    FramePool(UEyeCamera& camera, int count, bool want_huge_pages)
+        : camera(camera), pitch(FrameStackWriter::line_pitch_for(camera.width(), camera.bit_depth())),
+          frame_bytes(static_cast<size_t>(pitch)*camera.height()), huge(want_huge_pages), registered_at(0)
+    {
+        if(count < 1 || camera.bit_depth() == 0)
+        {
+            throw std::invalid_argument("A frame pool needs at least one buffer and the camera's bit depth");
+        }
+        try
+        {
+            for(int i = 0; i < count; ++i)
+            {
+                Buffer b;
+                b.bytes = frame_bytes;
+                bool got_huge = false;
+                b.memory = allocate_pages(b.bytes, want_huge_pages, got_huge);
+                huge = huge && got_huge;
+                b.id = 0;
+                buffers.push_back(b);
+            }
+            free_list.reserve(buffers.size());
+            for(size_t i = buffers.size(); i > 0; --i)
+            {
+                free_list.push_back(i - 1);
+            }
+            register_buffers();
+        }
+        catch(...)
+        {
+            release_buffers();
+            throw;
+        }
+    }
+
+    ~FramePool()
+    {
+        release_buffers();
+    }
+
+    size_t size() const { return buffers.size(); }
+    uint32_t line_pitch() const { return pitch; }
+    bool huge_pages() const { return huge; }
+
+    // A free buffer, waiting for one to be given back if none is.
+    FrameBuffer acquire()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        returned.wait(lock, [this]() { return ! free_list.empty(); });
+        size_t i = free_list.back();
+        free_list.pop_back();
+        return FrameBuffer(this, i);
+    }
+
+    // Take a picture into `frame`.  Returns the camera's timestamp in
+    // microseconds.  If the camera is re-initialized on the way, the
+    // buffers are registered again and the picture taken again.
+    uint64_t capture(const FrameBuffer& frame)
+    {
+        for(;;)
+        {
+            if(registered_at != camera.reconnect_count())
+            {
+                register_buffers();
+            }
+            const unsigned before = camera.reconnect_count();
+            uint64_t timestamp_us = camera.capture_registered(frame.data(), frame.memory_id());
+            if(camera.reconnect_count() == before)
+            {
+                return timestamp_us;
+            }
+        }
+    }
+
+private:
+    friend class FrameBuffer;
+
+    struct Buffer
+    {
+        char* memory;
+        size_t bytes;
+        INT id;
+    };
+
+    UEyeCamera& camera;
+    uint32_t pitch;
+    size_t frame_bytes;
+    bool huge;
+    unsigned registered_at;        // camera.reconnect_count() when registered
+    std::vector<Buffer> buffers;
+    std::mutex mutex;
+    std::condition_variable returned;
+    std::vector<size_t> free_list; // reserved for every buffer up front
+
+    FramePool(const FramePool&);
+    FramePool& operator=(const FramePool&);
+
+    void register_buffers()
+    {
+        registered_at = camera.reconnect_count();
+        for(size_t i = 0; i < buffers.size(); ++i)
+        {
+            Buffer& b = buffers[i];
+            camera.call("is_SetAllocatedImageMem", [&]() { return is_SetAllocatedImageMem(camera.handle(), camera.width(), camera.height(), camera.bit_depth(), b.memory, &b.id); });
+        }
+    }
+
+    void release_buffers()
+    {
+        for(size_t i = 0; i < buffers.size(); ++i)
+        {
+            // Only ends the registration; the memory is ours to free.
+            if(buffers[i].id != 0)
+            {
+                is_FreeImageMem(camera.handle(), buffers[i].memory, buffers[i].id);
+            }
+            free_pages(buffers[i].memory, buffers[i].bytes);
+        }
+        buffers.clear();
+    }
+
+    void give_back(size_t i)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            free_list.push_back(i);
+        }
+        returned.notify_one();
+    }
+};
+
+inline char* FrameBuffer::data() const { return pool->buffers[index].memory; }
+inline INT FrameBuffer::memory_id() const { return pool->buffers[index].id; }
+
+inline void FrameBuffer::release()
+{
+    if(pool != NULL)
+    {
+        pool->give_back(index);
+        pool = NULL;
+    }
+}
+
+#endif // FRAME_POOL_H
@@ -0,0 +1,275 @@
+#ifndef FRAME_QUEUE_H
+#define FRAME_QUEUE_H
+
+#include <cstddef>
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <stdexcept>
+#include <stdint.h>
+#include "frame_stack.h"
+
+#ifdef _WIN32
+#include <Windows.h>          // WaitOnAddress: Windows 8 and up, link synchronization
+#elif defined(__linux__)
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <ctime>
+#include <linux/futex.h>
+#endif
+
+// Frames handed from one pipeline stage to the next (capture thread to
+// processing, processing to writer) through a single-producer,
+// single-consumer ring: one thread only ever pushes, one other thread
+// only ever pops, and neither takes a lock.
+//
+// The producer owns `tail` and the consumer `head`; each is on a cache
+// line of its own, next to that side's cached copy of the other index,
+// so a push or pop only reads the other side's line when its cached
+// copy says the ring is full or empty.  Indices count up and wrap; the
+// capacity is a power of two.
+//
+// When the ring is empty (full), pop (push) waits according to the
+// strategy:
+//   SpinWait   busy-waits; lowest latency, burns a core per waiting side
+//   YieldWait  gives the core away between checks
+//   FutexWait  spins briefly, then sleeps in the kernel until the other
+//              side moves (futex on Linux, WaitOnAddress on Windows).
+//              A side only makes the wake-up call when the other is
+//              actually asleep.
+
+static const size_t CACHE_LINE_BYTES = 64;
+
+// A captured frame in flight: the buffer, its camera memory id and what
+// is known about the picture.
+struct FrameHandle
+{
+    FrameHandle() : memory(NULL), memory_id(0), meta() { }
+
+    char* memory;
+    int memory_id;
+    FrameMetadata meta;
+};
+
+inline void cpu_relax()
+{
+#if defined(__i386__) || defined(__x86_64__)
+    __builtin_ia32_pause();
+#endif
+}
+
+struct SpinWait
+{
+    static const char* name() { return "spin"; }
+
+    void wait(const std::atomic<uint32_t>& word, uint32_t seen, const std::atomic<bool>& closed)
+    {
+        while(word.load(std::memory_order_acquire) == seen && ! closed.load(std::memory_order_acquire))
+        {
+            cpu_relax();
+        }
+    }
+    void wake(std::atomic<uint32_t>&) { }
+};
+
+struct YieldWait
+{
+    static const char* name() { return "yield"; }
+
+    void wait(const std::atomic<uint32_t>& word, uint32_t seen, const std::atomic<bool>& closed)
+    {
+        while(word.load(std::memory_order_acquire) == seen && ! closed.load(std::memory_order_acquire))
+        {
+            std::this_thread::yield();
+        }
+    }
+    void wake(std::atomic<uint32_t>&) { }
+};
+
+struct FutexWait
+{
+    FutexWait() : sleeping(false) { }
+
+    static const char* name() { return "futex"; }
+
+    void wait(const std::atomic<uint32_t>& word, uint32_t seen, const std::atomic<bool>& closed)
+    {
+        for(int i = 0; i < 1000; ++i)
+        {
+            if(word.load(std::memory_order_acquire) != seen || closed.load(std::memory_order_acquire))
+            {
+                return;
+            }
+            cpu_relax();
+        }
+        // Say we sleep before the last look, and the other side looks at
+        // `sleeping` after its store: one of the two sees the other.
+        sleeping.store(true, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        while(word.load(std::memory_order_acquire) == seen && ! closed.load(std::memory_order_acquire))
+        {
+            sleep_on(word, seen);
+        }
+        sleeping.store(false, std::memory_order_relaxed);
+    }
+
+    void wake(std::atomic<uint32_t>& word)
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if(sleeping.load(std::memory_order_relaxed))
+        {
+            wake_on(word);
+        }
+    }
+
+private:
+    std::atomic<bool> sleeping;
+
+    // The kernel calls take the atomic's address as a plain 32-bit word.
+    // Closing the queue does not change the word, so a sleep is cut
+    // short now and then to look at `closed` again.
+    static void sleep_on(const std::atomic<uint32_t>& word, uint32_t seen)
+    {
+#ifdef _WIN32
+        WaitOnAddress(const_cast<std::atomic<uint32_t>*>(&word), &seen, sizeof(seen), 100);
+#elif defined(__linux__)
+        struct timespec timeout = { 0, 100000000 };
+        syscall(SYS_futex, &word, FUTEX_WAIT_PRIVATE, seen, &timeout, NULL, 0);
+#else
+        (void)word; (void)seen;
+        std::this_thread::yield();
+#endif
+    }
+
+    static void wake_on(std::atomic<uint32_t>& word)
+    {
+#ifdef _WIN32
+        WakeByAddressSingle(&word);
+#elif defined(__linux__)
+        syscall(SYS_futex, &word, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+#else
+        (void)word;
+#endif
+    }
+};
+
+template<typename T, typename Wait = FutexWait>
+class SpscQueue
+{
+public:
+    // Capacity is rounded up to a power of two.
+    explicit SpscQueue(size_t min_capacity)
+        : tail(0), head_cache(0), head(0), tail_cache(0), mask(0), closed(false)
+    {
+        if(min_capacity == 0 || min_capacity > (1u << 30))
+        {
+            throw std::invalid_argument("A frame queue holds 1 to 2^30 entries");
+        }
+        size_t capacity = 1;
+        while(capacity < min_capacity)
+        {
+            capacity *= 2;
+        }
+        slots.resize(capacity);
+        mask = static_cast<uint32_t>(capacity - 1);
+    }
+
+    size_t capacity() const { return slots.size(); }
+
+    // Producer only.
+    bool try_push(const T& item)
+    {
+        const uint32_t t = tail.load(std::memory_order_relaxed);
+        if(t - head_cache == slots.size())
+        {
+            head_cache = head.load(std::memory_order_acquire);
+            if(t - head_cache == slots.size())
+            {
+                return false;
+            }
+        }
+        slots[t & mask] = item;
+        tail.store(t + 1, std::memory_order_release);
+        consumer_wait.wake(tail);
+        return true;
+    }
+
+    // Waits while the ring is full.  False if the queue was closed.
+    bool push(const T& item)
+    {
+        while( ! try_push(item))
+        {
+            if(closed.load(std::memory_order_acquire))
+            {
+                return false;
+            }
+            producer_wait.wait(head, head_cache, closed);
+        }
+        return true;
+    }
+
+    // Consumer only.
+    bool try_pop(T& item)
+    {
+        const uint32_t h = head.load(std::memory_order_relaxed);
+        if(h == tail_cache)
+        {
+            tail_cache = tail.load(std::memory_order_acquire);
+            if(h == tail_cache)
+            {
+                return false;
+            }
+        }
+        item = slots[h & mask];
+        head.store(h + 1, std::memory_order_release);
+        producer_wait.wake(head);
+        return true;
+    }
+
+    // Waits while the ring is empty.  False once it is closed and empty.
+    bool pop(T& item)
+    {
+        while( ! try_pop(item))
+        {
+            if(closed.load(std::memory_order_acquire))
+            {
+                // Anything pushed before close() is still taken.
+                return try_pop(item);
+            }
+            consumer_wait.wait(tail, tail_cache, closed);
+        }
+        return true;
+    }
+
+    // No more pushes; wakes a waiting side.  Either side may call it.
+    void close()
+    {
+        closed.store(true, std::memory_order_release);
+        producer_wait.wake(head);
+        consumer_wait.wake(tail);
+    }
+
+private:
+    char pad0[CACHE_LINE_BYTES];
+
+    // Producer's line.
+    std::atomic<uint32_t> tail;
+    uint32_t head_cache;
+    char pad1[CACHE_LINE_BYTES];
+
+    // Consumer's line.
+    std::atomic<uint32_t> head;
+    uint32_t tail_cache;
+    char pad2[CACHE_LINE_BYTES];
+
+    // Read on every push and pop, written only around a sleep.
+    Wait producer_wait;
+    Wait consumer_wait;
+    char pad3[CACHE_LINE_BYTES];
+
+    std::vector<T> slots;
+    uint32_t mask;
+    std::atomic<bool> closed;
+};
+
+#endif // FRAME_QUEUE_H
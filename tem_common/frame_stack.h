@@ -0,0 +1,292 @@
+#ifndef FRAME_STACK_H
+#define FRAME_STACK_H
+
+#include <cstring>
+#include <string>
+#include <stdexcept>
+#include <stdint.h>
+#include "mapped_file.h"
+
+// Multi-frame raw stack file.
+//
+// One file holds a whole scan instead of one PNG per frame:
+//
+//   offset 0               FrameStackHeader (geometry, pixel format, layout)
+//   metadata_offset        capacity x FrameMetadata, one per frame slot
+//   data_offset            capacity x frame_stride bytes of raw pixels
+//
+// The file is created at its full size, and every frame slot starts on a
+// MAPPING_ALIGNMENT boundary so that the camera can capture straight into
+// a mapped view of the slot.  All numbers are little endian.  Octave can
+// read a frame with fseek(fid, data_offset + i*frame_stride) followed by
+// fread(fid, line_pitch*height, 'uint8=>uint8'), or 'int16=>int16' for
+// difference frames.
+
+enum FramePixelFormat
+{
+    FRAME_PIXEL_BGR8 = 1,  // 3 bytes per pixel, blue first (uEye default for 24 bit)
+    FRAME_PIXEL_MONO8 = 2,
+    FRAME_PIXEL_MONO16 = 3,
+    FRAME_PIXEL_DIFF16 = 4 // signed 16 bits per camera byte: frame minus complement frame
+};
+
+struct FrameStackHeader
+{
+    char magic[8];           // "TSSTACK1"
+    uint32_t header_size;    // sizeof(FrameStackHeader)
+    uint32_t metadata_size;  // sizeof(FrameMetadata)
+    uint32_t width;
+    uint32_t height;
+    uint32_t bits_per_pixel;
+    uint32_t pixel_format;   // FramePixelFormat
+    uint32_t line_pitch;     // bytes per image row
+    uint32_t reserved;
+    uint64_t frame_bytes;    // line_pitch * height
+    uint64_t frame_stride;   // distance between frame slots
+    uint64_t capacity;       // number of frame slots
+    uint64_t metadata_offset;
+    uint64_t data_offset;
+};
+
+static const uint32_t FRAME_VALID = 1;
+
+struct FrameMetadata
+{
+    uint64_t index;
+    uint64_t timestamp_us;   // camera timestamp
+    double exposure_ms;
+    int32_t gain;
+    int32_t pattern_id;
+    uint32_t flags;          // FRAME_VALID once the pixels are complete
+    uint32_t reserved;
+};
+
+inline const char* frame_stack_magic() { return "TSSTACK1"; }
+
+
+// Writes frames into a preallocated stack file.  Frame slots are
+// handed out as mapped memory that the camera fills directly; the
+// metadata entry is written last, so a frame only counts once it is
+// complete.  Reopening an existing stack continues where it stopped.
+class FrameStackWriter
+{
+public:
+    // Create a new stack for `capacity` frames.
+    FrameStackWriter(const std::string& path, uint32_t width, uint32_t height, uint32_t bits_per_pixel,
+                     FramePixelFormat format, uint64_t capacity)
+        : file(create_file(path, width, height, bits_per_pixel, format, capacity)), mapped_slot(NO_SLOT)
+    {
+        map_header();
+        FrameStackHeader& h = header();
+        memcpy(h.magic, frame_stack_magic(), sizeof(h.magic));
+        h.header_size = sizeof(FrameStackHeader);
+        h.metadata_size = sizeof(FrameMetadata);
+        h.width = width;
+        h.height = height;
+        h.bits_per_pixel = bits_per_pixel;
+        h.pixel_format = format;
+        h.line_pitch = line_pitch_for(width, bits_per_pixel);
+        h.reserved = 0;
+        h.frame_bytes = static_cast<uint64_t>(h.line_pitch) * height;
+        h.frame_stride = round_up_to_mapping(h.frame_bytes);
+        h.capacity = capacity;
+        h.metadata_offset = sizeof(FrameStackHeader);
+        h.data_offset = data_offset_for(capacity);
+    }
+
+    // Open an existing stack to fill in the frames still missing.
+    explicit FrameStackWriter(const std::string& path)
+        : file(MappedFile::open(path, true)), mapped_slot(NO_SLOT)
+    {
+        map_header();
+        check_header(header(), file.size());
+    }
+
+    const FrameStackHeader& info() const { return *reinterpret_cast<const FrameStackHeader*>(header_view.data()); }
+
+    // Whether a reopened stack holds frames of this size and layout, so
+    // that frames taken now can be added to it.
+    bool holds(uint32_t width, uint32_t height, uint32_t bits_per_pixel, FramePixelFormat format) const
+    {
+        const FrameStackHeader& h = info();
+        return h.width == width && h.height == height && h.bits_per_pixel == bits_per_pixel
+            && h.pixel_format == static_cast<uint32_t>(format) && h.line_pitch == line_pitch_for(width, bits_per_pixel);
+    }
+
+    bool has_frame(uint64_t index) const
+    {
+        return index < info().capacity && (metadata(index).flags & FRAME_VALID) != 0;
+    }
+
+    // Memory for the pixels of frame `index`, valid until the next
+    // call to slot().  Mapping is skipped if the slot is already mapped.
+    char* slot(uint64_t index)
+    {
+        if(index >= info().capacity)
+        {
+            throw std::out_of_range("Frame index beyond stack capacity");
+        }
+        if(mapped_slot != index)
+        {
+            slot_view = MappedView();
+            mapped_slot = NO_SLOT;
+            slot_view = file.map(info().data_offset + index*info().frame_stride, static_cast<size_t>(info().frame_bytes));
+            mapped_slot = index;
+        }
+        return slot_view.data();
+    }
+
+    // Mark frame `index` complete.  The pixels must already be in slot(index).
+    void commit(uint64_t index, const FrameMetadata& meta)
+    {
+        FrameMetadata& m = metadata(index);
+        m = meta;
+        m.index = index;
+        m.flags = 0;
+        m.reserved = 0;
+        // Pixels first, then the valid flag.
+        if(mapped_slot == index)
+        {
+            slot_view.flush();
+        }
+        m.flags = FRAME_VALID;
+        header_view.flush();
+    }
+
+    static uint32_t line_pitch_for(uint32_t width, uint32_t bits_per_pixel)
+    {
+        // Rows padded to 4 bytes, as the uEye image memory does.
+        return (width*bits_per_pixel/8 + 3) / 4 * 4;
+    }
+
+    // Everything the frames and the metadata table are found by must lie
+    // inside the file.  The numbers come from the file, so they are
+    // compared by division and subtraction, which cannot overflow.
+    static void check_header(const FrameStackHeader& h, uint64_t file_size)
+    {
+        const uint64_t row_bytes = (static_cast<uint64_t>(h.width)*h.bits_per_pixel/8 + 3) / 4 * 4;
+        if(memcmp(h.magic, frame_stack_magic(), sizeof(h.magic)) != 0
+           || h.header_size != sizeof(FrameStackHeader) || h.metadata_size != sizeof(FrameMetadata)
+           || h.data_offset % MAPPING_ALIGNMENT != 0 || h.frame_stride % MAPPING_ALIGNMENT != 0
+           || h.data_offset > file_size || h.metadata_offset < sizeof(FrameStackHeader) || h.metadata_offset > h.data_offset
+           || h.capacity > (h.data_offset - h.metadata_offset) / sizeof(FrameMetadata)
+           || h.width == 0 || h.height == 0 || h.bits_per_pixel == 0 || h.bits_per_pixel % 8 != 0
+           || h.line_pitch != row_bytes || h.frame_bytes / h.height != h.line_pitch || h.frame_bytes % h.height != 0
+           || h.frame_stride == 0 || h.frame_bytes > h.frame_stride || h.frame_bytes > static_cast<size_t>(-1)
+           || h.capacity > (file_size - h.data_offset) / h.frame_stride)
+        {
+            throw std::runtime_error("Not a frame stack file, or it is truncated");
+        }
+    }
+
+private:
+    static const uint64_t NO_SLOT = ~static_cast<uint64_t>(0);
+
+    MappedFile file;
+    MappedView header_view; // header and metadata table, mapped for the writer's lifetime
+    MappedView slot_view;
+    uint64_t mapped_slot;
+
+    FrameStackHeader& header() { return *reinterpret_cast<FrameStackHeader*>(header_view.data()); }
+
+    FrameMetadata& metadata(uint64_t index) const
+    {
+        return reinterpret_cast<FrameMetadata*>(header_view.data() + info().metadata_offset)[index];
+    }
+
+    void map_header()
+    {
+        // The data offset is not known before the header is read, so map
+        // the header alone first.
+        MappedView first = file.map(0, sizeof(FrameStackHeader));
+        const FrameStackHeader* h = reinterpret_cast<const FrameStackHeader*>(first.data());
+        uint64_t table_end = (memcmp(h->magic, frame_stack_magic(), sizeof(h->magic)) == 0) ? h->data_offset : 0;
+        if(table_end == 0 || table_end > file.size())
+        {
+            table_end = MAPPING_ALIGNMENT; // new file; capacity is checked later
+        }
+        header_view = file.map(0, static_cast<size_t>(table_end));
+    }
+
+    static uint64_t data_offset_for(uint64_t capacity)
+    {
+        return round_up_to_mapping(sizeof(FrameStackHeader) + capacity*sizeof(FrameMetadata));
+    }
+
+    static MappedFile create_file(const std::string& path, uint32_t width, uint32_t height, uint32_t bits_per_pixel,
+                                  FramePixelFormat, uint64_t capacity)
+    {
+        uint64_t stride = round_up_to_mapping(static_cast<uint64_t>(line_pitch_for(width, bits_per_pixel)) * height);
+        MappedFile f = MappedFile::create(path, data_offset_for(capacity) + capacity*stride);
+
+        // Write the data offset first so that map_header() maps the
+        // whole metadata table.
+        MappedView first = f.map(0, sizeof(FrameStackHeader));
+        FrameStackHeader* h = reinterpret_cast<FrameStackHeader*>(first.data());
+        memcpy(h->magic, frame_stack_magic(), sizeof(h->magic));
+        h->data_offset = data_offset_for(capacity);
+        return f;
+    }
+};
+
+
+// Random access to the frames of a stack file.  Each frame is mapped
+// when it is requested; the most recently used frame stays mapped.
+class FrameStackReader
+{
+public:
+    explicit FrameStackReader(const std::string& path)
+        : file(MappedFile::open(path, false)), mapped_frame(NO_FRAME)
+    {
+        MappedView first = file.map(0, sizeof(FrameStackHeader));
+        memcpy(&h, first.data(), sizeof(h));
+        FrameStackWriter::check_header(h, file.size());
+        table_view = file.map(0, static_cast<size_t>(h.data_offset));
+    }
+
+    const FrameStackHeader& info() const { return h; }
+    uint64_t capacity() const { return h.capacity; }
+
+    const FrameMetadata& metadata(uint64_t index) const
+    {
+        if(index >= h.capacity)
+        {
+            throw std::out_of_range("Frame index beyond stack capacity");
+        }
+        return reinterpret_cast<const FrameMetadata*>(table_view.data() + h.metadata_offset)[index];
+    }
+
+    bool has_frame(uint64_t index) const
+    {
+        return (metadata(index).flags & FRAME_VALID) != 0;
+    }
+
+    // Pixels of frame `index` (line_pitch * height bytes), valid until
+    // the next call to frame().
+    const unsigned char* frame(uint64_t index)
+    {
+        if( ! has_frame(index))
+        {
+            throw std::runtime_error("Frame was never written");
+        }
+        if(mapped_frame != index)
+        {
+            frame_view = MappedView();
+            mapped_frame = NO_FRAME;
+            frame_view = file.map(h.data_offset + index*h.frame_stride, static_cast<size_t>(h.frame_bytes));
+            mapped_frame = index;
+        }
+        return reinterpret_cast<const unsigned char*>(frame_view.data());
+    }
+
+private:
+    static const uint64_t NO_FRAME = ~static_cast<uint64_t>(0);
+
+    MappedFile file;
+    FrameStackHeader h;
+    MappedView table_view;
+    MappedView frame_view;
+    uint64_t mapped_frame;
+};
+
+#endif // FRAME_STACK_H
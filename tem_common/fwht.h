@@ -0,0 +1,181 @@
+#ifndef FWHT_H
+#define FWHT_H
+
+#include <cstddef>
+#include <cstring>
+#include <stdexcept>
+#include "parallel_for.h"
+
+// In-place fast Walsh-Hadamard transform in natural (Sylvester) order.
+//
+// fwht(data, n) replaces data with H*data, where H is the n x n
+// Hadamard matrix with H(i, j) = (-1)^popcount(i & j), without scaling.
+// Since H*H = n*I, applying it twice and dividing by n gives the input
+// back.  n must be a power of two.
+//
+// The first stages (butterfly distance below FWHT_BLOCK) run block by
+// block while a block sits in the cache; the remaining stages are done
+// two at a time (radix 4) so the whole array is swept half as often.
+// Both parts are split across threads, and the butterflies work on
+// 16-byte vectors.
+
+static const size_t FWHT_BLOCK = 4096;           // elements done in cache at once
+static const size_t FWHT_PARALLEL_MIN = 65536;   // smaller transforms use one thread
+
+template<typename T>
+struct FwhtVector
+{
+    typedef T type __attribute__((vector_size(16)));
+    static const size_t lanes = 16 / sizeof(T);
+
+    static type load(const T* p)
+    {
+        type v;
+        memcpy(&v, p, sizeof(v));
+        return v;
+    }
+
+    static void store(T* p, type v)
+    {
+        memcpy(p, &v, sizeof(v));
+    }
+};
+
+// a[i], b[i] <- a[i] + b[i], a[i] - b[i]
+template<typename T>
+inline void fwht_radix2(T* a, T* b, size_t count)
+{
+    typedef FwhtVector<T> V;
+    size_t i = 0;
+    for(; i + V::lanes <= count; i += V::lanes)
+    {
+        typename V::type x = V::load(a + i);
+        typename V::type y = V::load(b + i);
+        V::store(a + i, x + y);
+        V::store(b + i, x - y);
+    }
+    for(; i < count; ++i)
+    {
+        T x = a[i];
+        T y = b[i];
+        a[i] = x + y;
+        b[i] = x - y;
+    }
+}
+
+// Two stages at once on a, b = a + h, c = a + 2h, d = a + 3h.
+template<typename T>
+inline void fwht_radix4(T* a, T* b, T* c, T* d, size_t count)
+{
+    typedef FwhtVector<T> V;
+    size_t i = 0;
+    for(; i + V::lanes <= count; i += V::lanes)
+    {
+        typename V::type w = V::load(a + i);
+        typename V::type x = V::load(b + i);
+        typename V::type y = V::load(c + i);
+        typename V::type z = V::load(d + i);
+        typename V::type s0 = w + x;
+        typename V::type d0 = w - x;
+        typename V::type s1 = y + z;
+        typename V::type d1 = y - z;
+        V::store(a + i, s0 + s1);
+        V::store(b + i, d0 + d1);
+        V::store(c + i, s0 - s1);
+        V::store(d + i, d0 - d1);
+    }
+    for(; i < count; ++i)
+    {
+        T s0 = a[i] + b[i];
+        T d0 = a[i] - b[i];
+        T s1 = c[i] + d[i];
+        T d1 = c[i] - d[i];
+        a[i] = s0 + s1;
+        b[i] = d0 + d1;
+        c[i] = s0 - s1;
+        d[i] = d0 - d1;
+    }
+}
+
+// All stages with butterfly distance below n, for a block of n elements.
+template<typename T>
+inline void fwht_block(T* data, size_t n)
+{
+    size_t h = 1;
+    if(n >= 4)
+    {
+        // Distances 1 and 2 together, within groups of four.
+        for(size_t i = 0; i < n; i += 4)
+        {
+            T s0 = data[i] + data[i + 1];
+            T d0 = data[i] - data[i + 1];
+            T s1 = data[i + 2] + data[i + 3];
+            T d1 = data[i + 2] - data[i + 3];
+            data[i] = s0 + s1;
+            data[i + 1] = d0 + d1;
+            data[i + 2] = s0 - s1;
+            data[i + 3] = d0 - d1;
+        }
+        h = 4;
+    }
+    for(; 4*h <= n; h *= 4)
+    {
+        for(size_t i = 0; i < n; i += 4*h)
+        {
+            fwht_radix4(data + i, data + i + h, data + i + 2*h, data + i + 3*h, h);
+        }
+    }
+    if(2*h <= n)
+    {
+        for(size_t i = 0; i < n; i += 2*h)
+        {
+            fwht_radix2(data + i, data + i + h, h);
+        }
+    }
+}
+
+// threads = 0 uses all cores.
+template<typename T>
+void fwht(T* data, size_t n, int threads = 0)
+{
+    if(n == 0 || (n & (n - 1)) != 0)
+    {
+        throw std::invalid_argument("Walsh-Hadamard transform length must be a power of two");
+    }
+    if(n < FWHT_PARALLEL_MIN)
+    {
+        threads = 1;
+    }
+
+    const size_t block = (n < FWHT_BLOCK) ? n : FWHT_BLOCK;
+    parallel_for(static_cast<int>(n / block), threads, [&](int b)
+    {
+        fwht_block(data + static_cast<size_t>(b)*block, block);
+    });
+
+    // Remaining stages.  Work is cut into chunks of `block/4` butterfly
+    // columns; a chunk never crosses a group because h >= block.
+    const size_t chunk = block / 4;
+    size_t h = block;
+    for(; 4*h <= n; h *= 4)
+    {
+        parallel_for(static_cast<int>(n / 4 / chunk), threads, [&](int t)
+        {
+            size_t q = static_cast<size_t>(t)*chunk;
+            T* a = data + (q / h)*4*h + q % h;
+            fwht_radix4(a, a + h, a + 2*h, a + 3*h, chunk);
+        });
+    }
+    if(2*h <= n)
+    {
+        const size_t pair_chunk = (block / 2 < h) ? block / 2 : h;
+        parallel_for(static_cast<int>(n / 2 / pair_chunk), threads, [&](int t)
+        {
+            size_t q = static_cast<size_t>(t)*pair_chunk;
+            T* a = data + (q / h)*2*h + q % h;
+            fwht_radix2(a, a + h, pair_chunk);
+        });
+    }
+}
+
+#endif // FWHT_H
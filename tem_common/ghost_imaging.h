@@ -0,0 +1,218 @@
+#ifndef GHOST_IMAGING_H
+#define GHOST_IMAGING_H
+
+#include <cstring>
+#include <vector>
+#include <stdexcept>
+#include <stdint.h>
+
+// Streaming correlation for computational ghost imaging.
+//
+// Each measurement is a binary pattern I_k (one bit per macro pixel)
+// and a bucket value B_k.  The ghost image is the covariance
+//
+//   G(j) = <B I(j)> - <B> <I(j)>
+//
+// or, for differential ghost imaging (Ferri et al., 2010), with R_k the
+// number of pixels on in pattern k,
+//
+//   G(j) = <B I(j)> - <B>/<R> <R I(j)>
+//
+// Only running sums are kept, so memory is O(pixels) however many
+// patterns arrive, and image() can be called at any time.
+//
+// Patterns are taken packed, 64 pixels per word, pixel j at bit j % 64
+// of word j / 64.  Eight patterns are collected and then added in one
+// pass: for each pixel the 8 pattern bits form a byte (an 8x8 bit
+// transpose per byte of pixels), and a 256-entry table built from the
+// eight buckets gives the sum of the buckets of the patterns that pixel
+// was on in.  That is one addition per pixel per eight patterns instead
+// of one per pattern, and the pattern counts come from a popcount table
+// the same way.
+class GhostCorrelator
+{
+public:
+    explicit GhostCorrelator(size_t pixels)
+        : pixels(pixels), words((pixels + 63) / 64), pending(0), patterns(0), sum_b(0), sum_r(0),
+          pending_bits(8*words, 0), sum_i(pixels, 0), sum_bi(pixels, 0.0), sum_ri(pixels, 0.0)
+    {
+        for(int v = 0; v < 256; ++v)
+        {
+            popcount_table[v] = static_cast<uint8_t>(__builtin_popcount(v));
+        }
+    }
+
+    size_t pixel_count() const { return pixels; }
+    size_t words_per_pattern() const { return words; }
+    uint64_t pattern_count() const { return patterns + pending; }
+
+    // Add one measurement.  `bits` holds words_per_pattern() words.
+    void add(const uint64_t* bits, double bucket)
+    {
+        uint64_t on = 0;
+        for(size_t w = 0; w < words; ++w)
+        {
+            on += __builtin_popcountll(bits[w]);
+        }
+        memcpy(&pending_bits[pending*words], bits, words*sizeof(uint64_t));
+        pending_bucket[pending] = bucket;
+        pending_on[pending] = static_cast<double>(on);
+        if(++pending == 8)
+        {
+            flush();
+        }
+    }
+
+    // Current ghost image, one value per pixel.
+    void image(std::vector<double>& out, bool differential)
+    {
+        flush();
+        out.assign(pixels, 0.0);
+        if(patterns == 0)
+        {
+            return;
+        }
+        const double n = static_cast<double>(patterns);
+        const double mean_b = sum_b / n;
+        const double mean_r = sum_r / n;
+        for(size_t j = 0; j < pixels; ++j)
+        {
+            if(differential && mean_r > 0)
+            {
+                out[j] = sum_bi[j]/n - mean_b/mean_r * sum_ri[j]/n;
+            }
+            else
+            {
+                out[j] = sum_bi[j]/n - mean_b * static_cast<double>(sum_i[j])/n;
+            }
+        }
+    }
+
+    size_t memory_bytes() const
+    {
+        return pending_bits.capacity()*sizeof(uint64_t) + sum_i.capacity()*sizeof(uint32_t)
+             + sum_bi.capacity()*sizeof(double) + sum_ri.capacity()*sizeof(double);
+    }
+
+    // Pack one byte (0 or non-zero) per pixel into the layout add() takes.
+    static void pack(const unsigned char* grid, size_t pixels, std::vector<uint64_t>& bits)
+    {
+        bits.assign((pixels + 63) / 64, 0);
+        for(size_t j = 0; j < pixels; ++j)
+        {
+            if(grid[j])
+            {
+                bits[j >> 6] |= static_cast<uint64_t>(1) << (j & 63);
+            }
+        }
+    }
+
+private:
+    size_t pixels;
+    size_t words;
+    int pending;
+    uint64_t patterns;
+    double sum_b;
+    double sum_r;
+    std::vector<uint64_t> pending_bits;   // up to 8 patterns, words each
+    double pending_bucket[8];
+    double pending_on[8];
+    std::vector<uint32_t> sum_i;          // patterns each pixel was on in
+    std::vector<double> sum_bi;
+    std::vector<double> sum_ri;
+    uint8_t popcount_table[256];
+    double bucket_table[256];
+    double on_table[256];
+
+    // 8x8 bit matrix transpose; bit 8r + c <-> bit 8c + r
+    // (Hacker's Delight, section 7-3).
+    static uint64_t transpose8(uint64_t x)
+    {
+        uint64_t t;
+        t = (x ^ (x >> 7)) & 0x00AA00AA00AA00AAull;
+        x = x ^ t ^ (t << 7);
+        t = (x ^ (x >> 14)) & 0x0000CCCC0000CCCCull;
+        x = x ^ t ^ (t << 14);
+        t = (x ^ (x >> 28)) & 0x00000000F0F0F0F0ull;
+        x = x ^ t ^ (t << 28);
+        return x;
+    }
+
+    // subset sums of the pending values: table[m] = sum of value[k] for bits k of m
+    static void build_table(const double* value, int count, double* table)
+    {
+        table[0] = 0;
+        for(int k = 0; k < 8; ++k)
+        {
+            double v = (k < count) ? value[k] : 0.0;
+            int half = 1 << k;
+            for(int m = 0; m < half; ++m)
+            {
+                table[half + m] = table[m] + v;
+            }
+        }
+    }
+
+    void flush()
+    {
+        if(pending == 0)
+        {
+            return;
+        }
+        // Missing patterns of a partial group are all off.
+        for(int k = pending; k < 8; ++k)
+        {
+            memset(&pending_bits[k*words], 0, words*sizeof(uint64_t));
+        }
+        for(int k = 0; k < pending; ++k)
+        {
+            sum_b += pending_bucket[k];
+            sum_r += pending_on[k];
+        }
+        build_table(pending_bucket, pending, bucket_table);
+        build_table(pending_on, pending, on_table);
+
+        for(size_t w = 0; w < words; ++w)
+        {
+            uint64_t p[8];
+            for(int k = 0; k < 8; ++k)
+            {
+                p[k] = pending_bits[k*words + w];
+            }
+            if((p[0] | p[1] | p[2] | p[3] | p[4] | p[5] | p[6] | p[7]) == 0)
+            {
+                continue;
+            }
+            const size_t base = w*64;
+            const int count = (pixels - base < 64) ? static_cast<int>(pixels - base) : 64;
+            for(int q = 0; q < 8 && 8*q < count; ++q)
+            {
+                // Row k = byte q of pattern k; after the transpose byte c
+                // holds the eight pattern bits of pixel 8q + c.
+                uint64_t m = 0;
+                for(int k = 0; k < 8; ++k)
+                {
+                    m |= ((p[k] >> (8*q)) & 0xFF) << (8*k);
+                }
+                if(m == 0)
+                {
+                    continue;
+                }
+                m = transpose8(m);
+                const int last = (count - 8*q < 8) ? count - 8*q : 8;
+                for(int c = 0; c < last; ++c)
+                {
+                    unsigned int byte = static_cast<unsigned int>((m >> (8*c)) & 0xFF);
+                    size_t j = base + 8*q + c;
+                    sum_i[j] += popcount_table[byte];
+                    sum_bi[j] += bucket_table[byte];
+                    sum_ri[j] += on_table[byte];
+                }
+            }
+        }
+        patterns += pending;
+        pending = 0;
+    }
+};
+
+#endif // GHOST_IMAGING_H
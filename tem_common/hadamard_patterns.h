@@ -0,0 +1,277 @@
+#ifndef HADAMARD_PATTERNS_H
+#define HADAMARD_PATTERNS_H
+
+#include <cstring>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+#include <stdint.h>
+
+// Hadamard/Walsh patterns for single-pixel imaging.
+//
+// A pattern set covers a grid of grid_w x grid_h macro pixels, with
+// grid_w and grid_h powers of two and N = grid_w*grid_h patterns.  Pattern
+// h (natural Sylvester order) has macro pixel j = y*grid_w + x switched on
+// when H(h, j) = (-1)^popcount(h & j) is +1.  Because the bits of j split
+// into a y part and an x part, every grid row of a pattern is either the
+// same base row or its complement; rendering builds the base row once and
+// copies it.
+//
+// The same ordering functions are used by the reconstruction tools, so a
+// measurement index always means the same pattern on both sides.
+
+enum HadamardOrdering
+{
+    HADAMARD_NATURAL,   // Sylvester construction order
+    HADAMARD_SEQUENCY,  // Walsh order, increasing number of sign changes
+    HADAMARD_CAKE       // cake-cutting: increasing number of connected regions
+};
+
+inline bool parse_hadamard_ordering(const std::string& name, HadamardOrdering& ordering)
+{
+    if(name == "natural")  { ordering = HADAMARD_NATURAL;  return true; }
+    if(name == "sequency" || name == "walsh") { ordering = HADAMARD_SEQUENCY; return true; }
+    if(name == "cake")     { ordering = HADAMARD_CAKE;     return true; }
+    return false;
+}
+
+inline bool is_power_of_two(uint32_t n)
+{
+    return n != 0 && (n & (n - 1)) == 0;
+}
+
+inline int log2_of_power_of_two(uint32_t n)
+{
+    int k = 0;
+    while((1u << k) < n)
+    {
+        ++k;
+    }
+    return k;
+}
+
+inline int parity(uint32_t v)
+{
+    return __builtin_parity(v);
+}
+
+inline uint32_t reverse_bits(uint32_t v, int bits)
+{
+    uint32_t r = 0;
+    for(int i = 0; i < bits; ++i)
+    {
+        r = (r << 1) | ((v >> i) & 1);
+    }
+    return r;
+}
+
+// +1 or -1 entry of the natural-order Hadamard matrix.
+inline int hadamard_sign(uint32_t natural_index, uint32_t j)
+{
+    return parity(natural_index & j) ? -1 : 1;
+}
+
+// Sign changes along a Walsh function of `bits` bits given by its
+// natural index, i.e. its sequency: the inverse Gray code of the
+// reversed index.
+inline uint32_t hadamard_sign_changes(uint32_t natural_index, int bits)
+{
+    uint32_t s = reverse_bits(natural_index, bits);
+    for(int shift = 1; shift < bits; shift *= 2)
+    {
+        s ^= s >> shift;
+    }
+    return s;
+}
+
+// Number of 4-connected regions of equal sign in a natural-order
+// pattern, the sort key of the cake-cutting ordering.  The pattern is
+// the product of a Walsh function along x (the low bits of h) and one
+// along y (the high bits), so its sign changes cut the grid into
+// rectangles, and neighbouring rectangles always differ in sign.
+inline uint32_t hadamard_region_count(uint32_t h, uint32_t grid_w, uint32_t grid_h)
+{
+    const int x_bits = log2_of_power_of_two(grid_w);
+    const int y_bits = log2_of_power_of_two(grid_h);
+    const uint32_t columns = hadamard_sign_changes(h & (grid_w - 1), x_bits) + 1;
+    const uint32_t rows = hadamard_sign_changes(h >> x_bits, y_bits) + 1;
+    return columns*rows;
+}
+
+// order[i] is the natural index of the i-th pattern in the given ordering.
+inline std::vector<uint32_t> hadamard_order(HadamardOrdering ordering, uint32_t grid_w, uint32_t grid_h)
+{
+    if( ! is_power_of_two(grid_w) || ! is_power_of_two(grid_h))
+    {
+        throw std::invalid_argument("Hadamard grid sides must be powers of two");
+    }
+    const uint32_t n = grid_w*grid_h;
+    const int bits = log2_of_power_of_two(n);
+    std::vector<uint32_t> order(n);
+
+    switch(ordering)
+    {
+    case HADAMARD_NATURAL:
+        for(uint32_t i = 0; i < n; ++i)
+        {
+            order[i] = i;
+        }
+        break;
+
+    case HADAMARD_SEQUENCY:
+        // Walsh index s has natural index bitreverse(gray(s)).
+        for(uint32_t s = 0; s < n; ++s)
+        {
+            order[s] = reverse_bits(s ^ (s >> 1), bits);
+        }
+        break;
+
+    case HADAMARD_CAKE:
+    {
+        std::vector<uint32_t> regions(n);
+        for(uint32_t h = 0; h < n; ++h)
+        {
+            regions[h] = hadamard_region_count(h, grid_w, grid_h);
+            order[h] = h;
+        }
+        // Ties keep sequency order, which is what the cake-cutting
+        // paper uses within a piece count.
+        std::vector<uint32_t> sequency_rank(n);
+        for(uint32_t s = 0; s < n; ++s)
+        {
+            sequency_rank[reverse_bits(s ^ (s >> 1), bits)] = s;
+        }
+        std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b)
+        {
+            if(regions[a] != regions[b])
+            {
+                return regions[a] < regions[b];
+            }
+            return sequency_rank[a] < sequency_rank[b];
+        });
+        break;
+    }
+    }
+    return order;
+}
+
+
+// Where and how large a pattern set is drawn on the mirror.
+struct HadamardLayout
+{
+    HadamardLayout() : grid_w(32), grid_h(32), macro(1), x(0), y(0), ordering(HADAMARD_NATURAL) { }
+
+    uint32_t grid_w;
+    uint32_t grid_h;
+    uint32_t macro;     // mirror pixels per macro pixel side
+    int x;              // mirror position of the top left corner
+    int y;
+    HadamardOrdering ordering;
+
+    bool operator==(const HadamardLayout& o) const
+    {
+        return grid_w == o.grid_w && grid_h == o.grid_h && macro == o.macro && x == o.x && y == o.y && ordering == o.ordering;
+    }
+    bool operator!=(const HadamardLayout& o) const { return ! (*this == o); }
+};
+
+
+// Draws Hadamard patterns into a mirror buffer (one byte per mirror
+// pixel).  The ordering table and the area outside the pattern only
+// change with the layout, so they are prepared once per layout.
+class HadamardPatterns
+{
+public:
+    HadamardPatterns() : prepared(false), prepared_for(NULL), mirror_w(0), mirror_h(0) { }
+
+    uint32_t count() const { return layout.grid_w*layout.grid_h; }
+
+    // Call when something else has drawn into the mirror buffer.
+    void forget_background() { prepared_for = NULL; }
+
+    void set_layout(const HadamardLayout& new_layout)
+    {
+        if(prepared && new_layout == layout)
+        {
+            return;
+        }
+        if( ! is_power_of_two(new_layout.grid_w) || ! is_power_of_two(new_layout.grid_h) || new_layout.macro == 0)
+        {
+            throw std::invalid_argument("Hadamard grid sides must be powers of two and macro at least 1");
+        }
+        if(order.empty() || new_layout.ordering != layout.ordering
+           || new_layout.grid_w != layout.grid_w || new_layout.grid_h != layout.grid_h)
+        {
+            order = hadamard_order(new_layout.ordering, new_layout.grid_w, new_layout.grid_h);
+        }
+        layout = new_layout;
+        prepared = true;
+        prepared_for = NULL; // background must be cleared again
+    }
+
+    // Pattern `index` in the current ordering, or its complement.
+    // Mirror pixels are off_value or on_value.
+    void render(uint32_t index, bool complement, unsigned char* mirror, int width, int height,
+                unsigned char off_value, unsigned char on_value)
+    {
+        if(index >= count())
+        {
+            throw std::out_of_range("Hadamard pattern index out of range");
+        }
+        if(prepared_for != mirror || mirror_w != width || mirror_h != height)
+        {
+            // Everything outside the pattern stays off; only clear it
+            // when the layout or the buffer changes.
+            memset(mirror, off_value, static_cast<size_t>(width)*height);
+            prepared_for = mirror;
+            mirror_w = width;
+            mirror_h = height;
+        }
+
+        const uint32_t h = order[index];
+        const int x_bits = log2_of_power_of_two(layout.grid_w);
+        const uint32_t h_x = h & (layout.grid_w - 1);
+        const uint32_t h_y = h >> x_bits;
+
+        // Clip the pattern to the mirror.
+        const int x0 = std::max(layout.x, 0);
+        const int x1 = std::min(layout.x + static_cast<int>(layout.grid_w*layout.macro), width);
+        const int y0 = std::max(layout.y, 0);
+        const int y1 = std::min(layout.y + static_cast<int>(layout.grid_h*layout.macro), height);
+        if(x0 >= x1 || y0 >= y1)
+        {
+            return;
+        }
+
+        // Base row: macro pixel gx is on when parity(h_x & gx) is even.
+        base_row.resize(x1 - x0);
+        inverse_row.resize(x1 - x0);
+        for(int mx = x0; mx < x1; ++mx)
+        {
+            uint32_t gx = (mx - layout.x) / layout.macro;
+            bool on = (parity(h_x & gx) == 0) != complement;
+            base_row[mx - x0] = on ? on_value : off_value;
+            inverse_row[mx - x0] = on ? off_value : on_value;
+        }
+
+        for(int my = y0; my < y1; ++my)
+        {
+            uint32_t gy = (my - layout.y) / layout.macro;
+            const unsigned char* src = parity(h_y & gy) ? &inverse_row[0] : &base_row[0];
+            memcpy(mirror + static_cast<size_t>(my)*width + x0, src, x1 - x0);
+        }
+    }
+
+private:
+    HadamardLayout layout;
+    std::vector<uint32_t> order;
+    bool prepared;
+    const unsigned char* prepared_for;
+    int mirror_w;
+    int mirror_h;
+    std::vector<unsigned char> base_row;
+    std::vector<unsigned char> inverse_row;
+};
+
+#endif // HADAMARD_PATTERNS_H
@@ -0,0 +1,118 @@
+#ifndef HADAMARD_RECONSTRUCTION_H
+#define HADAMARD_RECONSTRUCTION_H
+
+#include <string>
+#include <vector>
+#include <stdexcept>
+#include <stdint.h>
+#include "bucket_file.h"
+#include "hadamard_patterns.h"
+#include "fwht.h"
+
+// Image from the bucket values of a Hadamard scan.
+//
+// With the +1/-1 pattern measurements c (put at their natural Hadamard
+// index), the image is x = H*c / N, computed with the fast transform in
+// O(N log N) instead of a dense matrix product.  Patterns that were not
+// measured count as zero, so a scan stopped early in sequency or
+// cake-cutting order gives a low-resolution image rather than nothing.
+//
+// The DMD can only show 0/1 patterns, so the +1/-1 measurement is got in
+// one of three ways:
+enum HadamardBucketMode
+{
+    HADAMARD_BUCKETS_SIGNED,    // buckets already are +1/-1 measurements
+    HADAMARD_BUCKETS_PAIRS,     // bucket 2k is pattern k, 2k+1 its complement
+                                // (the loader's "pairs" numbering)
+    HADAMARD_BUCKETS_POSITIVE   // 0/1 patterns only; uses the all-on pattern
+                                // (first in every ordering): c = 2*y - y_all
+};
+
+inline bool parse_hadamard_bucket_mode(const std::string& name, HadamardBucketMode& mode)
+{
+    if(name == "signed")   { mode = HADAMARD_BUCKETS_SIGNED;   return true; }
+    if(name == "pairs")    { mode = HADAMARD_BUCKETS_PAIRS;    return true; }
+    if(name == "positive") { mode = HADAMARD_BUCKETS_POSITIVE; return true; }
+    return false;
+}
+
+// +1/-1 measurements by position in the ordering.  Returns how many
+// patterns were measured.
+inline size_t hadamard_measurements(const BucketSeries& buckets, HadamardBucketMode mode, size_t n,
+                                    std::vector<double>& measurement, std::vector<unsigned char>& known)
+{
+    measurement.assign(n, 0.0);
+    known.assign(n, 0);
+    size_t count = 0;
+    for(size_t i = 0; i < n; ++i)
+    {
+        switch(mode)
+        {
+        case HADAMARD_BUCKETS_SIGNED:
+        case HADAMARD_BUCKETS_POSITIVE:
+            if(buckets.has(i))
+            {
+                measurement[i] = buckets.values[i];
+                known[i] = 1;
+            }
+            break;
+        case HADAMARD_BUCKETS_PAIRS:
+            if(buckets.has(2*i) && buckets.has(2*i + 1))
+            {
+                measurement[i] = buckets.values[2*i] - buckets.values[2*i + 1];
+                known[i] = 1;
+            }
+            break;
+        }
+        count += known[i];
+    }
+
+    if(mode == HADAMARD_BUCKETS_POSITIVE)
+    {
+        if( ! known[0])
+        {
+            throw std::runtime_error("Positive-only Hadamard buckets need the first (all on) pattern");
+        }
+        // y = (y_all + c)/2 for every pattern but the first, which is
+        // already all +1.
+        const double all_on = measurement[0];
+        for(size_t i = 1; i < n; ++i)
+        {
+            if(known[i])
+            {
+                measurement[i] = 2*measurement[i] - all_on;
+            }
+        }
+    }
+    return count;
+}
+
+// Image at macro pixel resolution, grid_w x grid_h values row by row.
+// Returns the number of patterns used.
+template<typename T>
+size_t reconstruct_hadamard(const BucketSeries& buckets, HadamardBucketMode mode, HadamardOrdering ordering,
+                            uint32_t grid_w, uint32_t grid_h, std::vector<T>& image, int threads = 0)
+{
+    const std::vector<uint32_t> order = hadamard_order(ordering, grid_w, grid_h);
+    const size_t n = order.size();
+
+    std::vector<double> measurement;
+    std::vector<unsigned char> known;
+    size_t used = hadamard_measurements(buckets, mode, n, measurement, known);
+
+    image.assign(n, T(0));
+    for(size_t i = 0; i < n; ++i)
+    {
+        image[order[i]] = static_cast<T>(measurement[i]);
+    }
+    fwht(&image[0], n, threads);
+
+    const T scale = T(1) / static_cast<T>(n);
+    for(size_t i = 0; i < n; ++i)
+    {
+        image[i] *= scale;
+    }
+    return used;
+}
+
+#endif // HADAMARD_RECONSTRUCTION_H
@@ -0,0 +1,112 @@
+#ifndef IMAGE_OUTPUT_H
+#define IMAGE_OUTPUT_H
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <stdexcept>
+
+// Writes a reconstructed image (width x height values, row by row).
+//
+//   *.txt - the values as a text matrix, one image row per line, for
+//           Octave's load()
+//   other - 8-bit binary PGM, scaled so that the smallest value is black
+//           and the largest white
+template<typename T>
+void write_reconstructed_image(const std::string& path, const std::vector<T>& image, int width, int height)
+{
+    bool text = path.size() >= 4 && path.compare(path.size() - 4, 4, ".txt") == 0;
+    FILE* f = fopen(path.c_str(), text ? "w" : "wb");
+    if(f == NULL)
+    {
+        throw std::runtime_error("Could not write " + path);
+    }
+
+    if(text)
+    {
+        for(int y = 0; y < height; ++y)
+        {
+            for(int x = 0; x < width; ++x)
+            {
+                fprintf(f, (x + 1 < width) ? "%.9g " : "%.9g\n", static_cast<double>(image[static_cast<size_t>(y)*width + x]));
+            }
+        }
+    }
+    else
+    {
+        double low = image.empty() ? 0 : image[0];
+        double high = low;
+        for(size_t i = 0; i < image.size(); ++i)
+        {
+            low = (image[i] < low) ? image[i] : low;
+            high = (image[i] > high) ? image[i] : high;
+        }
+        double scale = (high > low) ? 255.0 / (high - low) : 0.0;
+        std::vector<unsigned char> pixels(image.size());
+        for(size_t i = 0; i < image.size(); ++i)
+        {
+            pixels[i] = static_cast<unsigned char>((image[i] - low)*scale + 0.5);
+        }
+        fprintf(f, "P5\n%d %d\n255\n", width, height);
+        if( ! pixels.empty())
+        {
+            fwrite(&pixels[0], 1, pixels.size(), f);
+        }
+    }
+
+    if(fclose(f) != 0)
+    {
+        throw std::runtime_error("Could not write " + path);
+    }
+}
+
+// Reads a text matrix as written above (for example a previous result
+// used as the starting image).  Returns the values row by row.
+inline std::vector<double> read_text_image(const std::string& path, int& width, int& height)
+{
+    FILE* f = fopen(path.c_str(), "r");
+    if(f == NULL)
+    {
+        throw std::runtime_error("Could not open " + path);
+    }
+    std::vector<double> values;
+    width = 0;
+    height = 0;
+    std::string line;
+    int c;
+    do
+    {
+        c = fgetc(f);
+        if(c != '\n' && c != EOF)
+        {
+            line += static_cast<char>(c);
+            continue;
+        }
+        int count = 0;
+        const char* p = line.c_str();
+        char* end;
+        for(double v = strtod(p, &end); end != p; v = strtod(p, &end))
+        {
+            values.push_back(v);
+            ++count;
+            p = end;
+        }
+        line.clear();
+        if(count == 0)
+        {
+            continue;
+        }
+        if(width != 0 && count != width)
+        {
+            fclose(f);
+            throw std::runtime_error(path + " does not have the same number of values on every line");
+        }
+        width = count;
+        ++height;
+    } while(c != EOF);
+    fclose(f);
+    return values;
+}
+
+#endif // IMAGE_OUTPUT_H
@@ -0,0 +1,277 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <string>
+#include <stdexcept>
+#include <stdint.h>
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+// Offsets of mapped views have to be multiples of this.  It is the
+// Windows allocation granularity, which is also a multiple of the page
+// size everywhere else, so files laid out with it map on any system.
+static const uint64_t MAPPING_ALIGNMENT = 65536;
+
+inline uint64_t round_up_to_mapping(uint64_t n)
+{
+    return (n + MAPPING_ALIGNMENT - 1) / MAPPING_ALIGNMENT * MAPPING_ALIGNMENT;
+}
+
+
+// A mapped window into a MappedFile.  Unmapped when destroyed.
+class MappedView
+{
+public:
+    MappedView() : base(NULL), length(0) { }
+    MappedView(char* p, size_t n) : base(p), length(n) { }
+    ~MappedView() { unmap(); }
+
+    MappedView(MappedView&& other) : base(other.base), length(other.length)
+    {
+        other.base = NULL;
+        other.length = 0;
+    }
+
+    MappedView& operator=(MappedView&& other)
+    {
+        if(this != &other)
+        {
+            unmap();
+            base = other.base;
+            length = other.length;
+            other.base = NULL;
+            other.length = 0;
+        }
+        return *this;
+    }
+
+    char* data() const { return base; }
+    size_t size() const { return length; }
+    bool empty() const { return base == NULL; }
+
+    // Push the dirty pages of this view towards the disk.
+    void flush()
+    {
+        if(base == NULL)
+        {
+            return;
+        }
+#ifdef _WIN32
+        FlushViewOfFile(base, length);
+#else
+        msync(base, length, MS_ASYNC);
+#endif
+    }
+
+private:
+    char* base;
+    size_t length;
+
+    MappedView(const MappedView&);
+    MappedView& operator=(const MappedView&);
+
+    void unmap()
+    {
+        if(base == NULL)
+        {
+            return;
+        }
+#ifdef _WIN32
+        UnmapViewOfFile(base);
+#else
+        munmap(base, length);
+#endif
+        base = NULL;
+        length = 0;
+    }
+};
+
+
+// A file that is accessed through mapped views rather than read/write.
+// Views are mapped on demand so that files larger than the address
+// space of a 32-bit process still work.
+class MappedFile
+{
+public:
+    // Create (or truncate) a file of exactly the given size.  The
+    // space is reserved up front so later writes never extend it.
+    static MappedFile create(const std::string& path, uint64_t size)
+    {
+        MappedFile f;
+        f.writable = true;
+        f.file_size = size;
+#ifdef _WIN32
+        f.file = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+        if(f.file == INVALID_HANDLE_VALUE)
+        {
+            throw std::runtime_error("Could not create " + path);
+        }
+        LARGE_INTEGER end;
+        end.QuadPart = static_cast<LONGLONG>(size);
+        if( ! SetFilePointerEx(f.file, end, NULL, FILE_BEGIN) || ! SetEndOfFile(f.file))
+        {
+            throw std::runtime_error("Could not reserve space for " + path);
+        }
+#else
+        f.fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if(f.fd < 0)
+        {
+            throw std::runtime_error("Could not create " + path);
+        }
+        if(ftruncate(f.fd, static_cast<off_t>(size)) != 0)
+        {
+            throw std::runtime_error("Could not reserve space for " + path);
+        }
+#endif
+        f.create_mapping(path);
+        return f;
+    }
+
+    static MappedFile open(const std::string& path, bool writable)
+    {
+        MappedFile f;
+        f.writable = writable;
+#ifdef _WIN32
+        f.file = CreateFileA(path.c_str(), writable ? (GENERIC_READ | GENERIC_WRITE) : GENERIC_READ,
+                             FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+        if(f.file == INVALID_HANDLE_VALUE)
+        {
+            throw std::runtime_error("Could not open " + path);
+        }
+        LARGE_INTEGER size;
+        GetFileSizeEx(f.file, &size);
+        f.file_size = static_cast<uint64_t>(size.QuadPart);
+#else
+        f.fd = ::open(path.c_str(), writable ? O_RDWR : O_RDONLY);
+        if(f.fd < 0)
+        {
+            throw std::runtime_error("Could not open " + path);
+        }
+        struct stat info;
+        fstat(f.fd, &info);
+        f.file_size = static_cast<uint64_t>(info.st_size);
+#endif
+        f.create_mapping(path);
+        return f;
+    }
+
+    MappedFile(MappedFile&& other) { take(other); }
+    MappedFile& operator=(MappedFile&& other)
+    {
+        if(this != &other)
+        {
+            close();
+            take(other);
+        }
+        return *this;
+    }
+    ~MappedFile() { close(); }
+
+    uint64_t size() const { return file_size; }
+
+    // offset must be a multiple of MAPPING_ALIGNMENT.
+    MappedView map(uint64_t offset, size_t length) const
+    {
+        if(offset % MAPPING_ALIGNMENT != 0 || offset + length > file_size)
+        {
+            throw std::runtime_error("Mapped view outside of file");
+        }
+#ifdef _WIN32
+        void* p = MapViewOfFile(mapping, writable ? FILE_MAP_WRITE : FILE_MAP_READ,
+                                static_cast<DWORD>(offset >> 32), static_cast<DWORD>(offset & 0xFFFFFFFFu), length);
+        if(p == NULL)
+        {
+            throw std::runtime_error("MapViewOfFile failed");
+        }
+#else
+        void* p = mmap(NULL, length, writable ? (PROT_READ | PROT_WRITE) : PROT_READ, MAP_SHARED, fd, static_cast<off_t>(offset));
+        if(p == MAP_FAILED)
+        {
+            throw std::runtime_error("mmap failed");
+        }
+#endif
+        return MappedView(static_cast<char*>(p), length);
+    }
+
+private:
+#ifdef _WIN32
+    HANDLE file;
+    HANDLE mapping;
+#else
+    int fd;
+#endif
+    uint64_t file_size;
+    bool writable;
+
+    MappedFile() : file_size(0), writable(false)
+    {
+#ifdef _WIN32
+        file = INVALID_HANDLE_VALUE;
+        mapping = NULL;
+#else
+        fd = -1;
+#endif
+    }
+
+    MappedFile(const MappedFile&);
+    MappedFile& operator=(const MappedFile&);
+
+    void create_mapping(const std::string& path)
+    {
+#ifdef _WIN32
+        mapping = CreateFileMappingA(file, NULL, writable ? PAGE_READWRITE : PAGE_READONLY, 0, 0, NULL);
+        if(mapping == NULL)
+        {
+            throw std::runtime_error("Could not map " + path);
+        }
+#else
+        (void)path;
+#endif
+    }
+
+    void take(MappedFile& other)
+    {
+#ifdef _WIN32
+        file = other.file;
+        mapping = other.mapping;
+        other.file = INVALID_HANDLE_VALUE;
+        other.mapping = NULL;
+#else
+        fd = other.fd;
+        other.fd = -1;
+#endif
+        file_size = other.file_size;
+        writable = other.writable;
+    }
+
+    void close()
+    {
+#ifdef _WIN32
+        if(mapping != NULL)
+        {
+            CloseHandle(mapping);
+            mapping = NULL;
+        }
+        if(file != INVALID_HANDLE_VALUE)
+        {
+            CloseHandle(file);
+            file = INVALID_HANDLE_VALUE;
+        }
+#else
+        if(fd >= 0)
+        {
+            ::close(fd);
+            fd = -1;
+        }
+#endif
+    }
+};
+
+#endif // MAPPED_FILE_H
@@ -0,0 +1,257 @@
+#ifndef MEASUREMENT_OPERATORS_H
+#define MEASUREMENT_OPERATORS_H
+
+#include <vector>
+#include <thread>
+#include <stdexcept>
+#include <stdint.h>
+#include "fwht.h"
+#include "hadamard_patterns.h"
+#include "procedural_patterns.h"
+#include "parallel_for.h"
+
+// Measurement operators for single-pixel reconstruction.
+//
+// A scan of m patterns over an image of n macro pixels is y = A*x, with
+// one row of A per measured pattern.  The operators never store A: the
+// Hadamard operator uses the fast transform and the procedural operator
+// draws each pattern again from its seed whenever it is needed, so the
+// memory used is O(n + m) instead of O(n*m).
+class MeasurementOperator
+{
+public:
+    virtual ~MeasurementOperator() { }
+
+    virtual size_t rows() const = 0;      // measurements
+    virtual size_t columns() const = 0;   // image pixels
+
+    // y = A*x
+    virtual void forward(const std::vector<double>& x, std::vector<double>& y) = 0;
+    // x = A'*y
+    virtual void adjoint(const std::vector<double>& y, std::vector<double>& x) = 0;
+
+    // Bytes held by the operator itself.
+    virtual size_t memory_bytes() const = 0;
+};
+
+
+// Rows of the +1/-1 Hadamard matrix, picked by their position in an
+// ordering.  Both directions are one fast transform.
+class HadamardOperator : public MeasurementOperator
+{
+public:
+    // positions: which patterns of the ordering were measured.
+    HadamardOperator(HadamardOrdering ordering, uint32_t grid_w, uint32_t grid_h,
+                     const std::vector<uint32_t>& positions, int threads)
+        : threads(threads)
+    {
+        std::vector<uint32_t> order = hadamard_order(ordering, grid_w, grid_h);
+        rows_natural.resize(positions.size());
+        for(size_t k = 0; k < positions.size(); ++k)
+        {
+            if(positions[k] >= order.size())
+            {
+                throw std::out_of_range("Hadamard pattern beyond the pattern set");
+            }
+            rows_natural[k] = order[positions[k]];
+        }
+        work.resize(order.size());
+    }
+
+    size_t rows() const { return rows_natural.size(); }
+    size_t columns() const { return work.size(); }
+
+    void forward(const std::vector<double>& x, std::vector<double>& y)
+    {
+        work = x;
+        fwht(&work[0], work.size(), threads);
+        y.resize(rows_natural.size());
+        for(size_t k = 0; k < rows_natural.size(); ++k)
+        {
+            y[k] = work[rows_natural[k]];
+        }
+    }
+
+    void adjoint(const std::vector<double>& y, std::vector<double>& x)
+    {
+        // H is symmetric, so A' scatters y and transforms.
+        x.assign(work.size(), 0.0);
+        for(size_t k = 0; k < rows_natural.size(); ++k)
+        {
+            x[rows_natural[k]] = y[k];
+        }
+        fwht(&x[0], x.size(), threads);
+    }
+
+    size_t memory_bytes() const
+    {
+        return rows_natural.capacity()*sizeof(uint32_t) + work.capacity()*sizeof(double);
+    }
+
+private:
+    int threads;
+    std::vector<uint32_t> rows_natural;
+    std::vector<double> work;
+};
+
+
+// Procedural patterns, one row per frame number.  Patterns are 0/1, or
+// +1/-1 (on = +1, off = -1) for differential measurements.
+class ProceduralOperator : public MeasurementOperator
+{
+public:
+    ProceduralOperator(const ProceduralSpec& spec, const std::vector<uint64_t>& frames, bool signed_patterns, int threads)
+        : spec(spec), frames(frames), signed_patterns(signed_patterns)
+    {
+        if(spec.grid_w == 0 || spec.grid_h == 0)
+        {
+            throw std::invalid_argument("Procedural patterns for reconstruction need a size");
+        }
+        pixels = static_cast<size_t>(spec.grid_w) * spec.grid_h;
+        int workers = (threads <= 0) ? static_cast<int>(std::thread::hardware_concurrency()) : threads;
+        workers = std::max(1, std::min<int>(workers, static_cast<int>(std::max<size_t>(frames.size(), 1))));
+        scratch.resize(workers);
+    }
+
+    size_t rows() const { return frames.size(); }
+    size_t columns() const { return pixels; }
+
+    void forward(const std::vector<double>& x, std::vector<double>& y)
+    {
+        y.resize(frames.size());
+        double total = 0;
+        for(size_t j = 0; j < pixels; ++j)
+        {
+            total += x[j];
+        }
+        const int workers = static_cast<int>(scratch.size());
+        parallel_for(workers, workers, [&](int w)
+        {
+            Scratch& s = scratch[w];
+            for(size_t i = first_row(w); i < first_row(w + 1); ++i)
+            {
+                double on = on_sum(frames[i], x, s);
+                y[i] = signed_patterns ? 2*on - total : on;
+            }
+        });
+    }
+
+    void adjoint(const std::vector<double>& y, std::vector<double>& x)
+    {
+        const int workers = static_cast<int>(scratch.size());
+        parallel_for(workers, workers, [&](int w)
+        {
+            Scratch& s = scratch[w];
+            s.sum.assign(pixels, 0.0);
+            for(size_t i = first_row(w); i < first_row(w + 1); ++i)
+            {
+                add_pattern(frames[i], y[i], s);
+            }
+        });
+
+        double total = 0;
+        for(size_t i = 0; i < y.size(); ++i)
+        {
+            total += y[i];
+        }
+        x.assign(pixels, 0.0);
+        for(int w = 0; w < workers; ++w)
+        {
+            const std::vector<double>& sum = scratch[w].sum;
+            for(size_t j = 0; j < pixels; ++j)
+            {
+                x[j] += sum[j];
+            }
+        }
+        if(signed_patterns)
+        {
+            for(size_t j = 0; j < pixels; ++j)
+            {
+                x[j] = 2*x[j] - total;
+            }
+        }
+    }
+
+    size_t memory_bytes() const
+    {
+        size_t bytes = frames.capacity()*sizeof(uint64_t);
+        for(size_t w = 0; w < scratch.size(); ++w)
+        {
+            bytes += scratch[w].row.capacity() + scratch[w].used.capacity()
+                   + scratch[w].on_pixels.capacity()*sizeof(uint32_t) + scratch[w].sum.capacity()*sizeof(double);
+        }
+        return bytes;
+    }
+
+private:
+    struct Scratch
+    {
+        std::vector<unsigned char> row;
+        std::vector<unsigned char> used;
+        std::vector<uint32_t> on_pixels;
+        std::vector<double> sum;
+    };
+
+    ProceduralSpec spec;
+    std::vector<uint64_t> frames;
+    bool signed_patterns;
+    size_t pixels;
+    std::vector<Scratch> scratch;
+
+    size_t first_row(int worker) const
+    {
+        return frames.size()*worker / scratch.size();
+    }
+
+    // Sum of x over the pixels that are on in the pattern of `frame`.
+    double on_sum(uint64_t frame, const std::vector<double>& x, Scratch& s)
+    {
+        double sum = 0;
+        if(spec.type == PROCEDURAL_SPARSE)
+        {
+            procedural_sparse_pixels(spec, frame, s.on_pixels, s.used);
+            for(size_t k = 0; k < s.on_pixels.size(); ++k)
+            {
+                sum += x[s.on_pixels[k]];
+            }
+            return sum;
+        }
+        s.row.resize(spec.grid_w);
+        for(uint32_t gy = 0; gy < spec.grid_h; ++gy)
+        {
+            procedural_grid_row(spec, frame, gy, &s.row[0]);
+            const double* xr = &x[static_cast<size_t>(gy)*spec.grid_w];
+            for(uint32_t gx = 0; gx < spec.grid_w; ++gx)
+            {
+                sum += s.row[gx] * xr[gx];
+            }
+        }
+        return sum;
+    }
+
+    // s.sum += value on the pixels that are on in the pattern of `frame`.
+    void add_pattern(uint64_t frame, double value, Scratch& s)
+    {
+        if(spec.type == PROCEDURAL_SPARSE)
+        {
+            procedural_sparse_pixels(spec, frame, s.on_pixels, s.used);
+            for(size_t k = 0; k < s.on_pixels.size(); ++k)
+            {
+                s.sum[s.on_pixels[k]] += value;
+            }
+            return;
+        }
+        s.row.resize(spec.grid_w);
+        for(uint32_t gy = 0; gy < spec.grid_h; ++gy)
+        {
+            procedural_grid_row(spec, frame, gy, &s.row[0]);
+            double* sr = &s.sum[static_cast<size_t>(gy)*spec.grid_w];
+            for(uint32_t gx = 0; gx < spec.grid_w; ++gx)
+            {
+                sr[gx] += s.row[gx] * value;
+            }
+        }
+    }
+};
+
+#endif // MEASUREMENT_OPERATORS_H
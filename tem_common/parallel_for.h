@@ -0,0 +1,167 @@
+#ifndef PARALLEL_FOR_H
+#define PARALLEL_FOR_H
+
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+
+// Run f(i) for i in [0, count) on up to `threads` threads (0 = all cores).
+template<typename F>
+void parallel_for(int count, int threads, F f)
+{
+    if(threads <= 0)
+    {
+        threads = static_cast<int>(std::thread::hardware_concurrency());
+    }
+    if(threads > count)
+    {
+        threads = count;
+    }
+    if(threads <= 1)
+    {
+        for(int i = 0; i < count; ++i)
+        {
+            f(i);
+        }
+        return;
+    }
+
+    std::atomic<int> next(0);
+    std::vector<std::thread> workers;
+    for(int t = 0; t < threads; ++t)
+    {
+        workers.push_back(std::thread([&]()
+        {
+            for(int i = next++; i < count; i = next++)
+            {
+                f(i);
+            }
+        }));
+    }
+    for(size_t t = 0; t < workers.size(); ++t)
+    {
+        workers[t].join();
+    }
+}
+
+// Like parallel_for, on threads started once instead of for every call,
+// for loops that run for every picture: starting threads allocates, and
+// takes longer than a small picture does.  The calling thread is one of
+// the `threads` (0 = all cores).  One run() at a time.
+class WorkerPool
+{
+public:
+    explicit WorkerPool(int threads)
+        : job_call(NULL), job_context(NULL), job_count(0), next(0), generation(0), busy(0), stopping(false)
+    {
+        if(threads <= 0)
+        {
+            threads = static_cast<int>(std::thread::hardware_concurrency());
+        }
+        for(int t = 1; t < threads; ++t)
+        {
+            workers.push_back(std::thread([this]() { work_loop(); }));
+        }
+    }
+
+    ~WorkerPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        started.notify_all();
+        for(size_t t = 0; t < workers.size(); ++t)
+        {
+            workers[t].join();
+        }
+    }
+
+    int size() const { return static_cast<int>(workers.size()) + 1; }
+
+    // f(i) for i in [0, count); returns when all are done.
+    template<typename F>
+    void run(int count, F& f)
+    {
+        if(workers.empty() || count <= 1)
+        {
+            for(int i = 0; i < count; ++i)
+            {
+                f(i);
+            }
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            job_call = &call<F>;
+            job_context = &f;
+            job_count = count;
+            next.store(0);
+            busy = static_cast<int>(workers.size());
+            ++generation;
+        }
+        started.notify_all();
+        work();
+        std::unique_lock<std::mutex> lock(mutex);
+        finished.wait(lock, [this]() { return busy == 0; });
+    }
+
+private:
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable started;
+    std::condition_variable finished;
+    void (*job_call)(void*, int);
+    void* job_context;
+    int job_count;
+    std::atomic<int> next;
+    unsigned generation;
+    int busy;                     // workers not done with this run
+    bool stopping;
+
+    WorkerPool(const WorkerPool&);
+    WorkerPool& operator=(const WorkerPool&);
+
+    // The function is called through a plain pointer, so that handing
+    // it to the workers does not allocate as std::function may.
+    template<typename F>
+    static void call(void* f, int i)
+    {
+        (*static_cast<F*>(f))(i);
+    }
+
+    void work()
+    {
+        for(int i = next++; i < job_count; i = next++)
+        {
+            job_call(job_context, i);
+        }
+    }
+
+    void work_loop()
+    {
+        unsigned seen = 0;
+        for(;;)
+        {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                started.wait(lock, [this, seen]() { return stopping || generation != seen; });
+                if(stopping)
+                {
+                    return;
+                }
+                seen = generation;
+            }
+            work();
+            std::lock_guard<std::mutex> lock(mutex);
+            if(--busy == 0)
+            {
+                finished.notify_one();
+            }
+        }
+    }
+};
+
+#endif // PARALLEL_FOR_H
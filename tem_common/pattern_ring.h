@@ -0,0 +1,455 @@
+#ifndef PATTERN_RING_H
+#define PATTERN_RING_H
+
+#include <cstring>
+#include <string>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <limits>
+#include <functional>
+#include <stdexcept>
+#include <stdint.h>
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <cerrno>
+#include <ctime>
+#include <fcntl.h>
+#include <unistd.h>
+#include <semaphore.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+// A ring of pattern slots in named shared memory, through which a client
+// (a MEX/oct file, a script's helper program) hands patterns to the
+// loader without files:
+//
+//   header   PatternRingHeader, 192 bytes
+//   slot i   at 192 + i*slot_stride: PatternSlotHeader (64 bytes), then
+//            up to slot_bytes of pattern
+//
+// The client fills slot (submitted % slot_count) and then increases
+// `submitted`; the loader shows it, increases `shown` and the client
+// may use the slot again.  Two named semaphores wake the other side:
+// <name>-submitted after each submit and <name>-shown after each
+// pattern shown.  The counters are only ever increased, each by one
+// side, with release stores and acquire loads, so no lock is needed.
+//
+// There is one <name>-shown semaphore and every post wakes one waiter,
+// so a ring has a single client: one PatternRing object, used by one
+// thread at a time.  A second waiter would take posts meant for the
+// first, which then waits out its timeout although its pattern was shown.
+//
+// A client checks the geometry in the header against the size of the
+// shared memory before using it, and keeps its own copy, so that a
+// damaged or foreign header cannot send it outside the mapping.
+//
+// Slot pictures are mirror_w x mirror_h (or smaller, placed like a
+// picture file), in one of two formats:
+//   PATTERN_SLOT_BYTES  one byte per pixel, the loader's 0 (off) and 128
+//                       (on); a full-size slot goes to the mirror as is
+//   PATTERN_SLOT_BITS   one bit per pixel, rows of (width + 7) / 8 bytes,
+//                       pixel x in bit x % 8 of byte x / 8
+
+struct PatternRingHeader
+{
+    char magic[8];            // "TEMRING1"
+    uint32_t slot_count;
+    uint32_t slot_bytes;
+    uint32_t slot_stride;
+    uint32_t mirror_w;
+    uint32_t mirror_h;
+    uint32_t reserved[9];
+    uint32_t submitted;       // written by the client only
+    uint32_t pad1[15];
+    uint32_t shown;           // written by the loader only
+    uint32_t pad2[15];
+};
+
+enum PatternSlotFormat
+{
+    PATTERN_SLOT_BYTES = 1,
+    PATTERN_SLOT_BITS = 2
+};
+
+struct PatternSlotHeader
+{
+    uint32_t format;          // PatternSlotFormat
+    uint32_t width;
+    uint32_t height;
+    int32_t pattern_id;       // passed through to acknowledgements
+    uint32_t reserved[12];
+};
+
+static const size_t PATTERN_RING_HEADER_BYTES = sizeof(PatternRingHeader);
+static const size_t PATTERN_SLOT_HEADER_BYTES = sizeof(PatternSlotHeader);
+
+
+// A named semaphore shared between processes.
+class NamedSemaphore
+{
+public:
+    NamedSemaphore(const std::string& name, bool create) : name(name), owner(create)
+    {
+#ifdef _WIN32
+        handle = create ? CreateSemaphoreA(NULL, 0, 0x7FFFFFFF, name.c_str())
+                        : OpenSemaphoreA(SEMAPHORE_ALL_ACCESS, FALSE, name.c_str());
+        if(handle == NULL)
+        {
+            throw std::runtime_error("Could not open semaphore " + name);
+        }
+#else
+        if(create)
+        {
+            sem_unlink(("/" + name).c_str());
+        }
+        handle = create ? sem_open(("/" + name).c_str(), O_CREAT | O_EXCL, 0600, 0)
+                        : sem_open(("/" + name).c_str(), 0);
+        if(handle == SEM_FAILED)
+        {
+            throw std::runtime_error("Could not open semaphore " + name);
+        }
+#endif
+    }
+
+    ~NamedSemaphore()
+    {
+#ifdef _WIN32
+        CloseHandle(handle);
+#else
+        sem_close(handle);
+        if(owner)
+        {
+            sem_unlink(("/" + name).c_str());
+        }
+#endif
+    }
+
+    void post()
+    {
+#ifdef _WIN32
+        ReleaseSemaphore(handle, 1, NULL);
+#else
+        sem_post(handle);
+#endif
+    }
+
+    // False if nothing was posted within timeout_ms.
+    bool wait(int timeout_ms)
+    {
+#ifdef _WIN32
+        return WaitForSingleObject(handle, timeout_ms) == WAIT_OBJECT_0;
+#else
+        timespec until;
+        clock_gettime(CLOCK_REALTIME, &until);
+        until.tv_sec += timeout_ms / 1000;
+        until.tv_nsec += static_cast<long>(timeout_ms % 1000) * 1000000;
+        if(until.tv_nsec >= 1000000000)
+        {
+            until.tv_sec += 1;
+            until.tv_nsec -= 1000000000;
+        }
+        int r;
+        while((r = sem_timedwait(handle, &until)) != 0 && errno == EINTR)
+        {
+        }
+        return r == 0;
+#endif
+    }
+
+private:
+    std::string name;
+    bool owner;
+#ifdef _WIN32
+    HANDLE handle;
+#else
+    sem_t* handle;
+#endif
+
+    NamedSemaphore(const NamedSemaphore&);
+    NamedSemaphore& operator=(const NamedSemaphore&);
+};
+
+
+// Named shared memory, not backed by any file.
+class SharedMemory
+{
+public:
+    SharedMemory(const std::string& name, size_t size, bool create) : name(name), owner(create), base(NULL), length(size)
+    {
+#ifdef _WIN32
+        mapping = create ? CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE,
+                                              static_cast<DWORD>(static_cast<uint64_t>(size) >> 32), static_cast<DWORD>(size), name.c_str())
+                         : OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, name.c_str());
+        if(mapping == NULL)
+        {
+            throw std::runtime_error("Could not open shared memory " + name);
+        }
+        base = static_cast<char*>(MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, size));
+        if(base == NULL)
+        {
+            CloseHandle(mapping);
+            throw std::runtime_error("Could not map shared memory " + name);
+        }
+#else
+        const std::string path = "/" + name;
+        int fd = create ? shm_open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600)
+                        : shm_open(path.c_str(), O_RDWR, 0);
+        if(fd < 0)
+        {
+            throw std::runtime_error("Could not open shared memory " + name);
+        }
+        if(create && ftruncate(fd, static_cast<off_t>(size)) != 0)
+        {
+            close(fd);
+            shm_unlink(path.c_str());
+            throw std::runtime_error("Could not size shared memory " + name);
+        }
+        // Mapping past the end of an existing object would fault on use.
+        struct stat st;
+        if( ! create && (fstat(fd, &st) != 0 || static_cast<uint64_t>(st.st_size) < size))
+        {
+            close(fd);
+            throw std::runtime_error("Shared memory " + name + " is smaller than it claims");
+        }
+        void* p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        if(p == MAP_FAILED)
+        {
+            if(create)
+            {
+                shm_unlink(path.c_str());
+            }
+            throw std::runtime_error("Could not map shared memory " + name);
+        }
+        base = static_cast<char*>(p);
+#endif
+    }
+
+    ~SharedMemory()
+    {
+#ifdef _WIN32
+        UnmapViewOfFile(base);
+        CloseHandle(mapping);
+#else
+        munmap(base, length);
+        if(owner)
+        {
+            shm_unlink(("/" + name).c_str());
+        }
+#endif
+    }
+
+    char* data() const { return base; }
+    size_t size() const { return length; }
+
+private:
+    std::string name;
+    bool owner;
+    char* base;
+    size_t length;
+#ifdef _WIN32
+    HANDLE mapping;
+#endif
+
+    SharedMemory(const SharedMemory&);
+    SharedMemory& operator=(const SharedMemory&);
+};
+
+
+class PatternRing
+{
+public:
+    // The loader's side: creates the ring.
+    PatternRing(const std::string& name, uint32_t slot_count, uint32_t mirror_w, uint32_t mirror_h)
+        : memory(name, total_size(slot_count, slot_stride_for(mirror_w, mirror_h)), true),
+          submitted_signal(name + "-submitted", true), shown_signal(name + "-shown", true),
+          header(reinterpret_cast<PatternRingHeader*>(memory.data())),
+          slots(slot_count), stride(slot_stride_for(mirror_w, mirror_h)), bytes(mirror_w*mirror_h),
+          width(mirror_w), height(mirror_h), watching(false)
+    {
+        if(slot_count == 0)
+        {
+            throw std::invalid_argument("A pattern ring needs at least one slot");
+        }
+        memset(header, 0, sizeof(*header));
+        header->slot_count = slot_count;
+        header->slot_bytes = mirror_w*mirror_h;
+        header->slot_stride = slot_stride_for(mirror_w, mirror_h);
+        header->mirror_w = mirror_w;
+        header->mirror_h = mirror_h;
+        // The magic goes in last: a client that sees it sees the rest.
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+        memcpy(header->magic, "TEMRING1", 8);
+    }
+
+    // A client's side: opens the ring the loader created.
+    explicit PatternRing(const std::string& name)
+        : memory(name, PATTERN_RING_HEADER_BYTES, false),
+          submitted_signal(name + "-submitted", false), shown_signal(name + "-shown", false),
+          header(reinterpret_cast<PatternRingHeader*>(memory.data())), slots(0), stride(0), bytes(0), width(0), height(0), watching(false)
+    {
+        if(memcmp(header->magic, "TEMRING1", 8) != 0)
+        {
+            throw std::runtime_error("Shared memory " + name + " is not a pattern ring");
+        }
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        PatternRingHeader h;
+        memcpy(&h, header, sizeof(h));
+        const uint64_t mirror_pixels = static_cast<uint64_t>(h.mirror_w)*h.mirror_h;
+        if(h.slot_count == 0 || mirror_pixels != h.slot_bytes
+           || mirror_pixels > std::numeric_limits<uint32_t>::max() - PATTERN_SLOT_HEADER_BYTES - 63
+           || h.slot_stride != slot_stride_for(h.mirror_w, h.mirror_h)
+           || h.slot_count > (std::numeric_limits<size_t>::max() - PATTERN_RING_HEADER_BYTES) / h.slot_stride)
+        {
+            throw std::runtime_error("Pattern ring " + name + " has a damaged header");
+        }
+        slots = h.slot_count;
+        stride = h.slot_stride;
+        bytes = h.slot_bytes;
+        width = h.mirror_w;
+        height = h.mirror_h;
+        // Map it again at its full size, which fails if the shared
+        // memory is smaller.
+        full.reset(new SharedMemory(name, total_size(slots, stride), false));
+        header = reinterpret_cast<PatternRingHeader*>(full->data());
+    }
+
+    ~PatternRing()
+    {
+        stop_watching();
+    }
+
+    uint32_t slot_count() const { return slots; }
+    uint32_t slot_bytes() const { return bytes; }
+    uint32_t mirror_width() const { return width; }
+    uint32_t mirror_height() const { return height; }
+
+    PatternSlotHeader& slot_header(uint32_t i)
+    {
+        return *reinterpret_cast<PatternSlotHeader*>(slot_base(i));
+    }
+
+    unsigned char* slot_data(uint32_t i)
+    {
+        return reinterpret_cast<unsigned char*>(slot_base(i) + PATTERN_SLOT_HEADER_BYTES);
+    }
+
+    uint32_t submitted_count() const { return __atomic_load_n(&header->submitted, __ATOMIC_ACQUIRE); }
+    uint32_t shown_count() const { return __atomic_load_n(&header->shown, __ATOMIC_ACQUIRE); }
+
+    // Client: the slot to fill next, waiting up to timeout_ms for one to
+    // be free.  Returns its index, or -1 if none became free.
+    int64_t begin_submit(int timeout_ms)
+    {
+        const uint32_t next = header->submitted;
+        while(next - shown_count() >= slots)
+        {
+            if( ! shown_signal.wait(timeout_ms))
+            {
+                return -1;
+            }
+        }
+        return next % slots;
+    }
+
+    // Client: hand the slot from begin_submit() to the loader.
+    void submit()
+    {
+        __atomic_store_n(&header->submitted, header->submitted + 1, __ATOMIC_RELEASE);
+        submitted_signal.post();
+    }
+
+    // Client: wait until the loader has shown `count` patterns in all.
+    // Only the ring's one client may wait (see above).
+    bool wait_shown(uint32_t count, int timeout_ms)
+    {
+        while(static_cast<int32_t>(count - shown_count()) > 0)
+        {
+            if( ! shown_signal.wait(timeout_ms))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Loader: the slot of the next pattern to show, or -1 if the client
+    // has not submitted one.
+    int64_t next_submitted() const
+    {
+        const uint32_t next = header->shown;
+        return (submitted_count() != next) ? static_cast<int64_t>(next % slots) : -1;
+    }
+
+    // Loader: the pattern from next_submitted() is on the mirror.
+    void finish_shown()
+    {
+        __atomic_store_n(&header->shown, header->shown + 1, __ATOMIC_RELEASE);
+        shown_signal.post();
+    }
+
+    // Loader: call `notify` (on a thread of its own) whenever the client
+    // submits.  Stopped when the ring is destroyed.
+    void watch(const std::function<void()>& notify)
+    {
+        stop_watching();
+        watching = true;
+        watcher = std::thread([this, notify]()
+        {
+            while(watching)
+            {
+                if(submitted_signal.wait(100))
+                {
+                    notify();
+                }
+            }
+        });
+    }
+
+    static uint32_t slot_stride_for(uint32_t mirror_w, uint32_t mirror_h)
+    {
+        return static_cast<uint32_t>((PATTERN_SLOT_HEADER_BYTES + static_cast<size_t>(mirror_w)*mirror_h + 63) / 64 * 64);
+    }
+
+    static size_t total_size(uint32_t slot_count, uint32_t slot_stride)
+    {
+        return PATTERN_RING_HEADER_BYTES + static_cast<size_t>(slot_count)*slot_stride;
+    }
+
+private:
+    SharedMemory memory;
+    std::unique_ptr<SharedMemory> full;
+    NamedSemaphore submitted_signal;
+    NamedSemaphore shown_signal;
+    PatternRingHeader* header;
+    uint32_t slots;         // geometry, checked once and not read back
+    uint32_t stride;
+    uint32_t bytes;
+    uint32_t width;
+    uint32_t height;
+    std::atomic<bool> watching;
+    std::thread watcher;
+
+    char* slot_base(uint32_t i)
+    {
+        return reinterpret_cast<char*>(header) + PATTERN_RING_HEADER_BYTES + static_cast<size_t>(i)*stride;
+    }
+
+    void stop_watching()
+    {
+        watching = false;
+        if(watcher.joinable())
+        {
+            watcher.join();
+        }
+    }
+
+    PatternRing(const PatternRing&);
+    PatternRing& operator=(const PatternRing&);
+};
+
+#endif // PATTERN_RING_H
@@ -0,0 +1,282 @@
+#ifndef PATTERN_SPEC_H
+#define PATTERN_SPEC_H
+
+#include <cstdlib>
+#include <map>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <stdexcept>
+#include <stdint.h>
+#include "hadamard_patterns.h"
+#include "procedural_patterns.h"
+#include "fiducial_patterns.h"
+#include "placement_map.h"
+#include "bit_planes.h"
+
+// A generated pattern, as written on one line of the loader's input:
+//
+//   @<type> [value...] [key=value...] [flag...]
+//
+// for example "@hadamard 17 size=64x64 macro=8 order=sequency neg".
+// Words without '=' that are numbers are positional values; other
+// words are flags.  Lines that do not start with '@' are file names.
+//
+// The same lines describe the patterns of a scan to the reconstruction
+// tools, usually without the frame number.
+
+class PatternSpec
+{
+public:
+    std::string type;
+    std::vector<std::string> values;
+    std::map<std::string, std::string> options;
+    std::set<std::string> flags;
+
+    static bool is_spec(const std::string& line)
+    {
+        return ! line.empty() && line[0] == '@';
+    }
+
+    static PatternSpec parse(const std::string& line)
+    {
+        PatternSpec spec;
+        std::istringstream words(line.substr(1));
+        if( ! (words >> spec.type))
+        {
+            throw std::invalid_argument("Pattern line without a pattern type: " + line);
+        }
+        std::string word;
+        while(words >> word)
+        {
+            std::string::size_type equals = word.find('=');
+            if(equals != std::string::npos)
+            {
+                spec.options[word.substr(0, equals)] = word.substr(equals + 1);
+            }
+            else if(is_number(word))
+            {
+                spec.values.push_back(word);
+            }
+            else
+            {
+                spec.flags.insert(word);
+            }
+        }
+        return spec;
+    }
+
+    bool has_flag(const std::string& name) const
+    {
+        return flags.count(name) != 0;
+    }
+
+    std::string get_string(const std::string& key, const std::string& default_value) const
+    {
+        std::map<std::string, std::string>::const_iterator i = options.find(key);
+        return i == options.end() ? default_value : i->second;
+    }
+
+    long get_int(const std::string& key, long default_value) const
+    {
+        std::map<std::string, std::string>::const_iterator i = options.find(key);
+        return i == options.end() ? default_value : to_int(key, i->second);
+    }
+
+    uint64_t get_uint64(const std::string& key, uint64_t default_value) const
+    {
+        std::map<std::string, std::string>::const_iterator i = options.find(key);
+        if(i == options.end())
+        {
+            return default_value;
+        }
+        char* end;
+        unsigned long long value = strtoull(i->second.c_str(), &end, 0);
+        if(i->second.empty() || *end != '\0' || i->second[0] == '-')
+        {
+            throw std::invalid_argument("Pattern option " + key + " is not a positive integer: " + i->second);
+        }
+        return value;
+    }
+
+    double get_double(const std::string& key, double default_value) const
+    {
+        std::map<std::string, std::string>::const_iterator i = options.find(key);
+        if(i == options.end())
+        {
+            return default_value;
+        }
+        char* end;
+        double value = strtod(i->second.c_str(), &end);
+        if(i->second.empty() || *end != '\0')
+        {
+            throw std::invalid_argument("Pattern option " + key + " is not a number: " + i->second);
+        }
+        return value;
+    }
+
+    // Positional value n, or the option `key` if it was given by name.
+    long get_value(size_t n, const std::string& key, long default_value) const
+    {
+        if(options.count(key) != 0 || n >= values.size())
+        {
+            return get_int(key, default_value);
+        }
+        return to_int(key, values[n]);
+    }
+
+    // Sizes are written as WxH, or a single number for a square.
+    void get_size(const std::string& key, long& width, long& height) const
+    {
+        std::string text = get_string(key, "");
+        if(text.empty())
+        {
+            return;
+        }
+        std::string::size_type x = text.find('x');
+        width = to_int(key, text.substr(0, x));
+        height = (x == std::string::npos) ? width : to_int(key, text.substr(x + 1));
+    }
+
+private:
+    static bool is_number(const std::string& word)
+    {
+        char* end;
+        strtod(word.c_str(), &end);
+        return ! word.empty() && *end == '\0';
+    }
+
+    static long to_int(const std::string& key, const std::string& text)
+    {
+        char* end;
+        long value = strtol(text.c_str(), &end, 0);
+        if(text.empty() || *end != '\0')
+        {
+            throw std::invalid_argument("Pattern option " + key + " is not an integer: " + text);
+        }
+        return value;
+    }
+};
+
+
+// Layout of a @hadamard line:
+//   [size=WxH] [macro=M] [x=X] [y=Y] [order=natural|sequency|cake]
+inline HadamardLayout hadamard_layout_from(const PatternSpec& spec)
+{
+    HadamardLayout layout;
+    long grid_w = layout.grid_w;
+    long grid_h = layout.grid_h;
+    spec.get_size("size", grid_w, grid_h);
+    long macro = spec.get_int("macro", layout.macro);
+    if(grid_w <= 0 || grid_h <= 0 || macro <= 0)
+    {
+        throw std::invalid_argument("Hadamard size and macro must be positive");
+    }
+    layout.grid_w = grid_w;
+    layout.grid_h = grid_h;
+    layout.macro = macro;
+    layout.x = spec.get_int("x", 0);
+    layout.y = spec.get_int("y", 0);
+    std::string order = spec.get_string("order", "natural");
+    if( ! parse_hadamard_ordering(order, layout.ordering))
+    {
+        throw std::invalid_argument("Unknown Hadamard order: " + order);
+    }
+    return layout;
+}
+
+// Spec of a @bernoulli, @sparse, @checker or @grating line:
+//   [seed=S] [density=D] [period=P] [phase=X] [angle=A] [step=X] [duty=D]
+//   [size=WxH] [macro=M] [x=X] [y=Y]
+// Without size, grid_w and grid_h are left 0 (cover the mirror).
+inline ProceduralSpec procedural_spec_from(ProceduralType type, const PatternSpec& spec)
+{
+    ProceduralSpec p;
+    p.type = type;
+    p.seed = spec.get_uint64("seed", 0);
+    p.density = spec.get_double("density", p.density);
+    p.period = spec.get_double("period", p.period);
+    p.phase = spec.get_double("phase", p.phase);
+    p.angle = spec.get_double("angle", p.angle);
+    // Gratings step a quarter period per frame by default, the usual
+    // four-step phase shift.
+    p.step = spec.get_double("step", (type == PROCEDURAL_GRATING) ? 0.25 : p.step);
+    p.duty = spec.get_double("duty", p.duty);
+    long grid_w = 0;
+    long grid_h = 0;
+    spec.get_size("size", grid_w, grid_h);
+    long macro = spec.get_int("macro", 1);
+    if(grid_w < 0 || grid_h < 0 || macro <= 0)
+    {
+        throw std::invalid_argument("Pattern size and macro must be positive");
+    }
+    p.grid_w = grid_w;
+    p.grid_h = grid_h;
+    p.macro = macro;
+    p.x = spec.get_int("x", 0);
+    p.y = spec.get_int("y", 0);
+    return p;
+}
+
+// Layout of a @fiducial line:
+//   [grid=WxH] [dot=D] [margin=M]
+inline FiducialLayout fiducial_layout_from(const PatternSpec& spec)
+{
+    FiducialLayout layout;
+    long grid_w = layout.grid_w;
+    long grid_h = layout.grid_h;
+    spec.get_size("grid", grid_w, grid_h);
+    long dot = spec.get_int("dot", layout.dot);
+    if(grid_w <= 0 || grid_h <= 0 || dot <= 0)
+    {
+        throw std::invalid_argument("Fiducial grid and dot size must be positive");
+    }
+    layout.grid_w = grid_w;
+    layout.grid_h = grid_h;
+    layout.dot = dot;
+    layout.margin = spec.get_int("margin", layout.margin);
+    return layout;
+}
+
+// Placement of picture files (the loader's --placement), written like a
+// pattern line:
+//   @placement [scale=N] [x=X] [y=Y] [rotate=0|90|180|270] [flip=x|y|xy] [diagonal]
+inline PlacementTransform placement_from(const PatternSpec& spec)
+{
+    PlacementTransform t;
+    long scale = spec.get_int("scale", 1);
+    if(scale <= 0)
+    {
+        throw std::invalid_argument("Placement scale must be positive");
+    }
+    t.scale = scale;
+    t.x = spec.get_int("x", 0);
+    t.y = spec.get_int("y", 0);
+    t.rotation = spec.get_int("rotate", 0);
+    std::string flip = spec.get_string("flip", "");
+    if(flip != "" && flip != "x" && flip != "y" && flip != "xy" && flip != "yx")
+    {
+        throw std::invalid_argument("Placement flip must be x, y or xy");
+    }
+    t.flip_x = flip.find('x') != std::string::npos;
+    t.flip_y = flip.find('y') != std::string::npos;
+    t.diagonal = spec.has_flag("diagonal");
+    return t;
+}
+
+// Grey level display of a @bit-planes line:
+//   [unit=<microseconds>] [bits=N]
+inline BitPlaneSchedule bit_plane_schedule_from(const PatternSpec& spec)
+{
+    BitPlaneSchedule s;
+    s.unit_us = spec.get_double("unit", s.unit_us);
+    s.bits = spec.get_int("bits", s.bits);
+    if(s.unit_us <= 0 || s.bits < 1 || s.bits > BitPlanes::PLANES)
+    {
+        throw std::invalid_argument("Bit planes need unit > 0 and bits from 1 to 8");
+    }
+    return s;
+}
+
+#endif // PATTERN_SPEC_H
@@ -0,0 +1,295 @@
+#ifndef PLACEMENT_MAP_H
+#define PLACEMENT_MAP_H
+
+#include <cstring>
+#include <vector>
+#include <stdexcept>
+#include <stdint.h>
+
+// Where a (small) picture goes on the mirror: flipped, turned clockwise
+// by a multiple of 90 degrees, blown up by an integer factor and put
+// with its top left corner at (x, y).
+//
+// With `diagonal`, the mirror is taken to be a diamond array, whose rows
+// are half a pixel apart and every other row shifted by half a pixel;
+// each picture row then covers two mirror rows, so that the picture
+// keeps its shape, and every mirror pixel shows the picture pixel under
+// its centre.
+struct PlacementTransform
+{
+    PlacementTransform() : scale(1), x(0), y(0), rotation(0), flip_x(false), flip_y(false), diagonal(false) { }
+
+    uint32_t scale;
+    int x;
+    int y;
+    int rotation;    // 0, 90, 180 or 270
+    bool flip_x;     // left <-> right, before turning
+    bool flip_y;     // top <-> bottom, before turning
+    bool diagonal;
+
+    bool operator==(const PlacementTransform& o) const
+    {
+        return scale == o.scale && x == o.x && y == o.y && rotation == o.rotation
+            && flip_x == o.flip_x && flip_y == o.flip_y && diagonal == o.diagonal;
+    }
+    bool operator!=(const PlacementTransform& o) const { return ! (*this == o); }
+
+    // Source pixel (row by row) shown by mirror pixel (mx, my) of a
+    // picture of width x height, or -1.
+    int64_t source_of(int mx, int my, int width, int height) const
+    {
+        const int u = mx - x;
+        int v = my - y;
+        if(u < 0 || v < 0)
+        {
+            return -1;
+        }
+        int tx;
+        if(diagonal)
+        {
+            // Odd rows sit half a pixel to the right: in half pixels the
+            // mirror column is at 2u + 1.
+            tx = (2*u + (v & 1)) / static_cast<int>(2*scale);
+            v /= 2;
+        }
+        else
+        {
+            tx = u / static_cast<int>(scale);
+        }
+        const int ty = v / static_cast<int>(scale);
+
+        // Undo the turn, then the flips.
+        const bool sideways = (rotation == 90 || rotation == 270);
+        const int turned_w = sideways ? height : width;
+        const int turned_h = sideways ? width : height;
+        if(tx >= turned_w || ty >= turned_h)
+        {
+            return -1;
+        }
+        int sx, sy;
+        switch(rotation)
+        {
+        case 90:  sx = ty;             sy = height - 1 - tx; break;
+        case 180: sx = width - 1 - tx; sy = height - 1 - ty; break;
+        case 270: sx = width - 1 - ty; sy = tx;              break;
+        default:  sx = tx;             sy = ty;              break;
+        }
+        if(flip_x) { sx = width - 1 - sx; }
+        if(flip_y) { sy = height - 1 - sy; }
+        return static_cast<int64_t>(sy)*width + sx;
+    }
+};
+
+
+// A placement compiled for one picture size and mirror size.
+//
+// Each mirror row is a list of runs; a run takes `count` source pixels,
+// `step` apart, and writes each `repeat` times.  An unscaled, unturned
+// row is one run copied with memcpy, a scaled row is expanded a word at
+// a time, and a turned picture steps down source columns.  Mirror rows
+// that are the same as the row above (every row of a scaled picture but
+// the first of each block) are copied from it.  Compiling looks at every
+// mirror pixel once; applying it touches only the placed pixels.
+class PlacementMap
+{
+public:
+    PlacementMap() : source_w(-1), source_h(-1), mirror_w(-1), mirror_h(-1) { }
+
+    void set_transform(const PlacementTransform& t)
+    {
+        if(t.scale == 0 || (t.rotation != 0 && t.rotation != 90 && t.rotation != 180 && t.rotation != 270))
+        {
+            throw std::invalid_argument("Placement needs a scale of at least 1 and a turn of 0, 90, 180 or 270 degrees");
+        }
+        if(t != transform)
+        {
+            transform = t;
+            source_w = -1;
+        }
+    }
+
+    const PlacementTransform& get_transform() const { return transform; }
+    size_t run_count() const { return runs.size(); }
+
+    // Put a width x height picture (one byte per pixel, already the
+    // mirror's off and on values) on the mirror.  Mirror pixels outside
+    // the picture are set to off_value.
+    void apply(const unsigned char* source, int width, int height,
+               unsigned char* mirror, int m_width, int m_height, unsigned char off_value)
+    {
+        compile(width, height, m_width, m_height);
+        for(int my = 0; my < m_height; ++my)
+        {
+            unsigned char* out = mirror + static_cast<size_t>(my)*m_width;
+            const Row& row = rows[my];
+            if(row.same_as_above)
+            {
+                memcpy(out, out - m_width, m_width);
+                continue;
+            }
+            memset(out, off_value, m_width);
+            for(uint32_t k = row.first_run; k < row.end_run; ++k)
+            {
+                expand(runs[k], source, out);
+            }
+        }
+    }
+
+private:
+    struct Run
+    {
+        uint32_t mirror_x;
+        int64_t source;
+        int64_t step;
+        uint32_t count;
+        uint32_t repeat;
+    };
+
+    struct Row
+    {
+        uint32_t first_run;
+        uint32_t end_run;
+        bool same_as_above;
+    };
+
+    PlacementTransform transform;
+    int source_w;
+    int source_h;
+    int mirror_w;
+    int mirror_h;
+    std::vector<Run> runs;
+    std::vector<Row> rows;
+    std::vector<int64_t> column_source;
+    std::vector<int64_t> previous_source;   // kept, so a new size does not allocate
+
+    void compile(int width, int height, int m_width, int m_height)
+    {
+        if(width == source_w && height == source_h && m_width == mirror_w && m_height == mirror_h)
+        {
+            return;
+        }
+        runs.clear();
+        rows.assign(m_height, Row());
+        column_source.resize(m_width);
+        for(int my = 0; my < m_height; ++my)
+        {
+            for(int mx = 0; mx < m_width; ++mx)
+            {
+                column_source[mx] = transform.source_of(mx, my, width, height);
+            }
+            Row& row = rows[my];
+            row.same_as_above = (my > 0 && column_source == previous_source);
+            row.first_run = row.end_run = static_cast<uint32_t>(runs.size());
+            if( ! row.same_as_above)
+            {
+                add_runs(m_width);
+                row.end_run = static_cast<uint32_t>(runs.size());
+                previous_source = column_source;
+            }
+        }
+        source_w = width;
+        source_h = height;
+        mirror_w = m_width;
+        mirror_h = m_height;
+    }
+
+    // Runs of the mirror row whose source pixels are in column_source.
+    void add_runs(int m_width)
+    {
+        int mx = 0;
+        bool open = false;
+        Run run;
+        while(mx < m_width)
+        {
+            const int64_t s = column_source[mx];
+            int hold = 1;
+            while(mx + hold < m_width && column_source[mx + hold] == s)
+            {
+                ++hold;
+            }
+            if(s >= 0)
+            {
+                // Extends the open run if it continues right after it
+                // with the same repeat and step.
+                const bool extends = open && hold == static_cast<int>(run.repeat)
+                                  && mx == static_cast<int>(run.mirror_x + run.count*run.repeat)
+                                  && (run.count == 1 || s == run.source + run.count*run.step);
+                if(extends)
+                {
+                    if(run.count == 1)
+                    {
+                        run.step = s - run.source;
+                    }
+                    ++run.count;
+                }
+                else
+                {
+                    if(open)
+                    {
+                        runs.push_back(run);
+                    }
+                    run.mirror_x = mx;
+                    run.source = s;
+                    run.step = 0;
+                    run.count = 1;
+                    run.repeat = hold;
+                    open = true;
+                }
+            }
+            mx += hold;
+        }
+        if(open)
+        {
+            runs.push_back(run);
+        }
+    }
+
+    static void expand(const Run& run, const unsigned char* source, unsigned char* out)
+    {
+        unsigned char* d = out + run.mirror_x;
+        const unsigned char* s = source + run.source;
+        if(run.repeat == 1 && run.step == 1)
+        {
+            memcpy(d, s, run.count);
+            return;
+        }
+        switch(run.repeat)
+        {
+        case 1:
+            for(uint32_t k = 0; k < run.count; ++k)
+            {
+                d[k] = s[k*run.step];
+            }
+            break;
+        case 2:
+            expand_words<uint16_t>(s, run.step, run.count, d);
+            break;
+        case 4:
+            expand_words<uint32_t>(s, run.step, run.count, d);
+            break;
+        case 8:
+            expand_words<uint64_t>(s, run.step, run.count, d);
+            break;
+        default:
+            for(uint32_t k = 0; k < run.count; ++k)
+            {
+                memset(d + static_cast<size_t>(k)*run.repeat, s[k*run.step], run.repeat);
+            }
+            break;
+        }
+    }
+
+    // One word of sizeof(W) copies of each source byte.
+    template<typename W>
+    static void expand_words(const unsigned char* s, int64_t step, uint32_t count, unsigned char* d)
+    {
+        const W ones = static_cast<W>(~static_cast<W>(0)) / 0xFF;
+        for(uint32_t k = 0; k < count; ++k)
+        {
+            const W word = static_cast<W>(s[k*step]) * ones;
+            memcpy(d + static_cast<size_t>(k)*sizeof(W), &word, sizeof(W));
+        }
+    }
+};
+
+#endif // PLACEMENT_MAP_H
@@ -0,0 +1,363 @@
+#ifndef PROCEDURAL_PATTERNS_H
+#define PROCEDURAL_PATTERNS_H
+
+#include <cmath>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+#include <stdint.h>
+#include "parallel_for.h"
+
+// Procedural binary patterns for compressive sensing.
+//
+// Every pattern is a function of its spec and a frame index only.  The
+// random patterns use the counter-based Philox4x32-10 generator: the
+// random number for macro pixel j of frame f is computed from (j, f) and
+// the seed directly, with no generator state carried from one pixel or
+// frame to the next.  Any frame can therefore be regenerated on its own
+// (by the reconstruction as well as by the loader), and the rows of one
+// frame can be drawn on several threads.
+//
+// Patterns are defined on a grid of grid_w x grid_h macro pixels; the
+// renderer scales them to the mirror like the Hadamard patterns.
+
+enum ProceduralType
+{
+    PROCEDURAL_BERNOULLI,  // each macro pixel on with probability `density`
+    PROCEDURAL_SPARSE,     // exactly round(density*N) macro pixels on
+    PROCEDURAL_CHECKER,    // checkerboard of `period` sized squares, shifted per frame
+    PROCEDURAL_GRATING     // binarized sinusoidal grating, phase stepped per frame
+};
+
+inline bool parse_procedural_type(const std::string& name, ProceduralType& type)
+{
+    if(name == "bernoulli") { type = PROCEDURAL_BERNOULLI; return true; }
+    if(name == "sparse")    { type = PROCEDURAL_SPARSE;    return true; }
+    if(name == "checker")   { type = PROCEDURAL_CHECKER;   return true; }
+    if(name == "grating")   { type = PROCEDURAL_GRATING;   return true; }
+    return false;
+}
+
+struct ProceduralSpec
+{
+    ProceduralSpec() : type(PROCEDURAL_BERNOULLI), seed(0), density(0.5), period(8.0), phase(0.0),
+                       angle(0.0), step(1.0), duty(0.5), grid_w(0), grid_h(0), macro(1), x(0), y(0) { }
+
+    ProceduralType type;
+    uint64_t seed;
+    double density;   // bernoulli, sparse: fraction of macro pixels on
+    double period;    // checker: square side; grating: period, in macro pixels
+    double phase;     // checker: shift in macro pixels; grating: shift in periods
+    double angle;     // grating: direction in degrees, 0 = stripes along y
+    double step;      // shift per frame (checker: macro pixels, grating: periods)
+    double duty;      // grating: fraction of each period that is on
+    uint32_t grid_w;  // 0 = cover the mirror
+    uint32_t grid_h;
+    uint32_t macro;
+    int x;
+    int y;
+};
+
+
+// Philox4x32-10 (Salmon et al., "Parallel random numbers: as easy as
+// 1, 2, 3", SC 2011).  Encrypts the 128-bit counter with a 64-bit key.
+inline void philox4x32(uint32_t counter[4], uint32_t key0, uint32_t key1)
+{
+    for(int round = 0; round < 10; ++round)
+    {
+        uint64_t p0 = static_cast<uint64_t>(0xD2511F53u) * counter[0];
+        uint64_t p1 = static_cast<uint64_t>(0xCD9E8D57u) * counter[2];
+        uint32_t c0 = static_cast<uint32_t>(p1 >> 32) ^ counter[1] ^ key0;
+        uint32_t c1 = static_cast<uint32_t>(p1);
+        uint32_t c2 = static_cast<uint32_t>(p0 >> 32) ^ counter[3] ^ key1;
+        uint32_t c3 = static_cast<uint32_t>(p0);
+        counter[0] = c0;
+        counter[1] = c1;
+        counter[2] = c2;
+        counter[3] = c3;
+        key0 += 0x9E3779B9u;
+        key1 += 0xBB67AE85u;
+    }
+}
+
+// Four random words for block `block` of frame `frame`.  Block b holds
+// the random numbers of macro pixels 4b .. 4b+3.
+inline void procedural_random_block(uint64_t seed, uint64_t frame, uint64_t block, uint32_t out[4])
+{
+    out[0] = static_cast<uint32_t>(block);
+    out[1] = static_cast<uint32_t>(block >> 32);
+    out[2] = static_cast<uint32_t>(frame);
+    out[3] = static_cast<uint32_t>(frame >> 32);
+    philox4x32(out, static_cast<uint32_t>(seed), static_cast<uint32_t>(seed >> 32));
+}
+
+// The sparse sampler draws from its own stream so that it never shares
+// random numbers with the Bernoulli pattern of the same seed and frame.
+static const uint64_t PROCEDURAL_SPARSE_STREAM = static_cast<uint64_t>(1) << 63;
+
+inline double procedural_fraction(double v)
+{
+    return v - std::floor(v);
+}
+
+
+// Macro pixel values (0 or 1) of row gy of the pattern, grid_w of them.
+inline void procedural_grid_row(const ProceduralSpec& spec, uint64_t frame, uint32_t gy, unsigned char* row)
+{
+    const uint32_t w = spec.grid_w;
+    switch(spec.type)
+    {
+    case PROCEDURAL_BERNOULLI:
+    {
+        // Compare against the density scaled to 32 bits; the
+        // comparison is exact for any density that is a multiple of 2^-32.
+        const double scaled = spec.density * 4294967296.0;
+        const uint64_t threshold = scaled <= 0 ? 0 : (scaled >= 4294967296.0 ? 4294967296ull : static_cast<uint64_t>(scaled));
+        const uint64_t first = static_cast<uint64_t>(gy) * w;
+        uint32_t words[4];
+        uint64_t loaded_block = ~static_cast<uint64_t>(0);
+        for(uint32_t gx = 0; gx < w; ++gx)
+        {
+            uint64_t j = first + gx;
+            if((j >> 2) != loaded_block)
+            {
+                loaded_block = j >> 2;
+                procedural_random_block(spec.seed, frame, loaded_block, words);
+            }
+            row[gx] = words[j & 3] < threshold;
+        }
+        break;
+    }
+
+    case PROCEDURAL_CHECKER:
+    {
+        const double period = spec.period > 0 ? spec.period : 1;
+        const double shift = spec.phase + spec.step*static_cast<double>(frame);
+        const long cell_y = static_cast<long>(std::floor(gy / period));
+        for(uint32_t gx = 0; gx < w; ++gx)
+        {
+            long cell_x = static_cast<long>(std::floor((gx + shift) / period));
+            row[gx] = ((cell_x + cell_y) & 1) == 0;
+        }
+        break;
+    }
+
+    case PROCEDURAL_GRATING:
+    {
+        // On where the phase of cos(2 pi u) lies within the duty cycle
+        // centred on its maximum.  u advances by a constant per macro
+        // pixel, so no trigonometry is needed inside the loop.
+        const double period = spec.period > 0 ? spec.period : 1;
+        const double radians = spec.angle * 3.14159265358979323846 / 180.0;
+        const double du = std::cos(radians) / period;
+        const double half_duty = spec.duty / 2;
+        double u = gy*std::sin(radians)/period + spec.phase + spec.step*static_cast<double>(frame) + half_duty;
+        for(uint32_t gx = 0; gx < w; ++gx, u += du)
+        {
+            row[gx] = procedural_fraction(u) < spec.duty;
+        }
+        break;
+    }
+
+    case PROCEDURAL_SPARSE:
+        throw std::logic_error("Sparse patterns are drawn as a whole, not by rows");
+    }
+}
+
+// Macro pixel indices that are on in a sparse pattern, in drawing order.
+// Position i is the first unused of the candidates drawn from counter
+// (i, attempt), which picks round(density*N) distinct pixels.
+inline void procedural_sparse_pixels(const ProceduralSpec& spec, uint64_t frame,
+                                     std::vector<uint32_t>& pixels, std::vector<unsigned char>& used)
+{
+    const uint64_t n = static_cast<uint64_t>(spec.grid_w) * spec.grid_h;
+    double wanted = spec.density * static_cast<double>(n) + 0.5;
+    const uint64_t k = wanted <= 0 ? 0 : std::min(n, static_cast<uint64_t>(wanted));
+    pixels.clear();
+    used.assign(n, 0);
+    for(uint64_t i = 0; i < k; ++i)
+    {
+        for(uint64_t attempt = 0; ; ++attempt)
+        {
+            uint32_t words[4];
+            procedural_random_block(spec.seed, frame, PROCEDURAL_SPARSE_STREAM | (attempt << 32) | i, words);
+            uint64_t r = (static_cast<uint64_t>(words[0]) << 32) | words[1];
+            uint32_t j = static_cast<uint32_t>(r % n);
+            if( ! used[j])
+            {
+                used[j] = 1;
+                pixels.push_back(j);
+                break;
+            }
+        }
+    }
+}
+
+// The whole pattern at grid resolution, one byte (0 or 1) per macro
+// pixel, row by row.  This is what reconstruction uses as the
+// measurement matrix row of `frame`.
+inline void procedural_grid(const ProceduralSpec& spec, uint64_t frame, std::vector<unsigned char>& grid)
+{
+    grid.assign(static_cast<size_t>(spec.grid_w) * spec.grid_h, 0);
+    if(spec.type == PROCEDURAL_SPARSE)
+    {
+        std::vector<uint32_t> pixels;
+        std::vector<unsigned char> used;
+        procedural_sparse_pixels(spec, frame, pixels, used);
+        for(size_t i = 0; i < pixels.size(); ++i)
+        {
+            grid[pixels[i]] = 1;
+        }
+        return;
+    }
+    for(uint32_t gy = 0; gy < spec.grid_h; ++gy)
+    {
+        procedural_grid_row(spec, frame, gy, &grid[static_cast<size_t>(gy) * spec.grid_w]);
+    }
+}
+
+
+// Draws procedural patterns into a mirror buffer.  Scratch rows are
+// kept between calls, so drawing does not allocate once warmed up.
+class ProceduralPatterns
+{
+public:
+    ProceduralPatterns() : threads(0) { }
+
+    // 0 = all cores.  Small patterns are always drawn on one thread.
+    void set_threads(int n) { threads = n; }
+
+    // Fill in the grid size for a spec that leaves it to the mirror.
+    static void fit_to_mirror(ProceduralSpec& spec, int width, int height)
+    {
+        if(spec.macro == 0)
+        {
+            throw std::invalid_argument("Macro pixel size must be at least 1");
+        }
+        if(spec.grid_w == 0)
+        {
+            spec.grid_w = (std::max(width - spec.x, 0) + spec.macro - 1) / spec.macro;
+        }
+        if(spec.grid_h == 0)
+        {
+            spec.grid_h = (std::max(height - spec.y, 0) + spec.macro - 1) / spec.macro;
+        }
+    }
+
+    // With `complement` every macro pixel of the pattern is inverted;
+    // the mirror outside the pattern stays off either way.
+    void render(ProceduralSpec spec, uint64_t frame, bool complement, unsigned char* mirror, int width, int height,
+                unsigned char off_value, unsigned char on_value)
+    {
+        fit_to_mirror(spec, width, height);
+        memset(mirror, off_value, static_cast<size_t>(width)*height);
+
+        const int x0 = std::max(spec.x, 0);
+        const int x1 = std::min(spec.x + static_cast<int>(spec.grid_w*spec.macro), width);
+        const int y0 = std::max(spec.y, 0);
+        const int y1 = std::min(spec.y + static_cast<int>(spec.grid_h*spec.macro), height);
+        if(x0 >= x1 || y0 >= y1)
+        {
+            return;
+        }
+
+        const unsigned char pattern_on = complement ? off_value : on_value;
+        const unsigned char pattern_off = complement ? on_value : off_value;
+
+        if(spec.type == PROCEDURAL_SPARSE)
+        {
+            // Only the chosen pixels need drawing (on a lit pattern area
+            // for the complement).
+            if(complement)
+            {
+                for(int py = y0; py < y1; ++py)
+                {
+                    memset(mirror + static_cast<size_t>(py)*width + x0, pattern_off, x1 - x0);
+                }
+            }
+            procedural_sparse_pixels(spec, frame, sparse_pixels, sparse_used);
+            for(size_t i = 0; i < sparse_pixels.size(); ++i)
+            {
+                int gx = sparse_pixels[i] % spec.grid_w;
+                int gy = sparse_pixels[i] / spec.grid_w;
+                int px0 = std::max(spec.x + gx*static_cast<int>(spec.macro), x0);
+                int px1 = std::min(spec.x + (gx + 1)*static_cast<int>(spec.macro), x1);
+                int py0 = std::max(spec.y + gy*static_cast<int>(spec.macro), y0);
+                int py1 = std::min(spec.y + (gy + 1)*static_cast<int>(spec.macro), y1);
+                for(int py = py0; py < py1; ++py)
+                {
+                    if(px0 < px1)
+                    {
+                        memset(mirror + static_cast<size_t>(py)*width + px0, pattern_on, px1 - px0);
+                    }
+                }
+            }
+            return;
+        }
+
+        // Grid rows are independent of each other.  Each is computed
+        // once, expanded to mirror pixels, and copied to the `macro`
+        // mirror rows it covers.
+        const int gy0 = (y0 - spec.y) / static_cast<int>(spec.macro);
+        const int gy1 = (y1 - 1 - spec.y) / static_cast<int>(spec.macro) + 1;
+        const int rows = gy1 - gy0;
+        const uint64_t work = static_cast<uint64_t>(rows) * spec.grid_w;
+        const int thread_count = (work < 65536) ? 1 : threads;
+        const int workers = (thread_count <= 0) ? static_cast<int>(std::thread::hardware_concurrency()) : thread_count;
+        const int bands = std::max(1, std::min(workers, rows));
+        if(scratch.size() < static_cast<size_t>(bands))
+        {
+            scratch.resize(bands);
+        }
+
+        parallel_for(bands, thread_count, [&](int band)
+        {
+            Scratch& s = scratch[band];
+            s.grid_row.resize(spec.grid_w);
+            s.mirror_row.resize(x1 - x0);
+            for(int gy = gy0 + band; gy < gy1; gy += bands)
+            {
+                procedural_grid_row(spec, frame, gy, &s.grid_row[0]);
+                expand_row(spec, &s.grid_row[0], x0, x1, pattern_on, pattern_off, &s.mirror_row[0]);
+                int py0 = std::max(spec.y + gy*static_cast<int>(spec.macro), y0);
+                int py1 = std::min(spec.y + (gy + 1)*static_cast<int>(spec.macro), y1);
+                for(int py = py0; py < py1; ++py)
+                {
+                    memcpy(mirror + static_cast<size_t>(py)*width + x0, &s.mirror_row[0], x1 - x0);
+                }
+            }
+        });
+    }
+
+private:
+    // Mirror pixels x0..x1 of a grid row, one run of `macro` pixels per
+    // macro pixel.
+    static void expand_row(const ProceduralSpec& spec, const unsigned char* grid_row, int x0, int x1,
+                           unsigned char on_value, unsigned char off_value, unsigned char* out)
+    {
+        int mx = x0;
+        uint32_t gx = (x0 - spec.x) / spec.macro;
+        while(mx < x1)
+        {
+            int run_end = std::min(spec.x + static_cast<int>((gx + 1)*spec.macro), x1);
+            memset(out + (mx - x0), grid_row[gx] ? on_value : off_value, run_end - mx);
+            mx = run_end;
+            ++gx;
+        }
+    }
+
+    struct Scratch
+    {
+        std::vector<unsigned char> grid_row;
+        std::vector<unsigned char> mirror_row;
+    };
+
+    int threads;
+    std::vector<Scratch> scratch;
+    std::vector<uint32_t> sparse_pixels;
+    std::vector<unsigned char> sparse_used;
+};
+
+#endif // PROCEDURAL_PATTERNS_H
@@ -0,0 +1,96 @@
+#ifndef QUEUE_BENCHMARK_H
+#define QUEUE_BENCHMARK_H
+
+#include <iostream>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+#include "frame_queue.h"
+
+// Hand-over cost of SpscQueue with each wait strategy, between two
+// threads as a capture and a writer stage would use it.
+//
+// Throughput: the producer pushes frame handles as fast as it can.
+// Latency: the producer pushes one every 50 us (a fast camera), so the
+// consumer is usually waiting, and the time from push to pop is what a
+// frame spends in the queue, waking up included.
+
+struct TimedFrame
+{
+    FrameHandle frame;
+    std::chrono::steady_clock::time_point pushed;
+};
+
+template<typename Wait>
+void run_queue_benchmark_with(int frames)
+{
+    typedef std::chrono::steady_clock Clock;
+    const int paced_frames = std::min(frames, 20000);
+    std::vector<double> latency_us(paced_frames);
+
+    double seconds;
+    {
+        SpscQueue<TimedFrame, Wait> queue(256);
+        std::thread consumer([&queue]()
+        {
+            TimedFrame t;
+            while(queue.pop(t)) { }
+        });
+        Clock::time_point start = Clock::now();
+        TimedFrame t;
+        for(int i = 0; i < frames; ++i)
+        {
+            t.frame.meta.index = i;
+            queue.push(t);
+        }
+        queue.close();
+        consumer.join();
+        seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    }
+    {
+        SpscQueue<TimedFrame, Wait> queue(256);
+        std::thread consumer([&queue, &latency_us]()
+        {
+            TimedFrame t;
+            while(queue.pop(t))
+            {
+                latency_us[t.frame.meta.index] = std::chrono::duration<double, std::micro>(Clock::now() - t.pushed).count();
+            }
+        });
+        Clock::time_point next = Clock::now();
+        TimedFrame t;
+        for(int i = 0; i < paced_frames; ++i)
+        {
+            next += std::chrono::microseconds(50);
+            while(Clock::now() < next)
+            {
+                cpu_relax();
+            }
+            t.frame.meta.index = i;
+            t.pushed = Clock::now();
+            queue.push(t);
+        }
+        queue.close();
+        consumer.join();
+    }
+
+    std::sort(latency_us.begin(), latency_us.end());
+    const size_t n = latency_us.size();
+    std::cout << Wait::name() << ": " << frames/seconds/1e6 << " M frames/s, latency us"
+              << " p50 " << latency_us[n/2]
+              << " p99 " << latency_us[n*99/100]
+              << " p99.9 " << latency_us[n*999/1000]
+              << " max " << latency_us[n - 1] << std::endl;
+}
+
+inline void run_queue_benchmark(int frames)
+{
+    std::cout << "Frame queue benchmark, " << frames << " frames of " << sizeof(TimedFrame) << " bytes ("
+              << std::thread::hardware_concurrency() << " cores)" << std::endl;
+    run_queue_benchmark_with<SpinWait>(frames);
+    run_queue_benchmark_with<YieldWait>(frames);
+    run_queue_benchmark_with<FutexWait>(frames);
+}
+
+#endif // QUEUE_BENCHMARK_H
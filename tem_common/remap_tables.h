@@ -0,0 +1,367 @@
+#ifndef REMAP_TABLES_H
+#define REMAP_TABLES_H
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <stdexcept>
+#include <stdint.h>
+
+// Precomputed mirror <-> camera lookup tables, written by tem_calibrate
+// (see dmd_calibration.h) and read by the loader and the reducers.
+//
+// Files are a RemapFileHeader followed by the table, little endian:
+//   forward  mirror_w*mirror_h pairs of float (camera x, y of each
+//            mirror pixel; -1, -1 if the camera does not see it)
+//   inverse  camera_w*camera_h int32 (mirror pixel y*mirror_w + x under
+//            each camera pixel; -1 if none)
+//
+// A table is checked when it is read: the sizes must be between 1 and
+// REMAP_MAX_SIDE, the file must hold the whole table, and every entry
+// must be "none" or point inside the mirror or camera.
+
+static const uint32_t REMAP_MAX_SIDE = 1u << 14;
+
+struct RemapFileHeader
+{
+    char magic[8];         // "TEMREMAP"
+    uint32_t kind;         // REMAP_FORWARD or REMAP_INVERSE
+    uint32_t mirror_w;
+    uint32_t mirror_h;
+    uint32_t camera_w;
+    uint32_t camera_h;
+    uint32_t reserved;
+};
+
+enum RemapKind
+{
+    REMAP_FORWARD = 1,
+    REMAP_INVERSE = 2
+};
+
+struct ForwardRemap
+{
+    uint32_t mirror_w;
+    uint32_t mirror_h;
+    uint32_t camera_w;
+    uint32_t camera_h;
+    std::vector<float> camera_xy;
+};
+
+struct InverseRemap
+{
+    uint32_t camera_w;
+    uint32_t camera_h;
+    uint32_t mirror_w;
+    uint32_t mirror_h;
+    std::vector<int32_t> mirror_pixel;
+};
+
+inline void write_remap_file(const std::string& path, RemapKind kind, uint32_t mirror_w, uint32_t mirror_h,
+                             uint32_t camera_w, uint32_t camera_h, const void* table, size_t bytes)
+{
+    RemapFileHeader h;
+    memcpy(h.magic, "TEMREMAP", 8);
+    h.kind = kind;
+    h.mirror_w = mirror_w;
+    h.mirror_h = mirror_h;
+    h.camera_w = camera_w;
+    h.camera_h = camera_h;
+    h.reserved = 0;
+    FILE* f = fopen(path.c_str(), "wb");
+    if(f == NULL)
+    {
+        throw std::runtime_error("Could not write remap table " + path);
+    }
+    bool ok = fwrite(&h, sizeof(h), 1, f) == 1 && fwrite(table, 1, bytes, f) == bytes;
+    if(fclose(f) != 0 || ! ok)
+    {
+        throw std::runtime_error("Could not write remap table " + path);
+    }
+}
+
+// Reads the header into `h` and the table into `table` (resized to the
+// table of a `kind` file).
+template<typename T>
+void read_remap_file(const std::string& path, RemapKind kind, RemapFileHeader& h, std::vector<T>& table)
+{
+    FILE* f = fopen(path.c_str(), "rb");
+    if(f == NULL)
+    {
+        throw std::runtime_error("Could not read remap table " + path);
+    }
+    if(fread(&h, sizeof(h), 1, f) != 1 || memcmp(h.magic, "TEMREMAP", 8) != 0 || h.kind != static_cast<uint32_t>(kind))
+    {
+        fclose(f);
+        throw std::runtime_error(path + (kind == REMAP_FORWARD ? " is not a forward remap table" : " is not an inverse remap table"));
+    }
+    if(h.mirror_w == 0 || h.mirror_h == 0 || h.camera_w == 0 || h.camera_h == 0
+       || h.mirror_w > REMAP_MAX_SIDE || h.mirror_h > REMAP_MAX_SIDE || h.camera_w > REMAP_MAX_SIDE || h.camera_h > REMAP_MAX_SIDE)
+    {
+        fclose(f);
+        throw std::runtime_error("Remap table " + path + " has bad sizes");
+    }
+    size_t entries = (kind == REMAP_FORWARD) ? 2*static_cast<size_t>(h.mirror_w)*h.mirror_h
+                                             : static_cast<size_t>(h.camera_w)*h.camera_h;
+    // Nothing is allocated for more than the file holds.
+    const long start = ftell(f);
+    const bool sized = start >= 0 && fseek(f, 0, SEEK_END) == 0;
+    const long end = sized ? ftell(f) : -1;
+    if(end < start || static_cast<uint64_t>(end - start) < static_cast<uint64_t>(entries)*sizeof(T)
+       || fseek(f, start, SEEK_SET) != 0)
+    {
+        fclose(f);
+        throw std::runtime_error("Remap table " + path + " is cut short");
+    }
+    table.resize(entries);
+    bool ok = entries == 0 || fread(&table[0], sizeof(T), entries, f) == entries;
+    fclose(f);
+    if( ! ok)
+    {
+        throw std::runtime_error("Remap table " + path + " is cut short");
+    }
+}
+
+inline void write_forward_remap(const std::string& path, const ForwardRemap& remap)
+{
+    write_remap_file(path, REMAP_FORWARD, remap.mirror_w, remap.mirror_h, remap.camera_w, remap.camera_h,
+                     remap.camera_xy.empty() ? NULL : &remap.camera_xy[0], remap.camera_xy.size()*sizeof(float));
+}
+
+inline void write_inverse_remap(const std::string& path, const InverseRemap& remap)
+{
+    write_remap_file(path, REMAP_INVERSE, remap.mirror_w, remap.mirror_h, remap.camera_w, remap.camera_h,
+                     remap.mirror_pixel.empty() ? NULL : &remap.mirror_pixel[0], remap.mirror_pixel.size()*sizeof(int32_t));
+}
+
+// Camera positions are -1, -1 or inside the camera frame, as
+// build_forward_remap() writes them.
+inline bool forward_remap_valid(const ForwardRemap& remap)
+{
+    if(remap.mirror_w == 0 || remap.mirror_h == 0 || remap.camera_w == 0 || remap.camera_h == 0
+       || remap.camera_xy.size() != 2*static_cast<size_t>(remap.mirror_w)*remap.mirror_h)
+    {
+        return false;
+    }
+    const float right = static_cast<float>(remap.camera_w);
+    const float bottom = static_cast<float>(remap.camera_h);
+    for(size_t i = 0; i < remap.camera_xy.size(); i += 2)
+    {
+        const float cx = remap.camera_xy[i];
+        const float cy = remap.camera_xy[i + 1];
+        const bool none = cx == -1 && cy == -1;
+        if( ! none && ! (cx >= -0.5f && cx < right && cy >= -0.5f && cy < bottom))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Mirror pixels are -1 or one of the mirror's.
+inline bool inverse_remap_valid(const InverseRemap& remap)
+{
+    if(remap.mirror_w == 0 || remap.mirror_h == 0 || remap.camera_w == 0 || remap.camera_h == 0
+       || remap.mirror_pixel.size() != static_cast<size_t>(remap.camera_w)*remap.camera_h)
+    {
+        return false;
+    }
+    const int64_t mirror_pixels = static_cast<int64_t>(remap.mirror_w)*remap.mirror_h;
+    for(size_t i = 0; i < remap.mirror_pixel.size(); ++i)
+    {
+        const int32_t m = remap.mirror_pixel[i];
+        if(m < -1 || m >= mirror_pixels)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+inline ForwardRemap read_forward_remap(const std::string& path)
+{
+    RemapFileHeader h;
+    ForwardRemap remap;
+    read_remap_file(path, REMAP_FORWARD, h, remap.camera_xy);
+    remap.mirror_w = h.mirror_w;
+    remap.mirror_h = h.mirror_h;
+    remap.camera_w = h.camera_w;
+    remap.camera_h = h.camera_h;
+    if( ! forward_remap_valid(remap))
+    {
+        throw std::runtime_error("Remap table " + path + " is damaged");
+    }
+    return remap;
+}
+
+inline InverseRemap read_inverse_remap(const std::string& path)
+{
+    RemapFileHeader h;
+    InverseRemap remap;
+    read_remap_file(path, REMAP_INVERSE, h, remap.mirror_pixel);
+    remap.mirror_w = h.mirror_w;
+    remap.mirror_h = h.mirror_h;
+    remap.camera_w = h.camera_w;
+    remap.camera_h = h.camera_h;
+    if( ! inverse_remap_valid(remap))
+    {
+        throw std::runtime_error("Remap table " + path + " is damaged");
+    }
+    return remap;
+}
+
+
+// Places pictures drawn in camera coordinates on the mirror, so that
+// the camera sees them upright and undistorted.  The picture is
+// stretched over the whole camera frame.  For each picture size the
+// source pixel of every mirror pixel is worked out once; after that
+// placing a picture is one table lookup per mirror pixel.
+class CalibratedPlacement
+{
+public:
+    explicit CalibratedPlacement(const ForwardRemap& remap) : remap(remap), source_w(0), source_h(0)
+    {
+        if( ! forward_remap_valid(remap))
+        {
+            throw std::invalid_argument("Bad forward remap table");
+        }
+    }
+
+    uint32_t mirror_width() const { return remap.mirror_w; }
+    uint32_t mirror_height() const { return remap.mirror_h; }
+
+    // Index into a source_w x source_h picture (row by row) for every
+    // mirror pixel, or -1 where the mirror shows nothing of the picture.
+    const std::vector<int32_t>& source_index(int width, int height)
+    {
+        if(width != source_w || height != source_h)
+        {
+            source_w = width;
+            source_h = height;
+            const double sx = static_cast<double>(width) / remap.camera_w;
+            const double sy = static_cast<double>(height) / remap.camera_h;
+            const size_t count = static_cast<size_t>(remap.mirror_w)*remap.mirror_h;
+            index.resize(count);
+            for(size_t i = 0; i < count; ++i)
+            {
+                const float cx = remap.camera_xy[2*i];
+                const float cy = remap.camera_xy[2*i + 1];
+                const int x = static_cast<int>((cx + 0.5) * sx);
+                const int y = static_cast<int>((cy + 0.5) * sy);
+                index[i] = (cx < 0 || x < 0 || y < 0 || x >= width || y >= height) ? -1 : y*width + x;
+            }
+        }
+        return index;
+    }
+
+private:
+    ForwardRemap remap;
+    int source_w;
+    int source_h;
+    std::vector<int32_t> index;
+};
+
+
+// The camera pixels under a grid of mirror regions, kept as runs along
+// camera rows so that a frame is reduced to per-region sums in one
+// sequential pass, without any per-pixel geometry.
+//
+// Region r = gy*grid_w + gx covers mirror pixels x + gx*region_w ...
+// x + (gx+1)*region_w - 1 and the same along y.
+class CameraRegionMap
+{
+public:
+    CameraRegionMap(const InverseRemap& remap, int x, int y, uint32_t region_w, uint32_t region_h,
+                    uint32_t grid_w = 1, uint32_t grid_h = 1)
+        : regions(static_cast<size_t>(grid_w)*grid_h), counts(regions, 0), width(remap.camera_w), height(remap.camera_h)
+    {
+        if(region_w == 0 || region_h == 0 || regions == 0)
+        {
+            throw std::invalid_argument("Camera regions need a positive size");
+        }
+        if( ! inverse_remap_valid(remap))
+        {
+            throw std::invalid_argument("Bad inverse remap table");
+        }
+        for(uint32_t cy = 0; cy < remap.camera_h; ++cy)
+        {
+            Run run;
+            run.region = -1;
+            for(uint32_t cx = 0; cx <= remap.camera_w; ++cx)
+            {
+                int32_t region = -1;
+                if(cx < remap.camera_w)
+                {
+                    const int32_t m = remap.mirror_pixel[static_cast<size_t>(cy)*remap.camera_w + cx];
+                    if(m >= 0)
+                    {
+                        const int gx = (static_cast<int>(m % remap.mirror_w) - x) / static_cast<int>(region_w);
+                        const int gy = (static_cast<int>(m / remap.mirror_w) - y) / static_cast<int>(region_h);
+                        const bool inside = static_cast<int>(m % remap.mirror_w) >= x && static_cast<int>(m / remap.mirror_w) >= y
+                                         && gx < static_cast<int>(grid_w) && gy < static_cast<int>(grid_h);
+                        region = inside ? gy*static_cast<int32_t>(grid_w) + gx : -1;
+                    }
+                }
+                if(region != run.region)
+                {
+                    if(run.region >= 0)
+                    {
+                        run.end = cx;
+                        runs.push_back(run);
+                        counts[run.region] += run.end - run.begin;
+                    }
+                    run.row = cy;
+                    run.begin = cx;
+                    run.region = region;
+                }
+            }
+        }
+    }
+
+    size_t region_count() const { return regions; }
+    size_t run_count() const { return runs.size(); }
+
+    // Camera pixels in each region.
+    const std::vector<uint64_t>& pixel_counts() const { return counts; }
+
+    // sums[r] = sum of all values (all channels) of the camera pixels
+    // under region r.  T is the type of one value: unsigned char for
+    // camera frames, int16_t for difference frames.
+    template<typename T>
+    void reduce(const unsigned char* frame, uint32_t line_pitch, int values_per_pixel, std::vector<double>& sums) const
+    {
+        sums.assign(regions, 0.0);
+        for(size_t k = 0; k < runs.size(); ++k)
+        {
+            const Run& run = runs[k];
+            const T* values = reinterpret_cast<const T*>(frame + static_cast<size_t>(run.row)*line_pitch);
+            int64_t sum = 0;
+            for(uint32_t i = run.begin*values_per_pixel; i < run.end*values_per_pixel; ++i)
+            {
+                sum += values[i];
+            }
+            sums[run.region] += static_cast<double>(sum);
+        }
+    }
+
+    uint32_t camera_width() const { return width; }
+    uint32_t camera_height() const { return height; }
+
+private:
+    struct Run
+    {
+        uint32_t row;
+        uint32_t begin;
+        uint32_t end;
+        int32_t region;
+    };
+
+    size_t regions;
+    std::vector<uint64_t> counts;
+    std::vector<Run> runs;
+    uint32_t width;
+    uint32_t height;
+};
+
+#endif // REMAP_TABLES_H
@@ -0,0 +1,461 @@
+#ifndef SPARSE_SOLVERS_H
+#define SPARSE_SOLVERS_H
+
+#include <cmath>
+#include <chrono>
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+#include "measurement_operators.h"
+
+// Sparse reconstruction for undersampled single-pixel scans.
+//
+//   FISTA-L1:  min 0.5*|A*x - y|^2 + lambda*|W*x|_1,  W = orthonormal Haar
+//   TV:        min 0.5*|A*x - y|^2 + lambda*TV(x),    isotropic total variation
+//
+// Both are FISTA (Beck and Teboulle, 2009) with step 1/L, L = |A|^2
+// estimated by power iteration.  The TV proximal step is solved with the
+// fast gradient projection method on its dual, whose variables are kept
+// from one outer iteration to the next.  x holds the starting image on
+// entry (warm start; zeros for a cold start) and the result on return.
+
+struct SolverOptions
+{
+    SolverOptions() : lambda(0.001), iterations(200), tolerance(1e-5), haar_levels(4), tv_iterations(20), nonnegative(false) { }
+
+    double lambda;       // relative to max|A'*y| (in the Haar domain for FISTA-L1)
+    int iterations;      // at most this many outer iterations
+    double tolerance;    // stop when |x_new - x| <= tolerance*|x|
+    int haar_levels;     // FISTA-L1: wavelet levels (fewer if the size is odd)
+    int tv_iterations;   // TV: inner iterations per proximal step
+    bool nonnegative;    // TV only: clip negative pixels after each step
+};
+
+struct SolverReport
+{
+    SolverReport() : iterations(0), seconds(0), lipschitz(0), residual(0), memory_bytes(0) { }
+
+    int iterations;
+    double seconds;
+    double lipschitz;
+    double residual;      // |A*x - y| at the end
+    size_t memory_bytes;  // operator plus solver vectors
+
+    double iterations_per_second() const
+    {
+        return (seconds > 0) ? iterations / seconds : 0;
+    }
+};
+
+inline double vector_norm(const std::vector<double>& v)
+{
+    double sum = 0;
+    for(size_t i = 0; i < v.size(); ++i)
+    {
+        sum += v[i]*v[i];
+    }
+    return std::sqrt(sum);
+}
+
+inline size_t vector_bytes(const std::vector<double>& v)
+{
+    return v.capacity()*sizeof(double);
+}
+
+// Largest eigenvalue of A'*A.
+inline double estimate_lipschitz(MeasurementOperator& op, int iterations = 30)
+{
+    std::vector<double> v(op.columns());
+    std::vector<double> av;
+    for(size_t j = 0; j < v.size(); ++j)
+    {
+        // Any start vector with a component along the top eigenvector;
+        // a deterministic one keeps runs reproducible.
+        v[j] = 1.0 + 0.5*std::sin(static_cast<double>(j));
+    }
+    double norm = vector_norm(v);
+    double lambda = 0;
+    for(int k = 0; k < iterations && norm > 0; ++k)
+    {
+        for(size_t j = 0; j < v.size(); ++j)
+        {
+            v[j] /= norm;
+        }
+        op.forward(v, av);
+        op.adjoint(av, v);
+        norm = vector_norm(v);
+        lambda = norm;
+    }
+    // A little head room, as power iteration approaches from below.
+    return lambda*1.02;
+}
+
+
+// Orthonormal 2D Haar transform of a width x height image, in place.
+// Level k works on the top left (width >> k) x (height >> k) block, so
+// the coarse approximation ends up in the top left corner.
+class HaarTransform
+{
+public:
+    HaarTransform(int width, int height, int max_levels) : width(width), height(height), levels(0)
+    {
+        while(levels < max_levels && ((width >> levels) % 2) == 0 && ((height >> levels) % 2) == 0
+              && (width >> levels) >= 2 && (height >> levels) >= 2)
+        {
+            ++levels;
+        }
+        line.resize(std::max(width, height));
+    }
+
+    int level_count() const { return levels; }
+
+    // Coefficients in the top left block are not penalized.
+    bool is_approximation(size_t index) const
+    {
+        int x = static_cast<int>(index % width);
+        int y = static_cast<int>(index / width);
+        return x < (width >> levels) && y < (height >> levels);
+    }
+
+    void analyse(std::vector<double>& v)
+    {
+        for(int k = 0; k < levels; ++k)
+        {
+            int w = width >> k;
+            int h = height >> k;
+            for(int y = 0; y < h; ++y)
+            {
+                split(&v[static_cast<size_t>(y)*width], 1, w);
+            }
+            for(int x = 0; x < w; ++x)
+            {
+                split(&v[x], width, h);
+            }
+        }
+    }
+
+    void synthesise(std::vector<double>& v)
+    {
+        for(int k = levels - 1; k >= 0; --k)
+        {
+            int w = width >> k;
+            int h = height >> k;
+            for(int x = 0; x < w; ++x)
+            {
+                merge(&v[x], width, h);
+            }
+            for(int y = 0; y < h; ++y)
+            {
+                merge(&v[static_cast<size_t>(y)*width], 1, w);
+            }
+        }
+    }
+
+private:
+    int width;
+    int height;
+    int levels;
+    std::vector<double> line;
+
+    // n values at p, p + stride, ... -> n/2 averages then n/2 details
+    void split(double* p, size_t stride, int n)
+    {
+        const double r = std::sqrt(0.5);
+        for(int i = 0; i < n/2; ++i)
+        {
+            double a = p[2*i*stride];
+            double b = p[(2*i + 1)*stride];
+            line[i] = (a + b)*r;
+            line[n/2 + i] = (a - b)*r;
+        }
+        for(int i = 0; i < n; ++i)
+        {
+            p[i*stride] = line[i];
+        }
+    }
+
+    void merge(double* p, size_t stride, int n)
+    {
+        const double r = std::sqrt(0.5);
+        for(int i = 0; i < n/2; ++i)
+        {
+            double s = p[i*stride];
+            double d = p[(n/2 + i)*stride];
+            line[2*i] = (s + d)*r;
+            line[2*i + 1] = (s - d)*r;
+        }
+        for(int i = 0; i < n; ++i)
+        {
+            p[i*stride] = line[i];
+        }
+    }
+};
+
+
+inline double soft_threshold(double v, double t)
+{
+    return (v > t) ? v - t : ((v < -t) ? v + t : 0.0);
+}
+
+inline double fista_momentum(double& t)
+{
+    double t_next = (1 + std::sqrt(1 + 4*t*t)) / 2;
+    double beta = (t - 1) / t_next;
+    t = t_next;
+    return beta;
+}
+
+// Relative change between iterates, for the stopping test.
+inline double relative_change(const std::vector<double>& now, const std::vector<double>& before)
+{
+    double diff = 0;
+    double norm = 0;
+    for(size_t i = 0; i < now.size(); ++i)
+    {
+        diff += (now[i] - before[i])*(now[i] - before[i]);
+        norm += now[i]*now[i];
+    }
+    return (norm > 0) ? std::sqrt(diff / norm) : std::sqrt(diff);
+}
+
+inline double residual_norm(MeasurementOperator& op, const std::vector<double>& x, const std::vector<double>& y)
+{
+    std::vector<double> ax;
+    op.forward(x, ax);
+    for(size_t i = 0; i < ax.size(); ++i)
+    {
+        ax[i] -= y[i];
+    }
+    return vector_norm(ax);
+}
+
+
+inline SolverReport solve_fista_l1(MeasurementOperator& op, const std::vector<double>& y, int width, int height,
+                                   const SolverOptions& options, std::vector<double>& x)
+{
+    const size_t n = op.columns();
+    if(static_cast<size_t>(width)*height != n || y.size() != op.rows())
+    {
+        throw std::invalid_argument("Image or bucket count does not match the patterns");
+    }
+    x.resize(n, 0.0);
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    SolverReport report;
+    report.lipschitz = estimate_lipschitz(op);
+    HaarTransform haar(width, height, options.haar_levels);
+
+    std::vector<double> c(x);         // coefficients
+    std::vector<double> c_previous;
+    std::vector<double> z;            // extrapolated point
+    std::vector<double> image;
+    std::vector<double> residual;
+    std::vector<double> gradient;
+    haar.analyse(c);
+
+    // lambda relative to the largest wavelet coefficient of A'*y
+    op.adjoint(y, gradient);
+    haar.analyse(gradient);
+    double largest = 0;
+    for(size_t j = 0; j < n; ++j)
+    {
+        if( ! haar.is_approximation(j))
+        {
+            largest = std::max(largest, std::fabs(gradient[j]));
+        }
+    }
+    const double threshold = options.lambda*largest / report.lipschitz;
+
+    z = c;
+    double t = 1;
+    for(int k = 0; k < options.iterations; ++k)
+    {
+        image = z;
+        haar.synthesise(image);
+        op.forward(image, residual);
+        for(size_t i = 0; i < residual.size(); ++i)
+        {
+            residual[i] -= y[i];
+        }
+        op.adjoint(residual, gradient);
+        haar.analyse(gradient);
+
+        c_previous.swap(c);
+        c.resize(n);
+        for(size_t j = 0; j < n; ++j)
+        {
+            double v = z[j] - gradient[j] / report.lipschitz;
+            c[j] = haar.is_approximation(j) ? v : soft_threshold(v, threshold);
+        }
+
+        double beta = fista_momentum(t);
+        for(size_t j = 0; j < n; ++j)
+        {
+            z[j] = c[j] + beta*(c[j] - c_previous[j]);
+        }
+        report.iterations = k + 1;
+        if(relative_change(c, c_previous) <= options.tolerance)
+        {
+            break;
+        }
+    }
+
+    x = c;
+    haar.synthesise(x);
+    report.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    report.memory_bytes = op.memory_bytes() + vector_bytes(c) + vector_bytes(c_previous) + vector_bytes(z)
+                        + vector_bytes(image) + vector_bytes(residual) + vector_bytes(gradient) + vector_bytes(x);
+    report.residual = residual_norm(op, x, y);
+    return report;
+}
+
+
+// Proximal step of mu*TV: the image closest to b with total variation
+// weighted by mu.  px, py are the dual variables (gradient field), kept
+// between calls as the warm start.
+class TvProximal
+{
+public:
+    TvProximal(int width, int height) : width(width), height(height),
+        px(static_cast<size_t>(width)*height, 0.0), py(px), qx(px), qy(px), px_previous(px), py_previous(px), u(px) { }
+
+    void solve(const std::vector<double>& b, double mu, int iterations, bool nonnegative, std::vector<double>& x)
+    {
+        const size_t n = b.size();
+        if(mu <= 0)
+        {
+            x = b;
+            return;
+        }
+        qx = px;
+        qy = py;
+        double t = 1;
+        const double step = 1.0 / (8*mu);
+        for(int k = 0; k < iterations; ++k)
+        {
+            primal(b, mu, qx, qy, nonnegative, u);
+            px_previous.swap(px);
+            py_previous.swap(py);
+            for(int yy = 0; yy < height; ++yy)
+            {
+                for(int xx = 0; xx < width; ++xx)
+                {
+                    size_t i = static_cast<size_t>(yy)*width + xx;
+                    double gx = (xx + 1 < width) ? u[i + 1] - u[i] : 0.0;
+                    double gy = (yy + 1 < height) ? u[i + width] - u[i] : 0.0;
+                    double vx = qx[i] - step*gx;
+                    double vy = qy[i] - step*gy;
+                    double scale = std::max(1.0, std::sqrt(vx*vx + vy*vy));
+                    px[i] = vx / scale;
+                    py[i] = vy / scale;
+                }
+            }
+            double beta = fista_momentum(t);
+            for(size_t i = 0; i < n; ++i)
+            {
+                qx[i] = px[i] + beta*(px[i] - px_previous[i]);
+                qy[i] = py[i] + beta*(py[i] - py_previous[i]);
+            }
+        }
+        primal(b, mu, px, py, nonnegative, x);
+    }
+
+    size_t memory_bytes() const
+    {
+        return vector_bytes(px) + vector_bytes(py) + vector_bytes(qx) + vector_bytes(qy)
+             + vector_bytes(px_previous) + vector_bytes(py_previous) + vector_bytes(u);
+    }
+
+private:
+    int width;
+    int height;
+    std::vector<double> px, py, qx, qy, px_previous, py_previous, u;
+
+    // x = b - mu*div(p), with div the negative adjoint of the forward
+    // difference gradient.
+    void primal(const std::vector<double>& b, double mu, const std::vector<double>& ax, const std::vector<double>& ay,
+                bool nonnegative, std::vector<double>& x) const
+    {
+        x.resize(b.size());
+        for(int yy = 0; yy < height; ++yy)
+        {
+            for(int xx = 0; xx < width; ++xx)
+            {
+                size_t i = static_cast<size_t>(yy)*width + xx;
+                double div = 0;
+                if(xx + 1 < width) div += ax[i];
+                if(xx > 0)         div -= ax[i - 1];
+                if(yy + 1 < height) div += ay[i];
+                if(yy > 0)          div -= ay[i - width];
+                double v = b[i] - mu*div;
+                x[i] = (nonnegative && v < 0) ? 0.0 : v;
+            }
+        }
+    }
+};
+
+inline SolverReport solve_fista_tv(MeasurementOperator& op, const std::vector<double>& y, int width, int height,
+                                   const SolverOptions& options, std::vector<double>& x)
+{
+    const size_t n = op.columns();
+    if(static_cast<size_t>(width)*height != n || y.size() != op.rows())
+    {
+        throw std::invalid_argument("Image or bucket count does not match the patterns");
+    }
+    x.resize(n, 0.0);
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    SolverReport report;
+    report.lipschitz = estimate_lipschitz(op);
+
+    std::vector<double> residual;
+    std::vector<double> gradient;
+    op.adjoint(y, gradient);
+    double largest = 0;
+    for(size_t j = 0; j < n; ++j)
+    {
+        largest = std::max(largest, std::fabs(gradient[j]));
+    }
+    const double mu = options.lambda*largest / report.lipschitz;
+
+    TvProximal prox(width, height);
+    std::vector<double> x_previous;
+    std::vector<double> z(x);
+    std::vector<double> b(n);
+    double t = 1;
+    for(int k = 0; k < options.iterations; ++k)
+    {
+        op.forward(z, residual);
+        for(size_t i = 0; i < residual.size(); ++i)
+        {
+            residual[i] -= y[i];
+        }
+        op.adjoint(residual, gradient);
+        for(size_t j = 0; j < n; ++j)
+        {
+            b[j] = z[j] - gradient[j] / report.lipschitz;
+        }
+
+        x_previous.swap(x);
+        prox.solve(b, mu, options.tv_iterations, options.nonnegative, x);
+
+        double beta = fista_momentum(t);
+        for(size_t j = 0; j < n; ++j)
+        {
+            z[j] = x[j] + beta*(x[j] - x_previous[j]);
+        }
+        report.iterations = k + 1;
+        if(relative_change(x, x_previous) <= options.tolerance)
+        {
+            break;
+        }
+    }
+
+    report.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    report.memory_bytes = op.memory_bytes() + prox.memory_bytes() + vector_bytes(x) + vector_bytes(x_previous)
+                        + vector_bytes(z) + vector_bytes(b) + vector_bytes(residual) + vector_bytes(gradient);
+    report.residual = residual_norm(op, x, y);
+    return report;
+}
+
+#endif // SPARSE_SOLVERS_H
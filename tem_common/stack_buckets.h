@@ -0,0 +1,153 @@
+#ifndef STACK_BUCKETS_H
+#define STACK_BUCKETS_H
+
+#include <cstdio>
+#include <string>
+#include <stdexcept>
+#include <stdint.h>
+#include "bucket_file.h"
+#include "frame_stack.h"
+#include "remap_tables.h"
+
+// Bucket values straight from a frame stack written by the acquisition
+// program: the sum of all pixel values (all channels) of each frame,
+// optionally only inside a region of interest.  The bucket is stored
+// under the frame's pattern id, which is the number sent on the
+// acquisition program's input.
+struct BucketRegion
+{
+    BucketRegion() : x(0), y(0), width(0), height(0) { }
+
+    int x;
+    int y;
+    int width;   // 0 = to the right edge
+    int height;  // 0 = to the bottom edge
+};
+
+// "x,y,width,height", as given to --roi.
+inline bool parse_bucket_region(const std::string& text, BucketRegion& region)
+{
+    return sscanf(text.c_str(), "%d,%d,%d,%d", &region.x, &region.y, &region.width, &region.height) == 4
+        && region.width > 0 && region.height > 0;
+}
+
+// The bucket number of frame i: its pattern id, or the frame number if
+// it has none.  Held to MAX_BUCKET_PATTERNS, as in bucket files.
+inline size_t stack_bucket_index(const FrameStackReader& stack, uint64_t i, const std::string& path)
+{
+    const int32_t id = stack.metadata(i).pattern_id;
+    const uint64_t index = (id >= 0) ? static_cast<uint64_t>(id) : i;
+    if(index >= MAX_BUCKET_PATTERNS)
+    {
+        throw std::runtime_error("Frame " + std::to_string(i) + " of " + path + " has pattern number " + std::to_string(index)
+                                 + "; at most " + std::to_string(MAX_BUCKET_PATTERNS - 1) + " is allowed");
+    }
+    return static_cast<size_t>(index);
+}
+
+// Pixel bounds [x0, x1) x [y0, y1) of a region in a width x height
+// frame; false if the region does not lie inside the frame.
+inline bool bucket_region_bounds(const BucketRegion& region, int width, int height, int& x0, int& y0, int& x1, int& y1)
+{
+    x0 = region.x;
+    y0 = region.y;
+    x1 = (region.width > 0) ? region.x + region.width : width;
+    y1 = (region.height > 0) ? region.y + region.height : height;
+    return x0 >= 0 && y0 >= 0 && x1 <= width && y1 <= height && x0 < x1 && y0 < y1;
+}
+
+// Difference stacks (FRAME_PIXEL_DIFF16, one frame per complementary
+// pair) give the signed sum of the differences.
+inline BucketSeries read_stack_buckets(const std::string& path, const BucketRegion& region)
+{
+    FrameStackReader stack(path);
+    const FrameStackHeader& info = stack.info();
+    if(info.pixel_format == FRAME_PIXEL_MONO16)
+    {
+        throw std::runtime_error("16-bit stacks are not supported for bucket values");
+    }
+    const bool difference = (info.pixel_format == FRAME_PIXEL_DIFF16);
+    const int values_per_pixel = info.bits_per_pixel / (difference ? 16 : 8);
+    int x0, y0, x1, y1;
+    if( ! bucket_region_bounds(region, info.width, info.height, x0, y0, x1, y1))
+    {
+        throw std::runtime_error("Bucket region lies outside the frames of " + path);
+    }
+
+    BucketSeries buckets;
+    for(uint64_t i = 0; i < stack.capacity(); ++i)
+    {
+        if( ! stack.has_frame(i))
+        {
+            continue;
+        }
+        const unsigned char* pixels = stack.frame(i);
+        int64_t sum = 0;
+        for(int y = y0; y < y1; ++y)
+        {
+            const unsigned char* row = pixels + static_cast<size_t>(y)*info.line_pitch;
+            if(difference)
+            {
+                const int16_t* values = reinterpret_cast<const int16_t*>(row);
+                for(int b = x0*values_per_pixel; b < x1*values_per_pixel; ++b)
+                {
+                    sum += values[b];
+                }
+            }
+            else
+            {
+                for(int b = x0*values_per_pixel; b < x1*values_per_pixel; ++b)
+                {
+                    sum += row[b];
+                }
+            }
+        }
+        buckets.set(stack_bucket_index(stack, i, path), static_cast<double>(sum));
+    }
+    return buckets;
+}
+
+// The same, summing exactly the camera pixels under the mirror regions
+// of a calibration (see remap_tables.h).
+inline BucketSeries read_stack_buckets(const std::string& path, const CameraRegionMap& regions)
+{
+    FrameStackReader stack(path);
+    const FrameStackHeader& info = stack.info();
+    if(info.pixel_format == FRAME_PIXEL_MONO16)
+    {
+        throw std::runtime_error("16-bit stacks are not supported for bucket values");
+    }
+    if(info.width != regions.camera_width() || info.height != regions.camera_height())
+    {
+        throw std::runtime_error("The calibration is for a different camera size than the frames of " + path);
+    }
+    const bool difference = (info.pixel_format == FRAME_PIXEL_DIFF16);
+    const int values_per_pixel = info.bits_per_pixel / (difference ? 16 : 8);
+
+    BucketSeries buckets;
+    std::vector<double> sums;
+    for(uint64_t i = 0; i < stack.capacity(); ++i)
+    {
+        if( ! stack.has_frame(i))
+        {
+            continue;
+        }
+        if(difference)
+        {
+            regions.reduce<int16_t>(stack.frame(i), info.line_pitch, values_per_pixel, sums);
+        }
+        else
+        {
+            regions.reduce<unsigned char>(stack.frame(i), info.line_pitch, values_per_pixel, sums);
+        }
+        double sum = 0;
+        for(size_t r = 0; r < sums.size(); ++r)
+        {
+            sum += sums[r];
+        }
+        buckets.set(stack_bucket_index(stack, i, path), sum);
+    }
+    return buckets;
+}
+
+#endif // STACK_BUCKETS_H
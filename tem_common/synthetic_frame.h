@@ -0,0 +1,48 @@
+#ifndef SYNTHETIC_FRAME_H
+#define SYNTHETIC_FRAME_H
+
+#include <cmath>
+#include <vector>
+#include <stdint.h>
+
+// Synthetic detector frames for benchmarks that should not depend on
+// the camera: a dark background a few counts above zero with sensor
+// noise, and one bright illuminated disk with a soft edge that clips at
+// full scale in the middle, as in our TEM images.
+inline void make_synthetic_frame(std::vector<unsigned char>& pixels, int width, int height, int channels, uint32_t seed)
+{
+    pixels.resize(static_cast<size_t>(width)*height*channels);
+
+    uint32_t state = seed*2654435761u + 1;
+    const double cx = width*(0.45 + 0.1*((seed % 7)/7.0));
+    const double cy = height*(0.45 + 0.1*((seed % 5)/5.0));
+    const double radius = 0.25*((width < height) ? width : height);
+
+    size_t i = 0;
+    for(int y = 0; y < height; ++y)
+    {
+        for(int x = 0; x < width; ++x)
+        {
+            double r = std::sqrt((x - cx)*(x - cx) + (y - cy)*(y - cy));
+            double signal = 4.0;
+            if(r < radius*1.2)
+            {
+                double edge = (radius*1.2 - r)/(radius*0.4);
+                signal += 300.0*((edge > 1.0) ? 1.0 : edge);
+            }
+            for(int c = 0; c < channels; ++c)
+            {
+                // xorshift32 noise, roughly +-2 counts in the background
+                // and growing with the signal like shot noise
+                state ^= state << 13;
+                state ^= state >> 17;
+                state ^= state << 5;
+                double noise = ((state & 0xFF)/255.0 - 0.5)*(4.0 + std::sqrt(signal));
+                double v = signal + noise;
+                pixels[i++] = static_cast<unsigned char>((v < 0) ? 0 : ((v > 255) ? 255 : v));
+            }
+        }
+    }
+}
+
+#endif // SYNTHETIC_FRAME_H
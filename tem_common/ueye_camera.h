@@ -0,0 +1,605 @@
+#ifndef UEYE_CAMERA_H
+#define UEYE_CAMERA_H
+
+#include <iostream>
+#include <string>
+#include <chrono>
+#include <thread>
+#include <stdint.h>
+#include "uEye.h"
+#include "ueye_error.h"
+
+// Settings applied through UEyeCamera, kept so that they can be
+// restored after the camera is re-initialized.  UNSET fields were
+// never configured by this program and are left alone.
+struct CameraSettings
+{
+    static const int UNSET = -1;
+
+    CameraSettings() : pixel_clock(UNSET), long_exposure(UNSET), log_mode(UNSET), shutter_mode(UNSET),
+                       gain(UNSET), blacklevel(UNSET), frame_rate(UNSET), exposure_ms(UNSET), trigger_mode(UNSET) { }
+
+    int pixel_clock;
+    int long_exposure;
+    int log_mode;
+    int shutter_mode;
+    int gain;
+    int blacklevel;
+    double frame_rate;
+    double exposure_ms;
+    int trigger_mode;
+};
+
+
+// One uEye camera.  Every is_* call goes through call(), which
+// retries transient errors and, if the device was lost, runs an
+// is_ExitCamera/is_InitCamera cycle, restores the image memory and
+// cached settings, and then tries the call again.  Errors that cannot
+// be recovered are thrown as UEyeException.
+//
+// The object also remembers what the camera is currently set to, so
+// repeated get/set sequences only reach the driver when a value
+// actually changes.
+class UEyeCamera
+{
+public:
+    UEyeCamera(HIDS id, bool quiet_mode, const RetryPolicy& retry_policy = RetryPolicy())
+        : camera_id(id), hCam(id), quiet(quiet_mode), policy(retry_policy),
+          image_memory(NULL), memory_ID(0), image_bit_depth(0), image_pitch(0), reconnecting(false), reconnect_total(0),
+          verify_readback(false), exposure_range_known(false), skipped_total(0), issued_total(0)
+    {
+        call("is_InitCamera", [this]() { return is_InitCamera(&hCam, NULL); });
+        call("is_GetSensorInfo", [this]() { return is_GetSensorInfo(hCam, &sensor); });
+    }
+
+    ~UEyeCamera()
+    {
+        if(image_memory != NULL)
+        {
+            is_FreeImageMem(hCam, image_memory, memory_ID);
+        }
+        is_ExitCamera(hCam);
+    }
+
+    HIDS handle() const { return hCam; }
+    int width() const { return sensor.nMaxWidth; }
+    int height() const { return sensor.nMaxHeight; }
+    unsigned reconnect_count() const { return reconnect_total; }
+    const CameraSettings& settings() const { return applied; }
+
+    // With verification on, every getter queries the camera and every
+    // setter reads its value back; otherwise cached values are trusted.
+    void set_verify_readback(bool verify) { verify_readback = verify; }
+
+    // Calls answered from the cache or skipped because the camera
+    // already had the requested value.
+    unsigned skipped_calls() const { return skipped_total; }
+    unsigned issued_calls() const { return issued_total; }
+
+    void allocate_image_memory(int bit_depth)
+    {
+        image_bit_depth = bit_depth;
+        call("is_AllocImageMem", [this]() { return is_AllocImageMem(hCam, width(), height(), image_bit_depth, &image_memory, &memory_ID); });
+        call("is_SetImageMem", [this]() { return is_SetImageMem(hCam, image_memory, memory_ID); });
+        call("is_GetImageMemPitch", [this]() { return is_GetImageMemPitch(hCam, &image_pitch); });
+    }
+
+    // The camera's own image buffer, holding the last frame taken with
+    // freeze_video().  pitch() is the distance between rows in bytes.
+    char* image_data() const { return image_memory; }
+    int pitch() const { return image_pitch; }
+    int bit_depth() const { return image_bit_depth; }
+
+    // Make the camera's own buffer the active one again, after frames
+    // went into other memory (a ring of buffers, say).
+    void restore_image_memory()
+    {
+        call("is_SetImageMem", [this]() { return is_SetImageMem(hCam, image_memory, memory_ID); });
+    }
+
+    // Getters return the cached value when the device state is already
+    // known, unless read-back verification is on.  Setters skip the call
+    // when the camera already has the requested value.
+    double get_frame_rate()
+    {
+        if(cache_hit(known.frame_rate))
+        {
+            return known.frame_rate;
+        }
+        double fps = 0;
+        call("is_SetFrameRate", [&]() { return is_SetFrameRate(hCam, IS_GET_FRAMERATE, &fps); });
+        known.frame_rate = fps;
+        return fps;
+    }
+
+    double set_frame_rate(double fps)
+    {
+        // The camera rounds the rate, so compare against the last request.
+        if(known.frame_rate != CameraSettings::UNSET && already_set(applied.frame_rate, fps))
+        {
+            return known.frame_rate;
+        }
+        applied.frame_rate = fps;
+        double readback = 0;
+        call("is_SetFrameRate", [&]() { return is_SetFrameRate(hCam, fps, &readback); });
+        known.frame_rate = readback;
+        // The camera shortens the exposure if it no longer fits a frame.
+        known.exposure_ms = CameraSettings::UNSET;
+        exposure_range_known = false;
+        return readback;
+    }
+
+    double get_exposure()
+    {
+        if(cache_hit(known.exposure_ms))
+        {
+            return known.exposure_ms;
+        }
+        return read_exposure();
+    }
+
+    // Asks the camera even when the exposure is cached.
+    double read_exposure()
+    {
+        double ms = 0;
+        call("is_Exposure", [&]() { return is_Exposure(hCam, IS_EXPOSURE_CMD_GET_EXPOSURE, &ms, sizeof(ms)); });
+        known.exposure_ms = ms;
+        return ms;
+    }
+
+    // The camera rounds the exposure to its own steps, so what it took
+    // is read back and cached, and a repeated request is compared
+    // against the last request, as for the frame rate.
+    void set_exposure(double ms)
+    {
+        if(known.exposure_ms != CameraSettings::UNSET && already_set(applied.exposure_ms, ms))
+        {
+            return;
+        }
+        applied.exposure_ms = ms;
+        call("is_Exposure", [&]() { return is_Exposure(hCam, IS_EXPOSURE_CMD_SET_EXPOSURE, &ms, sizeof(ms)); });
+        read_exposure();
+    }
+
+    // The range only changes with pixel clock and frame rate, so it
+    // is queried once and then kept until one of those changes.
+    void get_exposure_range(double range[3])
+    {
+        if( ! exposure_range_known || verify_readback)
+        {
+            call("is_Exposure", [&]() { return is_Exposure(hCam, IS_EXPOSURE_CMD_GET_EXPOSURE_RANGE, exposure_range, sizeof(exposure_range)); });
+            exposure_range_known = true;
+        }
+        else
+        {
+            ++skipped_total;
+        }
+        range[0] = exposure_range[0];
+        range[1] = exposure_range[1];
+        range[2] = exposure_range[2];
+    }
+
+    void set_long_exposure(bool enable)
+    {
+        UINT mode = enable ? 1 : 0;
+        applied.long_exposure = mode;
+        if(already_set(known.long_exposure, static_cast<int>(mode)))
+        {
+            return;
+        }
+        call("is_Exposure", [&]() { return is_Exposure(hCam, IS_EXPOSURE_CMD_SET_LONG_EXPOSURE_ENABLE, &mode, sizeof(mode)); });
+        known.long_exposure = mode;
+    }
+
+    void set_pixel_clock(int mhz)
+    {
+        applied.pixel_clock = mhz;
+        if(already_set(known.pixel_clock, mhz))
+        {
+            return;
+        }
+        call("is_PixelClock", [&]() { return is_PixelClock(hCam, IS_PIXELCLOCK_CMD_SET, &mhz, sizeof(mhz)); });
+        known.pixel_clock = mhz;
+
+        // Frame rate and exposure limits depend on the pixel clock.
+        known.frame_rate = CameraSettings::UNSET;
+        known.exposure_ms = CameraSettings::UNSET;
+        exposure_range_known = false;
+    }
+
+    void set_log_mode(UINT mode)
+    {
+        applied.log_mode = mode;
+        if(already_set(known.log_mode, static_cast<int>(mode)))
+        {
+            return;
+        }
+        call("is_DeviceFeature", [&]() { return is_DeviceFeature(hCam, IS_DEVICE_FEATURE_CMD_SET_LOG_MODE, &mode, sizeof(mode)); });
+        known.log_mode = mode;
+    }
+
+    void set_shutter_mode(UINT mode)
+    {
+        applied.shutter_mode = mode;
+        if(already_set(known.shutter_mode, static_cast<int>(mode)))
+        {
+            return;
+        }
+        call("is_DeviceFeature", [&]() { return is_DeviceFeature(hCam, IS_DEVICE_FEATURE_CMD_SET_SHUTTER_MODE, &mode, sizeof(mode)); });
+        known.shutter_mode = mode;
+    }
+
+    int get_gain()
+    {
+        if(cache_hit(known.gain))
+        {
+            return known.gain;
+        }
+        // IS_GET_MASTER_GAIN returns the gain itself (0-100), so a
+        // negative value is the only sign of an error.
+        int gain = 0;
+        call("is_SetHardwareGain", [&]()
+        {
+            gain = is_SetHardwareGain(hCam, IS_GET_MASTER_GAIN, IS_IGNORE_PARAMETER, IS_IGNORE_PARAMETER, IS_IGNORE_PARAMETER);
+            return (gain < 0) ? last_error() : IS_SUCCESS;
+        });
+        known.gain = gain;
+        return gain;
+    }
+
+    void set_gain(int gain)
+    {
+        applied.gain = gain;
+        if(already_set(known.gain, gain))
+        {
+            return;
+        }
+        call("is_SetHardwareGain", [&]() { return is_SetHardwareGain(hCam, gain, IS_IGNORE_PARAMETER, IS_IGNORE_PARAMETER, IS_IGNORE_PARAMETER); });
+        known.gain = gain;
+        if(verify_readback)
+        {
+            get_gain();
+        }
+    }
+
+    int get_blacklevel()
+    {
+        if(cache_hit(known.blacklevel))
+        {
+            return known.blacklevel;
+        }
+        int offset = 0;
+        call("is_Blacklevel", [&]() { return is_Blacklevel(hCam, IS_BLACKLEVEL_CMD_GET_OFFSET, &offset, sizeof(offset)); });
+        known.blacklevel = offset;
+        return offset;
+    }
+
+    void set_blacklevel(int offset)
+    {
+        applied.blacklevel = offset;
+        if(already_set(known.blacklevel, offset))
+        {
+            return;
+        }
+        call("is_Blacklevel", [&]() { return is_Blacklevel(hCam, IS_BLACKLEVEL_CMD_SET_OFFSET, &offset, sizeof(offset)); });
+        known.blacklevel = offset;
+        if(verify_readback)
+        {
+            get_blacklevel();
+        }
+    }
+
+    void set_trigger(int mode)
+    {
+        applied.trigger_mode = mode;
+        if(already_set(known.trigger_mode, mode))
+        {
+            return;
+        }
+        call("is_SetExternalTrigger", [&]() { return is_SetExternalTrigger(hCam, mode); });
+        known.trigger_mode = mode;
+    }
+
+    // Drop everything known about the camera's state so the next
+    // getters and setters go to the driver again.
+    void forget_state()
+    {
+        known = CameraSettings();
+        exposure_range_known = false;
+    }
+
+    // Write the camera's complete state to a uEye parameter file.
+    void save_parameter_set(const std::string& ini_file)
+    {
+        std::wstring w_file_name(ini_file.begin(), ini_file.end());
+        call("is_ParameterSet", [&]() { return is_ParameterSet(hCam, IS_PARAMETERSET_CMD_SAVE_FILE, &w_file_name[0], 0); });
+    }
+
+    // Load a parameter file in one call.  contents describes what the
+    // file sets, so the cache stays correct and a reconnect can load
+    // the same file again.
+    void load_parameter_set(const std::string& ini_file, const CameraSettings& contents)
+    {
+        std::wstring w_file_name(ini_file.begin(), ini_file.end());
+        call("is_ParameterSet", [&]() { return is_ParameterSet(hCam, IS_PARAMETERSET_CMD_LOAD_FILE, &w_file_name[0], 0); });
+        parameter_set_file = ini_file;
+        parameter_set_contents = contents;
+        known = contents;
+        applied = contents;
+        // contents has the exposure asked for, not what the camera made of it.
+        known.exposure_ms = CameraSettings::UNSET;
+        exposure_range_known = false;
+    }
+
+    void freeze_video()
+    {
+        call("is_FreezeVideo", [this]() { return is_FreezeVideo(hCam, IS_WAIT); });
+    }
+
+    void save_image(const std::string& file_name, UINT file_type, UINT quality)
+    {
+        std::wstring w_file_name(file_name.begin(), file_name.end());
+        IMAGE_FILE_PARAMS ImageFileParams;
+        ImageFileParams.pwchFileName = &w_file_name[0];
+        ImageFileParams.nFileType = file_type;
+        ImageFileParams.pnImageID = NULL;
+        ImageFileParams.ppcImageMem = NULL;
+        ImageFileParams.nQuality = quality;
+        if( ! quiet) { std::wcout << "\nSaving image to " << ImageFileParams.pwchFileName << " ..." << std::endl; }
+        call("is_ImageFile", [&]() { return is_ImageFile(hCam, IS_IMAGE_FILE_CMD_SAVE, &ImageFileParams, sizeof(ImageFileParams)); });
+    }
+
+    // Take a picture and save it.  If the camera had to be
+    // re-initialized in between, the frame in memory is gone, so the
+    // whole capture is repeated.
+    void capture_to_file(const std::string& file_name, UINT file_type, UINT quality)
+    {
+        unsigned reconnects_before;
+        do
+        {
+            reconnects_before = reconnect_total;
+            if( ! quiet) { std::cout << "\nFreezing video ..." << std::endl; }
+            freeze_video();
+            save_image(file_name, file_type, quality);
+        } while(reconnect_total != reconnects_before);
+    }
+
+    // Take a picture straight into caller-owned memory, such as a
+    // mapped slot of a frame stack, instead of the camera's own
+    // buffer.  The memory must hold a full frame at the allocated bit
+    // depth.  Returns the camera's timestamp in microseconds.
+    uint64_t capture_into(char* destination)
+    {
+        unsigned reconnects_before;
+        UEYEIMAGEINFO image_info;
+        do
+        {
+            reconnects_before = reconnect_total;
+            INT user_ID = 0;
+            call("is_SetAllocatedImageMem", [&]() { return is_SetAllocatedImageMem(hCam, width(), height(), image_bit_depth, destination, &user_ID); });
+            call("is_SetImageMem", [&]() { return is_SetImageMem(hCam, destination, user_ID); });
+            if(reconnect_total == reconnects_before)
+            {
+                freeze_video();
+            }
+            if(reconnect_total == reconnects_before)
+            {
+                call("is_GetImageInfo", [&]() { return is_GetImageInfo(hCam, user_ID, &image_info, sizeof(image_info)); });
+            }
+
+            // Hand the camera its own buffer back and release the user
+            // memory (is_FreeImageMem does not free memory it did not allocate).
+            if(reconnect_total == reconnects_before)
+            {
+                call("is_SetImageMem", [this]() { return is_SetImageMem(hCam, image_memory, memory_ID); });
+                is_FreeImageMem(hCam, destination, user_ID);
+            }
+        } while(reconnect_total != reconnects_before);
+
+        return image_info.u64TimestampDevice / 10; // device clock counts 0.1 us
+    }
+
+    // Take a picture into memory registered once with
+    // is_SetAllocatedImageMem (a FramePool buffer), leaving the camera's
+    // own buffer active again afterwards.  A reconnect ends the
+    // registration: the caller sees reconnect_count() change, registers
+    // the memory again and repeats the picture.
+    uint64_t capture_registered(char* memory, INT id)
+    {
+        const unsigned reconnects_before = reconnect_total;
+        UEYEIMAGEINFO image_info;
+        image_info.u64TimestampDevice = 0;
+        call("is_SetImageMem", [&]() { return is_SetImageMem(hCam, memory, id); });
+        if(reconnect_total == reconnects_before)
+        {
+            freeze_video();
+        }
+        if(reconnect_total == reconnects_before)
+        {
+            call("is_GetImageInfo", [&]() { return is_GetImageInfo(hCam, id, &image_info, sizeof(image_info)); });
+        }
+        if(reconnect_total == reconnects_before)
+        {
+            restore_image_memory();
+        }
+        return image_info.u64TimestampDevice / 10; // device clock counts 0.1 us
+    }
+
+    // Run one is_* call under the retry policy.  f() must return
+    // the uEye status code and use the current hCam, since a
+    // reconnect changes it.
+    template<typename F>
+    void call(const char* name, F f)
+    {
+        int delay_ms = policy.delay_ms;
+        int attempts_left = policy.attempts;
+        int reconnects_left = policy.reconnects;
+        while(true)
+        {
+            ++issued_total;
+            INT ret = f();
+            if(ret == IS_SUCCESS)
+            {
+                if( ! quiet) { std::cout << "Success!" << std::endl; }
+                return;
+            }
+
+            UEyeErrorClass kind = classify_ueye_error(ret);
+            if(kind == UEYE_TRANSIENT && --attempts_left > 0)
+            {
+                std::cout << name << " returned " << ret << ", retrying in " << delay_ms << " ms ..." << std::endl;
+                std::this_thread::sleep_for(std::chrono::milliseconds(delay_ms));
+                delay_ms *= 2;
+                continue;
+            }
+
+            // Only a lost camera is worth an exit and re-init; a call that
+            // still fails after its retries, or was refused, fails here.
+            if(kind == UEYE_DEVICE_LOST && ! reconnecting && reconnects_left-- > 0)
+            {
+                std::cout << name << " returned " << ret << ", re-initializing camera ..." << std::endl;
+                reconnect();
+                attempts_left = policy.attempts;
+                delay_ms = policy.delay_ms;
+                continue;
+            }
+
+            throw UEyeException(name, ret, error_text());
+        }
+    }
+
+    // Exit and re-initialize the camera, then put back the image
+    // memory and every setting made through this object.
+    void reconnect()
+    {
+        reconnecting = true;
+        try
+        {
+            is_ExitCamera(hCam);
+            image_memory = NULL;
+
+            // The device may need a while to show up again.
+            for(int attempt = 1; ; ++attempt)
+            {
+                std::this_thread::sleep_for(std::chrono::milliseconds(policy.reconnect_delay_ms));
+                hCam = camera_id;
+                INT ret = is_InitCamera(&hCam, NULL);
+                if(ret == IS_SUCCESS)
+                {
+                    break;
+                }
+                if(attempt >= policy.attempts)
+                {
+                    throw UEyeException("is_InitCamera", ret, "");
+                }
+            }
+            call("is_GetSensorInfo", [this]() { return is_GetSensorInfo(hCam, &sensor); });
+            if(image_bit_depth != 0)
+            {
+                allocate_image_memory(image_bit_depth);
+            }
+            restore_settings();
+        }
+        catch(...)
+        {
+            reconnecting = false;
+            throw;
+        }
+        reconnecting = false;
+        ++reconnect_total;
+    }
+
+private:
+    const HIDS camera_id;
+    HIDS hCam;
+    bool quiet;
+    RetryPolicy policy;
+    SENSORINFO sensor;
+    char* image_memory;
+    INT memory_ID;
+    int image_bit_depth;
+    INT image_pitch;
+    bool reconnecting;
+    unsigned reconnect_total;
+    CameraSettings applied; // everything set through this object, restored after a reconnect
+    CameraSettings known;   // last value set or read back, UNSET if not known
+    std::string parameter_set_file;        // loaded with load_parameter_set(), empty if none
+    CameraSettings parameter_set_contents;
+    bool verify_readback;
+    double exposure_range[3];
+    bool exposure_range_known;
+    unsigned skipped_total;
+    unsigned issued_total;
+
+    template<typename T>
+    bool cache_hit(T value)
+    {
+        if(verify_readback || value == CameraSettings::UNSET)
+        {
+            return false;
+        }
+        ++skipped_total;
+        return true;
+    }
+
+    template<typename T>
+    bool already_set(T value, T target)
+    {
+        if(value == CameraSettings::UNSET || value != target)
+        {
+            return false;
+        }
+        ++skipped_total;
+        return true;
+    }
+
+    // Same order as the original configuration sequence.
+    void restore_settings()
+    {
+        // Nothing is known about the freshly initialized camera.
+        forget_state();
+
+        if( ! parameter_set_file.empty())
+        {
+            std::wstring w_file_name(parameter_set_file.begin(), parameter_set_file.end());
+            call("is_ParameterSet", [&]() { return is_ParameterSet(hCam, IS_PARAMETERSET_CMD_LOAD_FILE, &w_file_name[0], 0); });
+            known = parameter_set_contents;
+            known.exposure_ms = CameraSettings::UNSET;
+        }
+
+        CameraSettings s = applied;
+        if(s.pixel_clock != CameraSettings::UNSET)   { set_pixel_clock(s.pixel_clock); }
+        if(s.long_exposure != CameraSettings::UNSET) { set_long_exposure(s.long_exposure != 0); }
+        if(s.log_mode != CameraSettings::UNSET)      { set_log_mode(s.log_mode); }
+        if(s.shutter_mode != CameraSettings::UNSET)  { set_shutter_mode(s.shutter_mode); }
+        if(s.gain != CameraSettings::UNSET)          { set_gain(s.gain); }
+        if(s.blacklevel != CameraSettings::UNSET)    { set_blacklevel(s.blacklevel); }
+        if(s.frame_rate != CameraSettings::UNSET)    { set_frame_rate(s.frame_rate); }
+        if(s.exposure_ms != CameraSettings::UNSET)   { set_exposure(s.exposure_ms); }
+        if(s.trigger_mode != CameraSettings::UNSET)  { set_trigger(s.trigger_mode); }
+    }
+
+    INT last_error()
+    {
+        INT errNum = IS_SUCCESS;
+        IS_CHAR* errMessage;
+        if(is_GetError(hCam, &errNum, &errMessage) != IS_SUCCESS || errNum == IS_SUCCESS)
+        {
+            return IS_NO_SUCCESS;
+        }
+        return errNum;
+    }
+
+    std::string error_text()
+    {
+        INT errNum;
+        IS_CHAR* errMessage = NULL;
+        if(is_GetError(hCam, &errNum, &errMessage) != IS_SUCCESS || errMessage == NULL)
+        {
+            return std::string();
+        }
+        return std::string(errMessage);
+    }
+};
+
+#endif // UEYE_CAMERA_H
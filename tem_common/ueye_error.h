@@ -0,0 +1,91 @@
+#ifndef UEYE_ERROR_H
+#define UEYE_ERROR_H
+
+#include <string>
+#include <sstream>
+#include <exception>
+#include "uEye.h"
+
+// How a failed is_* call should be handled.
+enum UEyeErrorClass
+{
+    UEYE_TRANSIENT,   // try the same call again after a short pause, then give up
+    UEYE_DEVICE_LOST, // the camera went away; exit and re-initialize it (the only class that does)
+    UEYE_FATAL        // bad parameters, unsupported feature, ...; give up
+};
+
+inline UEyeErrorClass classify_ueye_error(INT code)
+{
+    switch(code)
+    {
+    case IS_NO_SUCCESS:
+    case IS_TIMED_OUT:
+    case IS_TRANSFER_ERROR:
+    case IS_CAPTURE_RUNNING:
+        return UEYE_TRANSIENT;
+
+    case IS_INVALID_CAMERA_HANDLE:
+    case IS_IO_REQUEST_FAILED:
+    case IS_CANT_OPEN_DEVICE:
+        return UEYE_DEVICE_LOST;
+
+    default:
+        return UEYE_FATAL;
+    }
+}
+
+inline const char* ueye_error_class_name(UEyeErrorClass c)
+{
+    switch(c)
+    {
+    case UEYE_TRANSIENT:   return "transient";
+    case UEYE_DEVICE_LOST: return "device lost";
+    default:               return "fatal";
+    }
+}
+
+
+// Thrown when a uEye call fails and the retry policy is used up.
+class UEyeException : public std::exception
+{
+public:
+    UEyeException(const std::string& call, INT code, const std::string& message) throw()
+        : error_code(code), error_class(classify_ueye_error(code))
+    {
+        std::ostringstream out;
+        out << call << " failed\nError number " << code << " (" << ueye_error_class_name(error_class) << ")";
+        if( ! message.empty())
+        {
+            out << "\nError Message " << message;
+        }
+        what_message = out.str();
+    }
+    ~UEyeException() throw() { }
+
+    const char* what() const throw()
+    {
+        return what_message.c_str();
+    }
+
+    INT code() const { return error_code; }
+    UEyeErrorClass kind() const { return error_class; }
+
+private:
+    INT error_code;
+    UEyeErrorClass error_class;
+    std::string what_message;
+};
+
+
+// Retry limits for failed uEye calls.
+struct RetryPolicy
+{
+    RetryPolicy() : attempts(3), delay_ms(50), reconnects(2), reconnect_delay_ms(1000) { }
+
+    int attempts;           // tries per call for transient errors
+    int delay_ms;           // pause between tries, doubled after each failure
+    int reconnects;         // exit/init cycles allowed per call, for UEYE_DEVICE_LOST only
+    int reconnect_delay_ms; // pause before re-initializing, lets USB re-enumerate
+};
+
+#endif // UEYE_ERROR_H
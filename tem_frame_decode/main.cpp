@@ -0,0 +1,99 @@
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <exception>
+#include "frame_codec.h"
+
+// Decode .tlc pictures from the acquisition programs into binary PPM
+// (color) or PGM (mono) files, which Octave reads with imread().
+void write_netpbm(const std::string& file_name, const std::vector<unsigned char>& pixels, int width, int height, int channels)
+{
+    // Mono goes to PGM; BGR and BGRA (alpha dropped) go to PPM.
+    if(channels != 1 && channels != 3 && channels != 4)
+    {
+        throw std::runtime_error("Cannot write a picture with " + std::to_string(channels) + " channels");
+    }
+    FILE* f = fopen(file_name.c_str(), "wb");
+    if(f == NULL)
+    {
+        throw std::runtime_error("Could not write " + file_name);
+    }
+
+    fprintf(f, "%s\n%d %d\n255\n", (channels == 1) ? "P5" : "P6", width, height);
+    if(channels == 1)
+    {
+        fwrite(&pixels[0], 1, pixels.size(), f);
+    }
+    else
+    {
+        // The camera stores blue, green, red; PPM wants red first.
+        std::vector<unsigned char> row(static_cast<size_t>(width)*3);
+        for(int y = 0; y < height; ++y)
+        {
+            const unsigned char* in = &pixels[static_cast<size_t>(y)*width*channels];
+            for(int x = 0; x < width; ++x)
+            {
+                row[3*x + 0] = in[channels*x + 2];
+                row[3*x + 1] = in[channels*x + 1];
+                row[3*x + 2] = in[channels*x + 0];
+            }
+            fwrite(&row[0], 1, row.size(), f);
+        }
+    }
+
+    if(fclose(f) != 0)
+    {
+        throw std::runtime_error("Could not write " + file_name);
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    if(argc < 2)
+    {
+        std::cerr << "Usage: tem_frame_decode picture.tlc [output.ppm]\n"
+                  << "       tem_frame_decode picture1.tlc picture2.tlc ...\n"
+                  << "Without an output name, picture.tlc is written to picture.ppm (or .pgm for mono).\n";
+        return 1;
+    }
+
+    // A single input may be followed by its output name.
+    bool named_output = (argc == 3 && std::string(argv[2]).find(".tlc") == std::string::npos);
+    int inputs = named_output ? 1 : argc - 1;
+
+    int failures = 0;
+    std::vector<unsigned char> pixels;
+    for(int i = 1; i <= inputs; ++i)
+    {
+        try
+        {
+            int width, height, channels;
+            tlc_read_file(argv[i], pixels, width, height, channels);
+
+            std::string output;
+            if(named_output)
+            {
+                output = argv[2];
+            }
+            else
+            {
+                output = argv[i];
+                std::string::size_type dot = output.rfind('.');
+                if(dot != std::string::npos)
+                {
+                    output.erase(dot);
+                }
+                output += (channels == 1) ? ".pgm" : ".ppm";
+            }
+            write_netpbm(output, pixels, width, height, channels);
+        }
+        catch(const std::exception& e)
+        {
+            std::cout << argv[i] << ": " << e.what() << '\n';
+            ++failures;
+        }
+    }
+
+    return (failures == 0) ? 0 : 1;
+}
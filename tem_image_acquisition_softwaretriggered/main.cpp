@@ -1,48 +1,125 @@
 #include <iostream>
 #include <string>
+#include <memory>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <cmath>
+#include <cstring>
 #include <Windows.h>
 #include "uEye.h"
+#include "ueye_camera.h"
+#include "camera_configuration.h"
+#include "scan_journal.h"
+#include "frame_stack.h"
+#include "differential_pair.h"
+#include "camera_group.h"
+#include "frame_pool.h"
+
+// In stack mode each stdin line labels a frame.  A numeric label is
+// stored as the frame's pattern id; otherwise the step number is used.
+int pattern_id_from_label(const std::string& label, unsigned step)
+{
+    char* end = NULL;
+    long id = strtol(label.c_str(), &end, 10);
+    return (end != label.c_str() && *end == '\0') ? static_cast<int>(id) : static_cast<int>(step);
+}
 
-void detailed_error_message(const HIDS& hCam, bool quiet)
+// Camera ids as given with --cameras, e.g. "1,2".
+bool parse_camera_ids(const std::string& text, std::vector<HIDS>& ids)
 {
-    INT errNum;
-    IS_CHAR* errMessage;
-    int errReturnValue = is_GetError(hCam, &errNum, &errMessage);
-    if(errNum != IS_SUCCESS || errReturnValue != IS_SUCCESS)
+    ids.clear();
+    const char* p = text.c_str();
+    while(*p)
     {
-        if(errReturnValue != IS_SUCCESS)
+        char* end = NULL;
+        long id = strtol(p, &end, 10);
+        if(end == p || id < 1 || (*end != ',' && *end != '\0'))
         {
-            std::cout << "GetError() return value " << errReturnValue << std::endl;
+            return false;
         }
-
-        if(errNum != IS_SUCCESS)
+        for(size_t k = 0; k < ids.size(); ++k)
         {
-            std::cout << "Error number " << errNum << std::endl;
-            std::wcout << "Error Message " << errMessage << std::endl;
-            exit(1);
+            if(ids[k] == static_cast<HIDS>(id))
+            {
+                return false;
+            }
         }
+        ids.push_back(static_cast<HIDS>(id));
+        p = (*end == ',') ? end + 1 : end;
     }
-    else
+    return ! ids.empty();
+}
+
+bool file_exists(const std::string& file_name)
+{
+    FILE* f = fopen(file_name.c_str(), "rb");
+    if(f == NULL)
     {
-        if( ! quiet) { std::cout << "Success!" << std::endl; }
+        return false;
+    }
+    fclose(f);
+    return true;
+}
+
+// A stack is continued only with frames of the size it was made for.
+void check_stack_holds(const FrameStackWriter& stack, const std::string& name, int width, int height, int bits_per_pixel, FramePixelFormat format)
+{
+    if( ! stack.holds(width, height, bits_per_pixel, format))
+    {
+        const FrameStackHeader& h = stack.info();
+        std::ostringstream message;
+        message << "Stack " << name << " holds " << h.width << "x" << h.height << " frames of " << h.bits_per_pixel
+                << " bits per pixel (row pitch " << h.line_pitch << "); the camera takes " << width << "x" << height
+                << " frames of " << bits_per_pixel << " bits per pixel";
+        throw std::runtime_error(message.str());
     }
 }
 
 int main(int argc, char **argv)
 {
     std::string image_save_file_name;
+    std::string journal_file_name;
+    std::string stack_file_name;
+    unsigned stack_frames = 0;
     bool interactiveFilenames = 1;
     double exposure_time = 0;
     int gain_setting = 0;
     int blacklvl_setting = 0;
     bool quiet = false;
+    bool verify = false;
+    std::string preset_name;
+    bool compare_preset = false;
+    std::string format_name = "png";
+    PictureFormat picture_format = PICTURE_PNG;
+    bool differential = false;
+    std::string bucket_file_name;
+    std::string region_text;
+    double plane_cycle_ms = 0;
+    std::string cameras_text = "1";
+    bool hardware_trigger = false;
+    bool huge_pages = false;
     for(int i = 1; i < argc; i += 2)
     {
         if(std::string(argv[i]) == "--exposure") { exposure_time = atof(argv[i+1]);  }
         if(std::string(argv[i]) == "--blacklvl")     { blacklvl_setting = atoi(argv[i+1]);   }
         if(std::string(argv[i]) == "--gain")     { gain_setting = atoi(argv[i+1]);   }
         if(std::string(argv[i]) == "--filename") { image_save_file_name = argv[i+1]; interactiveFilenames = 0;}
+        if(std::string(argv[i]) == "--journal")  { journal_file_name = argv[i+1]; }
+        if(std::string(argv[i]) == "--stack")    { stack_file_name = argv[i+1]; }
+        if(std::string(argv[i]) == "--stack-frames") { stack_frames = atoi(argv[i+1]); }
         if(std::string(argv[i]) == "--quiet")    { quiet = true; --i; }
+        if(std::string(argv[i]) == "--verify")   { verify = true; --i; }
+        if(std::string(argv[i]) == "--preset")   { preset_name = argv[i+1]; }
+        if(std::string(argv[i]) == "--compare-preset") { compare_preset = true; --i; }
+        if(std::string(argv[i]) == "--format")   { format_name = argv[i+1]; }
+        if(std::string(argv[i]) == "--differential") { differential = true; --i; }
+        if(std::string(argv[i]) == "--buckets")  { bucket_file_name = argv[i+1]; }
+        if(std::string(argv[i]) == "--roi")      { region_text = argv[i+1]; }
+        if(std::string(argv[i]) == "--plane-cycle") { plane_cycle_ms = atof(argv[i+1]); }
+        if(std::string(argv[i]) == "--cameras")  { cameras_text = argv[i+1]; }
+        if(std::string(argv[i]) == "--hardware-trigger") { hardware_trigger = true; --i; }
+        if(std::string(argv[i]) == "--hugepages") { huge_pages = true; --i; }
     }
 
     bool errors = false;
@@ -69,11 +146,76 @@ int main(int argc, char **argv)
         std::cerr << "Black level setting must be set to a number between 0 and 255 with --blacklvl <number>" << std::endl;
         errors = true;
     }
+    if( ! stack_file_name.empty() && stack_frames == 0 && ! file_exists(stack_file_name))
+    {
+        std::cerr << "A new stack needs its size given with --stack-frames <number>" << std::endl;
+        errors = true;
+    }
+
+    if( ! parse_picture_format(format_name, picture_format))
+    {
+        std::cerr << "Picture format must be png or tlc with --format <name>" << std::endl;
+        errors = true;
+    }
+
+    if(compare_preset && preset_name.empty())
+    {
+        std::cerr << "--compare-preset needs a preset name given with --preset <name>" << std::endl;
+        errors = true;
+    }
+
+    BucketRegion region;
+    if(differential && stack_file_name.empty() && bucket_file_name.empty())
+    {
+        std::cerr << "--differential needs --stack <file> and/or --buckets <file> for its output" << std::endl;
+        errors = true;
+    }
+    if( ! bucket_file_name.empty() && ! differential)
+    {
+        std::cerr << "--buckets is only written with --differential" << std::endl;
+        errors = true;
+    }
+    if((differential || ! bucket_file_name.empty()) && interactiveFilenames == 0)
+    {
+        // A single picture for --filename is taken without reading stdin.
+        std::cerr << "--differential and --buckets read their pairs from stdin; they cannot be used with --filename" << std::endl;
+        errors = true;
+    }
+    if( ! region_text.empty() && ! parse_bucket_region(region_text, region))
+    {
+        std::cerr << "Region must be given as --roi <x>,<y>,<width>,<height>" << std::endl;
+        errors = true;
+    }
+    std::vector<HIDS> camera_ids;
+    if( ! parse_camera_ids(cameras_text, camera_ids))
+    {
+        std::cerr << "Cameras must be given as --cameras <id>,<id>,... with different ids from 1 up" << std::endl;
+        errors = true;
+    }
+    if(camera_ids.size() > 1 && differential)
+    {
+        std::cerr << "--differential works with one camera only" << std::endl;
+        errors = true;
+    }
     if(errors)
     {
         return 1;
     }
 
+    if(plane_cycle_ms > 0)
+    {
+        // The loader shows grey pictures as a repeating cycle of bit
+        // planes; only an exposure of whole cycles sees every plane for
+        // its full weight, wherever in the cycle it starts.
+        double cycles = floor(exposure_time / plane_cycle_ms + 0.5);
+        if(cycles < 1)
+        {
+            cycles = 1;
+        }
+        exposure_time = cycles*plane_cycle_ms;
+        if( ! quiet) { std::cout << "Exposure set to " << exposure_time << " ms, " << cycles << " bit plane cycle(s)" << std::endl; }
+    }
+
     SYSTEMTIME time;
     GetSystemTime(&time);
     LONG prev_time_ms = (time.wSecond*1000) + time.wMilliseconds;
@@ -81,35 +223,22 @@ int main(int argc, char **argv)
 
 
 
-    HIDS m_hCam = 1;
-    if( ! quiet) { std::cout << "Initializing camera ..." << std::endl; }
-    is_InitCamera (&m_hCam, NULL);
-    detailed_error_message(m_hCam, quiet);
-
-
-    if( ! quiet) { std::cout << "Getting sensor info ..." << std::endl; }
-    SENSORINFO pInfo;
-    is_GetSensorInfo (m_hCam, &pInfo);
-    detailed_error_message(m_hCam, quiet);
-
-
-    int width = pInfo.nMaxWidth;
-    int height = pInfo.nMaxHeight;
-    int bit_depth = 24;
-    if( ! quiet) { std::cout << "Camera ID: " << m_hCam << std::endl; }
-    if( ! quiet) { std::cout << "Sensor dimensions: " << width << " x " << height << " (assuming bit-depth per pixel of " << bit_depth << ")" << std::endl; }
+    try
+    {
+        if( ! quiet) { std::cout << "Initializing camera ..." << std::endl; }
+        UEyeCamera camera(camera_ids[0], quiet);
+        camera.set_verify_readback(verify);
 
 
-    if( ! quiet) { std::cout << "Allocating memory for images ..." << std::endl; }
-    char* image_memory;
-    INT memory_ID;
-    is_AllocImageMem(m_hCam, width, height, bit_depth, &image_memory, &memory_ID);
-    detailed_error_message(m_hCam, quiet);
+        int width = camera.width();
+        int height = camera.height();
+        int bit_depth = 24;
+        if( ! quiet) { std::cout << "Camera ID: " << camera.handle() << std::endl; }
+        if( ! quiet) { std::cout << "Sensor dimensions: " << width << " x " << height << " (assuming bit-depth per pixel of " << bit_depth << ")" << std::endl; }
 
 
-    if( ! quiet) { std::cout << "Setting image memory location ..." << std::endl; }
-    is_SetImageMem(m_hCam, image_memory, memory_ID);
-    detailed_error_message(m_hCam, quiet);
+        if( ! quiet) { std::cout << "Allocating memory for images ..." << std::endl; }
+        camera.allocate_image_memory(bit_depth);
 
 // Was EXP, FRAME RATE, PIXEL CLOCK
 
@@ -117,163 +246,367 @@ int main(int argc, char **argv)
 
 
 
-    if( ! quiet) { std::cout << "Getting current frame rate ..." << std::endl; }
-    double new_frame_rate;
-    is_SetFrameRate(m_hCam, IS_GET_FRAMERATE, &new_frame_rate);
-    detailed_error_message(m_hCam, quiet);
-    if( ! quiet) { std::cout << "Current frame rate " << new_frame_rate << std::endl << std::endl; }
-
-
-    if( ! quiet) { std::cout << "Getting current exposure ..." << std::endl; }
-    double exposure_ms;
-    is_Exposure(m_hCam, IS_EXPOSURE_CMD_GET_EXPOSURE, &exposure_ms, sizeof(exposure_ms));
-    detailed_error_message(m_hCam, quiet);
-    if( ! quiet) { std::cout << "Current exposure: " << exposure_ms << " ms" << std::endl; }
-
-   // SET current pixel clock
-    int nPixelClock = 10;
-    is_PixelClock(m_hCam, IS_PIXELCLOCK_CMD_SET, (void*)&nPixelClock, sizeof(nPixelClock));
-    detailed_error_message(m_hCam, quiet);
-    std::cout << "Just attempted setting pixel clock ..." << std::endl;
-
-    // Set long exposure enable
-    UINT expmode = 1;
-    is_Exposure (m_hCam, IS_EXPOSURE_CMD_SET_LONG_EXPOSURE_ENABLE, (void*)&expmode, sizeof(expmode));
-    detailed_error_message(m_hCam, quiet);
-
-    // SET LOG MODE OFF
-    UINT logmode = IS_LOG_MODE_OFF;
-    is_DeviceFeature(m_hCam, IS_DEVICE_FEATURE_CMD_SET_LOG_MODE, (void*)&logmode, sizeof(logmode));
-    detailed_error_message(m_hCam, quiet);
-
-    // Set rolling shutter
-    UINT shuttermode = IS_DEVICE_FEATURE_CAP_SHUTTER_MODE_ROLLING;
-    is_DeviceFeature(m_hCam, IS_DEVICE_FEATURE_CMD_SET_SHUTTER_MODE, (void*)&shuttermode, sizeof(shuttermode));
-    detailed_error_message(m_hCam, quiet);
-
-
-
-
-
-    if( ! quiet) { std::cout << "Getting current gain ..." << std::endl; }
-    if( ! quiet) { std::cout << "Current gain setting is: " << is_SetHardwareGain(m_hCam, IS_GET_MASTER_GAIN, IS_IGNORE_PARAMETER, IS_IGNORE_PARAMETER, IS_IGNORE_PARAMETER) << std::endl; }
-    detailed_error_message(m_hCam, quiet);
-    if( ! quiet) { std::cout << "Setting gain to " << gain_setting << " ..." << std::endl; }
-    is_SetHardwareGain(m_hCam, gain_setting, IS_IGNORE_PARAMETER, IS_IGNORE_PARAMETER, IS_IGNORE_PARAMETER);
-    detailed_error_message(m_hCam, quiet);
-    if( ! quiet) { std::cout << "Getting current gain ..." << std::endl; }
-    if( ! quiet) { std::cout << "Current gain setting is: " << is_SetHardwareGain(m_hCam, IS_GET_MASTER_GAIN, IS_IGNORE_PARAMETER, IS_IGNORE_PARAMETER, IS_IGNORE_PARAMETER) << std::endl << std::endl; }
-    detailed_error_message(m_hCam, quiet);
-
-    int current_blacklevel;
-    if( ! quiet) { std::cout << "Getting current blacklevel ..." << std::endl; }
-    is_Blacklevel(m_hCam, IS_BLACKLEVEL_CMD_GET_OFFSET, (void*)&current_blacklevel, sizeof(current_blacklevel));
-    detailed_error_message(m_hCam, quiet);
-    if( ! quiet) { std::cout << "Current blacklevel: " << current_blacklevel << std::endl; }
-
-    if( ! quiet) { std::cout << "Setting blacklevel to " << blacklvl_setting << "..." << std::endl; }
-    is_Blacklevel(m_hCam, IS_BLACKLEVEL_CMD_SET_OFFSET, (void*)&blacklvl_setting, sizeof(blacklvl_setting));
-    detailed_error_message(m_hCam, quiet);
-
-    if( ! quiet) { std::cout << "Getting current blacklevel ..." << std::endl; }
-    is_Blacklevel(m_hCam, IS_BLACKLEVEL_CMD_GET_OFFSET, (void*)&current_blacklevel, sizeof(current_blacklevel));
-    detailed_error_message(m_hCam, quiet);
-    if( ! quiet) { std::cout << "Current blacklevel: " << current_blacklevel << std::endl; }
+        std::chrono::steady_clock::time_point configure_start = std::chrono::steady_clock::now();
+        bool from_preset = ! preset_name.empty() && load_camera_preset(camera, preset_name);
+        configure_camera(camera, gain_setting, blacklvl_setting, exposure_time, quiet);
+        if( ! quiet) { std::cout << "Camera configured in " << milliseconds_since(configure_start) << " ms (" << (from_preset ? "preset " + preset_name : std::string("sequential")) << ")" << std::endl; }
+        if( ! preset_name.empty() && ! from_preset)
+        {
+            if( ! quiet) { std::cout << "Saving preset " << preset_name << " ..." << std::endl; }
+            save_camera_preset(camera, preset_name);
+        }
+        if(compare_preset)
+        {
+            compare_preset_startup(camera, preset_name, gain_setting, blacklvl_setting, exposure_time);
+        }
+        if(plane_cycle_ms > 0)
+        {
+            // The camera rounds the exposure to its own steps; whatever is
+            // left over of a cycle shows up as a grey level error.
+            double actual = camera.get_exposure();
+            double remainder = fmod(actual, plane_cycle_ms);
+            if(remainder > plane_cycle_ms/2)
+            {
+                remainder -= plane_cycle_ms;
+            }
+            std::cout << "Camera exposure " << actual << " ms is " << remainder << " ms off a whole number of bit plane cycles" << std::endl;
+        }
 
-//    new_frame_rate = 0.1;
- //   double frame_rate_readback;
-  //  if( ! quiet) { std::cout << "Setting frame rate to " << new_frame_rate << " fps ..." << std::endl; }
-   // is_SetFrameRate(m_hCam, new_frame_rate, &frame_rate_readback);
-    //detailed_error_message(m_hCam, quiet);
-    //if( ! quiet) { std::cout << "Frame rate set to " << frame_rate_readback << " fps ..." << std::endl << std::endl; }
 
 
-    if( ! quiet) { std::cout << "Getting valid exposure range ..." << std::endl; }
-    double exposure_range[3];
-    is_Exposure(m_hCam, IS_EXPOSURE_CMD_GET_EXPOSURE_RANGE, exposure_range, sizeof(exposure_range));
-    detailed_error_message(m_hCam, quiet);
-    if( ! quiet) { std::cout << "Min: " << exposure_range[0] << " ms\nMax: " << exposure_range[1] << " ms\nInc: " << exposure_range[2] << " ms" << std::endl; }
+        // The other cameras get the same settings; a preset is the first
+        // camera's only.
+        std::vector<std::unique_ptr<UEyeCamera> > other_cameras;
+        std::vector<UEyeCamera*> cameras(1, &camera);
+        for(size_t c = 1; c < camera_ids.size(); ++c)
+        {
+            if( ! quiet) { std::cout << "Initializing camera " << camera_ids[c] << " ..." << std::endl; }
+            other_cameras.push_back(std::unique_ptr<UEyeCamera>(new UEyeCamera(camera_ids[c], quiet)));
+            UEyeCamera& other = *other_cameras.back();
+            other.set_verify_readback(verify);
+            other.allocate_image_memory(bit_depth);
+            configure_camera(other, gain_setting, blacklvl_setting, exposure_time, quiet);
+            cameras.push_back(&other);
+        }
 
+        // An external trigger (the DMD's, say) starts the exposure
+        // instead of the software one.
+        for(size_t c = 0; c < cameras.size(); ++c)
+        {
+            cameras[c]->set_trigger(hardware_trigger ? IS_SET_TRIGGER_LO_HI : IS_SET_TRIGGER_SOFTWARE);
+        }
 
 
-    if( ! quiet) { std::cout << "Setting new exposure to: " << exposure_time << " ms ..." << std::endl; }
-    is_Exposure(m_hCam, IS_EXPOSURE_CMD_SET_EXPOSURE, &exposure_time, sizeof(exposure_ms));
-    detailed_error_message(m_hCam, quiet);
-    if( ! quiet) { std::cout << "Current exposure now " << exposure_time << " ms" << std::endl << std::endl; }
 
+        if( ! hardware_trigger)
+        {
+            if( ! quiet) { std::cout << "\nFreezing video ..." << std::endl; }
+            camera.freeze_video();
+        }
 
+        // Several cameras capture continuously, each into a ring of
+        // buffers, and every trigger gives one record of a frame from each.
+        // Triggers come at most one per exposure, so frames within half an
+        // exposure of each other are the same trigger's; software triggers
+        // go to the cameras one after the other and the next is only sent
+        // once the record is in, so they get another millisecond.
+        const int record_timeout_ms = static_cast<int>(2*exposure_time) + 1000;
+        std::unique_ptr<CameraGroup> group;
+        if(cameras.size() > 1)
+        {
+            const uint64_t match_us = static_cast<uint64_t>(500*exposure_time) + (hardware_trigger ? 0 : 1000);
+            group.reset(new CameraGroup(cameras, 4, match_us, record_timeout_ms));
+        }
+        unsigned long missing_records = 0;
+
+        // One camera takes its pictures into buffers registered with it
+        // once: two for a differential pair, one otherwise.  Together
+        // with the reused file name, a scan then allocates nothing per
+        // picture.  (Stack frames go straight into the stack file.)
+        std::unique_ptr<FramePool> pool;
+        std::wstring wide_name;
+        if( ! group && interactiveFilenames == 1 && (differential || stack_file_name.empty()))
+        {
+            pool.reset(new FramePool(camera, differential ? 2 : 1, huge_pages));
+            if(huge_pages && ! pool->huge_pages() && ! quiet) { std::cout << "Huge pages not available, using ordinary pages" << std::endl; }
+        }
 
-    is_SetExternalTrigger(m_hCam, IS_SET_TRIGGER_SOFTWARE);
-    detailed_error_message(m_hCam, quiet);
 
 
+        GetSystemTime(&time);
+        delta_time = (time.wSecond*1000) + time.wMilliseconds-prev_time_ms;
+        std::cout << delta_time << std::endl;
+        prev_time_ms = (time.wSecond*1000) + time.wMilliseconds;
 
-    if( ! quiet) { std::cout << "\nFreezing video ..." << std::endl; }
-    is_FreezeVideo(m_hCam, IS_WAIT);
-    detailed_error_message(m_hCam, quiet);
+        if(interactiveFilenames==1){
+            std::unique_ptr<ScanJournal> journal;
+            if( ! journal_file_name.empty())
+            {
+                journal.reset(new ScanJournal(journal_file_name));
+                if( ! quiet) { std::cout << "Resuming scan journal " << journal_file_name << " at step " << journal->resume_step() << std::endl; }
+            }
 
+            std::unique_ptr<FrameStackWriter> stack;
+            std::vector<std::unique_ptr<FrameStackWriter> > other_stacks;
+            if( ! stack_file_name.empty())
+            {
+                for(size_t c = 1; c < cameras.size(); ++c)
+                {
+                    // Frames of the other cameras go to stacks of their own.
+                    const std::string other_name = camera_file_name(stack_file_name, camera_ids[c], false);
+                    if(file_exists(other_name))
+                    {
+                        other_stacks.push_back(std::unique_ptr<FrameStackWriter>(new FrameStackWriter(other_name)));
+                        check_stack_holds(*other_stacks.back(), other_name, cameras[c]->width(), cameras[c]->height(), bit_depth, FRAME_PIXEL_BGR8);
+                    }
+                    else
+                    {
+                        if( ! quiet) { std::cout << "Creating frame stack " << other_name << " for " << stack_frames << " frames ..." << std::endl; }
+                        other_stacks.push_back(std::unique_ptr<FrameStackWriter>(new FrameStackWriter(other_name, cameras[c]->width(), cameras[c]->height(), bit_depth, FRAME_PIXEL_BGR8, stack_frames)));
+                    }
+                }
+                if(file_exists(stack_file_name))
+                {
+                    if( ! quiet) { std::cout << "Continuing frame stack " << stack_file_name << " ..." << std::endl; }
+                    stack.reset(new FrameStackWriter(stack_file_name));
+                }
+                else if(differential)
+                {
+                    if( ! quiet) { std::cout << "Creating difference stack " << stack_file_name << " for " << stack_frames << " pattern pairs ..." << std::endl; }
+                    stack.reset(new FrameStackWriter(stack_file_name, width, height, 2*bit_depth, FRAME_PIXEL_DIFF16, stack_frames));
+                }
+                else
+                {
+                    if( ! quiet) { std::cout << "Creating frame stack " << stack_file_name << " for " << stack_frames << " frames ..." << std::endl; }
+                    stack.reset(new FrameStackWriter(stack_file_name, width, height, bit_depth, FRAME_PIXEL_BGR8, stack_frames));
+                }
+                if((stack->info().pixel_format == FRAME_PIXEL_DIFF16) != differential)
+                {
+                    throw std::runtime_error("Stack " + stack_file_name + (differential ? " does not hold difference frames" : " holds difference frames; use --differential"));
+                }
+                if(differential)
+                {
+                    check_stack_holds(*stack, stack_file_name, width, height, 2*bit_depth, FRAME_PIXEL_DIFF16);
+                }
+                else
+                {
+                    check_stack_holds(*stack, stack_file_name, width, height, bit_depth, FRAME_PIXEL_BGR8);
+                }
+            }
 
+            // Differential mode: the lines come in pairs, a pattern and
+            // then its complement (for example the loader's pairs
+            // numbering, or a file followed by @complement).  Each pair
+            // is reduced to one difference as soon as its second frame
+            // is in.  Its pattern id is the first line's number halved,
+            // so the pairs numbering 2k, 2k+1 gives k.
+            std::unique_ptr<DifferentialPair> pair;
+            FrameBuffer pattern_buffer;
+            FrameBuffer complement_buffer;
+            std::ofstream bucket_output;
+            FrameMetadata pair_meta;
+            std::string pair_label;     // the first line of the pair
+            bool pair_done = false;     // appended to the bucket file in an earlier run
+            // Without a stack, a pair's only output is its bucket line;
+            // the journal then records the bucket file's size after it.
+            const bool journal_buckets = journal && ! stack && ! bucket_file_name.empty();
+            if(differential)
+            {
+                pattern_buffer = pool->acquire();
+                complement_buffer = pool->acquire();
+                pair.reset(new DifferentialPair(width, height, bit_depth, pattern_buffer.data(), complement_buffer.data()));
+                if( ! bucket_file_name.empty())
+                {
+                    bucket_output.open(bucket_file_name.c_str(), std::ios::app);
+                    if( ! bucket_output)
+                    {
+                        throw std::runtime_error("Could not open bucket file " + bucket_file_name);
+                    }
+                }
+            }
 
-    GetSystemTime(&time);
-    delta_time = (time.wSecond*1000) + time.wMilliseconds-prev_time_ms;
-    std::cout << delta_time << std::endl;
-    prev_time_ms = (time.wSecond*1000) + time.wMilliseconds;
+            unsigned step = 0;
+            for( ; getline(std::cin, image_save_file_name); ++step)
+            {
+                if(image_save_file_name.empty())
+                {
+                    --step;
+                    continue;
+                }
+
+                std::cout << image_save_file_name << std::endl;
+
+                if( ! pair && journal && journal->already_done(step, image_save_file_name))
+                {
+                    if( ! quiet) { std::cout << "Already saved in an earlier run, skipping ..." << std::endl; }
+                    continue;
+                }
+
+                if(pair)
+                {
+                    const unsigned pair_index = step / 2;
+                    if(stack && stack->has_frame(pair_index))
+                    {
+                        if( ! quiet) { std::cout << "Pair " << pair_index << " already in stack, skipping ..." << std::endl; }
+                        continue;
+                    }
+                    if(step % 2 == 0)
+                    {
+                        pair_done = journal_buckets && journal->already_appended(step, image_save_file_name, bucket_file_name);
+                        if(pair_done)
+                        {
+                            if( ! quiet) { std::cout << "Pair " << pair_index << " already in the bucket file, skipping ..." << std::endl; }
+                            continue;
+                        }
+                        pair_label = image_save_file_name;
+                        pair_meta.timestamp_us = pool->capture(pattern_buffer);
+                        pair_meta.exposure_ms = camera.settings().exposure_ms;
+                        pair_meta.gain = camera.settings().gain;
+                        pair_meta.pattern_id = pattern_id_from_label(image_save_file_name, step) / 2;
+                        continue;
+                    }
+                    if(pair_done)
+                    {
+                        continue;
+                    }
+                    pool->capture(complement_buffer);
+                    if(stack)
+                    {
+                        pair->difference_frame(reinterpret_cast<unsigned char*>(stack->slot(pair_index)), stack->info().line_pitch);
+                        stack->commit(pair_index, pair_meta);
+                    }
+                    if(bucket_output.is_open())
+                    {
+                        bucket_output << pair_meta.pattern_id << " " << pair->region_difference(region) << std::endl;
+                    }
+                    if(journal_buckets)
+                    {
+                        // Both lines, so that resume_step() counts the pair.
+                        journal->commit_appended(step - 1, pair_label, bucket_file_name);
+                        journal->commit_appended(step, image_save_file_name, bucket_file_name);
+                    }
+                    continue;
+                }
+
+                if(stack && stack->has_frame(step))
+                {
+                    if( ! quiet) { std::cout << "Frame " << step << " already in stack, skipping ..." << std::endl; }
+                    continue;
+                }
+
+                if(group)
+                {
+                    CameraRecord record;
+                    if( ! hardware_trigger)
+                    {
+                        group->trigger();
+                    }
+                    if( ! group->next_record(record, record_timeout_ms))
+                    {
+                        std::cout << "No frame from every camera for " << image_save_file_name << std::endl;
+                        ++missing_records;
+                        continue;
+                    }
+                    for(size_t c = 0; c < cameras.size(); ++c)
+                    {
+                        UEyeCamera& cam = *cameras[c];
+                        if( ! stack)
+                        {
+                            save_frame_picture(cam, record.frames[c], camera_file_name(image_save_file_name, camera_ids[c], c == 0), picture_format, wide_name);
+                            continue;
+                        }
+                        // Ring buffers are reused, so the frame is copied.
+                        FrameStackWriter& s = (c == 0) ? *stack : *other_stacks[c - 1];
+                        char* slot = s.slot(step);
+                        const size_t row_bytes = static_cast<size_t>(cam.width())*(bit_depth/8);
+                        for(int y = 0; y < cam.height(); ++y)
+                        {
+                            memcpy(slot + static_cast<size_t>(y)*s.info().line_pitch, record.frames[c].memory + static_cast<size_t>(y)*cam.pitch(), row_bytes);
+                        }
+                        FrameMetadata meta;
+                        meta.timestamp_us = record.timestamp_us;
+                        meta.exposure_ms = cam.settings().exposure_ms;
+                        meta.gain = cam.settings().gain;
+                        meta.pattern_id = pattern_id_from_label(image_save_file_name, step);
+                        s.commit(step, meta);
+                    }
+                    group->release(record);
+                    if(journal && ! stack)
+                    {
+                        journal->commit(step, image_save_file_name);
+                    }
+                    continue;
+                }
+
+                if(stack)
+                {
+                    // The frame goes straight from the camera into the
+                    // mapped stack file; nothing is copied.
+                    FrameMetadata meta;
+                    meta.timestamp_us = camera.capture_into(stack->slot(step));
+                    meta.exposure_ms = camera.settings().exposure_ms;
+                    meta.gain = camera.settings().gain;
+                    meta.pattern_id = pattern_id_from_label(image_save_file_name, step);
+                    stack->commit(step, meta);
+                    continue;
+                }
+
+                {
+                    FrameBuffer frame = pool->acquire();
+                    pool->capture(frame);
+                    save_frame_memory(camera, frame.data(), frame.memory_id(), pool->line_pitch(), image_save_file_name, picture_format, wide_name);
+                }
+
+                if(journal)
+                {
+                    journal->commit(step, image_save_file_name);
+                }
+            }
+        }else if(group){
+            CameraRecord record;
+            if( ! hardware_trigger)
+            {
+                group->trigger();
+            }
+            if( ! group->next_record(record, record_timeout_ms))
+            {
+                throw std::runtime_error("No frame from every camera");
+            }
+            for(size_t c = 0; c < cameras.size(); ++c)
+            {
+                save_frame_picture(*cameras[c], record.frames[c], camera_file_name(image_save_file_name, camera_ids[c], c == 0), picture_format, wide_name);
+            }
+            group->release(record);
+        }else{
+            save_picture(camera, image_save_file_name, picture_format, quiet);
+        }
 
-    if(interactiveFilenames==1){
-        while(getline(std::cin, image_save_file_name))
+        if(group)
         {
-            if(image_save_file_name.empty())
+            std::cout << "Cameras:";
+            for(size_t c = 0; c < cameras.size(); ++c)
             {
-                continue;
+                std::cout << " " << camera_ids[c] << " dropped " << group->dropped(c) << (c + 1 < cameras.size() ? "," : "");
             }
-
-            std::cout << image_save_file_name << std::endl;
-
-            if( ! quiet) { std::cout << "\nFreezing video ..." << std::endl; }
-            is_FreezeVideo(m_hCam, IS_WAIT);
-            detailed_error_message(m_hCam, quiet);
-
-            wchar_t *wchar_file_name = new wchar_t[image_save_file_name.size() + 1];
-            std::wstring w_image_name(image_save_file_name.begin(), image_save_file_name.end());
-            w_image_name.copy(wchar_file_name, image_save_file_name.size());
-            wchar_file_name[image_save_file_name.size()] = '\0';
-            IMAGE_FILE_PARAMS ImageFileParams;
-            if( ! quiet) { std::cout << "\nSaving image ..." << std::endl; }
-            ImageFileParams.pwchFileName = wchar_file_name;
-            ImageFileParams.nFileType = IS_IMG_PNG;
-            ImageFileParams.pnImageID = NULL;
-            ImageFileParams.ppcImageMem = NULL;
-            ImageFileParams.nQuality = 100;
-            if( ! quiet) { std::wcout << "\nSaving image to " << ImageFileParams.pwchFileName << " ..." << std::endl; }
-            is_ImageFile(m_hCam, IS_IMAGE_FILE_CMD_SAVE, &ImageFileParams, sizeof(ImageFileParams));
-            detailed_error_message(m_hCam, quiet);
-
+            std::cout << "; " << group->unmatched() << " unmatched frames, " << missing_records << " records missing" << std::endl;
         }
-    }else{
-        if( ! quiet) { std::cout << "\nFreezing video ..." << std::endl; }
-            is_FreezeVideo(m_hCam, IS_WAIT);
-            detailed_error_message(m_hCam, quiet);
-
-            wchar_t *wchar_file_name = new wchar_t[image_save_file_name.size() + 1];
-            std::wstring w_image_name(image_save_file_name.begin(), image_save_file_name.end());
-            w_image_name.copy(wchar_file_name, image_save_file_name.size());
-            wchar_file_name[image_save_file_name.size()] = '\0';
-            IMAGE_FILE_PARAMS ImageFileParams;
-            if( ! quiet) { std::cout << "\nSaving image ..." << std::endl; }
-            ImageFileParams.pwchFileName = wchar_file_name;
-            ImageFileParams.nFileType = IS_IMG_PNG;
-            ImageFileParams.pnImageID = NULL;
-            ImageFileParams.ppcImageMem = NULL;
-            ImageFileParams.nQuality = 100;
-            if( ! quiet) { std::wcout << "\nSaving image to " << ImageFileParams.pwchFileName << " ..." << std::endl; }
-            is_ImageFile(m_hCam, IS_IMAGE_FILE_CMD_SAVE, &ImageFileParams, sizeof(ImageFileParams));
-            detailed_error_message(m_hCam, quiet);
-    }
 
+        if(camera.reconnect_count() > 0)
+        {
+            std::cout << "Camera was re-initialized " << camera.reconnect_count() << " time(s)" << std::endl;
+        }
 
+        if( ! quiet) { std::cout << camera.issued_calls() << " camera calls made, " << camera.skipped_calls() << " redundant calls skipped" << std::endl; }
 
-    if( ! quiet) { std::cout << "\nShutting down camera ..." << std::endl; }
-    is_ExitCamera(m_hCam);
+        if( ! quiet) { std::cout << "\nShutting down camera ..." << std::endl; }
+    }
+    catch(const std::exception& e)
+    {
+        // Anything already saved is in the journal; restarting with
+        // the same --journal picks up from here.
+        std::cout << e.what() << std::endl;
+        return 1;
+    }
 
 
 
@@ -0,0 +1,292 @@
+#ifndef SCAN_JOURNAL_H
+#define SCAN_JOURNAL_H
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <stdexcept>
+#include <stdint.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#include <io.h>
+#include <Windows.h>
+#else
+#include <unistd.h>
+#endif
+
+// Append-only progress journal for long scans.
+//
+// Every captured and saved frame appends one fixed-size record
+// (step number, hash of the output file name, size of the output
+// file).  If the program dies part way through a scan, restarting
+// it with the same journal and the same list of file names skips
+// every step that was already committed and whose output file is
+// still on disk with the recorded size.  Only stat() is used to
+// check the files; the pixel data is never read back.
+class ScanJournal
+{
+public:
+    explicit ScanJournal(const std::string& path) : journal_file(NULL), header_on_disk(false)
+    {
+        replay(path);
+
+        journal_file = fopen(path.c_str(), "ab");
+        if(journal_file == NULL)
+        {
+            throw std::runtime_error("Could not open scan journal " + path);
+        }
+        if( ! header_on_disk)
+        {
+            fwrite(magic(), 8, 1, journal_file);
+            fflush(journal_file);
+        }
+    }
+
+    ~ScanJournal()
+    {
+        if(journal_file != NULL)
+        {
+            fclose(journal_file);
+        }
+    }
+
+    // True if this step was committed with the same file name and
+    // the file is still there with the size it had when committed.
+    bool already_done(unsigned step, const std::string& file_name) const
+    {
+        if(step >= records.size() || records[step].file_size == 0)
+        {
+            return false;
+        }
+
+        const Record& r = records[step];
+        return r.name_hash == hash_name(file_name) && file_size_on_disk(file_name) == r.file_size;
+    }
+
+    // Record that a step's output file has been completely written.
+    // Flushed immediately so the record survives the process exiting.
+    // Nothing is recorded if the file is missing or empty.
+    void commit(unsigned step, const std::string& file_name)
+    {
+        append(step, hash_name(file_name), file_size_on_disk(file_name));
+    }
+
+    // For steps whose output is appended to a file shared by the whole
+    // scan (the bucket file of a differential scan) rather than written
+    // to a file of their own: the step is done if the output file still
+    // holds at least as much as it did when the step was committed.
+    bool already_appended(unsigned step, const std::string& label, const std::string& output_file) const
+    {
+        if(step >= records.size() || records[step].file_size == 0)
+        {
+            return false;
+        }
+
+        const Record& r = records[step];
+        return r.name_hash == hash_name(label) && file_size_on_disk(output_file) >= r.file_size;
+    }
+
+    // Call once the step's output has been appended and flushed.
+    void commit_appended(unsigned step, const std::string& label, const std::string& output_file)
+    {
+        append(step, hash_name(label), file_size_on_disk(output_file));
+    }
+
+    // First step that has not been committed; everything before it
+    // was finished in an earlier run.
+    unsigned resume_step() const
+    {
+        unsigned step = 0;
+        while(step < records.size() && records[step].file_size != 0)
+        {
+            ++step;
+        }
+        return step;
+    }
+
+private:
+    struct Record
+    {
+        uint32_t step;
+        uint32_t name_hash;
+        uint64_t file_size;
+        uint32_t check;
+        uint32_t reserved;
+    };
+
+    static const char* magic() { return "TSJRNL01"; }
+
+    // Far more steps than any scan takes; a record beyond it (with a
+    // good checksum) means the journal is damaged, and must not make the
+    // table of records huge.
+    static const unsigned MAX_STEPS = 1u << 24;
+
+    FILE* journal_file;
+    bool header_on_disk;
+    std::vector<Record> records; // indexed by step; file_size == 0 means not committed
+
+    void append(unsigned step, uint32_t name_hash, uint64_t file_size)
+    {
+        if(step >= MAX_STEPS)
+        {
+            throw std::runtime_error("Scan too long for the scan journal");
+        }
+        Record r;
+        r.step = step;
+        r.name_hash = name_hash;
+        r.file_size = file_size;
+        r.check = checksum(r);
+        r.reserved = 0;
+        if(r.file_size == 0)
+        {
+            return;
+        }
+
+        if(fwrite(&r, sizeof(r), 1, journal_file) != 1 || fflush(journal_file) != 0)
+        {
+            throw std::runtime_error("Could not append to scan journal");
+        }
+
+        if(step >= records.size())
+        {
+            records.resize(step + 1);
+        }
+        records[step] = r;
+    }
+
+    void replay(const std::string& path)
+    {
+        FILE* f = fopen(path.c_str(), "rb");
+        if(f == NULL)
+        {
+            return; // new journal
+        }
+
+        // A header cut short (the process died while creating the
+        // journal) is rewritten; anything else is not a journal and is
+        // left alone rather than overwritten.
+        char header[8];
+        size_t header_read = fread(header, 1, sizeof(header), f);
+        bool valid_header = header_read == sizeof(header) && memcmp(header, magic(), sizeof(header)) == 0;
+        if( ! valid_header && (header_read == sizeof(header) || memcmp(header, magic(), header_read) != 0))
+        {
+            fclose(f);
+            throw std::runtime_error(path + " is not a scan journal");
+        }
+        header_on_disk = true;
+
+        std::vector<Record> good;
+        bool torn_tail = ! valid_header;
+        Record r;
+        while(valid_header)
+        {
+            size_t n = fread(&r, 1, sizeof(r), f);
+            if(n == 0)
+            {
+                break;
+            }
+            if(n != sizeof(r) || r.check != checksum(r) || r.file_size == 0)
+            {
+                // The process died in the middle of a write.
+                torn_tail = true;
+                break;
+            }
+            if(r.step >= MAX_STEPS)
+            {
+                fclose(f);
+                throw std::runtime_error("Scan journal " + path + " has a record for step " + std::to_string(r.step) + "; it is damaged");
+            }
+            good.push_back(r);
+        }
+        fclose(f);
+
+        for(size_t i = 0; i < good.size(); ++i)
+        {
+            if(good[i].step >= records.size())
+            {
+                records.resize(good[i].step + 1);
+            }
+            records[good[i].step] = good[i];
+        }
+
+        if(torn_tail)
+        {
+            rewrite(path, good);
+        }
+    }
+
+    // Replace the journal with only the valid records, so that new
+    // records are not appended after garbage.  The records go to a
+    // temporary file that is flushed to disk and then renamed over the
+    // journal, so that a crash during the repair leaves either the old
+    // journal or the repaired one, never a half-written file.
+    static void rewrite(const std::string& path, const std::vector<Record>& good)
+    {
+        const std::string temporary = path + ".tmp";
+        FILE* out = fopen(temporary.c_str(), "wb");
+        if(out == NULL)
+        {
+            throw std::runtime_error("Could not rewrite scan journal " + path);
+        }
+        bool ok = fwrite(magic(), 8, 1, out) == 1;
+        if(ok && ! good.empty())
+        {
+            ok = fwrite(&good[0], sizeof(Record), good.size(), out) == good.size();
+        }
+        ok = fflush(out) == 0 && ok;
+#ifdef _WIN32
+        ok = _commit(_fileno(out)) == 0 && ok;
+#else
+        ok = fsync(fileno(out)) == 0 && ok;
+#endif
+        ok = fclose(out) == 0 && ok;
+#ifdef _WIN32
+        ok = ok && MoveFileExA(temporary.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+        ok = ok && rename(temporary.c_str(), path.c_str()) == 0;
+#endif
+        if( ! ok)
+        {
+            remove(temporary.c_str());
+            throw std::runtime_error("Could not rewrite scan journal " + path);
+        }
+    }
+
+    static uint32_t hash_name(const std::string& s)
+    {
+        // FNV-1a
+        uint32_t h = 2166136261u;
+        for(size_t i = 0; i < s.size(); ++i)
+        {
+            h ^= static_cast<unsigned char>(s[i]);
+            h *= 16777619u;
+        }
+        return h;
+    }
+
+    static uint32_t checksum(const Record& r)
+    {
+        uint32_t h = 2166136261u;
+        const uint32_t words[4] = { r.step, r.name_hash, static_cast<uint32_t>(r.file_size), static_cast<uint32_t>(r.file_size >> 32) };
+        for(int i = 0; i < 4; ++i)
+        {
+            h ^= words[i];
+            h *= 16777619u;
+        }
+        return h;
+    }
+
+    static uint64_t file_size_on_disk(const std::string& file_name)
+    {
+        struct stat info;
+        if(stat(file_name.c_str(), &info) != 0)
+        {
+            return 0;
+        }
+        return static_cast<uint64_t>(info.st_size);
+    }
+};
+
+#endif // SCAN_JOURNAL_H
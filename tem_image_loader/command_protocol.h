@@ -0,0 +1,153 @@
+#ifndef COMMAND_PROTOCOL_H
+#define COMMAND_PROTOCOL_H
+
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <stdexcept>
+#include <stdint.h>
+
+// The loader's binary protocol (--binary), for clients that send many
+// patterns and want to know when each one is on the mirror.
+//
+// Every command is a CommandHeader followed by `length` bytes of
+// payload; every command gets a CommandReply with the same sequence
+// number, in order.  A client may send any number of commands before
+// reading replies.  All numbers are little endian.
+//
+//   LOAD_PATH    payload: file name                index: slot for STORE
+//   LOAD_INDEX   no payload; shows stored pattern `index`
+//   INLINE_BITS  payload: uint32 width, uint32 height, packed bits (rows
+//                of (width + 7) / 8 bytes, pixel x in bit x % 8 of byte
+//                x / 8; placed like a picture file)
+//   GENERATE     payload: a pattern line, e.g. "@hadamard 17 size=64x64"
+//   RESET        no payload; forgets the stored patterns and turns the
+//                mirror off
+//   FLUSH_ACK    no payload; replied to (and all replies before it sent)
+//                at once
+//
+// With COMMAND_STORE in flags, LOAD_PATH, INLINE_BITS and GENERATE keep
+// the pattern as stored pattern `index` instead of showing it, so that
+// LOAD_INDEX can show it later without reading or drawing it again.
+//
+// A reply's timestamp is the loader's monotonic clock (microseconds)
+// just after the mirror switched to the pattern, or when the command was
+// done for commands that show nothing.
+
+enum CommandOpcode
+{
+    COMMAND_LINE = 0,            // not sent: a text line (text mode)
+    COMMAND_LOAD_PATH = 1,
+    COMMAND_LOAD_INDEX = 2,
+    COMMAND_INLINE_BITS = 3,
+    COMMAND_GENERATE = 4,
+    COMMAND_RESET = 5,
+    COMMAND_FLUSH_ACK = 6
+};
+
+enum CommandFlags
+{
+    COMMAND_STORE = 1
+};
+
+enum CommandStatus
+{
+    COMMAND_OK = 0,
+    COMMAND_BAD_REQUEST = 1,     // unknown opcode or malformed payload
+    COMMAND_NOT_FOUND = 2,       // file could not be read, no such index
+    COMMAND_BAD_PATTERN = 3      // pattern line or bits not usable
+};
+
+struct CommandHeader
+{
+    uint32_t length;             // payload bytes after this header
+    uint16_t opcode;             // CommandOpcode
+    uint16_t flags;              // CommandFlags
+    uint32_t sequence;           // echoed in the reply
+    uint32_t index;
+};
+
+struct CommandReply
+{
+    uint32_t sequence;
+    uint16_t opcode;
+    uint16_t status;             // CommandStatus
+    uint64_t timestamp_us;
+};
+
+// No command needs more than a mirror's worth of bytes.
+static const uint32_t COMMAND_MAX_PAYLOAD = 64u << 20;
+
+// A command as the loader works on it: a decoded binary command, or in
+// text mode a line (opcode COMMAND_LINE, the line in `text`).
+struct LoaderCommand
+{
+    LoaderCommand() : opcode(COMMAND_LINE), flags(0), sequence(0), index(0) { }
+
+    uint16_t opcode;
+    uint16_t flags;
+    uint32_t sequence;
+    uint32_t index;
+    std::string text;                  // LOAD_PATH, GENERATE, lines
+    std::vector<unsigned char> data;   // INLINE_BITS
+
+    static LoaderCommand line(const std::string& text)
+    {
+        LoaderCommand c;
+        c.text = text;
+        return c;
+    }
+};
+
+// Reads the next command from `in`.  False at the end of the input;
+// throws std::runtime_error if the input ends inside a command or a
+// length is out of range, since the stream cannot be resynchronized.
+inline bool read_command(FILE* in, LoaderCommand& command)
+{
+    CommandHeader h;
+    size_t got = fread(&h, 1, sizeof(h), in);
+    if(got == 0)
+    {
+        return false;
+    }
+    if(got != sizeof(h) || h.length > COMMAND_MAX_PAYLOAD)
+    {
+        throw std::runtime_error("Broken command on input");
+    }
+    command.opcode = h.opcode;
+    command.flags = h.flags;
+    command.sequence = h.sequence;
+    command.index = h.index;
+    command.text.clear();
+    command.data.clear();
+    if(h.length == 0)
+    {
+        return true;
+    }
+    std::vector<unsigned char>& payload = command.data;
+    payload.resize(h.length);
+    if(fread(&payload[0], 1, h.length, in) != h.length)
+    {
+        throw std::runtime_error("Input ended inside a command");
+    }
+    if(h.opcode == COMMAND_LOAD_PATH || h.opcode == COMMAND_GENERATE)
+    {
+        // From a pointer: from the vector's iterators the string would
+        // be built in a temporary first.
+        command.text.assign(reinterpret_cast<const char*>(&payload[0]), payload.size());
+        payload.clear();
+    }
+    return true;
+}
+
+inline void write_reply(FILE* out, uint32_t sequence, uint16_t opcode, uint16_t status, uint64_t timestamp_us)
+{
+    CommandReply r;
+    r.sequence = sequence;
+    r.opcode = opcode;
+    r.status = status;
+    r.timestamp_us = timestamp_us;
+    fwrite(&r, sizeof(r), 1, out);
+}
+
+#endif // COMMAND_PROTOCOL_H
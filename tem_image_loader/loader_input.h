@@ -0,0 +1,241 @@
+#ifndef LOADER_INPUT_H
+#define LOADER_INPUT_H
+
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <exception>
+#include <condition_variable>
+#include "command_protocol.h"
+
+// The loader's commands from stdin (text lines, or binary commands with
+// --binary), read on their own thread, so that the loader can keep the
+// mirror busy (bit plane cycles) while it waits for the next one, and
+// can be woken by other sources of patterns too.
+//
+// Commands are handed over by swapping them with slots of a ring that
+// only grows when more commands are waiting than ever before, so the
+// memory of their text and data goes round between the reader, the
+// ring and the loader instead of being allocated for every line.
+//
+// Only a few commands (and at most MAX_WAITING_BYTES of their text and
+// data) are read ahead: the reader then waits for the loader to take
+// one, so that a client writing faster than the mirror is shown is held
+// up by the pipe instead of filling the memory with patterns.
+class LoaderInput
+{
+public:
+    static const size_t MAX_WAITING = 64;
+    static const size_t MAX_WAITING_BYTES = 64u << 20;
+
+    explicit LoaderInput(bool binary) : queue(new Queue())
+    {
+        // Reading stdin would flush std::cout before every line, from
+        // this thread; the loader flushes its output itself.
+        std::cin.tie(0);
+        // Detached, since a thread blocked reading stdin cannot be
+        // stopped and the loader may quit before stdin ends; the queue
+        // lives as long as either side needs it.
+        std::shared_ptr<Queue> q = queue;
+        std::thread([q, binary]() { binary ? read_commands(*q) : read_lines(*q); }).detach();
+    }
+
+    // Waits for the next command; false once stdin has ended.
+    bool next(LoaderCommand& command)
+    {
+        std::unique_lock<std::mutex> lock(queue->mutex);
+        Queue& q = *queue;
+        q.arrived.wait(lock, [&q]() { return q.count > 0 || q.ended; });
+        return pop(command);
+    }
+
+    // Queue a line as if it had come from stdin (from other threads that
+    // hand the loader work, such as the pattern ring's).  These lines are
+    // wake-ups ("@ring", "@spool") whose commands show everything that is
+    // ready, so one that is already waiting is not queued again.  They
+    // are held to the same bound as stdin, but without blocking the
+    // caller: while the queue is full the line waits aside and goes in as
+    // soon as the loader takes a command.
+    void push(const std::string& line)
+    {
+        std::lock_guard<std::mutex> lock(queue->mutex);
+        Queue& q = *queue;
+        if(q.waiting(line))
+        {
+            return;
+        }
+        if( ! q.has_room(line.size()))
+        {
+            q.deferred.push_back(line);
+            return;
+        }
+        q.add_line(line);
+        q.arrived.notify_one();
+    }
+
+    // The next command if there is one; `finished` is set once there are
+    // no more to come.
+    bool poll(LoaderCommand& command, bool& finished)
+    {
+        std::lock_guard<std::mutex> lock(queue->mutex);
+        finished = queue->count == 0 && queue->ended;
+        return pop(command);
+    }
+
+    // Whether a command is waiting; replies are sent on once there is
+    // none, so that a client sending many commands gets them in batches.
+    bool pending()
+    {
+        std::lock_guard<std::mutex> lock(queue->mutex);
+        return queue->count > 0;
+    }
+
+private:
+    struct Queue
+    {
+        Queue() : first(0), count(0), waiting_bytes(0), ended(false) { }
+
+        std::mutex mutex;
+        std::condition_variable arrived;
+        std::condition_variable taken;      // the reader waits on this when full
+        std::vector<LoaderCommand> slots;   // `count` waiting from `first`, in a ring
+        size_t first;
+        size_t count;
+        size_t waiting_bytes;               // of their text and data
+        bool ended;
+        std::vector<std::string> deferred;  // pushed lines kept out while full
+
+        // One command is always let in, however big it is.
+        bool has_room(size_t bytes) const
+        {
+            return count == 0 || (count < MAX_WAITING && waiting_bytes + bytes <= MAX_WAITING_BYTES);
+        }
+
+        // Whether a pushed line is already waiting, in the queue or aside.
+        bool waiting(const std::string& line) const
+        {
+            for(size_t i = 0; i < count; ++i)
+            {
+                const LoaderCommand& c = slots[(first + i) % slots.size()];
+                if(c.opcode == COMMAND_LINE && c.sequence == 0 && c.text == line)
+                {
+                    return true;
+                }
+            }
+            return std::find(deferred.begin(), deferred.end(), line) != deferred.end();
+        }
+
+        void add_line(const std::string& line)
+        {
+            LoaderCommand& slot = add_slot();
+            slot.opcode = COMMAND_LINE;
+            slot.flags = 0;
+            slot.sequence = 0;
+            slot.index = 0;
+            slot.text = line;
+            slot.data.clear();
+            waiting_bytes += line.size();
+        }
+
+        // The slot after the last command waiting, now counted as
+        // waiting too.
+        LoaderCommand& add_slot()
+        {
+            if(count == slots.size())
+            {
+                std::vector<LoaderCommand> bigger(slots.empty() ? 16 : 2*slots.size());
+                for(size_t i = 0; i < slots.size(); ++i)
+                {
+                    std::swap(bigger[i], slots[(first + i) % slots.size()]);
+                }
+                slots.swap(bigger);
+                first = 0;
+            }
+            ++count;
+            return slots[(first + count - 1) % slots.size()];
+        }
+    };
+
+    std::shared_ptr<Queue> queue;
+
+    static size_t bytes_of(const LoaderCommand& command)
+    {
+        return command.text.size() + command.data.size();
+    }
+
+    bool pop(LoaderCommand& command)
+    {
+        Queue& q = *queue;
+        if(q.count == 0)
+        {
+            return false;
+        }
+        // The slot keeps the memory of the command given back.
+        std::swap(command, q.slots[q.first]);
+        q.first = (q.first + 1) % q.slots.size();
+        --q.count;
+        q.waiting_bytes -= bytes_of(command);
+        while( ! q.deferred.empty() && q.has_room(q.deferred.front().size()))
+        {
+            q.add_line(q.deferred.front());
+            q.deferred.erase(q.deferred.begin());
+        }
+        q.taken.notify_one();
+        return true;
+    }
+
+    // Waits while the queue is full.
+    static void add(Queue& q, LoaderCommand& command)
+    {
+        std::unique_lock<std::mutex> lock(q.mutex);
+        const size_t bytes = bytes_of(command);
+        q.taken.wait(lock, [&q, bytes]() { return q.has_room(bytes); });
+        q.waiting_bytes += bytes;
+        std::swap(q.add_slot(), command);
+        q.arrived.notify_one();
+    }
+
+    static void finish(Queue& q)
+    {
+        std::lock_guard<std::mutex> lock(q.mutex);
+        q.ended = true;
+        q.arrived.notify_one();
+    }
+
+    // Lines are numbered from 1 in `sequence`, for --ack.
+    static void read_lines(Queue& q)
+    {
+        LoaderCommand command;
+        uint32_t line_number = 0;
+        while(getline(std::cin, command.text))
+        {
+            command.sequence = ++line_number;
+            add(q, command);
+        }
+        finish(q);
+    }
+
+    static void read_commands(Queue& q)
+    {
+        try
+        {
+            LoaderCommand command;
+            while(read_command(stdin, command))
+            {
+                add(q, command);
+            }
+        }
+        catch(const std::exception& e)
+        {
+            std::cerr << e.what() << std::endl;
+        }
+        finish(q);
+    }
+};
+
+#endif // LOADER_INPUT_H
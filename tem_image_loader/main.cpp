@@ -1,7 +1,19 @@
 #include <string>
 #include <iostream>
 #include <exception>
+#include <memory>
 #include <cctype>
+#include <chrono>
+#include <thread>
+#include <functional>
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#endif
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
 
 #define cimg_display 0
 #include "CImg.h"
@@ -9,11 +21,25 @@ using namespace cimg_library;
 
 #include <alpbasic.h>
 
+#include "pattern_spec.h"
+#include "pattern_generator.h"
+#include "remap_tables.h"
+#include "dithering.h"
+#include "dither_benchmark.h"
+#include "bit_planes.h"
+#include "pattern_ring.h"
+#include "command_protocol.h"
+#include "loader_input.h"
+#include "spool_ingest.h"
+#include "mirror_devices.h"
+#include "picture_decoder.h"
+#include "allocation_counter.h"
+
 
 class MirrorException : public std::exception
 {
 public:
-    MirrorException(std::string s) throw() : what_message(s) { }
+    MirrorException(const std::string& s) throw() : what_message(s) { }
     ~MirrorException() throw() { }
 
     const char* what() const throw()
@@ -29,75 +55,28 @@ private:
 class DMD_Mirror
 {
 public:
-    DMD_Mirror() : mirror_allocated(false), image_for_mirror(NULL)
+    // Pixel values
+    const static unsigned char OFF = 0;
+    const static unsigned char ON = 128;
+
+    // Drives ALP devices 0 to mirrors - 1 together (see
+    // mirror_devices.h); they must all be the same size.
+    explicit DMD_Mirror(int mirrors = 1) : nSizeX(0), nSizeY(0), image_for_mirror(NULL), use_placement_map(false), placed_w(0), placed_h(0), mask_w(-1), mask_h(-1),
+                   dither_mode(DITHER_THRESHOLD), grey_w(0), grey_h(0), use_planes(false), cycling(false), shown_plane(0), late_planes(0)
     {
         try
         {
-            // The first thing to do is to allocate one ALP device.
-            // The alpid serves for further requests to identify the device.
-            check_return_code(AlpbDevAlloc(0, &alpid), "Error in function AlpbDevAlloc");
-            mirror_allocated = true;
-
-            // Query serial number
-            unsigned long serial;
-            check_return_code(AlpbDevInquire(alpid, ALPB_DEV_SERIAL, &serial), "Error in function AlpbDevInquire (Serial number)");
-            //std::cout << "The allocated ALP has the serial number " << serial << "\n";
-
-            // Detect DMD type
-            ALPB_DMDTYPES nDmdType;
-            check_return_code(AlpbDevInquire(alpid, ALPB_DEV_DMDTYPE, &nDmdType), "Error in function AlpbDevInquire (DMD type)");
-
-            // Evaluate DMD type
-            // Applications often depend on a particular DMD type. In this case just
-            // inquire ALPB_DEV_DMDTYPE and reject all unsupported types.
-            switch(nDmdType)
-            {
-            case ALPB_DMDTYPE_DISCONNECT:
-                //std::cout << "DMD type: DMD disconnected or not recognized\nEmulate 1080p\n";
-                nSizeX = 1920;
-                nSizeY = 1080;
-                break;
-            case ALPB_DMDTYPE_1080P_095A:
-                //std::cout << "DMD type: 1080p .95\" Type-A\n";
-                nSizeX = 1920;
-                nSizeY = 1080;
-                break;
-            case ALPB_DMDTYPE_WUXGA_096A:
-                //std::cout << "DMD type: WUXGA .96\" Type-A\n)";
-                nSizeX = 1920;
-                nSizeY = 1200;
-                break;
-
-            case ALPB_DMDTYPE_XGA:
-                //std::cout << "DMD type: XGA\n";
-                nSizeX = 1024;
-                nSizeY = 768;
-                break;
-            case ALPB_DMDTYPE_XGA_055A:
-                //std::cout << "DMD type: XGA .55\" Type-A\n";
-                nSizeX = 1024;
-                nSizeY = 768;
-                break;
-            case ALPB_DMDTYPE_XGA_055X:
-                //std::cout << "DMD type: XGA .55\" Type-X\n";
-                nSizeX = 1024;
-                nSizeY = 768;
-                break;
-            case ALPB_DMDTYPE_XGA_07A:
-                //std::cout << "DMD type: XGA .7\" Type-A\n";
-                nSizeX = 1024;
-                nSizeY = 768;
-                break;
-
-            default:
-                throw MirrorException("DMD type: (unknown)\nError: DMD type not known");
-            }
-
-            //std::cout << "Mirror successfully contacted.\n";
-            //std::cout << "Width  = " << nSizeX << " px\n";
-            //std::cout << "Height = " << nSizeY << " px\n";
-
+            for(int i = 0; i < mirrors; ++i)
+            {
+                allocate_device(i);
+            }
+            devices.start(nSizeX, nSizeY);
+            buffer_list.resize(devices.size());
             image_for_mirror = new unsigned char[nSizeX*nSizeY];
+            for(int i = 1; i < mirrors; ++i)
+            {
+                device_buffers.push_back(std::vector<unsigned char>(static_cast<size_t>(nSizeX)*nSizeY, OFF));
+            }
         }
         catch(...)
         {
@@ -111,61 +90,605 @@ public:
         cleanup();
     }
 
-    void write_image_to_mirror(std::string filename)
+    int width() const { return nSizeX; }
+    int height() const { return nSizeY; }
+
+    // One byte per mirror pixel, OFF or ON, row by row.  Fill it and
+    // call show_mirror_buffer() to put it on the mirror.
+    unsigned char* mirror_buffer() { return image_for_mirror; }
+
+    int mirror_count() const { return static_cast<int>(devices.size()); }
+
+    // A buffer like mirror_buffer() for each mirror, for patterns that
+    // differ between mirrors; show_mirror_buffers() shows them.  The
+    // first is mirror_buffer().
+    unsigned char* mirror_buffer(int mirror)
     {
-        // Pixel values
-        const static unsigned char OFF = 0;
-        const static unsigned char ON = 128;
+        return (mirror == 0) ? image_for_mirror : &device_buffers[mirror - 1][0];
+    }
 
-        const static unsigned char THRESHOLD = 128;
+    // How far apart the mirrors switched, over the patterns shown.
+    const SkewStats& switch_skew() const { return skew; }
 
-        CImg<unsigned int> input_image;
-        try
+    // From now on, image files are placed with this transform (see
+    // placement_map.h) instead of at the top left corner of the mirror.
+    void use_placement(const PlacementTransform& transform)
+    {
+        placement_map.set_transform(transform);
+        use_placement_map = true;
+        placement.reset();
+        frames_changed();
+        mask_w = -1;
+    }
+
+    // From now on, image files are in camera coordinates and are placed
+    // through the forward table of a calibration (see remap_tables.h)
+    // instead of at the top left corner of the mirror.
+    void use_calibration(const std::string& forward_table)
+    {
+        placement.reset(new CalibratedPlacement(read_forward_remap(forward_table)));
+        use_placement_map = false;
+        frames_changed();
+        mask_w = -1;
+        if(static_cast<int>(placement->mirror_width()) != nSizeX || static_cast<int>(placement->mirror_height()) != nSizeY)
         {
-            input_image.assign(filename.c_str());
+            throw MirrorException("Calibration " + forward_table + " is for a different mirror size");
         }
-        catch(const CImgIOException& e)
+    }
+
+    // How image files are turned into on/off mirror pixels from now on
+    // (see dithering.h).  Threshold, the default, switches on pixels
+    // whose red value is 128 or more.
+    void use_dither(DitherMode mode)
+    {
+        dither_mode = mode;
+        frames_changed();
+    }
+
+    // From now on, image files are shown in grey: their bit planes are
+    // put on the mirror one after the other, for binary-weighted times,
+    // over and over until the next line of input (see bit_planes.h).
+    // The camera exposure should be a whole number of cycles.
+    void use_bit_planes(const BitPlaneSchedule& s)
+    {
+        schedule = s;
+        use_planes = true;
+        std::cout << "Bit planes: " << schedule.bits << ", shortest " << schedule.unit_us
+                  << " us, cycle " << schedule.cycle_us()/1000 << " ms\n";
+    }
+
+    void use_binary_pictures()
+    {
+        use_planes = false;
+    }
+
+    // Whether the bit planes of a grey picture are being cycled through;
+    // call show_next_bit_plane() until something else is shown.
+    bool showing_bit_planes() const { return cycling; }
+
+    // Planes that went up late, because loading them took longer than
+    // the plane before was on for.
+    unsigned long late_bit_planes() const { return late_planes; }
+
+    // Returns false if the image could not be read.
+    bool write_image_to_mirror(const std::string& filename)
+    {
+        if( ! read_grey_picture(filename.c_str()))
         {
-            // Error message printed by exception
-            // constructor; no need to print it
-            // here.  Just return and wait for the
-            // next image.
+            return false;
+        }
+        show_grey_picture(filename.c_str());
+        return true;
+    }
+
+    // Draw an image file, dithered and placed, into a mirror sized
+    // buffer without showing it.  Returns false if it could not be read.
+    bool render_image(const std::string& filename, unsigned char* mirror)
+    {
+        if( ! read_grey_picture(filename.c_str()))
+        {
+            return false;
+        }
+        binarize_grey_picture(mirror);
+        return true;
+    }
+
+    // Draw a width x height pattern, one byte per pixel (OFF/ON) or
+    // packed bits (see bit_planes.h), placed like a picture file, into a
+    // mirror sized buffer.
+    void render_pattern(const unsigned char* data, bool packed, int w, int h, unsigned char* mirror)
+    {
+        placed_w = w;
+        placed_h = h;
+        const bool as_is = ! use_placement_map && ! placement && w == nSizeX && h == nSizeY;
+        if(as_is && packed)
+        {
+            expander.expand(data, w, h, mirror, OFF, ON);
             return;
         }
+        if(packed)
+        {
+            picture.resize(static_cast<size_t>(w)*h);
+            expander.expand(data, w, h, &picture[0], OFF, ON);
+            data = &picture[0];
+        }
+        place(data, w, h, mirror);
+    }
 
-        // x and y are mirror pixel coordinates
-        for(int x = 0; x < nSizeX; ++x)
+    // Show a pattern as render_pattern() draws it.  A full-size byte
+    // pattern that needs no placing is only copied, since the mirror
+    // buffer must hold what is shown (@complement inverts it).
+    void show_pattern(const unsigned char* data, bool packed, int w, int h, const char* what)
+    {
+        if( ! packed && ! use_placement_map && ! placement && w == nSizeX && h == nSizeY)
         {
-            for(int y = 0; y < nSizeY; ++y)
+            memcpy(image_for_mirror, data, static_cast<size_t>(w)*h);
+            placed_w = w;
+            placed_h = h;
+        }
+        else
+        {
+            render_pattern(data, packed, w, h, image_for_mirror);
+        }
+        show_buffer(image_for_mirror, what);
+    }
+
+    // Show packed bits of the whole mirror, already placed.
+    void show_packed(const unsigned char* bits, const char* what)
+    {
+        expander.expand(bits, nSizeX, nSizeY, image_for_mirror, OFF, ON);
+        show_buffer(image_for_mirror, what);
+    }
+
+    // Where the last picture or pattern placed on the mirror lies, for
+    // @complement (see pattern_area.h).
+    PatternArea placed_area() const
+    {
+        if(use_placement_map || placement)
+        {
+            return PatternArea::placed_picture(placed_w, placed_h);
+        }
+        return PatternArea::rectangle(0, 0, placed_w, placed_h);
+    }
+
+    // The mirror pixels a width x height picture covers with the
+    // placement map or calibration, 0xFF where it is; NULL without
+    // either.  Worked out again only when the size or placement changes.
+    const unsigned char* placed_mask(int width, int height)
+    {
+        if( ! use_placement_map && ! placement)
+        {
+            return NULL;
+        }
+        if(width != mask_w || height != mask_h)
+        {
+            area_mask.resize(static_cast<size_t>(nSizeX)*nSizeY);
+            if(use_placement_map)
             {
-                // expected input is binary black/white images, so just taking
-                // the red channel should suffice.
-                if( (x >= input_image.width()) || (y >= input_image.height()) )
+                const PlacementTransform& t = placement_map.get_transform();
+                for(int y = 0; y < nSizeY; ++y)
                 {
-                    image_for_mirror[x+nSizeX*y] = OFF;
+                    for(int x = 0; x < nSizeX; ++x)
+                    {
+                        area_mask[static_cast<size_t>(y)*nSizeX + x] = (t.source_of(x, y, width, height) < 0) ? 0 : 0xFF;
+                    }
                 }
-                else
+            }
+            else
+            {
+                const std::vector<int32_t>& index = placement->source_index(width, height);
+                for(size_t i = 0; i < index.size(); ++i)
                 {
-                    image_for_mirror[x+nSizeX*y] = (input_image(x,y) < THRESHOLD) ? OFF : ON;
+                    area_mask[i] = (index[i] < 0) ? 0 : 0xFF;
                 }
             }
+            mask_w = width;
+            mask_h = height;
         }
+        return &area_mask[0];
+    }
 
-        //std::cout << "\nWriting images to mirror... \n";
-        check_return_code(AlpbDevLoadRows(alpid, image_for_mirror, 0, nSizeY-1),
-                          std::string("Error in function AlpbDevLoadRows\nCould not write image (") + filename + ") to mirror.");
-        check_return_code(AlpbDevReset(alpid, ALPB_RESET_GLOBAL, 0),
-                          "Error in function AlpbDevReset");
+    // Monotonic time just after the mirror last switched pattern.
+    std::chrono::steady_clock::time_point shown_at() const { return last_shown; }
+
+    // Patterns can also be handed over in shared memory (see
+    // pattern_ring.h); `notify` is called, on another thread, whenever
+    // the client submits one.
+    void use_pattern_ring(const std::string& name, uint32_t slots, const std::function<void()>& notify)
+    {
+        ring.reset(new PatternRing(name, slots, nSizeX, nSizeY));
+        ring->watch(notify);
+    }
+
+    // Show every pattern submitted to the ring and not shown yet, in
+    // order.  Full-size byte patterns are copied into the mirror buffer
+    // as they are; packed bits are expanded into it.
+    void show_ring_patterns()
+    {
+        if( ! ring)
+        {
+            throw std::invalid_argument("@ring needs the loader to be started with --ring");
+        }
+        for(int64_t slot = ring->next_submitted(); slot >= 0; slot = ring->next_submitted())
+        {
+            const PatternSlotHeader& h = ring->slot_header(slot);
+            unsigned char* data = ring->slot_data(slot);
+            const bool bytes = (h.format == PATTERN_SLOT_BYTES);
+            const size_t size = bytes ? static_cast<size_t>(h.width)*h.height : static_cast<size_t>((h.width + 7) / 8)*h.height;
+            if((h.format != PATTERN_SLOT_BYTES && h.format != PATTERN_SLOT_BITS) || h.width == 0 || h.height == 0 || size > ring->slot_bytes())
+            {
+                std::cout << "Pattern ring slot " << slot << " has a bad format or size; skipped\n";
+                ring->finish_shown();
+                continue;
+            }
+            show_pattern(data, ! bytes, h.width, h.height, "pattern ring");
+            ring->finish_shown();
+        }
+    }
+
+    // Picture files can also be dropped into a spool directory (see
+    // spool_ingest.h); `ready` is called, on another thread, whenever
+    // the next one has been decoded.
+    void use_spool(const SpoolSettings& settings, const std::function<void()>& ready)
+    {
+        spool.reset(new SpoolIngest(settings, ready));
+    }
+
+    // Show every spool file decoded and not shown yet, in order.  A file
+    // with the same contents as one shown recently is not dithered and
+    // placed again; its frame comes from the cache.
+    void show_spool_frames()
+    {
+        if( ! spool)
+        {
+            throw std::invalid_argument("@spool needs the loader to be started with --watch");
+        }
+        while(spool->next_frame(spool_frame))
+        {
+            int cached_w = 0;
+            int cached_h = 0;
+            const unsigned char* bits = (spool_frame.cached && ! use_planes) ? spool->frame_cache().find(spool_frame.hash, cached_w, cached_h) : NULL;
+            if(spool_frame.cached && ! bits)
+            {
+                // Dropped from the cache since, or shown in grey.
+                spool->decode_frame(spool_frame);
+            }
+            if( ! spool_frame.ok)
+            {
+                ++spool_stats.failed;
+                std::cout << "Spool: " << spool_frame.path << " could not be read\n";
+                continue;
+            }
+            if(bits)
+            {
+                show_packed(bits, spool_frame.path.c_str());
+                placed_w = cached_w;
+                placed_h = cached_h;
+            }
+            else
+            {
+                grey.swap(spool_frame.grey);
+                grey_w = spool_frame.width;
+                grey_h = spool_frame.height;
+                show_grey_picture(spool_frame.path.c_str());
+                if( ! use_planes && spool_frame.hash != 0)
+                {
+                    spool_bits.resize(static_cast<size_t>((nSizeX + 7) / 8)*nSizeY);
+                    pack_bits(image_for_mirror, nSizeX, nSizeY, &spool_bits[0]);
+                    spool->frame_cache().add(spool_frame.hash, spool_bits, grey_w, grey_h);
+                }
+            }
+            const double latency_us = std::chrono::duration<double, std::micro>(last_shown - spool_frame.closed).count();
+            spool_stats.add(latency_us, bits != NULL);
+            std::cout << "Spool: " << spool_frame.path << " on the mirror " << latency_us/1000 << " ms after it was written"
+                      << (bits ? " (cached)\n" : "\n");
+        }
+    }
+
+    const SpoolStats& spool_latency() const { return spool_stats; }
+
+    // Wait until the plane on the mirror has been on for its time,
+    // switch to the next one (already loaded) and load the one after.
+    void show_next_bit_plane()
+    {
+        if(std::chrono::steady_clock::now() > plane_end)
+        {
+            // Loading took longer than the plane was meant to be on;
+            // start timing again from here.
+            ++late_planes;
+            plane_end = std::chrono::steady_clock::now();
+        }
+        check_devices(devices.run(NULL, true, plane_end), "bit plane");
+        last_shown = devices.last_switched();
+        shown_plane = following_plane(shown_plane);
+        plane_end += plane_dwell(shown_plane);
+        load_plane(following_plane(shown_plane));
+    }
+
+    // Load the mirror buffer onto the DMD and switch to it.  `what`
+    // names the picture in error messages.
+    void show_mirror_buffer(const char* what)
+    {
+        show_buffer(image_for_mirror, what);
+    }
+
+    // Load each mirror's buffer (see mirror_buffer(int)) onto it and
+    // switch all of them together.
+    void show_mirror_buffers(const char* what)
+    {
+        cycling = false;
+        for(size_t i = 0; i < devices.size(); ++i)
+        {
+            buffer_list[i] = mirror_buffer(static_cast<int>(i));
+        }
+        show_buffers(what);
     }
 
 private:
-    ALPB_HDEVICE alpid;
+    // Load a mirror sized buffer onto the DMD (every DMD) and switch to
+    // it.
+    void show_buffer(unsigned char* buffer, const char* what)
+    {
+        cycling = false;
+        std::fill(buffer_list.begin(), buffer_list.end(), buffer);
+        show_buffers(what);
+    }
+
+    void show_buffers(const char* what)
+    {
+        //std::cout << "\nWriting images to mirror... \n";
+        check_devices(devices.run(&buffer_list[0], true, std::chrono::steady_clock::time_point()), what);
+        last_shown = devices.last_switched();
+        if(devices.size() > 1)
+        {
+            skew.add(std::chrono::duration<double, std::micro>(last_shown - devices.first_switched()).count());
+        }
+    }
+
+    // Report a failed upload or reset, as check_return_code() does.  The
+    // message is only put together when there is an error.
+    void check_devices(long return_code, const char* what)
+    {
+        if(return_code >= 0)
+        {
+            return;
+        }
+        std::string message = std::string("Error in function ") + devices.failed_call();
+        if(devices.size() > 1)
+        {
+            message += " (mirror " + std::to_string(devices.failed_device()) + ")";
+        }
+        if(std::string(devices.failed_call()) == "AlpbDevLoadRows")
+        {
+            message += std::string("\nCould not write image (") + what + ") to mirror.";
+        }
+        check_return_code(return_code, message);
+    }
+
     int nSizeX;
     int nSizeY;
-    bool mirror_allocated;
+    MirrorDevices devices;
+    std::vector<unsigned char*> buffer_list;     // one per device
+    std::vector<std::vector<unsigned char> > device_buffers;
+    SkewStats skew;
     unsigned char *image_for_mirror;
+    std::unique_ptr<CalibratedPlacement> placement;
+    bool use_placement_map;
+    PlacementMap placement_map;
+    int placed_w;                       // size of the last picture placed
+    int placed_h;
+    std::vector<unsigned char> area_mask;   // see placed_mask()
+    int mask_w;                         // -1 when area_mask is out of date
+    int mask_h;
+    DitherMode dither_mode;
+    Ditherer ditherer;
+    std::vector<unsigned char> grey;
+    int grey_w;
+    int grey_h;
+    std::vector<unsigned char> picture;
+    std::chrono::steady_clock::time_point last_shown;
+    bool use_planes;
+    BitPlaneSchedule schedule;
+    BitPlanes planes;
+    std::vector<unsigned char> grey_mirror;
+    bool cycling;
+    int shown_plane;
+    std::chrono::steady_clock::time_point plane_end;
+    unsigned long late_planes;
+    std::unique_ptr<PatternRing> ring;
+    BitExpander expander;
+    std::unique_ptr<SpoolIngest> spool;
+    SpoolFrame spool_frame;
+    std::vector<unsigned char> spool_bits;
+    SpoolStats spool_stats;
+    PictureDecoder decoder;
+
+    bool read_grey_picture(const char* filename)
+    {
+        return decoder.decode(filename, grey, grey_w, grey_h);
+    }
+
+    // Show the grey picture: in bit planes, or dithered and placed.
+    void show_grey_picture(const char* what)
+    {
+        if(use_planes)
+        {
+            // Place the grey values; the planes are cut from the mirror
+            // sized picture.
+            grey_mirror.resize(static_cast<size_t>(nSizeX)*nSizeY);
+            place(grey.empty() ? NULL : &grey[0], grey_w, grey_h, &grey_mirror[0]);
+            planes.extract(&grey_mirror[0], nSizeX, nSizeY);
+            start_bit_planes(what);
+            return;
+        }
+        binarize_grey_picture(image_for_mirror);
+        show_mirror_buffer(what);
+    }
+
+    // The cached spool frames were drawn with the old placement or
+    // dithering.
+    void frames_changed()
+    {
+        if(spool)
+        {
+            spool->frame_cache().clear();
+        }
+    }
+
+    // Dither the grey picture at its own size and then place it.
+    void binarize_grey_picture(unsigned char* mirror)
+    {
+        picture.resize(grey.size());
+        if( ! grey.empty())
+        {
+            ditherer.dither(dither_mode, &grey[0], grey_w, grey_h, &picture[0], OFF, ON);
+        }
+        place(picture.empty() ? NULL : &picture[0], grey_w, grey_h, mirror);
+    }
 
-    void check_return_code(long return_code, std::string message)
+    // Put a width x height picture (one byte per pixel) on a mirror
+    // sized buffer: with the placement map, through the calibration, or
+    // at the top left corner, cut off at the mirror's edges.  The rest
+    // of the mirror is OFF.
+    void place(const unsigned char* source, int width, int height, unsigned char* mirror)
+    {
+        placed_w = width;
+        placed_h = height;
+        if(use_placement_map)
+        {
+            placement_map.apply(source, width, height, mirror, nSizeX, nSizeY, OFF);
+        }
+        else if(placement)
+        {
+            const std::vector<int32_t>& index = placement->source_index(width, height);
+            for(size_t i = 0; i < index.size(); ++i)
+            {
+                mirror[i] = (index[i] < 0) ? OFF : source[index[i]];
+            }
+        }
+        else
+        {
+            const int copy_w = (width < nSizeX) ? width : nSizeX;
+            for(int y = 0; y < nSizeY; ++y)
+            {
+                unsigned char* row = mirror + static_cast<size_t>(y)*nSizeX;
+                int x = 0;
+                if(y < height)
+                {
+                    memcpy(row, source + static_cast<size_t>(y)*width, copy_w);
+                    x = copy_w;
+                }
+                memset(row + x, OFF, nSizeX - x);
+            }
+        }
+    }
+
+    int following_plane(int plane) const
+    {
+        return (plane + 1 < BitPlanes::PLANES) ? plane + 1 : schedule.first_plane();
+    }
+
+    std::chrono::steady_clock::duration plane_dwell(int plane) const
+    {
+        return std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+            std::chrono::duration<double, std::micro>(schedule.dwell_us(plane)));
+    }
+
+    // Loads a plane into the DMD's memory; it shows at the next reset.
+    void load_plane(int plane)
+    {
+        planes.expand(plane, image_for_mirror, OFF, ON);
+        std::fill(buffer_list.begin(), buffer_list.end(), image_for_mirror);
+        check_devices(devices.run(&buffer_list[0], false, std::chrono::steady_clock::time_point()), "bit plane");
+    }
+
+    // Shows the lowest plane and loads the next one.
+    void start_bit_planes(const char* what)
+    {
+        shown_plane = schedule.first_plane();
+        planes.expand(shown_plane, image_for_mirror, OFF, ON);
+        show_mirror_buffer(what);
+        plane_end = std::chrono::steady_clock::now() + plane_dwell(shown_plane);
+        cycling = true;
+        load_plane(following_plane(shown_plane));
+    }
+
+    // Allocate ALP device `device` and find the size of its DMD.
+    void allocate_device(int device)
+    {
+        // The alpid serves for further requests to identify the device.
+        ALPB_HDEVICE alpid;
+        check_return_code(AlpbDevAlloc(device, &alpid), "Error in function AlpbDevAlloc");
+        devices.add(alpid);
+        const int first_x = nSizeX;
+        const int first_y = nSizeY;
+
+        // Query serial number
+        unsigned long serial;
+        check_return_code(AlpbDevInquire(alpid, ALPB_DEV_SERIAL, &serial), "Error in function AlpbDevInquire (Serial number)");
+        //std::cout << "The allocated ALP has the serial number " << serial << "\n";
+
+        // Detect DMD type
+        ALPB_DMDTYPES nDmdType;
+        check_return_code(AlpbDevInquire(alpid, ALPB_DEV_DMDTYPE, &nDmdType), "Error in function AlpbDevInquire (DMD type)");
+
+        // Evaluate DMD type
+        // Applications often depend on a particular DMD type. In this case just
+        // inquire ALPB_DEV_DMDTYPE and reject all unsupported types.
+        switch(nDmdType)
+        {
+        case ALPB_DMDTYPE_DISCONNECT:
+            //std::cout << "DMD type: DMD disconnected or not recognized\nEmulate 1080p\n";
+            nSizeX = 1920;
+            nSizeY = 1080;
+            break;
+        case ALPB_DMDTYPE_1080P_095A:
+            //std::cout << "DMD type: 1080p .95\" Type-A\n";
+            nSizeX = 1920;
+            nSizeY = 1080;
+            break;
+        case ALPB_DMDTYPE_WUXGA_096A:
+            //std::cout << "DMD type: WUXGA .96\" Type-A\n)";
+            nSizeX = 1920;
+            nSizeY = 1200;
+            break;
+
+        case ALPB_DMDTYPE_XGA:
+            //std::cout << "DMD type: XGA\n";
+            nSizeX = 1024;
+            nSizeY = 768;
+            break;
+        case ALPB_DMDTYPE_XGA_055A:
+            //std::cout << "DMD type: XGA .55\" Type-A\n";
+            nSizeX = 1024;
+            nSizeY = 768;
+            break;
+        case ALPB_DMDTYPE_XGA_055X:
+            //std::cout << "DMD type: XGA .55\" Type-X\n";
+            nSizeX = 1024;
+            nSizeY = 768;
+            break;
+        case ALPB_DMDTYPE_XGA_07A:
+            //std::cout << "DMD type: XGA .7\" Type-A\n";
+            nSizeX = 1024;
+            nSizeY = 768;
+            break;
+
+        default:
+            throw MirrorException("DMD type: (unknown)\nError: DMD type not known");
+        }
+
+        //std::cout << "Mirror successfully contacted.\n";
+        //std::cout << "Width  = " << nSizeX << " px\n";
+        //std::cout << "Height = " << nSizeY << " px\n";
+
+        if(device > 0 && (nSizeX != first_x || nSizeY != first_y))
+        {
+            throw MirrorException("DMD of ALP device " + std::to_string(device) + " is not the size of the first one");
+        }
+    }
+
+    void check_return_code(long return_code, const std::string& message)
     {
         if(return_code == ALPB_SUCC_PARTIAL)
         {
@@ -194,42 +717,589 @@ private:
 
     void cleanup()
     {
-        if(mirror_allocated)
+        devices.stop();
+        for(size_t i = 0; i < devices.size(); ++i)
         {
             long bHalt = 1;
-            AlpbDevControl(alpid, ALPB_DEV_HALT, &bHalt); // actually only necessary in multithreading use
-            AlpbDevFree(alpid); // close device driver
+            AlpbDevControl(devices.handle(i), ALPB_DEV_HALT, &bHalt); // actually only necessary in multithreading use
+            AlpbDevFree(devices.handle(i)); // close device driver
         }
 
         delete [] image_for_mirror;
     }
 };
 
+const unsigned char DMD_Mirror::OFF;
+const unsigned char DMD_Mirror::ON;
+
+
+DitherMode dither_mode_from(const std::string& name)
+{
+    DitherMode mode;
+    if( ! parse_dither_mode(name, mode))
+    {
+        throw std::invalid_argument("Unknown dither mode " + name + " (threshold, bayer, floyd-steinberg or sierra)");
+    }
+    return mode;
+}
+
+// Time cutting a grey picture into its bit planes against reading the
+// same picture from a 24-bit BMP file, as the loader does for every
+// picture.
+void run_bit_plane_benchmark(int width, int height, int repeats)
+{
+    std::vector<unsigned char> grey;
+    make_synthetic_frame(grey, width, height, 1, 0);
+    CImg<unsigned char> colour(width, height, 1, 3);
+    for(int c = 0; c < 3; ++c)
+    {
+        memcpy(colour.data(0, 0, 0, c), &grey[0], grey.size());
+    }
+    const std::string bmp_file = "bit_plane_benchmark.bmp";
+    colour.save_bmp(bmp_file.c_str());
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    PictureDecoder decoder;
+    std::vector<unsigned char> read;
+    int read_w, read_h;
+    for(int i = 0; i < repeats; ++i)
+    {
+        decoder.decode(bmp_file.c_str(), read, read_w, read_h);
+    }
+    const double read_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count()/repeats;
+    remove(bmp_file.c_str());
+
+    BitPlanes planes;
+    planes.extract(&grey[0], width, height);
+    start = std::chrono::steady_clock::now();
+    for(int i = 0; i < repeats; ++i)
+    {
+        planes.extract(&grey[0], width, height);
+    }
+    const double extract_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count()/repeats;
+
+    std::cout << "Bit plane benchmark, " << width << " x " << height << " picture" << std::endl;
+    std::cout << "Read 24-bit BMP:       " << read_ms << " ms" << std::endl;
+    std::cout << "Extract all 8 planes:  " << extract_ms << " ms" << std::endl;
+}
+
+// Waits for the next command, cycling through the bit planes of a grey
+// picture meanwhile.  False once the input has ended.
+bool next_command(LoaderInput& input, DMD_Mirror& mirror, LoaderCommand& command)
+{
+    while(mirror.showing_bit_planes())
+    {
+        bool finished = false;
+        if(input.poll(command, finished))
+        {
+            return true;
+        }
+        if(finished)
+        {
+            return false;
+        }
+        mirror.show_next_bit_plane();
+    }
+    return input.next(command);
+}
+
+// "<picture> | <picture> ..." shows a different picture (a file name or
+// a pattern line) on each mirror, all switched together.  Files are
+// dithered to black and white even with bit planes on.
+bool show_per_mirror(DMD_Mirror& mirror, PatternGenerator& generator, const std::string& line)
+{
+    std::vector<std::string> pictures;
+    std::string::size_type start = 0;
+    for(;;)
+    {
+        std::string::size_type bar = line.find('|', start);
+        std::string picture = line.substr(start, (bar == std::string::npos) ? std::string::npos : bar - start);
+        const std::string::size_type first = picture.find_first_not_of(" \t");
+        const std::string::size_type last = picture.find_last_not_of(" \t");
+        pictures.push_back((first == std::string::npos) ? std::string() : picture.substr(first, last - first + 1));
+        if(bar == std::string::npos)
+        {
+            break;
+        }
+        start = bar + 1;
+    }
+    if(static_cast<int>(pictures.size()) != mirror.mirror_count())
+    {
+        std::cout << "Line for " << pictures.size() << " mirrors, but the loader drives " << mirror.mirror_count()
+                  << " (see --mirrors): " << line << '\n';
+        return false;
+    }
+
+    // The generator draws each pattern from scratch, not over the last.
+    bool ok = true;
+    for(size_t i = 0; ok && i < pictures.size(); ++i)
+    {
+        unsigned char* buffer = mirror.mirror_buffer(static_cast<int>(i));
+        generator.mirror_overwritten();
+        if(PatternSpec::is_spec(pictures[i]))
+        {
+            try
+            {
+                generator.render(PatternSpec::parse(pictures[i]), buffer, mirror.width(), mirror.height());
+            }
+            catch(const std::logic_error& e)
+            {
+                std::cout << e.what() << '\n';
+                ok = false;
+            }
+        }
+        else
+        {
+            ok = mirror.render_image(pictures[i], buffer);
+        }
+    }
+    generator.mirror_overwritten();
+    if(ok)
+    {
+        mirror.show_mirror_buffers(line.c_str());
+    }
+    return ok;
+}
+
+// A line of input is either an image file name or, if it starts with
+// '@', a pattern to generate (see pattern_spec.h).  "@dither <mode>"
+// sets how the image files after it are dithered, "@bit-planes ..."
+// shows them in grey, "@ring" shows what has been submitted to the
+// pattern ring and "@spool" the files decoded from the watched spool
+// directory.  With several mirrors, the same picture goes on all of them
+// unless the line has one for each (see show_per_mirror()).  Returns
+// false if the line could not be shown.
+bool show_picture(DMD_Mirror& mirror, PatternGenerator& generator, const std::string& line)
+{
+    if(line.find('|') != std::string::npos)
+    {
+        return show_per_mirror(mirror, generator, line);
+    }
+    if(PatternSpec::is_spec(line))
+    {
+        try
+        {
+            PatternSpec spec = PatternSpec::parse(line);
+            if(spec.type == "dither")
+            {
+                mirror.use_dither(dither_mode_from((spec.flags.size() == 1) ? *spec.flags.begin() : std::string()));
+                return true;
+            }
+            if(spec.type == "ring")
+            {
+                mirror.show_ring_patterns();
+                generator.mirror_overwritten(mirror.placed_area());
+                return true;
+            }
+            if(spec.type == "spool")
+            {
+                mirror.show_spool_frames();
+                generator.mirror_overwritten(mirror.placed_area());
+                return true;
+            }
+            if(spec.type == "bit-planes")
+            {
+                if(spec.has_flag("off"))
+                {
+                    mirror.use_binary_pictures();
+                }
+                else
+                {
+                    mirror.use_bit_planes(bit_plane_schedule_from(spec));
+                }
+                return true;
+            }
+            generator.render(spec, mirror.mirror_buffer(), mirror.width(), mirror.height());
+        }
+        catch(const std::logic_error& e)
+        {
+            // Bad pattern line; wait for the next one.
+            std::cout << e.what() << '\n';
+            return false;
+        }
+        mirror.show_mirror_buffer(line.c_str());
+        return true;
+    }
+    if( ! mirror.write_image_to_mirror(line))
+    {
+        return false;
+    }
+    generator.mirror_overwritten(mirror.placed_area());
+    return true;
+}
+
+// Patterns kept for COMMAND_LOAD_INDEX, as packed bits of the whole
+// mirror (an eighth of the mirror buffer each), with where on the mirror
+// the pattern lies.
+class PatternStore
+{
+public:
+    void clear() { patterns.clear(); areas.clear(); }
+
+    bool has(uint32_t index) const { return index < patterns.size() && ! patterns[index].empty(); }
+    const unsigned char* bits(uint32_t index) const { return &patterns[index][0]; }
+    const PatternArea& area(uint32_t index) const { return areas[index]; }
+
+    // Keep a mirror sized OFF/ON buffer as pattern `index`.
+    void store(uint32_t index, const unsigned char* mirror, int width, int height, const PatternArea& area)
+    {
+        if(index >= patterns.size())
+        {
+            patterns.resize(index + 1);
+            areas.resize(index + 1);
+        }
+        patterns[index].resize(static_cast<size_t>((width + 7) / 8)*height);
+        pack_bits(mirror, width, height, &patterns[index][0]);
+        areas[index] = area;
+    }
+
+private:
+    std::vector<std::vector<unsigned char> > patterns;
+    std::vector<PatternArea> areas;
+};
+
+uint64_t microseconds(std::chrono::steady_clock::time_point t)
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(t.time_since_epoch()).count();
+}
+
+// Carry out one binary command (see command_protocol.h) and reply to it.
+void run_command(DMD_Mirror& mirror, PatternGenerator& generator, PatternStore& store,
+                 std::vector<unsigned char>& scratch, const LoaderCommand& command)
+{
+    const bool keep = (command.flags & COMMAND_STORE) != 0;
+    const int width = mirror.width();
+    const int height = mirror.height();
+    scratch.resize(static_cast<size_t>(width)*height);
+    uint16_t status = COMMAND_OK;
+    bool shows = ! keep;
+    PatternArea kept_area;
+    switch(command.opcode)
+    {
+    case COMMAND_LOAD_PATH:
+        if(keep)
+        {
+            status = mirror.render_image(command.text, &scratch[0]) ? COMMAND_OK : COMMAND_NOT_FOUND;
+            kept_area = mirror.placed_area();
+        }
+        else
+        {
+            status = mirror.write_image_to_mirror(command.text) ? COMMAND_OK : COMMAND_NOT_FOUND;
+            generator.mirror_overwritten(mirror.placed_area());
+        }
+        break;
+
+    case COMMAND_LOAD_INDEX:
+        shows = true;
+        if( ! store.has(command.index))
+        {
+            status = COMMAND_NOT_FOUND;
+            break;
+        }
+        mirror.show_packed(store.bits(command.index), "stored pattern");
+        generator.mirror_overwritten(store.area(command.index));
+        break;
+
+    case COMMAND_INLINE_BITS:
+    {
+        uint32_t size[2] = { 0, 0 };
+        if(command.data.size() >= sizeof(size))
+        {
+            memcpy(size, &command.data[0], sizeof(size));
+        }
+        const uint64_t bytes = static_cast<uint64_t>((size[0] + 7) / 8)*size[1];
+        if(command.data.size() < sizeof(size) || command.data.size() - sizeof(size) != bytes)
+        {
+            status = COMMAND_BAD_REQUEST;
+            break;
+        }
+        if(size[0] == 0 || size[1] == 0)
+        {
+            status = COMMAND_BAD_PATTERN;
+            break;
+        }
+        unsigned char* bits = const_cast<unsigned char*>(&command.data[sizeof(size)]);
+        if(keep)
+        {
+            mirror.render_pattern(bits, true, size[0], size[1], &scratch[0]);
+            kept_area = mirror.placed_area();
+        }
+        else
+        {
+            mirror.show_pattern(bits, true, size[0], size[1], "inline pattern");
+            generator.mirror_overwritten(mirror.placed_area());
+        }
+        break;
+    }
+
+    case COMMAND_GENERATE:
+        if( ! PatternSpec::is_spec(command.text))
+        {
+            status = COMMAND_BAD_PATTERN;
+        }
+        else if(keep)
+        {
+            // Drawn from scratch into the spare buffer, and the mirror
+            // buffer is drawn from scratch next time as well.
+            const PatternArea shown_area = generator.drawn_area();
+            try
+            {
+                generator.mirror_overwritten();
+                generator.render(PatternSpec::parse(command.text), &scratch[0], width, height);
+                kept_area = generator.drawn_area();
+            }
+            catch(const std::logic_error& e)
+            {
+                std::cerr << e.what() << '\n';
+                status = COMMAND_BAD_PATTERN;
+            }
+            generator.mirror_overwritten(shown_area);
+        }
+        else
+        {
+            status = show_picture(mirror, generator, command.text) ? COMMAND_OK : COMMAND_BAD_PATTERN;
+        }
+        break;
+
+    case COMMAND_RESET:
+        shows = true;
+        store.clear();
+        memset(mirror.mirror_buffer(), DMD_Mirror::OFF, static_cast<size_t>(width)*height);
+        mirror.show_mirror_buffer("reset");
+        generator.mirror_overwritten();
+        break;
+
+    case COMMAND_FLUSH_ACK:
+        shows = false;
+        break;
+
+    default:
+        shows = false;
+        status = COMMAND_BAD_REQUEST;
+        break;
+    }
+
+    if(keep && status == COMMAND_OK)
+    {
+        store.store(command.index, &scratch[0], width, height, kept_area);
+    }
+    const uint64_t when = (shows && status == COMMAND_OK) ? microseconds(mirror.shown_at())
+                                                          : microseconds(std::chrono::steady_clock::now());
+    write_reply(stdout, command.sequence, command.opcode, status, when);
+}
+
+
+// --watch <directory> with --watch-options "order=name|arrival
+// workers=<n> poll=<ms> cache=<frames> polling".
+SpoolSettings spool_settings_from(const std::string& directory, const PatternSpec& spec)
+{
+    SpoolSettings settings;
+    settings.directory = directory;
+    const std::string order = spec.get_string("order", "arrival");
+    if(order != "arrival" && order != "name")
+    {
+        throw std::invalid_argument("Spool order is arrival or name, not " + order);
+    }
+    settings.name_order = (order == "name");
+    settings.polling = spec.has_flag("polling");
+    settings.poll_ms = spec.get_int("poll", settings.poll_ms);
+    settings.workers = spec.get_int("workers", settings.workers);
+    const long cache = spec.get_int("cache", static_cast<long>(settings.cache_frames));
+    if(cache < 0)
+    {
+        throw std::invalid_argument("The spool cache cannot hold fewer than 0 frames");
+    }
+    settings.cache_frames = cache;
+    return settings;
+}
 
 int main(int argc, char* argv[])
 {
     try
     {
-        DMD_Mirror mirror;
+        if(argc == 3 && std::string(argv[1]) == "--dither-benchmark")
+        {
+            // No mirror needed, e.g. --dither-benchmark 1920x1080
+            int width, height;
+            if(sscanf(argv[2], "%dx%d", &width, &height) != 2 || width <= 0 || height <= 0)
+            {
+                throw std::invalid_argument("--dither-benchmark needs a picture size, e.g. 1920x1080");
+            }
+            run_dither_benchmark(width, height, 20, DMD_Mirror::OFF, DMD_Mirror::ON);
+            return 0;
+        }
+        if(argc == 3 && std::string(argv[1]) == "--bit-plane-benchmark")
+        {
+            int width, height;
+            if(sscanf(argv[2], "%dx%d", &width, &height) != 2 || width <= 0 || height <= 0)
+            {
+                throw std::invalid_argument("--bit-plane-benchmark needs a picture size, e.g. 1920x1080");
+            }
+            run_bit_plane_benchmark(width, height, 10);
+            return 0;
+        }
 
-        if(argc == 1)
+        // --binary decides how stdin is read, so it is looked for first.
+        bool binary = false;
+        bool acks = false;
+        int mirrors = 1;
+        for(int i = 1; i < argc; ++i)
         {
-            std::string file_name;
-            while(getline(std::cin, file_name))
+            binary = binary || std::string(argv[i]) == "--binary";
+            acks = acks || std::string(argv[i]) == "--ack";
+            if(std::string(argv[i]) == "--mirrors" && i + 1 < argc)
             {
-                if(file_name.empty())
+                mirrors = atoi(argv[i + 1]);
+                if(mirrors < 1)
                 {
-                    continue;
+                    throw std::invalid_argument("--mirrors needs the number of DMDs to drive");
                 }
-                mirror.write_image_to_mirror(file_name);
             }
         }
+        if(binary || acks)
+        {
+            // Replies are flushed when the loader runs out of work, not
+            // per line (see below).
+            setvbuf(stdout, 0, _IOFBF, 1 << 16);
+        }
+        if(binary)
+        {
+#ifdef _WIN32
+            _setmode(_fileno(stdin), _O_BINARY);
+            _setmode(_fileno(stdout), _O_BINARY);
+#endif
+            // stdout carries the replies; messages go to stderr.
+            std::cout.rdbuf(std::cerr.rdbuf());
+        }
+
+        // Before the mirror, which may hand it lines until it is gone.
+        LoaderInput input(binary);
+        DMD_Mirror mirror(mirrors);
+        PatternGenerator generator(DMD_Mirror::OFF, DMD_Mirror::ON);
+        generator.use_placed_mask([&mirror](int width, int height) { return mirror.placed_mask(width, height); });
+
+        std::string watch_directory;
+        std::string watch_options;
+        int first_picture = 1;
+        while(first_picture < argc && std::string(argv[first_picture]).compare(0, 2, "--") == 0)
+        {
+            std::string option = argv[first_picture];
+            if(option == "--binary" || option == "--ack")
+            {
+                ++first_picture;
+                continue;
+            }
+            if(first_picture + 1 == argc)
+            {
+                throw std::invalid_argument(option + " needs a value");
+            }
+            if(option == "--mirrors")
+            {
+                // Already used for the mirror.
+            }
+            else if(option == "--calibration")
+            {
+                mirror.use_calibration(argv[first_picture + 1]);
+            }
+            else if(option == "--placement")
+            {
+                // e.g. --placement "scale=4 x=100 y=60 rotate=90 flip=x"
+                mirror.use_placement(placement_from(PatternSpec::parse(std::string("@placement ") + argv[first_picture + 1])));
+            }
+            else if(option == "--dither")
+            {
+                mirror.use_dither(dither_mode_from(argv[first_picture + 1]));
+            }
+            else if(option == "--ring")
+            {
+                // e.g. --ring "name=tem_patterns slots=4"
+                PatternSpec spec = PatternSpec::parse(std::string("@ring ") + argv[first_picture + 1]);
+                long slots = spec.get_int("slots", 4);
+                if(slots < 1)
+                {
+                    throw std::invalid_argument("A pattern ring needs at least one slot");
+                }
+                mirror.use_pattern_ring(spec.get_string("name", "tem_patterns"), slots, [&input]() { input.push("@ring"); });
+            }
+            else if(option == "--watch")
+            {
+                watch_directory = argv[first_picture + 1];
+            }
+            else if(option == "--watch-options")
+            {
+                // e.g. --watch-options "order=name workers=2 poll=50 cache=64"
+                watch_options = argv[first_picture + 1];
+            }
+            else if(option == "--bit-planes")
+            {
+                // e.g. --bit-planes "unit=100 bits=8"
+                mirror.use_bit_planes(bit_plane_schedule_from(PatternSpec::parse(std::string("@bit-planes ") + argv[first_picture + 1])));
+            }
+            else
+            {
+                throw std::invalid_argument("Unknown option " + option);
+            }
+            first_picture += 2;
+        }
+
+        if( ! watch_directory.empty())
+        {
+            mirror.use_spool(spool_settings_from(watch_directory, PatternSpec::parse("@watch " + watch_options)),
+                             [&input]() { input.push("@spool"); });
+        }
+
+        if(binary && first_picture < argc)
+        {
+            throw std::invalid_argument("--binary reads commands from stdin; give no picture files");
+        }
+        if(first_picture == argc)
+        {
+            PatternStore store;
+            std::vector<unsigned char> scratch;
+            LoaderCommand command;
+            // Debug and Benchmark builds say whether patterns allocate
+            // once the buffers have grown (see allocation_counter.h).
+            AllocationTally allocations(10);
+            while(next_command(input, mirror, command))
+            {
+                if(command.opcode != COMMAND_LINE)
+                {
+                    run_command(mirror, generator, store, scratch, command);
+                }
+                else if(acks && command.sequence != 0)
+                {
+                    // A line from stdin (not one queued by the ring).
+                    const std::chrono::steady_clock::time_point before = mirror.shown_at();
+                    const bool ok = command.text.empty() || show_picture(mirror, generator, command.text);
+                    const bool shown = mirror.shown_at() != before;
+                    std::cout << (! ok ? "failed " : (shown ? "shown " : "done ")) << command.sequence << ' '
+                              << microseconds(shown ? mirror.shown_at() : std::chrono::steady_clock::now());
+                    if(shown && mirror.mirror_count() > 1)
+                    {
+                        // How far apart the mirrors switched.
+                        std::cout << ' ' << static_cast<long>(mirror.switch_skew().last_us + 0.5);
+                    }
+                    std::cout << '\n';
+                }
+                else if( ! command.text.empty())
+                {
+                    show_picture(mirror, generator, command.text);
+                }
+                // Replies to commands already waiting go out together.
+                if(command.opcode == COMMAND_FLUSH_ACK || ! input.pending())
+                {
+                    fflush(stdout);
+                }
+                allocations.pattern_done();
+            }
+            allocations.report(std::cout);
+        }
         else
         {
-            for(int i = 1; i < argc; ++i)
+            for(int i = first_picture; i < argc; ++i)
             {
                 std::cout << "Image: " << argv[i] << '\n';
-                mirror.write_image_to_mirror(argv[i]);
+                show_picture(mirror, generator, argv[i]);
                 std::cout << "Press enter to ";
                 if(i < (argc - 1))
                 {
@@ -239,9 +1309,30 @@ int main(int argc, char* argv[])
                 {
                     std::cout << "quit.\n";
                 }
-                std::cin.get();
+                std::cout.flush();
+                LoaderCommand enter;
+                next_command(input, mirror, enter);
             }
         }
+
+        if(mirror.late_bit_planes() > 0)
+        {
+            std::cout << mirror.late_bit_planes() << " bit planes were shown late; use a longer unit\n";
+        }
+        const SkewStats& skew = mirror.switch_skew();
+        if(skew.frames > 0)
+        {
+            std::cout << "Mirrors switched " << skew.total_us/skew.frames << " us apart on average, "
+                      << skew.max_us << " us at most, over " << skew.frames << " patterns\n";
+        }
+        const SpoolStats& spooled = mirror.spool_latency();
+        if(spooled.shown + spooled.failed > 0)
+        {
+            std::cout << "Spool: " << spooled.shown << " files shown (" << spooled.cached << " from the cache), "
+                      << spooled.failed << " unreadable; written to shown "
+                      << ((spooled.shown > 0) ? spooled.total_us/spooled.shown/1000 : 0.0) << " ms on average, "
+                      << spooled.max_us/1000 << " ms at most\n";
+        }
     }
     catch(const std::exception& e)
     {
@@ -0,0 +1,311 @@
+#ifndef MIRROR_DEVICES_H
+#define MIRROR_DEVICES_H
+
+#include <cstddef>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <condition_variable>
+#include <alpbasic.h>
+
+// The DMDs the loader drives together (--mirrors n), all of one size.
+//
+// With more than one, every DMD has its own upload thread, so the
+// patterns go to all of them at once.  The threads then wait for each
+// other (and for the time the patterns are due) at a barrier and call
+// AlpbDevReset together, so the mirrors switch as close together as
+// the threads can be released.  With one DMD the calls are made on the
+// caller's thread, as they always were.
+//
+// A reset cannot be tried out before it is made.  If it fails on one
+// DMD after others have switched, those are switched to all off, so
+// that no mirror is left showing a pattern the others do not.
+//
+// Until the patterns are due the threads sleep, and only spin for the
+// last scheduler tick, which a sleep could overshoot.
+//
+// Errors come back as ALP return codes, for the caller to report.
+class MirrorDevices
+{
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    MirrorDevices() : rows(0), stopping(false), job_number(0), finished(0), arrived(0), failed(false),
+                      failure(0), failure_call(""), failure_device(0) { }
+
+    ~MirrorDevices()
+    {
+        stop();
+    }
+
+    void add(ALPB_HDEVICE handle)
+    {
+        devices.push_back(std::unique_ptr<Device>(new Device(handle)));
+    }
+
+    size_t size() const { return devices.size(); }
+    ALPB_HDEVICE handle(size_t i) const { return devices[i]->handle; }
+
+    // Start uploading to mirrors of `mirror_columns` x `mirror_rows`.
+    void start(int mirror_columns, int mirror_rows)
+    {
+        rows = mirror_rows;
+        if(devices.size() < 2)
+        {
+            return;
+        }
+        blank.assign(static_cast<size_t>(mirror_columns)*mirror_rows, 0);
+        for(size_t i = 0; i < devices.size(); ++i)
+        {
+            devices[i]->thread = std::thread(&MirrorDevices::upload, this, i);
+        }
+    }
+
+    void stop()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for(size_t i = 0; i < devices.size(); ++i)
+        {
+            if(devices[i]->thread.joinable())
+            {
+                devices[i]->thread.join();
+            }
+        }
+    }
+
+    // Load buffers[i] (mirror sized, one byte per pixel) onto mirror i,
+    // unless buffers is NULL, and with `reset` switch all mirrors to it,
+    // not before `at`.  If any load fails, no mirror is switched.
+    // Returns 0, or the first failed call's return code (see
+    // failed_call() and failed_device()).
+    long run(unsigned char* const* buffers, bool reset, Clock::time_point at)
+    {
+        failure = 0;
+        failed = false;
+        if(devices.size() == 1)
+        {
+            arrived = 0;
+            Job job = { buffers, reset, at };
+            run_on(0, job);
+            return failure;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            job.buffers = buffers;
+            job.reset = reset;
+            job.at = at;
+            arrived = 0;
+            finished = 0;
+            ++job_number;
+        }
+        wake.notify_all();
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            done.wait(lock, [this]() { return finished == devices.size(); });
+        }
+        if(failed.load() && reset)
+        {
+            blank_switched();
+        }
+        return failure;
+    }
+
+    const char* failed_call() const { return failure_call; }
+    size_t failed_device() const { return failure_device; }
+
+    // Just after the first and the last mirror switched, at the last
+    // reset.
+    Clock::time_point first_switched() const
+    {
+        Clock::time_point t = devices[0]->switched;
+        for(size_t i = 1; i < devices.size(); ++i)
+        {
+            t = std::min(t, devices[i]->switched);
+        }
+        return t;
+    }
+
+    Clock::time_point last_switched() const
+    {
+        Clock::time_point t = devices[0]->switched;
+        for(size_t i = 1; i < devices.size(); ++i)
+        {
+            t = std::max(t, devices[i]->switched);
+        }
+        return t;
+    }
+
+private:
+    struct Device
+    {
+        explicit Device(ALPB_HDEVICE handle) : handle(handle), reset_ok(false) { }
+
+        ALPB_HDEVICE handle;
+        std::thread thread;
+        Clock::time_point switched;
+        bool reset_ok;                   // at the last reset
+    };
+
+    struct Job
+    {
+        unsigned char* const* buffers;
+        bool reset;
+        Clock::time_point at;
+    };
+
+    std::vector<std::unique_ptr<Device> > devices;
+    int rows;
+    std::vector<unsigned char> blank;    // all off, with more than one DMD
+
+    std::mutex mutex;
+    std::condition_variable wake;        // a job, or stopping
+    std::condition_variable done;        // a thread finished its part
+    bool stopping;
+    Job job;
+    uint64_t job_number;
+    size_t finished;
+
+    std::atomic<size_t> arrived;         // threads at the reset barrier
+    std::atomic<bool> failed;
+    long failure;                        // written under `mutex`, or
+    const char* failure_call;            // with a single mirror
+    size_t failure_device;
+
+    void upload(size_t i)
+    {
+        uint64_t seen = 0;
+        for(;;)
+        {
+            Job mine;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [this, seen]() { return stopping || job_number != seen; });
+                if(stopping)
+                {
+                    return;
+                }
+                seen = job_number;
+                mine = job;
+            }
+            run_on(i, mine);
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                ++finished;
+            }
+            done.notify_one();
+        }
+    }
+
+    void run_on(size_t i, const Job& mine)
+    {
+        Device& device = *devices[i];
+        if(mine.buffers)
+        {
+            long code = AlpbDevLoadRows(device.handle, mine.buffers[i], 0, rows - 1);
+            if(code < 0)
+            {
+                fail(i, code, "AlpbDevLoadRows");
+            }
+        }
+        if( ! mine.reset)
+        {
+            return;
+        }
+        device.reset_ok = false;
+        // Everyone loaded (or failed), and the patterns due.
+        arrived.fetch_add(1);
+        while(arrived.load() < devices.size())
+        {
+            std::this_thread::yield();
+        }
+        wait_until(mine.at);
+        if(failed.load())
+        {
+            return;
+        }
+        long code = AlpbDevReset(device.handle, ALPB_RESET_GLOBAL, 0);
+        device.switched = Clock::now();
+        if(code < 0)
+        {
+            fail(i, code, "AlpbDevReset");
+            return;
+        }
+        device.reset_ok = true;
+    }
+
+    static void wait_until(Clock::time_point at)
+    {
+        // A scheduler tick, 15.6 ms on Windows unless a program asks
+        // for less.
+        const Clock::duration tick = std::chrono::milliseconds(16);
+        if(Clock::now() + tick < at)
+        {
+            std::this_thread::sleep_until(at - tick);
+        }
+        while(Clock::now() < at)
+        {
+            std::this_thread::yield();
+        }
+    }
+
+    // After a failed reset: switch the mirrors that did switch to all off.
+    // The first error stays the one reported.
+    void blank_switched()
+    {
+        for(size_t i = 0; i < devices.size(); ++i)
+        {
+            Device& device = *devices[i];
+            if(device.reset_ok)
+            {
+                AlpbDevLoadRows(device.handle, &blank[0], 0, rows - 1);
+                AlpbDevReset(device.handle, ALPB_RESET_GLOBAL, 0);
+                device.reset_ok = false;
+            }
+        }
+    }
+
+    void fail(size_t i, long code, const char* call)
+    {
+        std::unique_lock<std::mutex> lock(mutex, std::defer_lock);
+        if(devices.size() > 1)
+        {
+            lock.lock();
+        }
+        if( ! failed.load())
+        {
+            failure = code;
+            failure_call = call;
+            failure_device = i;
+        }
+        failed.store(true);
+    }
+};
+
+// How far apart the mirrors switched, over the patterns shown.
+struct SkewStats
+{
+    SkewStats() : frames(0), last_us(0), total_us(0), max_us(0) { }
+
+    unsigned long frames;
+    double last_us;
+    double total_us;
+    double max_us;
+
+    void add(double skew_us)
+    {
+        ++frames;
+        last_us = skew_us;
+        total_us += skew_us;
+        max_us = std::max(max_us, skew_us);
+    }
+};
+
+#endif // MIRROR_DEVICES_H
@@ -0,0 +1,95 @@
+#ifndef PATTERN_AREA_H
+#define PATTERN_AREA_H
+
+#include <cstring>
+#include <climits>
+#include <algorithm>
+#include <stdint.h>
+
+// The part of the mirror a pattern was drawn on, so that @complement
+// inverts the pattern and leaves the off border around it off, as the
+// generators' own complements (neg, pairs) do.
+//
+// The area is a rectangle, clipped to the mirror when it is used.  A
+// picture put on the mirror through the placement map or a calibration
+// covers a shape of its own: its area keeps the picture's size, and the
+// mask of the mirror pixels it covers is only worked out when it is
+// inverted.
+struct PatternArea
+{
+    PatternArea() : x0(0), y0(0), x1(INT_MAX), y1(INT_MAX), picture_w(0), picture_h(0) { }
+
+    int x0;
+    int y0;
+    int x1;          // one past the right edge
+    int y1;          // one past the bottom edge
+    int picture_w;   // of a placed picture; 0 if the rectangle is the area
+    int picture_h;
+
+    // Anything not known to cover less, such as a reset mirror or a
+    // pattern that came whole.
+    static PatternArea whole_mirror() { return PatternArea(); }
+
+    static PatternArea rectangle(int x, int y, int width, int height)
+    {
+        PatternArea a;
+        a.x0 = x;
+        a.y0 = y;
+        a.x1 = static_cast<int>(std::min<int64_t>(static_cast<int64_t>(x) + width, INT_MAX));
+        a.y1 = static_cast<int>(std::min<int64_t>(static_cast<int64_t>(y) + height, INT_MAX));
+        return a;
+    }
+
+    static PatternArea placed_picture(int width, int height)
+    {
+        PatternArea a;
+        a.picture_w = width;
+        a.picture_h = height;
+        return a;
+    }
+
+    bool placed() const { return picture_w > 0 && picture_h > 0; }
+
+    // Swap off and on inside the area: an exclusive or with `flip`
+    // (off ^ on), done a word at a time.  `mask` is NULL, or for a
+    // placed picture mirror sized and 0xFF where the picture is.
+    void invert(unsigned char* mirror, int width, int height, unsigned char flip, const unsigned char* mask) const
+    {
+        const int left = std::max(x0, 0);
+        const int right = std::min(x1, width);
+        const int top = std::max(y0, 0);
+        const int bottom = std::min(y1, height);
+        if(left >= right || top >= bottom)
+        {
+            return;
+        }
+        const uint64_t word_mask = static_cast<uint64_t>(flip) * 0x0101010101010101ull;
+        for(int y = top; y < bottom; ++y)
+        {
+            unsigned char* row = mirror + static_cast<size_t>(y)*width;
+            if(mask)
+            {
+                const unsigned char* inside = mask + static_cast<size_t>(y)*width;
+                for(int x = left; x < right; ++x)
+                {
+                    row[x] ^= flip & inside[x];
+                }
+                continue;
+            }
+            int x = left;
+            for( ; x + 8 <= right; x += 8)
+            {
+                uint64_t word;
+                memcpy(&word, row + x, 8);
+                word ^= word_mask;
+                memcpy(row + x, &word, 8);
+            }
+            for( ; x < right; ++x)
+            {
+                row[x] ^= flip;
+            }
+        }
+    }
+};
+
+#endif // PATTERN_AREA_H
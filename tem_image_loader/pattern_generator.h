@@ -0,0 +1,167 @@
+#ifndef PATTERN_GENERATOR_H
+#define PATTERN_GENERATOR_H
+
+#include <cstring>
+#include <string>
+#include <functional>
+#include <stdexcept>
+#include <stdint.h>
+#include "pattern_spec.h"
+#include "hadamard_patterns.h"
+#include "procedural_patterns.h"
+#include "pattern_area.h"
+
+// Draws generated patterns straight into the mirror buffer, so that no
+// pattern files have to be written, stored or decoded.  Generators keep
+// their tables between calls; only a change of layout costs more than
+// drawing the pattern itself.
+class PatternGenerator
+{
+public:
+    PatternGenerator(unsigned char off_value, unsigned char on_value) : off(off_value), on(on_value) { }
+
+    // The mask of the mirror pixels a placed picture of width x height
+    // covers (see PatternArea), or NULL if its rectangle is enough.
+    typedef std::function<const unsigned char*(int width, int height)> PlacedMask;
+
+    // Where placed pictures go, for @complement after one.
+    void use_placed_mask(const PlacedMask& mask) { placed_mask = mask; }
+
+    // Throws std::invalid_argument or std::out_of_range for a bad spec,
+    // leaving the mirror buffer in an unspecified state.
+    void render(const PatternSpec& spec, unsigned char* mirror, int width, int height)
+    {
+        ProceduralType procedural_type;
+        if(spec.type == "complement")
+        {
+            invert_area(mirror, width, height);
+            hadamard.forget_background();
+        }
+        else if(spec.type == "fiducial")
+        {
+            render_fiducial(spec, mirror, width, height);
+            hadamard.forget_background();
+            area = PatternArea::whole_mirror();
+        }
+        else if(spec.type == "hadamard")
+        {
+            render_hadamard(spec, mirror, width, height);
+        }
+        else if(parse_procedural_type(spec.type, procedural_type))
+        {
+            render_procedural(procedural_type, spec, mirror, width, height);
+            hadamard.forget_background();
+        }
+        else
+        {
+            throw std::invalid_argument("Unknown pattern type: " + spec.type);
+        }
+    }
+
+    // Call after something else was written into the mirror buffer:
+    // with where it was drawn if that is known, so that @complement
+    // inverts only that.
+    void mirror_overwritten()
+    {
+        mirror_overwritten(PatternArea::whole_mirror());
+    }
+
+    void mirror_overwritten(const PatternArea& drawn)
+    {
+        hadamard.forget_background();
+        area = drawn;
+    }
+
+    // Where the last pattern drawn, or the one passed to
+    // mirror_overwritten(), lies.
+    const PatternArea& drawn_area() const { return area; }
+
+private:
+    unsigned char off;
+    unsigned char on;
+    HadamardPatterns hadamard;
+    ProceduralPatterns procedural;
+    PatternArea area;
+    PlacedMask placed_mask;
+
+    // @hadamard <index> [size=WxH] [macro=M] [x=X] [y=Y] [order=natural|sequency|cake] [neg] [pairs]
+    //
+    // With "pairs", index 2k is pattern k and index 2k+1 its complement.
+    void render_hadamard(const PatternSpec& spec, unsigned char* mirror, int width, int height)
+    {
+        const HadamardLayout layout = hadamard_layout_from(spec);
+        hadamard.set_layout(layout);
+
+        long index = spec.get_value(0, "index", -1);
+        if(index < 0)
+        {
+            throw std::invalid_argument("Hadamard pattern needs an index");
+        }
+        bool complement = complement_of(spec, index);
+        hadamard.render(index, complement, mirror, width, height, off, on);
+        area = PatternArea::rectangle(layout.x, layout.y, static_cast<int>(layout.grid_w*layout.macro), static_cast<int>(layout.grid_h*layout.macro));
+    }
+
+    // @bernoulli <frame> [seed=S] [density=D]
+    // @sparse    <frame> [seed=S] [density=D]
+    // @checker   <frame> [period=P] [phase=X] [step=X]
+    // @grating   <frame> [period=P] [angle=A] [phase=X] [step=X] [duty=D]
+    //
+    // all with [size=WxH] [macro=M] [x=X] [y=Y] [neg] [pairs]; without size
+    // the pattern covers the mirror from (x, y) on.
+    void render_procedural(ProceduralType type, const PatternSpec& spec, unsigned char* mirror, int width, int height)
+    {
+        ProceduralSpec p = procedural_spec_from(type, spec);
+
+        long frame = spec.get_value(0, "frame", 0);
+        if(frame < 0)
+        {
+            throw std::invalid_argument("Pattern frame must not be negative");
+        }
+        bool complement = complement_of(spec, frame);
+        procedural.render(p, frame, complement, mirror, width, height, off, on);
+        ProceduralPatterns::fit_to_mirror(p, width, height);
+        area = PatternArea::rectangle(p.x, p.y, static_cast<int>(p.grid_w*p.macro), static_cast<int>(p.grid_h*p.macro));
+    }
+
+    // @fiducial <frame> [grid=WxH] [dot=D] [margin=M]
+    //
+    // Dots for tem_calibrate; frame 0 is dark, 1 all dots, 2 on the bits
+    // of the dot numbers.
+    void render_fiducial(const PatternSpec& spec, unsigned char* mirror, int width, int height)
+    {
+        long frame = spec.get_value(0, "frame", -1);
+        if(frame < 0)
+        {
+            throw std::invalid_argument("Fiducial pattern needs a frame number");
+        }
+        fiducial_layout_from(spec).render(frame, mirror, width, height, off, on);
+    }
+
+    // "neg" shows the complement.  With "pairs", number 2k is pattern k
+    // and 2k+1 its complement; `number` is turned into k.
+    static bool complement_of(const PatternSpec& spec, long& number)
+    {
+        bool complement = spec.has_flag("neg");
+        if(spec.has_flag("pairs"))
+        {
+            complement = complement != ((number & 1) != 0);
+            number /= 2;
+        }
+        return complement;
+    }
+
+    // @complement
+    //
+    // Inverts the pattern already on the mirror, whatever drew it, so the
+    // second half of a complementary pair costs neither a file decode nor
+    // a pattern render.  Only its area is inverted: the mirror around a
+    // placed picture or a generated pattern stays off.
+    void invert_area(unsigned char* mirror, int width, int height)
+    {
+        const unsigned char* mask = (area.placed() && placed_mask) ? placed_mask(area.picture_w, area.picture_h) : NULL;
+        area.invert(mirror, width, height, static_cast<unsigned char>(off ^ on), mask);
+    }
+};
+
+#endif // PATTERN_GENERATOR_H
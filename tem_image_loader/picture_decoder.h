@@ -0,0 +1,252 @@
+#ifndef PICTURE_DECODER_H
+#define PICTURE_DECODER_H
+
+#include <cstdio>
+#include <vector>
+#include <stdint.h>
+
+#ifndef cimg_display
+#define cimg_display 0
+#endif
+#include "CImg.h"
+
+// Reads picture files into grey bytes: their red channel (the first
+// plane), since pictures are grey or black and white.
+//
+// Uncompressed BMP files (8-bit with a palette, 24 or 32-bit) and binary
+// PGM/PPM files with 8-bit samples, what the loader is usually given,
+// are decoded here from the file read whole into a buffer that is kept
+// for the next one, so once the buffers have grown to the size of the
+// pictures a picture is read without allocating.  Other files (PNG,
+// compressed or 16-bit pictures) are read by CImg, which allocates the
+// picture each time.
+class PictureDecoder
+{
+public:
+    PictureDecoder() : file_size(0) { }
+
+    // Returns false if the file could not be read.
+    bool decode(const char* filename, std::vector<unsigned char>& grey, int& width, int& height)
+    {
+        read_file(filename, false);
+        return decode_read(filename, grey, width, height);
+    }
+
+    // Reads the whole file, whatever its format, for a caller that needs
+    // its bytes too (the spool hashes them); decode_read() then decodes
+    // it without reading it again, unless CImg has to.  False if it
+    // cannot be read.
+    bool read(const char* filename) { return read_file(filename, true); }
+    const unsigned char* data() const { return (file_size > 0) ? &file[0] : NULL; }
+    size_t size() const { return file_size; }
+
+    bool decode_read(const char* filename, std::vector<unsigned char>& grey, int& width, int& height)
+    {
+        if(file_size > 2 && (decode_bmp(grey, width, height) || decode_pnm(grey, width, height)))
+        {
+            return true;
+        }
+        return decode_with_cimg(filename, grey, width, height);
+    }
+
+private:
+    std::vector<unsigned char> file;
+    size_t file_size;
+
+    static uint32_t u16(const unsigned char* p) { return p[0] | (p[1] << 8); }
+    static uint32_t u32(const unsigned char* p) { return p[0] | (p[1] << 8) | (p[2] << 16) | (static_cast<uint32_t>(p[3]) << 24); }
+
+    // Reads the whole file, unless only files that start like one
+    // decoded here are wanted.
+    bool read_file(const char* filename, bool any_format)
+    {
+        file_size = 0;
+        FILE* f = fopen(filename, "rb");
+        if( ! f)
+        {
+            return false;
+        }
+        // Read in one go; no stdio buffer needed.
+        setvbuf(f, NULL, _IONBF, 0);
+        unsigned char magic[2];
+        bool ok = any_format
+               || (fread(magic, 1, 2, f) == 2
+                   && ((magic[0] == 'B' && magic[1] == 'M') || (magic[0] == 'P' && (magic[1] == '5' || magic[1] == '6'))));
+        ok = ok && fseek(f, 0, SEEK_END) == 0;
+        const long size = ok ? ftell(f) : -1;
+        ok = ok && size >= 0 && fseek(f, 0, SEEK_SET) == 0;
+        if(ok && size > 0)
+        {
+            if(file.size() < static_cast<size_t>(size))
+            {
+                file.resize(size);
+            }
+            ok = fread(&file[0], 1, size, f) == static_cast<size_t>(size);
+            file_size = ok ? static_cast<size_t>(size) : 0;
+        }
+        fclose(f);
+        return ok;
+    }
+
+    bool decode_bmp(std::vector<unsigned char>& grey, int& width, int& height)
+    {
+        const unsigned char* b = &file[0];
+        if(file_size < 54 || b[0] != 'B' || b[1] != 'M')
+        {
+            return false;
+        }
+        const uint32_t data_at = u32(b + 10);
+        const uint32_t header_size = u32(b + 14);
+        const int32_t w = static_cast<int32_t>(u32(b + 18));
+        const int32_t signed_h = static_cast<int32_t>(u32(b + 22));
+        const uint32_t bits = u16(b + 28);
+        const uint32_t compression = u32(b + 30);
+        uint32_t colours = u32(b + 46);
+        // The header sizes come from the file: compared by subtraction,
+        // so that a huge one cannot wrap around.
+        if(data_at < 54 || data_at > file_size || header_size < 40 || header_size > data_at - 14
+           || compression != 0 || (bits != 8 && bits != 24 && bits != 32)
+           || w <= 0 || signed_h == 0 || w > 65536 || signed_h > 65536 || signed_h < -65536)
+        {
+            return false;
+        }
+        const bool top_down = signed_h < 0;
+        const int32_t h = top_down ? -signed_h : signed_h;
+        const size_t stride = (static_cast<size_t>(w)*bits + 31) / 32 * 4;
+        if((file_size - data_at) / stride < static_cast<size_t>(h))
+        {
+            return false;
+        }
+        const size_t palette_at = 14 + header_size;
+        const unsigned char* palette = b + palette_at;
+        if(bits == 8)
+        {
+            colours = (colours == 0 || colours > 256) ? 256 : colours;
+            if(4*colours > data_at - palette_at)
+            {
+                return false;
+            }
+        }
+
+        width = w;
+        height = h;
+        grey.resize(static_cast<size_t>(w)*h);
+        const size_t step = bits / 8;
+        for(int32_t y = 0; y < h; ++y)
+        {
+            // Bottom row first unless the height is negative.
+            const unsigned char* row = b + data_at + stride*(top_down ? y : h - 1 - y);
+            unsigned char* out = &grey[static_cast<size_t>(y)*w];
+            if(bits == 8)
+            {
+                for(int32_t x = 0; x < w; ++x)
+                {
+                    out[x] = (row[x] < colours) ? palette[4*row[x] + 2] : 0;
+                }
+            }
+            else
+            {
+                // Blue, green, red (and one more byte at 32 bits).
+                for(int32_t x = 0; x < w; ++x)
+                {
+                    out[x] = row[step*x + 2];
+                }
+            }
+        }
+        return true;
+    }
+
+    // Skips white space and # comments, then reads a decimal number.
+    bool pnm_number(size_t& at, uint32_t& value) const
+    {
+        const unsigned char* b = &file[0];
+        while(at < file_size && (b[at] == ' ' || b[at] == '\t' || b[at] == '\r' || b[at] == '\n' || b[at] == '#'))
+        {
+            if(b[at] == '#')
+            {
+                while(at < file_size && b[at] != '\n')
+                {
+                    ++at;
+                }
+            }
+            else
+            {
+                ++at;
+            }
+        }
+        if(at == file_size || b[at] < '0' || b[at] > '9')
+        {
+            return false;
+        }
+        value = 0;
+        while(at < file_size && b[at] >= '0' && b[at] <= '9' && value < 1000000)
+        {
+            value = 10*value + (b[at++] - '0');
+        }
+        return true;
+    }
+
+    bool decode_pnm(std::vector<unsigned char>& grey, int& width, int& height)
+    {
+        const unsigned char* b = &file[0];
+        if(b[0] != 'P' || (b[1] != '5' && b[1] != '6'))
+        {
+            return false;
+        }
+        size_t at = 2;
+        uint32_t w, h, max_value;
+        if( ! pnm_number(at, w) || ! pnm_number(at, h) || ! pnm_number(at, max_value)
+           || w == 0 || h == 0 || w > 65536 || h > 65536 || max_value == 0 || max_value > 255 || at == file_size)
+        {
+            // 16-bit samples go to CImg.
+            return false;
+        }
+        ++at;   // the one white space character before the samples
+        const size_t step = (b[1] == '6') ? 3 : 1;
+        const size_t count = static_cast<size_t>(w)*h;
+        if((file_size - at) / step < count)
+        {
+            return false;
+        }
+
+        width = w;
+        height = h;
+        grey.resize(count);
+        const unsigned char* samples = b + at;
+        for(size_t i = 0; i < count; ++i)
+        {
+            grey[i] = samples[step*i];
+        }
+        return true;
+    }
+
+    static bool decode_with_cimg(const char* filename, std::vector<unsigned char>& grey, int& width, int& height)
+    {
+        cimg_library::CImg<unsigned int> input_image;
+        try
+        {
+            input_image.assign(filename);
+        }
+        catch(const cimg_library::CImgIOException& e)
+        {
+            // Error message printed by exception
+            // constructor; no need to print it
+            // here.  Just return and wait for the
+            // next image.
+            return false;
+        }
+
+        width = input_image.width();
+        height = input_image.height();
+        const size_t count = static_cast<size_t>(width)*height;
+        const unsigned int* red = input_image.data();
+        grey.resize(count);
+        for(size_t i = 0; i < count; ++i)
+        {
+            grey[i] = static_cast<unsigned char>((red[i] > 255) ? 255 : red[i]);
+        }
+        return true;
+    }
+};
+
+#endif // PICTURE_DECODER_H
@@ -0,0 +1,711 @@
+#ifndef SPOOL_INGEST_H
+#define SPOOL_INGEST_H
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <unordered_map>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <stdexcept>
+#include <stdint.h>
+#include "picture_decoder.h"
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <cerrno>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#endif
+#endif
+
+// Picture files dropped into a spool directory by another program, shown
+// as they are completed (--watch):
+//
+//   - A watch thread finds completed files: inotify close-after-write and
+//     move-into events on Linux, ReadDirectoryChangesW on Windows (a file
+//     is complete once it can be opened without sharing), or, where
+//     neither is available or `polling` is asked for, a scan every
+//     poll_ms that takes a file as complete once its size and time have
+//     not changed between two scans.  Files there before the watch
+//     started, names starting with '.' and names ending in .tmp are
+//     ignored.
+//   - Worker threads hash and decode the files, several at a time.
+//   - The loader takes the decoded frames in the order the files were
+//     found (or by name, among files found together), whatever order
+//     the workers finish in.
+//
+// Files whose contents hash like a frame in the FrameCache are not
+// decoded again; the loader shows the cached frame.
+
+struct SpoolSettings
+{
+    SpoolSettings() : name_order(false), polling(false), poll_ms(50), workers(2), cache_frames(64) { }
+
+    std::string directory;
+    bool name_order;
+    bool polling;
+    int poll_ms;
+    int workers;
+    size_t cache_frames;          // 0: no cache, every file is decoded
+};
+
+// One file, as the loader gets it.
+struct SpoolFrame
+{
+    SpoolFrame() : hash(0), cached(false), ok(false), width(0), height(0) { }
+
+    std::string path;
+    std::chrono::steady_clock::time_point closed;   // when the file was complete
+    uint64_t hash;                // of the file's bytes; 0 if not hashed
+    bool cached;                  // in the frame cache; not decoded
+    bool ok;                      // decoded, or cached
+    std::vector<unsigned char> grey;
+    int width;
+    int height;
+};
+
+// Binarized, placed mirror frames (packed bits, see bit_planes.h) by the
+// hash of the file they came from, with the size of the picture.  The oldest frame is dropped when the
+// cache is full.  Workers only look frames up; the loader adds them.
+class FrameCache
+{
+public:
+    explicit FrameCache(size_t capacity) : capacity(capacity) { }
+
+    bool contains(uint64_t hash)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return frames.count(hash) != 0;
+    }
+
+    // The frame, or NULL.  Valid until the next add() or clear(), which
+    // only the loader's thread calls.
+    const unsigned char* find(uint64_t hash, int& width, int& height)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::unordered_map<uint64_t, Frame>::iterator i = frames.find(hash);
+        if(i == frames.end())
+        {
+            return NULL;
+        }
+        width = i->second.width;
+        height = i->second.height;
+        return &i->second.bits[0];
+    }
+
+    void add(uint64_t hash, const std::vector<unsigned char>& bits, int width, int height)
+    {
+        if(capacity == 0)
+        {
+            return;
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        if(frames.count(hash) != 0)
+        {
+            return;
+        }
+        if(frames.size() == capacity)
+        {
+            frames.erase(order.front());
+            order.pop_front();
+        }
+        Frame& frame = frames[hash];
+        frame.bits = bits;
+        frame.width = width;
+        frame.height = height;
+        order.push_back(hash);
+    }
+
+    // Placement or dithering changed; the frames are no longer what the
+    // files would give.
+    void clear()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        frames.clear();
+        order.clear();
+    }
+
+private:
+    struct Frame
+    {
+        std::vector<unsigned char> bits;
+        int width;
+        int height;
+    };
+
+    size_t capacity;
+    std::mutex mutex;
+    std::unordered_map<uint64_t, Frame> frames;
+    std::deque<uint64_t> order;
+};
+
+// Latency from a spool file being complete to its frame on the mirror.
+struct SpoolStats
+{
+    SpoolStats() : shown(0), cached(0), failed(0), total_us(0), max_us(0) { }
+
+    unsigned long shown;
+    unsigned long cached;
+    unsigned long failed;
+    double total_us;
+    double max_us;
+
+    void add(double latency_us, bool from_cache)
+    {
+        ++shown;
+        cached += from_cache ? 1 : 0;
+        total_us += latency_us;
+        max_us = std::max(max_us, latency_us);
+    }
+};
+
+// 64-bit FNV-1a over 8-byte words (and the last few bytes), with the
+// length mixed in: fast enough to hash every spool file.
+inline uint64_t spool_file_hash(const unsigned char* data, size_t size)
+{
+    const uint64_t prime = 0x100000001b3ull;
+    uint64_t h = 0xcbf29ce484222325ull ^ size;
+    size_t i = 0;
+    for( ; i + 8 <= size; i += 8)
+    {
+        uint64_t word;
+        memcpy(&word, data + i, 8);
+        h = (h ^ word) * prime;
+    }
+    for( ; i < size; ++i)
+    {
+        h = (h ^ data[i]) * prime;
+    }
+    return h;
+}
+
+class SpoolIngest
+{
+public:
+    // `ready` is called, on another thread, whenever the next frame in
+    // order has been decoded.
+    SpoolIngest(const SpoolSettings& settings, const std::function<void()>& ready)
+        : settings(settings), ready(ready), cache(settings.cache_frames),
+          stopping(false), found_count(0), taken_count(0)
+    {
+        if(settings.workers < 1 || settings.poll_ms < 1)
+        {
+            throw std::invalid_argument("--watch needs at least one worker and a poll time of at least 1 ms");
+        }
+        if( ! is_directory(settings.directory))
+        {
+            throw std::invalid_argument("Not a directory to watch: " + settings.directory);
+        }
+        watcher = std::thread(&SpoolIngest::watch, this);
+        for(int i = 0; i < settings.workers; ++i)
+        {
+            workers.push_back(std::thread(&SpoolIngest::work, this));
+        }
+    }
+
+    ~SpoolIngest()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        changed.notify_all();
+        watcher.join();
+        for(size_t i = 0; i < workers.size(); ++i)
+        {
+            workers[i].join();
+        }
+    }
+
+    FrameCache& frame_cache() { return cache; }
+
+    // The next frame in order if it has been decoded.
+    bool next_frame(SpoolFrame& frame)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::map<uint64_t, SpoolFrame>::iterator i = decoded.find(taken_count);
+        if(i == decoded.end())
+        {
+            return false;
+        }
+        std::swap(frame, i->second);
+        decoded.erase(i);
+        ++taken_count;
+        changed.notify_all();
+        return true;
+    }
+
+    // Decode a frame on the caller's thread, when a cached frame it was
+    // found to match has been dropped from the cache meanwhile.
+    bool decode_frame(SpoolFrame& frame)
+    {
+        frame.cached = false;
+        frame.ok = caller_decoder.decode(frame.path.c_str(), frame.grey, frame.width, frame.height);
+        return frame.ok;
+    }
+
+private:
+    struct Job
+    {
+        uint64_t number;
+        std::string path;
+        std::chrono::steady_clock::time_point closed;
+    };
+
+    SpoolSettings settings;
+    std::function<void()> ready;
+    FrameCache cache;
+    PictureDecoder caller_decoder;       // for decode_frame()
+
+    std::mutex mutex;
+    std::condition_variable changed;     // jobs added, frames taken, stopping
+    bool stopping;
+    std::deque<Job> jobs;
+    std::map<uint64_t, SpoolFrame> decoded;   // by number, until taken
+    uint64_t found_count;
+    uint64_t taken_count;
+
+    std::thread watcher;
+    std::vector<std::thread> workers;
+
+    bool stopped()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return stopping;
+    }
+
+    static bool wanted(const std::string& name)
+    {
+        const size_t n = name.size();
+        if(n == 0 || name[0] == '.')
+        {
+            return false;
+        }
+        return ! (n >= 4 && name.compare(n - 4, 4, ".tmp") == 0);
+    }
+
+    std::string path_of(const std::string& name) const
+    {
+        const char last = settings.directory.empty() ? '/' : settings.directory[settings.directory.size() - 1];
+        return (last == '/' || last == '\\') ? settings.directory + name : settings.directory + "/" + name;
+    }
+
+    // Files completed together; numbered in the order they are to be
+    // shown.
+    void found(std::vector<std::string>& names, std::chrono::steady_clock::time_point closed)
+    {
+        std::vector<std::chrono::steady_clock::time_point> times(names.size(), closed);
+        found(names, times);
+    }
+
+    void found(std::vector<std::string>& names, std::vector<std::chrono::steady_clock::time_point>& closed)
+    {
+        std::vector<size_t> order(names.size());
+        for(size_t i = 0; i < order.size(); ++i)
+        {
+            order[i] = i;
+        }
+        if(settings.name_order)
+        {
+            std::stable_sort(order.begin(), order.end(), [&names](size_t a, size_t b) { return names[a] < names[b]; });
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        for(size_t i = 0; i < order.size(); ++i)
+        {
+            Job job;
+            job.number = found_count++;
+            job.path = path_of(names[order[i]]);
+            job.closed = closed[order[i]];
+            jobs.push_back(job);
+        }
+        changed.notify_all();
+    }
+
+    void work()
+    {
+        // Each worker keeps its own file buffers from one file to the next.
+        PictureDecoder decoder;
+        for(;;)
+        {
+            Job job;
+            {
+                // Decoded frames wait in memory until they are shown;
+                // keep only a few in hand.  Jobs are taken in order, so
+                // the next frame to show is never left waiting for this.
+                std::unique_lock<std::mutex> lock(mutex);
+                const size_t in_hand = 4*settings.workers;
+                changed.wait(lock, [this, in_hand]() { return stopping || ( ! jobs.empty() && decoded.size() < in_hand); });
+                if(stopping)
+                {
+                    return;
+                }
+                job = jobs.front();
+                jobs.pop_front();
+            }
+
+            SpoolFrame frame;
+            frame.path = job.path;
+            frame.closed = job.closed;
+            try
+            {
+                if(settings.cache_frames > 0)
+                {
+                    // The bytes hashed are the ones decoded.
+                    if(decoder.read(frame.path.c_str()))
+                    {
+                        frame.hash = spool_file_hash(decoder.data(), decoder.size());
+                        frame.cached = cache.contains(frame.hash);
+                    }
+                    frame.ok = frame.cached || decoder.decode_read(frame.path.c_str(), frame.grey, frame.width, frame.height);
+                }
+                else
+                {
+                    frame.ok = decoder.decode(frame.path.c_str(), frame.grey, frame.width, frame.height);
+                }
+            }
+            catch(const std::exception&)
+            {
+                frame.ok = false;
+            }
+
+            bool next;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                next = (job.number == taken_count);
+                decoded[job.number] = SpoolFrame();
+                std::swap(decoded[job.number], frame);
+            }
+            if(next)
+            {
+                ready();
+            }
+        }
+    }
+
+    // Directory scans, for polling.
+    struct FileState
+    {
+        uint64_t size;
+        int64_t mtime_ns;         // since 1970
+        bool shown;               // found with this size and time already
+
+        bool same(const FileState& other) const { return size == other.size && mtime_ns == other.mtime_ns; }
+    };
+
+    static std::chrono::steady_clock::time_point steady_time_of(int64_t mtime_ns)
+    {
+        const int64_t now_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+        const int64_t age_ns = std::max<int64_t>(0, now_ns - mtime_ns);
+        return std::chrono::steady_clock::now() - std::chrono::nanoseconds(age_ns);
+    }
+
+    void watch()
+    {
+        if( ! settings.polling && watch_events())
+        {
+            return;
+        }
+        watch_by_polling();
+    }
+
+    void watch_by_polling()
+    {
+        std::map<std::string, FileState> known;
+        scan(known);
+        for(std::map<std::string, FileState>::iterator i = known.begin(); i != known.end(); ++i)
+        {
+            i->second.shown = true;
+        }
+        while( ! stopped())
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(settings.poll_ms));
+            std::map<std::string, FileState> now;
+            scan(now);
+            std::vector<std::string> names;
+            std::vector<std::chrono::steady_clock::time_point> closed;
+            for(std::map<std::string, FileState>::iterator i = now.begin(); i != now.end(); ++i)
+            {
+                std::map<std::string, FileState>::iterator before = known.find(i->first);
+                if(before == known.end() || ! before->second.same(i->second))
+                {
+                    // New or still being written: wait for a scan that
+                    // finds it unchanged.
+                    continue;
+                }
+                i->second.shown = before->second.shown;
+                if( ! i->second.shown)
+                {
+                    i->second.shown = true;
+                    names.push_back(i->first);
+                    closed.push_back(steady_time_of(i->second.mtime_ns));
+                }
+            }
+            known.swap(now);
+            if( ! names.empty())
+            {
+                found(names, closed);
+            }
+        }
+    }
+
+#ifdef _WIN32
+    static bool is_directory(const std::string& path)
+    {
+        DWORD attributes = GetFileAttributesA(path.c_str());
+        return attributes != INVALID_FILE_ATTRIBUTES && (attributes & FILE_ATTRIBUTE_DIRECTORY);
+    }
+
+    static FileState state_of(DWORD size_high, DWORD size_low, const FILETIME& written)
+    {
+        FileState state;
+        state.size = (static_cast<uint64_t>(size_high) << 32) | size_low;
+        const uint64_t ticks = (static_cast<uint64_t>(written.dwHighDateTime) << 32) | written.dwLowDateTime;
+        state.mtime_ns = (static_cast<int64_t>(ticks) - 116444736000000000ll)*100;   // from 1601, in 100 ns
+        state.shown = false;
+        return state;
+    }
+
+    void scan(std::map<std::string, FileState>& files)
+    {
+        WIN32_FIND_DATAA data;
+        HANDLE find = FindFirstFileA(path_of("*").c_str(), &data);
+        if(find == INVALID_HANDLE_VALUE)
+        {
+            return;
+        }
+        do
+        {
+            if((data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) || ! wanted(data.cFileName))
+            {
+                continue;
+            }
+            files[data.cFileName] = state_of(data.nFileSizeHigh, data.nFileSizeLow, data.ftLastWriteTime);
+        }
+        while(FindNextFileA(find, &data));
+        FindClose(find);
+    }
+
+    // Whether the writer has closed the file: it can be opened without
+    // sharing.  Files that have gone again count as done with.
+    bool completed(const std::string& name, bool& gone)
+    {
+        HANDLE file = CreateFileA(path_of(name).c_str(), GENERIC_READ, 0, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+        if(file == INVALID_HANDLE_VALUE)
+        {
+            gone = (GetLastError() != ERROR_SHARING_VIOLATION);
+            return false;
+        }
+        CloseHandle(file);
+        gone = false;
+        return true;
+    }
+
+    bool watch_events()
+    {
+        HANDLE directory = CreateFileA(settings.directory.c_str(), FILE_LIST_DIRECTORY,
+                                       FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING,
+                                       FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED, NULL);
+        if(directory == INVALID_HANDLE_VALUE)
+        {
+            return false;
+        }
+        OVERLAPPED overlapped;
+        memset(&overlapped, 0, sizeof(overlapped));
+        overlapped.hEvent = CreateEventA(NULL, TRUE, FALSE, NULL);
+        DWORD buffer[16384];
+        const DWORD changes = FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_LAST_WRITE | FILE_NOTIFY_CHANGE_SIZE;
+        if( ! overlapped.hEvent || ! ReadDirectoryChangesW(directory, buffer, sizeof(buffer), FALSE, changes, NULL, &overlapped, NULL))
+        {
+            if(overlapped.hEvent)
+            {
+                CloseHandle(overlapped.hEvent);
+            }
+            CloseHandle(directory);
+            return false;
+        }
+
+        // Files changed but still open for writing; tried again every
+        // poll_ms.
+        std::vector<std::string> writing;
+        // Size and time of the files handed on.  A change notice can come
+        // in after a file has been closed and shown; the file is only
+        // shown again if it has been written again.
+        std::map<std::string, FileState> handed_on;
+        while( ! stopped())
+        {
+            if(WaitForSingleObject(overlapped.hEvent, settings.poll_ms) == WAIT_OBJECT_0)
+            {
+                DWORD bytes = 0;
+                if(GetOverlappedResult(directory, &overlapped, &bytes, FALSE) && bytes > 0)
+                {
+                    const unsigned char* entry = reinterpret_cast<const unsigned char*>(buffer);
+                    for(;;)
+                    {
+                        const FILE_NOTIFY_INFORMATION* info = reinterpret_cast<const FILE_NOTIFY_INFORMATION*>(entry);
+                        if(info->Action == FILE_ACTION_ADDED || info->Action == FILE_ACTION_MODIFIED || info->Action == FILE_ACTION_RENAMED_NEW_NAME)
+                        {
+                            char name[MAX_PATH];
+                            int length = WideCharToMultiByte(CP_ACP, 0, info->FileName, info->FileNameLength/sizeof(WCHAR),
+                                                             name, sizeof(name) - 1, NULL, NULL);
+                            name[length] = '\0';
+                            if(wanted(name) && std::find(writing.begin(), writing.end(), std::string(name)) == writing.end())
+                            {
+                                writing.push_back(name);
+                            }
+                        }
+                        if(info->NextEntryOffset == 0)
+                        {
+                            break;
+                        }
+                        entry += info->NextEntryOffset;
+                    }
+                }
+                ResetEvent(overlapped.hEvent);
+                if( ! ReadDirectoryChangesW(directory, buffer, sizeof(buffer), FALSE, changes, NULL, &overlapped, NULL))
+                {
+                    break;
+                }
+            }
+
+            std::vector<std::string> names;
+            const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+            for(size_t i = 0; i < writing.size(); )
+            {
+                bool gone;
+                const bool done = completed(writing[i], gone);
+                WIN32_FILE_ATTRIBUTE_DATA attributes;
+                if(done && GetFileAttributesExA(path_of(writing[i]).c_str(), GetFileExInfoStandard, &attributes))
+                {
+                    const FileState state = state_of(attributes.nFileSizeHigh, attributes.nFileSizeLow, attributes.ftLastWriteTime);
+                    std::map<std::string, FileState>::iterator before = handed_on.find(writing[i]);
+                    if(before == handed_on.end() || ! before->second.same(state))
+                    {
+                        handed_on[writing[i]] = state;
+                        names.push_back(writing[i]);
+                    }
+                }
+                else if(done)
+                {
+                    names.push_back(writing[i]);
+                }
+                if(done || gone)
+                {
+                    writing.erase(writing.begin() + i);
+                }
+                else
+                {
+                    ++i;
+                }
+            }
+            if( ! names.empty())
+            {
+                found(names, now);
+            }
+        }
+
+        CancelIo(directory);
+        DWORD bytes;
+        GetOverlappedResult(directory, &overlapped, &bytes, TRUE);
+        CloseHandle(overlapped.hEvent);
+        CloseHandle(directory);
+        return true;
+    }
+#else
+    static bool is_directory(const std::string& path)
+    {
+        struct stat s;
+        return stat(path.c_str(), &s) == 0 && S_ISDIR(s.st_mode);
+    }
+
+    void scan(std::map<std::string, FileState>& files)
+    {
+        DIR* directory = opendir(settings.directory.c_str());
+        if( ! directory)
+        {
+            return;
+        }
+        while(struct dirent* entry = readdir(directory))
+        {
+            struct stat s;
+            if( ! wanted(entry->d_name) || stat(path_of(entry->d_name).c_str(), &s) != 0 || ! S_ISREG(s.st_mode))
+            {
+                continue;
+            }
+            FileState state;
+            state.size = s.st_size;
+#ifdef __linux__
+            state.mtime_ns = static_cast<int64_t>(s.st_mtim.tv_sec)*1000000000 + s.st_mtim.tv_nsec;
+#else
+            state.mtime_ns = static_cast<int64_t>(s.st_mtime)*1000000000;
+#endif
+            state.shown = false;
+            files[entry->d_name] = state;
+        }
+        closedir(directory);
+    }
+
+#ifdef __linux__
+    bool watch_events()
+    {
+        int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if(fd < 0)
+        {
+            return false;
+        }
+        if(inotify_add_watch(fd, settings.directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0)
+        {
+            close(fd);
+            return false;
+        }
+        alignas(struct inotify_event) char buffer[1 << 16];
+        while( ! stopped())
+        {
+            struct pollfd p = { fd, POLLIN, 0 };
+            if(poll(&p, 1, settings.poll_ms) <= 0)
+            {
+                continue;
+            }
+            ssize_t got = read(fd, buffer, sizeof(buffer));
+            const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+            std::vector<std::string> names;
+            for(ssize_t at = 0; at < got; )
+            {
+                const struct inotify_event* event = reinterpret_cast<const struct inotify_event*>(buffer + at);
+                if(event->len > 0 && ! (event->mask & IN_ISDIR) && wanted(event->name))
+                {
+                    names.push_back(event->name);
+                }
+                at += sizeof(struct inotify_event) + event->len;
+            }
+            if( ! names.empty())
+            {
+                found(names, now);
+            }
+        }
+        close(fd);
+        return true;
+    }
+#else
+    bool watch_events()
+    {
+        return false;
+    }
+#endif
+#endif
+};
+
+#endif // SPOOL_INGEST_H
@@ -0,0 +1,465 @@
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <memory>
+#include <exception>
+#include "bucket_file.h"
+#include "stack_buckets.h"
+#include "pattern_spec.h"
+#include "hadamard_reconstruction.h"
+#include "measurement_operators.h"
+#include "sparse_solvers.h"
+#include "image_output.h"
+#include "ghost_imaging.h"
+
+// Reconstruct single-pixel images from the bucket values of a scan.
+
+template<typename T>
+void run_hadamard(const BucketSeries& buckets, HadamardBucketMode mode, HadamardOrdering ordering,
+                  uint32_t grid_w, uint32_t grid_h, int threads, const std::string& output_file)
+{
+    std::vector<T> image;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    size_t used = reconstruct_hadamard(buckets, mode, ordering, grid_w, grid_h, image, threads);
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    std::cout << grid_w << " x " << grid_h << " image from " << used << " of " << image.size()
+              << " patterns in " << ms << " ms" << std::endl;
+    write_reconstructed_image(output_file, image, grid_w, grid_h);
+}
+
+// The pattern shown for bucket number `index`, one byte (0 or 1) per
+// macro pixel.  With "pairs" numbering, bucket 2k is pattern k and 2k+1
+// its complement, as the loader shows them.
+struct ShownPatterns
+{
+    bool hadamard;
+    bool pairs;
+    HadamardLayout layout;
+    std::vector<uint32_t> order;
+    ProceduralSpec procedural;
+
+    size_t pixels() const
+    {
+        return hadamard ? static_cast<size_t>(layout.grid_w)*layout.grid_h
+                        : static_cast<size_t>(procedural.grid_w)*procedural.grid_h;
+    }
+
+    void grid(uint64_t index, std::vector<unsigned char>& out) const
+    {
+        bool complement = pairs && (index & 1) != 0;
+        uint64_t pattern = pairs ? index / 2 : index;
+        if(hadamard)
+        {
+            if(pattern >= order.size())
+            {
+                throw std::out_of_range("Bucket number beyond the Hadamard pattern set");
+            }
+            const uint32_t h = order[pattern];
+            out.resize(order.size());
+            for(size_t j = 0; j < order.size(); ++j)
+            {
+                out[j] = (parity(h & static_cast<uint32_t>(j)) == 0) != complement;
+            }
+        }
+        else
+        {
+            procedural_grid(procedural, pattern, out);
+            if(complement)
+            {
+                for(size_t j = 0; j < out.size(); ++j)
+                {
+                    out[j] = ! out[j];
+                }
+            }
+        }
+    }
+};
+
+// Ghost imaging: correlate the buckets with the patterns as they come.
+// With bucket_file "-" the buckets are read from stdin one line at a
+// time, and every `preview` buckets the current image is written.
+void run_ghost(const ShownPatterns& shown, const BucketSeries& buckets, bool from_stdin, bool differential,
+               int preview, int width, int height, const std::string& output_file)
+{
+    GhostCorrelator correlator(shown.pixels());
+    std::vector<unsigned char> grid;
+    std::vector<uint64_t> bits;
+    std::vector<double> image;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    auto add = [&](size_t index, double value)
+    {
+        shown.grid(index, grid);
+        GhostCorrelator::pack(&grid[0], grid.size(), bits);
+        correlator.add(&bits[0], value);
+        if(preview > 0 && correlator.pattern_count() % preview == 0)
+        {
+            correlator.image(image, differential);
+            write_reconstructed_image(output_file, image, width, height);
+            std::cout << correlator.pattern_count() << " patterns" << std::endl;
+        }
+    };
+
+    if(from_stdin)
+    {
+        size_t next = 0;
+        char line[256];
+        while(fgets(line, sizeof(line), stdin) != NULL)
+        {
+            size_t index;
+            double value;
+            try
+            {
+                if( ! parse_bucket_line(line, next, index, value))
+                {
+                    continue;
+                }
+            }
+            catch(const std::invalid_argument& e)
+            {
+                std::cerr << "Bucket line ignored: " << e.what() << std::endl;
+                continue;
+            }
+            add(index, value);
+        }
+    }
+    else
+    {
+        for(size_t i = 0; i < buckets.values.size(); ++i)
+        {
+            if(buckets.has(i))
+            {
+                add(i, buckets.values[i]);
+            }
+        }
+    }
+
+    correlator.image(image, differential);
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << width << " x " << height << " ghost image from " << correlator.pattern_count() << " patterns in "
+              << seconds << " s, " << correlator.memory_bytes() / 1024 << " KiB of sums" << std::endl;
+    write_reconstructed_image(output_file, image, width, height);
+}
+
+// Bucket values from a bucket file, or summed from the frames of a
+// stack: over --roi, or with a calibration over exactly the camera
+// pixels under the area of the patterns on the mirror.
+BucketSeries read_buckets(const std::string& bucket_file, const std::string& stack_file, const BucketRegion& region,
+                          const std::string& calibration_file, bool hadamard, const HadamardLayout& layout,
+                          const ProceduralSpec& procedural)
+{
+    if( ! bucket_file.empty())
+    {
+        return read_bucket_file(bucket_file);
+    }
+    if(calibration_file.empty())
+    {
+        return read_stack_buckets(stack_file, region);
+    }
+    const int x = hadamard ? layout.x : procedural.x;
+    const int y = hadamard ? layout.y : procedural.y;
+    const uint32_t w = hadamard ? layout.grid_w*layout.macro : procedural.grid_w*procedural.macro;
+    const uint32_t h = hadamard ? layout.grid_h*layout.macro : procedural.grid_h*procedural.macro;
+    CameraRegionMap pattern_area(read_inverse_remap(calibration_file), x, y, w, h);
+    std::cout << pattern_area.pixel_counts()[0] << " camera pixels under the patterns" << std::endl;
+    return read_stack_buckets(stack_file, pattern_area);
+}
+
+int main(int argc, char* argv[])
+{
+    std::string bucket_file;
+    std::string stack_file;
+    std::string region_text;
+    std::string calibration_file;
+    std::string output_file;
+    std::string pattern_line;
+    std::string size_text;
+    std::string order_name;
+    std::string mode_name;
+    std::string solver_name;
+    std::string initial_file;
+    SolverOptions options;
+    bool single_precision = false;
+    bool differential = false;
+    int preview = 0;
+    int threads = 0;
+    for(int i = 1; i < argc; i += 2)
+    {
+        std::string option = argv[i];
+        if(option == "--float")  { single_precision = true; --i; continue; }
+        if(option == "--nonneg") { options.nonnegative = true; --i; continue; }
+        if(option == "--differential") { differential = true; --i; continue; }
+        if(i + 1 >= argc)
+        {
+            std::cerr << option << " needs a value" << std::endl;
+            return 1;
+        }
+        if(option == "--buckets")         { bucket_file = argv[i+1]; }
+        else if(option == "--stack")      { stack_file = argv[i+1]; }
+        else if(option == "--roi")        { region_text = argv[i+1]; }
+        else if(option == "--calibration") { calibration_file = argv[i+1]; }
+        else if(option == "--output")     { output_file = argv[i+1]; }
+        else if(option == "--patterns")   { pattern_line = argv[i+1]; }
+        else if(option == "--size")       { size_text = argv[i+1]; }
+        else if(option == "--order")      { order_name = argv[i+1]; }
+        else if(option == "--mode")       { mode_name = argv[i+1]; }
+        else if(option == "--solver")     { solver_name = argv[i+1]; }
+        else if(option == "--lambda")     { options.lambda = atof(argv[i+1]); }
+        else if(option == "--iterations") { options.iterations = atoi(argv[i+1]); }
+        else if(option == "--tolerance")  { options.tolerance = atof(argv[i+1]); }
+        else if(option == "--levels")     { options.haar_levels = atoi(argv[i+1]); }
+        else if(option == "--initial")    { initial_file = argv[i+1]; }
+        else if(option == "--threads")    { threads = atoi(argv[i+1]); }
+        else if(option == "--preview")    { preview = atoi(argv[i+1]); }
+        else
+        {
+            std::cerr << "Unknown option " << option << std::endl;
+            return 1;
+        }
+    }
+
+    // --size and --order are short for a @hadamard pattern line.
+    if(pattern_line.empty())
+    {
+        pattern_line = "@hadamard";
+        if( ! size_text.empty())  { pattern_line += " size=" + size_text; }
+        if( ! order_name.empty()) { pattern_line += " order=" + order_name; }
+    }
+
+    bool errors = false;
+    PatternSpec spec;
+    HadamardLayout layout;
+    ProceduralSpec procedural;
+    bool hadamard = false;
+    try
+    {
+        spec = PatternSpec::parse(pattern_line);
+        ProceduralType type;
+        if(spec.type == "hadamard")
+        {
+            hadamard = true;
+            layout = hadamard_layout_from(spec);
+            if(spec.options.count("size") == 0)
+            {
+                throw std::invalid_argument("Hadamard patterns need size=<W>x<H> (or --size)");
+            }
+        }
+        else if(parse_procedural_type(spec.type, type))
+        {
+            procedural = procedural_spec_from(type, spec);
+            if(procedural.grid_w == 0 || procedural.grid_h == 0)
+            {
+                throw std::invalid_argument("Procedural patterns need size=<W>x<H> for reconstruction");
+            }
+        }
+        else
+        {
+            throw std::invalid_argument("Unknown pattern type: " + spec.type);
+        }
+    }
+    catch(const std::logic_error& e)
+    {
+        std::cerr << e.what() << std::endl;
+        errors = true;
+    }
+
+    if(solver_name.empty())
+    {
+        solver_name = hadamard ? "fwht" : "fista";
+    }
+    if(mode_name.empty())
+    {
+        mode_name = "signed";
+    }
+    HadamardBucketMode mode = HADAMARD_BUCKETS_SIGNED;
+    BucketRegion region;
+    if(bucket_file.empty() == stack_file.empty())
+    {
+        std::cerr << "Bucket values must be supplied with either --buckets <file> or --stack <file>" << std::endl;
+        errors = true;
+    }
+    if( ! region_text.empty() && ! parse_bucket_region(region_text, region))
+    {
+        std::cerr << "Region must be given as --roi <x>,<y>,<width>,<height>" << std::endl;
+        errors = true;
+    }
+    if( ! calibration_file.empty() && ( stack_file.empty() || ! region_text.empty()))
+    {
+        std::cerr << "--calibration works with --stack and replaces --roi" << std::endl;
+        errors = true;
+    }
+    if(output_file.empty())
+    {
+        std::cerr << "Output image must be named with --output <file.pgm|file.txt>" << std::endl;
+        errors = true;
+    }
+    if( ! parse_hadamard_bucket_mode(mode_name, mode))
+    {
+        std::cerr << "Mode must be signed, pairs or positive with --mode <name>" << std::endl;
+        errors = true;
+    }
+    if(solver_name != "fwht" && solver_name != "fista" && solver_name != "tv" && solver_name != "ghost")
+    {
+        std::cerr << "Solver must be fwht, fista, tv or ghost with --solver <name>" << std::endl;
+        errors = true;
+    }
+    if(bucket_file == "-" && solver_name != "ghost")
+    {
+        std::cerr << "Only the ghost solver reads buckets from stdin (--buckets -)" << std::endl;
+        errors = true;
+    }
+    if(solver_name == "fwht" && ! hadamard)
+    {
+        std::cerr << "The fwht solver only works with Hadamard patterns" << std::endl;
+        errors = true;
+    }
+    if(options.nonnegative && solver_name != "tv")
+    {
+        // FISTA-L1 steps in the wavelet domain, where clipping pixels is
+        // not its proximal step.
+        std::cerr << "--nonneg only works with the tv solver" << std::endl;
+        errors = true;
+    }
+    if(single_precision && solver_name != "fwht")
+    {
+        // The iterative solvers and the ghost image compute in double.
+        std::cerr << "--float only works with the fwht solver" << std::endl;
+        errors = true;
+    }
+    if(options.lambda < 0 || options.iterations <= 0)
+    {
+        std::cerr << "--lambda must not be negative and --iterations must be positive" << std::endl;
+        errors = true;
+    }
+    if(errors)
+    {
+        return 1;
+    }
+
+    try
+    {
+        if(solver_name == "ghost")
+        {
+            ShownPatterns shown;
+            shown.hadamard = hadamard;
+            shown.pairs = (mode == HADAMARD_BUCKETS_PAIRS);
+            shown.layout = layout;
+            shown.procedural = procedural;
+            if(hadamard)
+            {
+                shown.order = hadamard_order(layout.ordering, layout.grid_w, layout.grid_h);
+            }
+            int width = hadamard ? layout.grid_w : procedural.grid_w;
+            int height = hadamard ? layout.grid_h : procedural.grid_h;
+            bool from_stdin = (bucket_file == "-");
+            BucketSeries buckets;
+            if( ! from_stdin)
+            {
+                buckets = read_buckets(bucket_file, stack_file, region, calibration_file, hadamard, layout, procedural);
+            }
+            run_ghost(shown, buckets, from_stdin, differential, preview, width, height, output_file);
+            return 0;
+        }
+
+        BucketSeries buckets = read_buckets(bucket_file, stack_file, region, calibration_file, hadamard, layout, procedural);
+
+        if(solver_name == "fwht")
+        {
+            if(single_precision)
+            {
+                run_hadamard<float>(buckets, mode, layout.ordering, layout.grid_w, layout.grid_h, threads, output_file);
+            }
+            else
+            {
+                run_hadamard<double>(buckets, mode, layout.ordering, layout.grid_w, layout.grid_h, threads, output_file);
+            }
+            return 0;
+        }
+
+        // Iterative solvers: measured patterns and their values.
+        std::vector<double> y;
+        int width;
+        int height;
+        std::unique_ptr<MeasurementOperator> op;
+        if(hadamard)
+        {
+            width = layout.grid_w;
+            height = layout.grid_h;
+            std::vector<double> measurement;
+            std::vector<unsigned char> known;
+            hadamard_measurements(buckets, mode, static_cast<size_t>(width)*height, measurement, known);
+            std::vector<uint32_t> positions;
+            for(size_t i = 0; i < known.size(); ++i)
+            {
+                if(known[i])
+                {
+                    positions.push_back(i);
+                    y.push_back(measurement[i]);
+                }
+            }
+            op.reset(new HadamardOperator(layout.ordering, width, height, positions, threads));
+        }
+        else
+        {
+            width = procedural.grid_w;
+            height = procedural.grid_h;
+            std::vector<uint64_t> frames;
+            if(mode == HADAMARD_BUCKETS_PAIRS)
+            {
+                // frame k minus its complement is the +1/-1 measurement of frame k
+                for(size_t k = 0; 2*k + 1 < buckets.values.size(); ++k)
+                {
+                    if(buckets.has(2*k) && buckets.has(2*k + 1))
+                    {
+                        frames.push_back(k);
+                        y.push_back(buckets.values[2*k] - buckets.values[2*k + 1]);
+                    }
+                }
+            }
+            else
+            {
+                for(size_t i = 0; i < buckets.values.size(); ++i)
+                {
+                    if(buckets.has(i))
+                    {
+                        frames.push_back(i);
+                        y.push_back(buckets.values[i]);
+                    }
+                }
+            }
+            op.reset(new ProceduralOperator(procedural, frames, mode != HADAMARD_BUCKETS_POSITIVE, threads));
+        }
+
+        std::vector<double> image;
+        if( ! initial_file.empty())
+        {
+            int initial_w;
+            int initial_h;
+            image = read_text_image(initial_file, initial_w, initial_h);
+            if(initial_w != width || initial_h != height)
+            {
+                throw std::runtime_error("Starting image " + initial_file + " does not have the pattern size");
+            }
+        }
+
+        SolverReport report = (solver_name == "tv") ? solve_fista_tv(*op, y, width, height, options, image)
+                                                    : solve_fista_l1(*op, y, width, height, options, image);
+
+        std::cout << width << " x " << height << " image from " << y.size() << " measurements with " << solver_name << std::endl;
+        std::cout << report.iterations << " iterations in " << report.seconds << " s ("
+                  << report.iterations_per_second() << " iterations/s)" << std::endl;
+        std::cout << "Memory used: " << report.memory_bytes / 1024 << " KiB, residual " << report.residual << std::endl;
+        write_reconstructed_image(output_file, image, width, height);
+    }
+    catch(const std::exception& e)
+    {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}